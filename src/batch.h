@@ -0,0 +1,339 @@
+/*
+This header contains batch_renderer, the headless (no window, no GUI) mode of the
+application. For every series it is given it loads the volume, renders the axial, coronal
+and sagittal slices at the requested indices plus the volume view into an offscreen render
+window, and writes each view to a PNG file.
+
+All VTK pipeline objects (reslice filters, colour mappers, actors, renderers, the offscreen
+window) are created once and reused for every series, so only the decoding and the
+rendering itself cost anything per series.
+
+Started from main.cxx with:
+
+	final_project --batch --out <dir> [--axial N] [--coronal N] [--sagittal N]
+		[--size WxH] [--cache] [--list <file with one series dir per line>] [series_dir ...]
+
+(--trace <file.json> works here too, see main.cxx.)
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkCamera.h>
+#include <vtkImageActor.h>
+#include <vtkImageData.h>
+#include <vtkImageMapper3D.h>
+#include <vtkImageMapToColors.h>
+#include <vtkImageReslice.h>
+#include <vtkMatrix4x4.h>
+#include <vtkPNGWriter.h>
+#include <vtkRenderer.h>
+#include <vtkRenderWindow.h>
+#include <vtkSmartPointer.h>
+#include <vtkSmartVolumeMapper.h>
+#include <vtkVolume.h>
+#include <vtkVolumeProperty.h>
+#include <vtkWindowToImageFilter.h>
+
+// Qt header files
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+
+// Our header files
+#include "colormaps.h"
+#include "dataset.h"
+#include "fast_reslice.h"
+#include "trace.h"
+
+#include <algorithm>
+
+
+class batch_renderer {
+
+public:
+	// constants (same plane numbering as ui.h)
+	static const int VOLUME = 0;
+	static const int AXIAL = 1;
+	static const int CORONAL = 2;
+	static const int SAGITTAL = 3;
+	static const int NUM_VIEWS = 4;
+
+	// slice index to render for each plane (-1 = middle slice); index 0 is unused
+	int slice_index[NUM_VIEWS] = { 0, -1, -1, -1 };
+
+	// size of the PNG files
+	int width = 512;
+	int height = 512;
+
+	// where the PNG files go
+	QString output_dir = ".";
+
+	// use the on-disk volume cache (off by default: batch runs touch each series once)
+	bool use_cache = false;
+
+	batch_renderer() {
+
+		// the same slicing planes as the interactive viewer
+		double planes[NUM_VIEWS][16] = {
+			{ 0 },
+			{ 1, 0, 0, 0,   0, 1, 0, 0,   0, 0, 1, 0,   0, 0, 0, 1 },  // axial
+			{ 1, 0, 0, 0,   0, 0, 1, 0,   0, -1, 0, 0,  0, 0, 0, 1 },  // coronal
+			{ 0, 0, -1, 0,  1, 0, 0, 0,   0, -1, 0, 0,  0, 0, 0, 1 } }; // sagittal
+
+		// slice pipelines: reslice -> colour map -> actor -> renderer
+		for (int i = 1; i < NUM_VIEWS; i++) {
+			reslice_axes_arr[i] = vtkSmartPointer<vtkMatrix4x4>::New();
+			reslice_axes_arr[i]->DeepCopy(planes[i]);
+
+			reslice_arr[i] = vtkSmartPointer<fast_reslice>::New();
+			reslice_arr[i]->SetOutputDimensionality(2);
+			reslice_arr[i]->SetResliceAxes(reslice_axes_arr[i]);
+			reslice_arr[i]->SetInterpolationModeToLinear();
+			trace_algorithm(reslice_arr[i], "reslice", -1, i);
+
+			imapper_arr[i] = vtkSmartPointer<vtkImageMapToColors>::New();
+			imapper_arr[i]->SetLookupTable(maps.grayScaleLut);
+			imapper_arr[i]->PassAlphaToOutputOn();
+			imapper_arr[i]->SetInputConnection(reslice_arr[i]->GetOutputPort());
+			trace_algorithm(imapper_arr[i], "map_to_colors", -1, i);
+
+			iactor_arr[i] = vtkSmartPointer<vtkImageActor>::New();
+			iactor_arr[i]->GetMapper()->SetInputConnection(imapper_arr[i]->GetOutputPort());
+
+			renderer_arr[i] = vtkSmartPointer<vtkRenderer>::New();
+			renderer_arr[i]->AddActor(iactor_arr[i]);
+		}
+
+		// volume pipeline; there may be no GPU, so ask for the CPU ray caster
+		volume_mapper = vtkSmartPointer<vtkSmartVolumeMapper>::New();
+		volume_mapper->SetBlendModeToComposite();
+		volume_mapper->SetRequestedRenderModeToRayCast();
+
+		volume_property = vtkSmartPointer<vtkVolumeProperty>::New();
+		volume_property->ShadeOff();
+		volume_property->SetInterpolationType(VTK_LINEAR_INTERPOLATION);
+		volume_property->SetScalarOpacity(colormaps::make_volume_opacity());
+		volume_property->SetColor(maps.grayscale_ctf);
+
+		volume = vtkSmartPointer<vtkVolume>::New();
+		volume->SetMapper(volume_mapper);
+		volume->SetProperty(volume_property);
+
+		renderer_arr[VOLUME] = vtkSmartPointer<vtkRenderer>::New();
+		renderer_arr[VOLUME]->AddViewProp(volume);
+
+		// one offscreen window, shared by all 4 views
+		window = vtkSmartPointer<vtkRenderWindow>::New();
+		window->SetOffScreenRendering(1);
+
+		window_to_image = vtkSmartPointer<vtkWindowToImageFilter>::New();
+		window_to_image->SetInput(window);
+		window_to_image->SetInputBufferTypeToRGB();
+		window_to_image->ReadFrontBufferOff();
+
+		png_writer = vtkSmartPointer<vtkPNGWriter>::New();
+		png_writer->SetInputConnection(window_to_image->GetOutputPort());
+	}
+
+	/*
+	Load one series and write its 4 snapshots as <output_dir>/<prefix>_{volume,axial,coronal,sagittal}.png.
+	Returns false if the series could not be loaded or a file could not be written.
+	*/
+	bool render_series(QDir dicom_dir, const QString& prefix) {
+
+		if (!dset.load(dicom_dir, NULL, load_progress_fn(), use_cache))
+			return false;
+
+		double* range = dset.scalar_range();
+		double* spacing = dset.image->GetSpacing();
+		double* origin = dset.image->GetOrigin();
+		int* dims = dset.image->GetDimensions();
+
+		// maps plane_idx to the "missing" axis ( e.g. axial (plane_idx=1) misses z (2) )
+		int map[] = { -1, 2, 1, 0 };
+
+		window->SetSize(width, height);
+		// the same default window/level as the viewer (see intensity_histogram::auto_window)
+		if (dset.histogram != NULL && !dset.histogram->empty()) {
+			double window, level;
+			dset.histogram->auto_window(window, level);
+			maps.grayScaleLut->SetRange(level - window / 2, level + window / 2);
+		}
+		else {
+			maps.grayScaleLut->SetRange(range);
+		}
+
+		bool ok = true;
+
+		for (int i = 1; i < NUM_VIEWS; i++) {
+			int axis = map[i];
+			int index = slice_index[i] >= 0 ? std::min(slice_index[i], dims[axis] - 1) : dims[axis] / 2;
+
+			reslice_axes_arr[i]->SetElement(axis, 3, origin[axis] + index * spacing[axis]);
+			reslice_arr[i]->SetInputData(dset.image);
+			reslice_arr[i]->Modified();
+
+			ok = render_view(i, prefix + "_" + view_names[i] + ".png") && ok;
+		}
+
+		volume_mapper->SetInputData(dset.image);
+		ok = render_view(VOLUME, prefix + "_volume.png") && ok;
+
+		// let go of the volume (the pipeline objects themselves are kept for the next series)
+		for (int i = 1; i < NUM_VIEWS; i++)
+			reslice_arr[i]->SetInputData(NULL);
+		volume_mapper->SetInputData(NULL);
+		dset.release();
+
+		return ok;
+	}
+
+	/*
+	Parse the command line and render every series on it. Returns the process exit code.
+	*/
+	int run(const QStringList& args) {
+
+		QStringList series_dirs;
+
+		for (int i = 0; i < args.size(); i++) {
+			const QString& arg = args[i];
+			bool has_value = i + 1 < args.size();
+
+			if (arg == "--batch")
+				continue;
+			else if (arg == "--out" && has_value)
+				output_dir = args[++i];
+			else if (arg == "--axial" && has_value)
+				slice_index[AXIAL] = args[++i].toInt();
+			else if (arg == "--coronal" && has_value)
+				slice_index[CORONAL] = args[++i].toInt();
+			else if (arg == "--sagittal" && has_value)
+				slice_index[SAGITTAL] = args[++i].toInt();
+			else if (arg == "--size" && has_value) {
+				QStringList size = args[++i].split('x');
+				if (size.size() == 2) {
+					width = size[0].toInt();
+					height = size[1].toInt();
+				}
+			}
+			else if (arg == "--cache")
+				use_cache = true;
+			else if (arg == "--list" && has_value)
+				series_dirs += read_list(args[++i]);
+			else if (arg.startsWith("--")) {
+				cout << "unknown or incomplete option " << arg.toStdString() << "\n";
+				print_usage();
+				return 1;
+			}
+			else
+				series_dirs << arg;
+		}
+
+		if (series_dirs.isEmpty() || width <= 0 || height <= 0) {
+			print_usage();
+			return 1;
+		}
+
+		if (!QDir().mkpath(output_dir)) {
+			cout << "could not create output directory " << output_dir.toStdString() << "\n";
+			return 1;
+		}
+
+		int failures = 0;
+		QElapsedTimer total_timer;
+		total_timer.start();
+
+		for (int i = 0; i < series_dirs.size(); i++) {
+			QElapsedTimer timer;
+			timer.start();
+
+			// number the outputs so series with the same directory name do not collide
+			QString prefix = QString("%1_%2").arg(i, 5, 10, QChar('0')).arg(QFileInfo(series_dirs[i]).fileName());
+
+			bool ok = render_series(QDir(series_dirs[i]), prefix);
+			if (!ok)
+				failures++;
+
+			cout << (ok ? "ok     " : "FAILED ") << series_dirs[i].toStdString() << " (" << timer.elapsed() << " ms)\n";
+		}
+
+		cout << series_dirs.size() - failures << "/" << series_dirs.size() << " series rendered in "
+			<< total_timer.elapsed() / 1000.0 << " s\n";
+
+		return failures == 0 ? 0 : 1;
+	}
+
+private:
+	const char* view_names[NUM_VIEWS] = { "volume", "axial", "coronal", "sagittal" };
+
+	colormaps maps;
+	dataset dset;
+
+	vtkSmartPointer<vtkMatrix4x4> reslice_axes_arr[NUM_VIEWS];
+	vtkSmartPointer<vtkImageReslice> reslice_arr[NUM_VIEWS];
+	vtkSmartPointer<vtkImageMapToColors> imapper_arr[NUM_VIEWS];
+	vtkSmartPointer<vtkImageActor> iactor_arr[NUM_VIEWS];
+	vtkSmartPointer<vtkRenderer> renderer_arr[NUM_VIEWS];
+
+	vtkSmartPointer<vtkSmartVolumeMapper> volume_mapper;
+	vtkSmartPointer<vtkVolumeProperty> volume_property;
+	vtkSmartPointer<vtkVolume> volume;
+
+	vtkSmartPointer<vtkRenderWindow> window;
+	vtkSmartPointer<vtkWindowToImageFilter> window_to_image;
+	vtkSmartPointer<vtkPNGWriter> png_writer;
+
+	// Render one view into the offscreen window and save it.
+	bool render_view(int view, const QString& file_name) {
+
+		for (int i = 0; i < NUM_VIEWS; i++) {
+			if (i != view && window->HasRenderer(renderer_arr[i]))
+				window->RemoveRenderer(renderer_arr[i]);
+		}
+		if (!window->HasRenderer(renderer_arr[view]))
+			window->AddRenderer(renderer_arr[view]);
+
+		renderer_arr[view]->ResetCamera();
+		renderer_arr[view]->ResetCameraClippingRange();
+		{
+			TRACE_SCOPE("render", -1, view);
+			window->Render();
+		}
+
+		window_to_image->Modified(); // grab the new frame
+		png_writer->SetFileName(QDir(output_dir).filePath(file_name).toStdString().c_str());
+		png_writer->Write();
+
+		return png_writer->GetErrorCode() == 0;
+	}
+
+	// One series directory per line (blank lines and lines starting with # are ignored).
+	static QStringList read_list(const QString& path) {
+
+		QStringList dirs;
+		QFile file(path);
+		if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+			cout << "could not open list file " << path.toStdString() << "\n";
+			return dirs;
+		}
+
+		QTextStream in(&file);
+		while (!in.atEnd()) {
+			QString line = in.readLine().trimmed();
+			if (!line.isEmpty() && !line.startsWith("#"))
+				dirs << line;
+		}
+		return dirs;
+	}
+
+	static void print_usage() {
+		cout << "usage: final_project --batch --out <dir> [--axial N] [--coronal N] [--sagittal N]\n"
+			"                     [--size WxH] [--cache] [--list <file>] [series_dir ...]\n";
+	}
+};
@@ -0,0 +1,100 @@
+/*
+Series load benchmark: compares the old loading scheme (one vtkDICOMImageReader per viewport,
+i.e. 4 decodes and 4 copies of the volume) against the shared dataset (1 decode, 1 copy).
+
+Peak RSS can only grow within a process, so each scheme is measured in its own run:
+
+	bench_load legacy <dicom_dir>
+	bench_load shared <dicom_dir>
+*/
+
+// VTK header files
+#include <vtkDICOMImageReader.h>
+#include <vtkImageReslice.h>
+#include <vtkSmartPointer.h>
+#include <vtkSmartVolumeMapper.h>
+
+// Qt header files
+#include <QDir>
+
+// Our header files
+#include "dataset.h"
+#include "bench_util.h"
+
+#include <cstring>
+#include <vector>
+
+
+// Build the 3 slice reslices + volume mapper the way ui.h did before datasets were shared.
+void load_legacy(const char* dir, std::vector<vtkSmartPointer<vtkObject>>& keep_alive) {
+
+	for (int i = 0; i < 4; i++) {
+		vtkSmartPointer<vtkDICOMImageReader> reader = vtkSmartPointer<vtkDICOMImageReader>::New();
+		reader->SetDirectoryName(dir);
+		reader->Update();
+
+		if (i < 3) {
+			vtkSmartPointer<vtkImageReslice> reslice = vtkSmartPointer<vtkImageReslice>::New();
+			reslice->SetInputConnection(reader->GetOutputPort());
+			reslice->SetOutputDimensionality(2);
+			reslice->Update();
+			keep_alive.push_back(reslice);
+		}
+		else {
+			vtkSmartPointer<vtkSmartVolumeMapper> mapper = vtkSmartPointer<vtkSmartVolumeMapper>::New();
+			mapper->SetInputConnection(reader->GetOutputPort());
+			keep_alive.push_back(mapper);
+		}
+	}
+}
+
+// Build the same 3 reslices + volume mapper from a single shared dataset.
+bool load_shared(const char* dir, dataset& dset, std::vector<vtkSmartPointer<vtkObject>>& keep_alive) {
+
+	// (no volume cache: the comparison is parse + decode, and nothing is stored during the timing)
+	if (!dset.load(QDir(dir), NULL, load_progress_fn(), false))
+		return false;
+
+	for (int i = 0; i < 3; i++) {
+		vtkSmartPointer<vtkImageReslice> reslice = vtkSmartPointer<vtkImageReslice>::New();
+		reslice->SetInputData(dset.image);
+		reslice->SetOutputDimensionality(2);
+		reslice->Update();
+		keep_alive.push_back(reslice);
+	}
+
+	vtkSmartPointer<vtkSmartVolumeMapper> mapper = vtkSmartPointer<vtkSmartVolumeMapper>::New();
+	mapper->SetInputData(dset.image);
+	keep_alive.push_back(mapper);
+
+	return true;
+}
+
+int main(int argc, char** argv) {
+
+	if (argc < 3 || !(strcmp(argv[1], "legacy") == 0 || strcmp(argv[1], "shared") == 0)) {
+		cout << "usage: bench_load <legacy|shared> <dicom_dir>\n";
+		return 1;
+	}
+
+	std::vector<vtkSmartPointer<vtkObject>> keep_alive; // hold the pipelines, like the viewports do
+	dataset dset;
+
+	double rss_before = peak_rss_mb();
+	bench_timer timer;
+
+	if (strcmp(argv[1], "legacy") == 0) {
+		load_legacy(argv[2], keep_alive);
+	}
+	else if (!load_shared(argv[2], dset, keep_alive)) {
+		return 1;
+	}
+
+	double load_ms = timer.elapsed_ms();
+
+	cout << "mode: " << argv[1] << "\n";
+	cout << "load time (ms): " << load_ms << "\n";
+	cout << "peak RSS (MB): " << peak_rss_mb() << " (baseline before load: " << rss_before << ")\n";
+
+	return 0;
+}
@@ -0,0 +1,347 @@
+/*
+Load generator for the render service (render_service.h). Opens --clients connections to a
+running `final_project --serve` on this machine, and each client scrolls through the axial slices
+of a series (with a volume snapshot every --volume-every requests), keeping up to --pipeline
+requests in flight. Reports, as JSON, the throughput (requests/s, MB/s), the latency percentiles
+seen by the clients and the server's own counters (batches, shared renders, volume loads).
+
+	final_project --serve --port 7575 &
+	bench_serve [--port N | --socket <name>] [--series <dir>] [--clients N] [--requests N]
+		[--pipeline N] [--volume-every N] [--format png|rgba] [--same-slices] [--shutdown]
+		[--out results.json]
+
+Without --series a synthetic series (see dicom_writer.h) is written to a temporary directory the
+server reads it from. With --same-slices every client asks for the same slices (several viewers
+on one study), which the server's batching renders once per batch.
+*/
+
+// Qt header files
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QHostAddress>
+#include <QIODevice>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+
+// Our header files
+#include "bench_util.h"
+#include "dicom_writer.h"
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+struct serve_options {
+	quint16 port = 7575;
+	QString socket_name;
+	QString series_dir;     // empty: write a synthetic series
+	synthetic_series series;
+	int clients = 8;
+	int requests = 200;     // per client
+	int pipeline = 1;       // requests in flight per client
+	int volume_every = 0;   // every Nth request is a volume snapshot (0 = slices only)
+	QString format = "png";
+	bool same_slices = false;
+	bool shutdown = false;
+	QString out_path;
+};
+
+// What one client saw.
+struct client_result {
+	sample_set latency_ms;
+	long long errors = 0;
+	long long bytes = 0;
+	QString failure; // set if the connection broke
+};
+
+const int TIMEOUT_MS = 60000;
+
+
+bool parse_options(const QStringList& args, serve_options& options) {
+
+	for (int i = 1; i < args.size(); i++) {
+		const QString& arg = args[i];
+
+		if (arg == "--same-slices") {
+			options.same_slices = true;
+			continue;
+		}
+		if (arg == "--shutdown") {
+			options.shutdown = true;
+			continue;
+		}
+
+		if (i + 1 >= args.size())
+			return false;
+		const QString value = args[++i];
+
+		if (arg == "--port")
+			options.port = (quint16)value.toInt();
+		else if (arg == "--socket")
+			options.socket_name = value;
+		else if (arg == "--series")
+			options.series_dir = value;
+		else if (arg == "--clients")
+			options.clients = value.toInt();
+		else if (arg == "--requests")
+			options.requests = value.toInt();
+		else if (arg == "--pipeline")
+			options.pipeline = value.toInt();
+		else if (arg == "--volume-every")
+			options.volume_every = value.toInt();
+		else if (arg == "--format" && (value == "png" || value == "rgba"))
+			options.format = value;
+		else if (arg == "--out")
+			options.out_path = value;
+		else
+			return false;
+	}
+
+	return options.clients > 0 && options.requests > 0 && options.pipeline > 0 && options.volume_every >= 0;
+}
+
+// Connect to the server (blocking; the socket belongs to the calling thread). NULL if that failed.
+QIODevice* connect_to_server(const serve_options& options) {
+
+	if (!options.socket_name.isEmpty()) {
+		QLocalSocket* socket = new QLocalSocket();
+		socket->connectToServer(options.socket_name);
+		if (socket->waitForConnected(TIMEOUT_MS))
+			return socket;
+		delete socket;
+		return NULL;
+	}
+
+	QTcpSocket* socket = new QTcpSocket();
+	socket->connectToHost(QHostAddress::LocalHost, options.port);
+	if (socket->waitForConnected(TIMEOUT_MS)) {
+		socket->setSocketOption(QAbstractSocket::LowDelayOption, 1); // (small request lines)
+		return socket;
+	}
+	delete socket;
+	return NULL;
+}
+
+bool send_request(QIODevice* socket, const QJsonObject& request) {
+
+	socket->write(QJsonDocument(request).toJson(QJsonDocument::Compact) + "\n");
+	while (socket->bytesToWrite() > 0) {
+		if (!socket->waitForBytesWritten(TIMEOUT_MS))
+			return false;
+	}
+	return true;
+}
+
+// Read one reply: the header line and its payload ("bytes" of it).
+bool read_reply(QIODevice* socket, QJsonObject& header, QByteArray& payload) {
+
+	while (!socket->canReadLine()) {
+		if (!socket->waitForReadyRead(TIMEOUT_MS))
+			return false;
+	}
+	header = QJsonDocument::fromJson(socket->readLine()).object();
+
+	int bytes = header["ok"].toBool() ? header["bytes"].toInt() : 0;
+	payload.clear();
+	while (payload.size() < bytes) {
+		if (socket->bytesAvailable() == 0 && !socket->waitForReadyRead(TIMEOUT_MS))
+			return false;
+		payload += socket->read(bytes - payload.size());
+	}
+	return true;
+}
+
+// Ask for a single reply (warm-up, stats, shutdown).
+bool round_trip(const serve_options& options, const QJsonObject& request, QJsonObject& header) {
+
+	std::unique_ptr<QIODevice> socket(connect_to_server(options));
+	QByteArray payload;
+	return socket != NULL && send_request(socket.get(), request) && read_reply(socket.get(), header, payload);
+}
+
+// One client: scroll through the slices, requests id 0..requests-1, up to pipeline in flight.
+void run_client(const serve_options& options, const QString& series_dir, int client_num, int slices, client_result& result) {
+
+	std::unique_ptr<QIODevice> socket(connect_to_server(options));
+	if (socket == NULL) {
+		result.failure = "could not connect";
+		return;
+	}
+
+	int start = options.same_slices ? 0 : (int)((long long)client_num * slices / options.clients);
+	std::map<int, bench_timer> in_flight;
+	int sent = 0, received = 0;
+	QByteArray payload;
+
+	while (received < options.requests) {
+		while (sent < options.requests && (int)in_flight.size() < options.pipeline) {
+			QJsonObject request;
+			request["id"] = sent;
+			request["series"] = series_dir;
+			request["format"] = options.format;
+			if (options.volume_every > 0 && sent % options.volume_every == options.volume_every - 1) {
+				request["plane"] = "volume";
+				request["azimuth"] = (sent * 10) % 360;
+			}
+			else {
+				request["plane"] = "axial";
+				request["index"] = (start + sent) % slices;
+			}
+			in_flight[sent] = bench_timer();
+			if (!send_request(socket.get(), request)) {
+				result.failure = "could not send a request";
+				return;
+			}
+			sent++;
+		}
+
+		QJsonObject header;
+		if (!read_reply(socket.get(), header, payload)) {
+			result.failure = "no reply (connection closed or timed out)";
+			return;
+		}
+		std::map<int, bench_timer>::iterator found = in_flight.find(header["id"].toInt(-1));
+		if (found == in_flight.end()) {
+			result.failure = "reply to a request that was not sent";
+			return;
+		}
+		result.latency_ms.add(found->second.elapsed_ms());
+		in_flight.erase(found);
+		received++;
+
+		if (header["ok"].toBool())
+			result.bytes += payload.size();
+		else
+			result.errors++;
+	}
+}
+
+int main(int argc, char** argv) {
+
+	QCoreApplication app(argc, argv);
+
+	serve_options options;
+	if (!parse_options(app.arguments(), options)) {
+		std::cout << "usage: bench_serve [--port N | --socket <name>] [--series <dir>] [--clients N] [--requests N]\n"
+			"                   [--pipeline N] [--volume-every N] [--format png|rgba] [--same-slices]\n"
+			"                   [--shutdown] [--out results.json]\n"
+			"(needs a running final_project --serve)\n";
+		return 1;
+	}
+
+	// S================== SERIES =================== //
+	QTemporaryDir temp_dir;
+	QString series_dir = options.series_dir;
+	if (series_dir.isEmpty()) {
+		if (!temp_dir.isValid() || !options.series.write(temp_dir.path().toStdString())) {
+			std::cout << "could not write the synthetic series\n";
+			return 1;
+		}
+		series_dir = temp_dir.path();
+	}
+
+	// S================== WARM UP =================== //
+	// the first request loads the series on the server (timed on its own)
+	QJsonObject request, header;
+	request["id"] = 0;
+	request["series"] = series_dir;
+	request["plane"] = "axial";
+	request["format"] = options.format;
+	bench_timer load_timer;
+	if (!round_trip(options, request, header)) {
+		std::cout << "no reply from the server (is final_project --serve running?)\n";
+		return 1;
+	}
+	if (!header["ok"].toBool()) {
+		std::cout << "the server could not render the series: " << header["error"].toString().toStdString() << "\n";
+		return 1;
+	}
+	double first_request_ms = load_timer.elapsed_ms();
+	int slices = header["slices"].toInt(1);
+
+	// S================== LOAD =================== //
+	std::vector<client_result> results(options.clients);
+	std::vector<std::thread> clients;
+	bench_timer timer;
+	for (int c = 0; c < options.clients; c++)
+		clients.push_back(std::thread(run_client, std::cref(options), series_dir, c, slices, std::ref(results[c])));
+	for (size_t c = 0; c < clients.size(); c++)
+		clients[c].join();
+	double elapsed_s = timer.elapsed_ms() / 1000.0;
+
+	sample_set latency_ms;
+	long long answered = 0, errors = 0, bytes = 0;
+	QStringList failures;
+	for (size_t c = 0; c < results.size(); c++) {
+		latency_ms.samples.insert(latency_ms.samples.end(), results[c].latency_ms.samples.begin(), results[c].latency_ms.samples.end());
+		answered += (long long)results[c].latency_ms.samples.size();
+		errors += results[c].errors;
+		bytes += results[c].bytes;
+		if (!results[c].failure.isEmpty())
+			failures << QString("client %1: %2").arg(c).arg(results[c].failure);
+	}
+
+	// S================== SERVER COUNTERS =================== //
+	QJsonObject stats_request, server_stats;
+	stats_request["command"] = "stats";
+	round_trip(options, stats_request, server_stats);
+
+	if (options.shutdown) {
+		QJsonObject shutdown_request, reply;
+		shutdown_request["command"] = "shutdown";
+		round_trip(options, shutdown_request, reply);
+	}
+
+	// S================== REPORT =================== //
+	QJsonObject config;
+	config["endpoint"] = options.socket_name.isEmpty() ? "127.0.0.1:" + QString::number(options.port) : options.socket_name;
+	config["series"] = options.series_dir.isEmpty() ? "synthetic" : options.series_dir;
+	config["clients"] = options.clients;
+	config["requests_per_client"] = options.requests;
+	config["pipeline"] = options.pipeline;
+	config["volume_every"] = options.volume_every;
+	config["format"] = options.format;
+	config["same_slices"] = options.same_slices;
+	config["hardware_threads"] = (int)std::thread::hardware_concurrency();
+
+	QJsonObject measured;
+	measured["first_request_ms"] = first_request_ms; // (includes the series load on the server)
+	measured["answered"] = (double)answered;
+	measured["errors"] = (double)errors;
+	measured["requests_per_s"] = answered / elapsed_s;
+	measured["mb_per_s"] = bytes / (1024.0 * 1024.0) / elapsed_s;
+	measured["latency_ms"] = latency_ms.to_json();
+	measured["server"] = server_stats;
+	if (!failures.isEmpty())
+		measured["failures"] = failures.join("; ");
+
+	QJsonObject report;
+	report["benchmark"] = "bench_serve";
+	report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+	report["config"] = config;
+	report["results"] = measured;
+
+	QByteArray json = QJsonDocument(report).toJson();
+
+	if (options.out_path.isEmpty()) {
+		std::cout << json.constData();
+	}
+	else {
+		QFile out(options.out_path);
+		if (!out.open(QIODevice::WriteOnly) || out.write(json) != json.size()) {
+			std::cout << "could not write " << options.out_path.toStdString() << "\n";
+			return 1;
+		}
+	}
+
+	return failures.isEmpty() ? 0 : 1;
+}
@@ -0,0 +1,810 @@
+/*
+Benchmark suite. Generates a synthetic DICOM series (see dicom_writer.h) and measures, fully
+offscreen:
+
+	- series load time (and decode throughput)
+	- decode throughput of the compressed transfer syntaxes (pixel_codecs.h) per core and on all
+	  cores, with the compression ratio; the lossless round trips (and lossless JPEG with every
+	  predictor, restart markers and point transform) must give back the original samples
+	- intensity histogram cost (intensity_histogram.h): the counting the reader fuses into the pixel
+	  pass, timed on its own over the loaded volume
+	- time to first rendered frame (load + pipeline setup + first slice render), and time to the
+	  first decoded slice with progressive loading
+	- per-slice reslice latency while stepping the axial/coronal/sagittal planes (with the
+	  direct slice copy of fast_reslice.h, or plain vtkImageReslice with --reslice vtk)
+	- latency of one nudge of a moved overlay (rigid_transform.h): the three slice planes resliced
+	  through the new transform and rendered
+	- colormap switch latency
+	- window/level latency of one axial slice (fused kernel of colormap_kernel.h, SIMD and scalar)
+	- CPU compositing latency of two slices (slice_blend.h, SIMD and scalar)
+	- difference view latency of one axial slice pair (slice_difference.h, signed and absolute, SIMD
+	  and scalar)
+	- thick-slab MIP/MinIP/average latency per slab step (slab_projector.h, sliding window and from
+	  scratch)
+	- offscreen volume render time (vtkSmartVolumeMapper, and the CPU ray caster of cpu_raycaster.h on
+	  the same volume and camera path); the run fails if the ray caster's image with empty space
+	  skipping differs from the one without
+	- series discovery (series_scanner.h): files per second over a tree of small files that holds
+	  several series, some mixed in one directory and some in subdirectories
+
+The results are written as JSON so runs of different versions can be compared:
+
+	bench_suite [--rows N] [--columns N] [--slices N] [--bits 8|16]
+		[--transfer-syntax implicit|explicit|big|rle|jpeg-lossless|jpeg-baseline] [--reslice fast|vtk]
+		[--repeat N] [--scan-files N] [--out results.json]
+*/
+
+// VTK header files
+#include <vtkCamera.h>
+#include <vtkImageActor.h>
+#include <vtkImageData.h>
+#include <vtkImageMapper3D.h>
+#include <vtkImageMapToColors.h>
+#include <vtkImageReslice.h>
+#include <vtkMatrix4x4.h>
+#include <vtkRenderer.h>
+#include <vtkRenderWindow.h>
+#include <vtkSmartPointer.h>
+#include <vtkSmartVolumeMapper.h>
+#include <vtkTransform.h>
+#include <vtkVolume.h>
+#include <vtkVolumeProperty.h>
+
+// Qt header files
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTemporaryDir>
+
+// Our header files
+#include "colormap_kernel.h"
+#include "colormaps.h"
+#include "cpu_raycaster.h"
+#include "dataset.h"
+#include "fast_reslice.h"
+#include "rigid_transform.h"
+#include "series_scanner.h"
+#include "slab_projector.h"
+#include "slice_blend.h"
+#include "slice_difference.h"
+#include "bench_util.h"
+#include "dicom_writer.h"
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+// options from the command line
+struct suite_options {
+	synthetic_series series;
+	int repeat = 3;
+	int scan_files = 10000; // files of the series discovery tree
+	bool direct_copy = true; // --reslice fast|vtk
+	QString out_path;
+};
+
+// the slice pipeline of the viewer (reslice -> colour map -> actor -> renderer -> window), offscreen
+struct slice_pipeline {
+	vtkSmartPointer<vtkMatrix4x4> axes = vtkSmartPointer<vtkMatrix4x4>::New();
+	vtkSmartPointer<fast_reslice> reslice = vtkSmartPointer<fast_reslice>::New();
+	vtkSmartPointer<vtkImageMapToColors> imapper = vtkSmartPointer<vtkImageMapToColors>::New();
+	vtkSmartPointer<vtkImageActor> actor = vtkSmartPointer<vtkImageActor>::New();
+	vtkSmartPointer<vtkRenderer> renderer = vtkSmartPointer<vtkRenderer>::New();
+	vtkSmartPointer<vtkRenderWindow> window = vtkSmartPointer<vtkRenderWindow>::New();
+
+	slice_pipeline(vtkImageData* image, const double plane[16], vtkLookupTable* lut, bool direct_copy) {
+
+		axes->DeepCopy(plane);
+		reslice->direct_copy = direct_copy;
+		reslice->SetInputData(image);
+		reslice->SetOutputDimensionality(2);
+		reslice->SetResliceAxes(axes);
+		reslice->SetInterpolationModeToLinear();
+
+		imapper->PassAlphaToOutputOn();
+		imapper->SetLookupTable(lut);
+		imapper->SetInputConnection(reslice->GetOutputPort());
+
+		actor->GetMapper()->SetInputConnection(imapper->GetOutputPort());
+		renderer->AddActor(actor);
+
+		window->SetOffScreenRendering(1);
+		window->SetSize(512, 512);
+		window->AddRenderer(renderer);
+	}
+
+	// Move the plane to a slice (world position along the plane normal) and render it.
+	void show_slice(int axis, double position) {
+		axes->SetElement(axis, 3, position);
+		reslice->Modified();
+		window->Render();
+	}
+};
+
+// the same planes as ui.h
+const double PLANES[4][16] = {
+	{ 0 },
+	{ 1, 0, 0, 0,   0, 1, 0, 0,   0, 0, 1, 0,   0, 0, 0, 1 },   // axial
+	{ 1, 0, 0, 0,   0, 0, 1, 0,   0, -1, 0, 0,  0, 0, 0, 1 },   // coronal
+	{ 0, 0, -1, 0,  1, 0, 0, 0,   0, -1, 0, 0,  0, 0, 0, 1 } }; // sagittal
+
+const char* PLANE_NAMES[4] = { "volume", "axial", "coronal", "sagittal" };
+
+// maps plane_idx to the "missing" axis ( e.g. axial (plane_idx=1) misses z (2) )
+const int PLANE_AXIS[4] = { -1, 2, 1, 0 };
+
+
+bool parse_options(const QStringList& args, suite_options& options) {
+
+	for (int i = 1; i < args.size(); i++) {
+		const QString& arg = args[i];
+		if (i + 1 >= args.size())
+			return false;
+		const QString value = args[++i];
+
+		if (arg == "--rows")
+			options.series.rows = value.toInt();
+		else if (arg == "--columns")
+			options.series.columns = value.toInt();
+		else if (arg == "--slices")
+			options.series.slices = value.toInt();
+		else if (arg == "--bits")
+			options.series.bits = value.toInt();
+		else if (arg == "--repeat")
+			options.repeat = value.toInt();
+		else if (arg == "--scan-files")
+			options.scan_files = value.toInt();
+		else if (arg == "--out")
+			options.out_path = value;
+		else if (arg == "--reslice" && (value == "fast" || value == "vtk"))
+			options.direct_copy = value == "fast";
+		else if (arg == "--transfer-syntax") {
+			if (value == "implicit")
+				options.series.transfer_syntax = TS_IMPLICIT_LITTLE;
+			else if (value == "explicit")
+				options.series.transfer_syntax = TS_EXPLICIT_LITTLE;
+			else if (value == "big")
+				options.series.transfer_syntax = TS_EXPLICIT_BIG;
+			else if (value == "rle")
+				options.series.transfer_syntax = TS_RLE_LOSSLESS;
+			else if (value == "jpeg-lossless")
+				options.series.transfer_syntax = TS_JPEG_LOSSLESS_SV1;
+			else if (value == "jpeg-baseline")
+				options.series.transfer_syntax = TS_JPEG_BASELINE;
+			else
+				return false;
+		}
+		else
+			return false;
+	}
+
+	const synthetic_series& s = options.series;
+	return s.rows > 0 && s.columns > 0 && s.slices > 0 && (s.bits == 8 || s.bits == 16) && options.repeat > 0 &&
+		options.scan_files >= 0 && (s.bits == 8 || s.transfer_syntax != TS_JPEG_BASELINE);
+}
+
+int main(int argc, char** argv) {
+
+	QCoreApplication app(argc, argv);
+
+	suite_options options;
+	if (!parse_options(app.arguments(), options)) {
+		cout << "usage: bench_suite [--rows N] [--columns N] [--slices N] [--bits 8|16]\n"
+			"                   [--transfer-syntax implicit|explicit|big|rle|jpeg-lossless|jpeg-baseline]\n"
+			"                   [--reslice fast|vtk] [--repeat N] [--scan-files N] [--out results.json]\n"
+			"(jpeg-baseline needs --bits 8)\n";
+		return 1;
+	}
+
+	// S================== GENERATE SERIES =================== //
+	QTemporaryDir series_dir;
+	if (!series_dir.isValid() || !options.series.write(series_dir.path().toStdString())) {
+		cout << "could not write the synthetic series\n";
+		return 1;
+	}
+
+	colormaps maps;
+	QJsonObject results;
+
+	// S================== SERIES LOAD =================== //
+	sample_set load_ms;
+	dataset dset;
+	for (int r = 0; r < options.repeat; r++) {
+		bench_timer timer;
+		if (!dset.load(QDir(series_dir.path()), NULL, load_progress_fn(), false)) {
+			cout << "could not load the synthetic series\n";
+			return 1;
+		}
+		load_ms.add(timer.elapsed_ms());
+	}
+	results["series_load_ms"] = load_ms.to_json();
+	results["load_throughput_mb_s"] = options.series.pixel_bytes() / (1024.0 * 1024.0) / (load_ms.percentile(0.5) / 1000.0);
+
+	// S================== HISTOGRAM =================== //
+	{
+		// what counting the histogram adds to the pixel pass (one slice per task, as the reader does)
+		int* dims = dset.dimensions();
+		size_t slice_voxels = (size_t)dims[0] * dims[1];
+		size_t slice_bytes = slice_voxels * dset.image->GetScalarSize();
+		const unsigned char* voxels = static_cast<const unsigned char*>(dset.image->GetScalarPointer());
+
+		sample_set histogram_ms;
+		std::shared_ptr<const intensity_histogram> histogram;
+		for (int r = 0; r < options.repeat; r++) {
+			bench_timer timer;
+			histogram_builder counts(dset.image->GetScalarType());
+			thread_pool::shared().parallel_for(dims[2], [&](int z) {
+				counts.add(voxels + z * slice_bytes, slice_voxels);
+			});
+			histogram = counts.finish(voxels, slice_voxels * dims[2]);
+			histogram_ms.add(timer.elapsed_ms());
+		}
+
+		double window, level;
+		histogram->auto_window(window, level);
+		QJsonObject histogram_results;
+		histogram_results["count_ms"] = histogram_ms.to_json();
+		histogram_results["mb_s"] = options.series.pixel_bytes() / (1024.0 * 1024.0) / (histogram_ms.percentile(0.5) / 1000.0);
+		histogram_results["share_of_load"] = histogram_ms.percentile(0.5) / load_ms.percentile(0.5);
+		histogram_results["bins"] = (int)histogram->counts.size();
+		histogram_results["auto_window"] = window;
+		histogram_results["auto_level"] = level;
+		results["histogram"] = histogram_results;
+	}
+
+	// S================== TIME TO FIRST FRAME =================== //
+	sample_set first_frame_ms;
+	for (int r = 0; r < options.repeat; r++) {
+		bench_timer timer;
+		dataset fresh;
+		fresh.load(QDir(series_dir.path()), NULL, load_progress_fn(), false);
+		maps.grayScaleLut->SetRange(fresh.scalar_range());
+		slice_pipeline axial(fresh.image, PLANES[1], maps.grayScaleLut, options.direct_copy);
+		axial.renderer->ResetCamera();
+		axial.window->Render();
+		first_frame_ms.add(timer.elapsed_ms());
+	}
+	results["first_frame_ms"] = first_frame_ms.to_json();
+
+	// S================== TIME TO FIRST SLICE =================== //
+	// progressive loading (loader.h): until the first slice is decoded and can be shown
+	sample_set first_slice_ms;
+	for (int r = 0; r < options.repeat; r++) {
+		bench_timer timer;
+		double first_ms = -1.0;
+		dataset progressive;
+		progressive.on_allocated = [](vtkImageData*) {};
+		progressive.on_slices_decoded = [&](int) { // serialised by the reader
+			if (first_ms < 0.0)
+				first_ms = timer.elapsed_ms();
+		};
+		progressive.load(QDir(series_dir.path()), NULL, load_progress_fn(), false);
+		first_slice_ms.add(first_ms);
+	}
+	results["first_slice_ms"] = first_slice_ms.to_json();
+
+	// S================== DECODE THROUGHPUT =================== //
+	{
+		// every slice of the phantom compressed in memory, then decoded on one thread and on all
+		// cores (MB/s of decoded pixels); no file I/O involved. The run fails if a lossless codec
+		// does not give back the original samples.
+		const char* codec_names[3] = { "rle", "jpeg_lossless", "jpeg_baseline" };
+		const char* codec_syntaxes[3] = { TS_RLE_LOSSLESS, TS_JPEG_LOSSLESS_SV1, TS_JPEG_BASELINE };
+		int num_codecs = options.series.bits == 8 ? 3 : 2; // baseline JPEG is 8-bit only
+
+		QJsonObject decode_results;
+		for (int c = 0; c < num_codecs; c++) {
+			synthetic_series s = options.series;
+			s.transfer_syntax = codec_syntaxes[c];
+
+			dicom_header hdr;
+			hdr.transfer_syntax = s.transfer_syntax;
+			hdr.rows = s.rows;
+			hdr.columns = s.columns;
+			hdr.bits_allocated = hdr.bits_stored = s.bits;
+
+			std::vector<std::vector<unsigned char>> compressed(s.slices);
+			double compressed_bytes = 0.0;
+			for (int z = 0; z < s.slices; z++) {
+				compressed[z] = s.encode_frame(s.native_samples(z, false));
+				compressed_bytes += compressed[z].size();
+			}
+
+			size_t frame_bytes = (size_t)s.rows * s.columns * (s.bits / 8);
+			std::vector<unsigned char> decoded(frame_bytes * s.slices);
+			std::atomic<bool> ok(true);
+			auto decode_slice = [&](int z) {
+				encoded_frame frame;
+				frame.data = compressed[z].data();
+				frame.size = compressed[z].size();
+				std::string error;
+				if (!pixel_codecs::decode(hdr, frame, decoded.data() + z * frame_bytes, error))
+					ok = false;
+			};
+
+			sample_set single_ms, parallel_ms;
+			for (int r = 0; r < options.repeat; r++) {
+				bench_timer timer;
+				for (int z = 0; z < s.slices; z++)
+					decode_slice(z);
+				single_ms.add(timer.elapsed_ms());
+
+				bench_timer parallel_timer;
+				thread_pool::shared().parallel_for(s.slices, decode_slice);
+				parallel_ms.add(parallel_timer.elapsed_ms());
+			}
+			if (!ok) {
+				cout << "could not decode the " << codec_names[c] << " frames\n";
+				return 1;
+			}
+
+			// the lossless codecs must give back the phantom exactly (baseline JPEG is lossy)
+			if (s.transfer_syntax != TS_JPEG_BASELINE) {
+				for (int z = 0; z < s.slices; z++) {
+					if (memcmp(decoded.data() + z * frame_bytes, s.native_samples(z, false).data(), frame_bytes) != 0) {
+						cout << "the " << codec_names[c] << " round trip differs from the original at slice " << z << "\n";
+						return 1;
+					}
+				}
+			}
+
+			double mb = s.pixel_bytes() / (1024.0 * 1024.0);
+			QJsonObject codec_results;
+			codec_results["single_thread_ms"] = single_ms.to_json();
+			codec_results["all_cores_ms"] = parallel_ms.to_json();
+			codec_results["mb_s_per_core"] = mb / (single_ms.percentile(0.5) / 1000.0);
+			codec_results["mb_s_all_cores"] = mb / (parallel_ms.percentile(0.5) / 1000.0);
+			codec_results["compression_ratio"] = s.pixel_bytes() / compressed_bytes;
+			decode_results[codec_names[c]] = codec_results;
+		}
+
+		// lossless JPEG beyond SV1: every predictor, with and without restart markers (an interval
+		// that ends mid-row) and point transform, checked on a few slices
+		int variants = 0;
+		for (int predictor = 1; predictor <= 7; predictor++) {
+			for (int restart_interval : { 0, options.series.columns + 3 }) {
+				for (int point_transform : { 0, 2 }) {
+					synthetic_series s = options.series;
+					s.transfer_syntax = TS_JPEG_LOSSLESS;
+					s.jpeg_predictor = predictor;
+					s.jpeg_restart_interval = restart_interval;
+					s.jpeg_point_transform = point_transform;
+
+					dicom_header hdr;
+					hdr.transfer_syntax = s.transfer_syntax;
+					hdr.rows = s.rows;
+					hdr.columns = s.columns;
+					hdr.bits_allocated = hdr.bits_stored = s.bits;
+
+					for (int z : { 0, s.slices / 2, s.slices - 1 }) {
+						std::vector<unsigned char> expected = s.native_samples(z, false);
+						std::vector<unsigned char> compressed = s.encode_frame(expected);
+						std::vector<unsigned char> decoded(expected.size());
+
+						// the dropped low bits come back as zeros
+						for (size_t i = 0; i < expected.size(); i += s.bits / 8)
+							expected[i] &= (unsigned char)(0xFF << point_transform);
+
+						encoded_frame frame;
+						frame.data = compressed.data();
+						frame.size = compressed.size();
+						std::string error;
+						if (!pixel_codecs::decode(hdr, frame, decoded.data(), error) || decoded != expected) {
+							cout << "the lossless JPEG round trip fails with predictor " << predictor << ", restart interval " <<
+								restart_interval << ", point transform " << point_transform << " (slice " << z << ") " << error << "\n";
+							return 1;
+						}
+					}
+					variants++;
+				}
+			}
+		}
+		decode_results["jpeg_lossless_variants_checked"] = variants;
+
+		decode_results["cores"] = (int)std::thread::hardware_concurrency();
+		results["decode_throughput"] = decode_results;
+	}
+
+	// S================== RESLICE LATENCY =================== //
+	maps.grayScaleLut->SetRange(dset.scalar_range());
+	double* origin = dset.image->GetOrigin();
+	double* spacing = dset.image->GetSpacing();
+	int* dims = dset.image->GetDimensions();
+
+	QJsonObject reslice_results;
+	for (int plane = 1; plane < 4; plane++) {
+		slice_pipeline pipeline(dset.image, PLANES[plane], maps.grayScaleLut, options.direct_copy);
+		int axis = PLANE_AXIS[plane];
+		pipeline.show_slice(axis, origin[axis]);
+		pipeline.renderer->ResetCamera();
+
+		// step through the whole range like a slider drag
+		sample_set step_ms;
+		for (int r = 0; r < options.repeat; r++) {
+			for (int k = 0; k < dims[axis]; k++) {
+				bench_timer timer;
+				pipeline.show_slice(axis, origin[axis] + k * spacing[axis]);
+				step_ms.add(timer.elapsed_ms());
+			}
+		}
+		QJsonObject plane_results = step_ms.to_json();
+		plane_results["direct_copy_pieces"] = pipeline.reslice->fast_pieces.load();
+		plane_results["resampled_pieces"] = pipeline.reslice->resampled_pieces.load();
+		reslice_results[PLANE_NAMES[plane]] = plane_results;
+	}
+	results["reslice_ms"] = reslice_results;
+
+	// S================== TRANSFORM NUDGE =================== //
+	{
+		// an overlay being aligned: every nudge gives the three planes a new reslice transform (the
+		// volume is never resampled) and renders them, which has to fit in one frame
+		std::vector<std::unique_ptr<slice_pipeline>> pipelines;
+		for (int plane = 1; plane < 4; plane++) {
+			pipelines.push_back(std::unique_ptr<slice_pipeline>(new slice_pipeline(dset.image, PLANES[plane], maps.grayScaleLut, options.direct_copy)));
+			int axis = PLANE_AXIS[plane];
+			pipelines.back()->show_slice(axis, origin[axis] + dims[axis] / 2 * spacing[axis]);
+			pipelines.back()->renderer->ResetCamera();
+		}
+
+		rigid_transform transform;
+		double* centre = dset.image->GetCenter();
+		sample_set nudge_ms;
+		for (int k = 0; k < 20 * options.repeat; k++) {
+			bench_timer timer;
+			transform.translation[k % 3] += 0.5;
+			transform.rotation[2] += 0.5;
+			double m[16];
+			transform.inverse_matrix(centre, m);
+			vtkSmartPointer<vtkTransform> to_volume = vtkSmartPointer<vtkTransform>::New();
+			to_volume->SetMatrix(m);
+			for (size_t p = 0; p < pipelines.size(); p++) {
+				pipelines[p]->reslice->SetResliceTransform(to_volume);
+				pipelines[p]->window->Render();
+			}
+			nudge_ms.add(timer.elapsed_ms());
+		}
+		QJsonObject nudge_results = nudge_ms.to_json();
+		nudge_results["frame_budget_ms"] = 1000.0 / 60.0;
+		results["transform_nudge_ms"] = nudge_results;
+	}
+
+	// S================== COLORMAP SWITCH =================== //
+	{
+		slice_pipeline pipeline(dset.image, PLANES[1], maps.grayScaleLut, options.direct_copy);
+		pipeline.show_slice(2, origin[2] + dims[2] / 2 * spacing[2]);
+		pipeline.renderer->ResetCamera();
+
+		maps.rainbowBlueRedLut->SetRange(dset.scalar_range());
+		vtkLookupTable* luts[2] = { maps.rainbowBlueRedLut, maps.grayScaleLut };
+
+		sample_set switch_ms;
+		for (int k = 0; k < 20 * options.repeat; k++) {
+			bench_timer timer;
+			pipeline.imapper->SetLookupTable(luts[k % 2]);
+			pipeline.window->Render();
+			switch_ms.add(timer.elapsed_ms());
+		}
+		results["colormap_switch_ms"] = switch_ms.to_json();
+	}
+
+	// S================== WINDOW/LEVEL =================== //
+	{
+		// one axial slice through the fused window/level + colour map kernel, as during a window/level drag
+		int scalar_size = dset.image->GetScalarSize();
+		size_t count = (size_t)dims[0] * dims[1];
+		const char* middle = static_cast<const char*>(dset.image->GetScalarPointer(0, 0, dims[2] / 2));
+		std::vector<char> values(middle, middle + count * scalar_size);
+		std::vector<unsigned char> rgba(4 * count);
+
+		double* range = dset.scalar_range();
+		lut_snapshot lut(maps.grayScaleLut);
+
+		QJsonObject window_level_results;
+		const char* kernel_names[2] = { "scalar", "simd" };
+		for (int simd = 0; simd < 2; simd++) {
+			sample_set step_ms;
+			for (int k = 0; k < 50 * options.repeat; k++) {
+				double window = (range[1] - range[0]) * (0.2 + 0.8 * (k % 10) / 10.0); // dragging the window
+				bench_timer timer;
+				colormap_kernel::apply(values.data(), dset.image->GetScalarType(), (int)count, lut, window,
+					(range[0] + range[1]) / 2, rgba.data(), simd == 1);
+				step_ms.add(timer.elapsed_ms());
+			}
+			window_level_results[kernel_names[simd]] = step_ms.to_json();
+		}
+		window_level_results["avx2"] = slice_extract::has_avx2();
+		window_level_results["slice_pixels"] = (double)count;
+		results["window_level_ms"] = window_level_results;
+	}
+
+	// S================== CPU COMPOSITING =================== //
+	{
+		// dataset 2 over dataset 1 for one slice (slice_blend.h), as after an opacity change
+		size_t count = (size_t)dims[0] * dims[1];
+		std::vector<unsigned char> lower(4 * count), upper(4 * count), blended(4 * count);
+		for (size_t i = 0; i < lower.size(); i++) {
+			lower[i] = (unsigned char)(i * 7);
+			upper[i] = (unsigned char)(i * 13 + 5);
+		}
+
+		QJsonObject composite_results;
+		const char* kernel_names[2] = { "scalar", "simd" };
+		for (int simd = 0; simd < 2; simd++) {
+			sample_set step_ms;
+			for (int k = 0; k < 50 * options.repeat; k++) {
+				bench_timer timer;
+				slice_blend::over(lower.data(), 1.0, upper.data(), (k % 10) / 10.0, (int)count, blended.data(), simd == 1);
+				step_ms.add(timer.elapsed_ms());
+			}
+			composite_results[kernel_names[simd]] = step_ms.to_json();
+		}
+		results["composite_ms"] = composite_results;
+	}
+
+	// S================== DIFFERENCE =================== //
+	{
+		// two neighbouring axial slices through the difference kernel (slice_difference.h), as when
+		// the difference view follows a slider step
+		int scalar_size = dset.image->GetScalarSize();
+		size_t count = (size_t)dims[0] * dims[1];
+		int k1 = dims[2] / 2, k2 = std::min(k1 + 1, dims[2] - 1);
+		const char* slice1 = static_cast<const char*>(dset.image->GetScalarPointer(0, 0, k1));
+		const char* slice2 = static_cast<const char*>(dset.image->GetScalarPointer(0, 0, k2));
+		std::vector<char> values1(slice1, slice1 + count * scalar_size), values2(slice2, slice2 + count * scalar_size);
+		std::vector<unsigned char> rgba(4 * count);
+
+		double* range = dset.scalar_range();
+		double difference_range = std::max(1.0, (range[1] - range[0]) / 4);
+		lut_snapshot luts[3];
+		luts[DIFFERENCE_SIGNED] = lut_snapshot(maps.differenceLut);
+		luts[DIFFERENCE_ABSOLUTE] = lut_snapshot(maps.absDifferenceLut);
+
+		QJsonObject difference_results;
+		const char* mode_names[3] = { "", "signed", "absolute" };
+		const char* kernel_names[2] = { "scalar", "simd" };
+		for (int mode = DIFFERENCE_SIGNED; mode <= DIFFERENCE_ABSOLUTE; mode++) {
+			QJsonObject mode_results;
+			for (int simd = 0; simd < 2; simd++) {
+				sample_set step_ms;
+				for (int k = 0; k < 50 * options.repeat; k++) {
+					bool is_signed = mode == DIFFERENCE_SIGNED;
+					bench_timer timer;
+					slice_difference::apply(values1.data(), dset.image->GetScalarType(), values2.data(), dset.image->GetScalarType(),
+						(int)count, (difference_mode)mode, luts[mode], is_signed ? 2 * difference_range : difference_range,
+						is_signed ? 0.0 : difference_range / 2, rgba.data(), simd == 1);
+					step_ms.add(timer.elapsed_ms());
+				}
+				mode_results[kernel_names[simd]] = step_ms.to_json();
+			}
+			difference_results[mode_names[mode]] = mode_results;
+		}
+		difference_results["avx2"] = slice_extract::has_avx2();
+		difference_results["slice_pixels"] = (double)count;
+		results["difference_ms"] = difference_results;
+	}
+
+	// S================== SLAB PROJECTION =================== //
+	{
+		// a thick axial slab (slab_projector.h) stepped through the volume like a slider drag, and
+		// the same slabs projected from scratch every step
+		size_t count = (size_t)dims[0] * dims[1];
+		int scalar_size = dset.image->GetScalarSize();
+		std::vector<std::shared_ptr<const raw_slice>> axial;
+		for (int k = 0; k < dims[2]; k++) {
+			std::shared_ptr<raw_slice> slice = std::make_shared<raw_slice>();
+			const char* voxels = static_cast<const char*>(dset.image->GetScalarPointer(0, 0, k));
+			slice->values.assign(voxels, voxels + count * scalar_size);
+			slice->scalar_type = dset.image->GetScalarType();
+			slice->width = dims[0];
+			slice->height = dims[1];
+			std::fill(slice->extent, slice->extent + 6, 0);
+			std::fill(slice->origin, slice->origin + 3, 0.0);
+			std::fill(slice->spacing, slice->spacing + 3, 1.0);
+			axial.push_back(slice);
+		}
+		slab_projector::slice_source source = [&](int k) { return axial[k]; };
+
+		int thickness = std::min(50, dims[2]);
+		QJsonObject slab_results;
+		const char* mode_names[3] = { "mip", "minip", "average" };
+		for (int mode = 0; mode < 3; mode++) {
+			sample_set slide_ms, full_ms;
+			for (int r = 0; r < options.repeat; r++) {
+				slab_projector slab;
+				for (int k = 0; k + thickness <= dims[2]; k++) {
+					bench_timer timer;
+					slab.project(k, k + thickness - 1, (slab_mode)mode, source);
+					slide_ms.add(timer.elapsed_ms());
+
+					slab_projector fresh;
+					bench_timer full_timer;
+					fresh.project(k, k + thickness - 1, (slab_mode)mode, source);
+					full_ms.add(full_timer.elapsed_ms());
+				}
+			}
+			QJsonObject mode_results;
+			mode_results["sliding"] = slide_ms.to_json();
+			mode_results["from_scratch"] = full_ms.to_json();
+			slab_results[mode_names[mode]] = mode_results;
+		}
+		slab_results["slab_slices"] = thickness;
+		results["slab_ms"] = slab_results;
+	}
+
+	// S================== VOLUME RENDER =================== //
+	{
+		vtkSmartPointer<vtkSmartVolumeMapper> mapper = vtkSmartPointer<vtkSmartVolumeMapper>::New();
+		mapper->SetBlendModeToComposite();
+		mapper->SetRequestedRenderModeToRayCast(); // offscreen box, maybe no GPU
+		mapper->SetInputData(dset.image);
+
+		vtkSmartPointer<vtkVolumeProperty> property = vtkSmartPointer<vtkVolumeProperty>::New();
+		property->ShadeOff();
+		property->SetInterpolationType(VTK_LINEAR_INTERPOLATION);
+		property->SetScalarOpacity(colormaps::make_volume_opacity());
+		property->SetColor(maps.grayscale_ctf);
+
+		vtkSmartPointer<vtkVolume> volume = vtkSmartPointer<vtkVolume>::New();
+		volume->SetMapper(mapper);
+		volume->SetProperty(property);
+
+		vtkSmartPointer<vtkRenderer> renderer = vtkSmartPointer<vtkRenderer>::New();
+		renderer->AddViewProp(volume);
+		renderer->ResetCamera();
+
+		vtkSmartPointer<vtkRenderWindow> window = vtkSmartPointer<vtkRenderWindow>::New();
+		window->SetOffScreenRendering(1);
+		window->SetSize(512, 512);
+		window->AddRenderer(renderer);
+		window->Render(); // warm up (first render builds the mapper's internal structures)
+
+		vtkSmartPointer<vtkCamera> start_camera = vtkSmartPointer<vtkCamera>::New();
+		start_camera->DeepCopy(renderer->GetActiveCamera());
+
+		sample_set frame_ms;
+		for (int k = 0; k < 10 * options.repeat; k++) {
+			renderer->GetActiveCamera()->Azimuth(10);
+			bench_timer timer;
+			window->Render();
+			frame_ms.add(timer.elapsed_ms());
+		}
+		results["volume_render_ms"] = frame_ms.to_json();
+
+		// the CPU ray caster (cpu_raycaster.h) on the same volume, property, camera path and image size
+		renderer->GetActiveCamera()->DeepCopy(start_camera);
+		cpu_raycaster raycaster;
+		bench_timer build_timer;
+		raycaster.set_volume(dset.image);
+		raycaster.set_transfer_functions(property);
+		double build_ms = build_timer.elapsed_ms();
+
+		std::vector<unsigned char> rgba(4 * 512 * 512);
+		sample_set raycast_ms;
+		long long samples = 0, rays = 0, skipped = 0, terminated = 0;
+		for (int k = 0; k < 10 * options.repeat; k++) {
+			renderer->GetActiveCamera()->Azimuth(10);
+			bench_timer timer;
+			raycaster.render(raycast_camera(renderer->GetActiveCamera()), 512, 512, rgba.data());
+			raycast_ms.add(timer.elapsed_ms());
+			samples += raycaster.stats.samples;
+			rays += raycaster.stats.rays;
+			skipped += raycaster.stats.cells_skipped;
+			terminated += raycaster.stats.rays_terminated;
+		}
+
+		// skipping empty macro cells must not change the image: compare with every sample taken
+		int mismatched_frames = 0;
+		std::vector<unsigned char> reference(rgba.size());
+		renderer->GetActiveCamera()->DeepCopy(start_camera);
+		for (int k = 0; k < 4; k++) {
+			renderer->GetActiveCamera()->Azimuth(90);
+			raycast_camera camera(renderer->GetActiveCamera());
+			raycaster.skip_empty = true;
+			raycaster.render(camera, 512, 512, rgba.data());
+			raycaster.skip_empty = false;
+			raycaster.render(camera, 512, 512, reference.data());
+			if (rgba != reference)
+				mismatched_frames++;
+		}
+		raycaster.skip_empty = true;
+		if (mismatched_frames > 0) {
+			cout << "the CPU ray caster gives a different image with empty space skipping (" << mismatched_frames << " of 4 views)\n";
+			return 1;
+		}
+
+		QJsonObject raycast_results = raycast_ms.to_json();
+		raycast_results["build_cells_ms"] = build_ms;
+		raycast_results["visible_cells"] = raycaster.stats.visible_cells;
+		raycast_results["samples_per_ray"] = rays > 0 ? (double)samples / rays : 0.0;
+		raycast_results["cells_skipped_per_ray"] = rays > 0 ? (double)skipped / rays : 0.0;
+		raycast_results["rays_terminated"] = rays > 0 ? (double)terminated / rays : 0.0;
+		results["cpu_raycast_ms"] = raycast_results;
+	}
+
+	// S================== SERIES SCAN =================== //
+	if (options.scan_files > 0) {
+		// 16x16 slices, 8 series of equal size: half written into the root directory with different
+		// file name prefixes (mixed), half into one subdirectory each
+		const int num_series = 8;
+		QTemporaryDir scan_dir;
+		bool written = scan_dir.isValid();
+		for (int i = 0; i < num_series && written; i++) {
+			synthetic_series small;
+			small.rows = small.columns = 16;
+			small.slices = std::max(1, options.scan_files / num_series);
+			small.series_number = i + 1;
+			small.series_uid = options.series.series_uid + "." + std::to_string(i + 1);
+
+			std::string dir = scan_dir.path().toStdString();
+			if (i % 2 == 1) {
+				dir += "/series_" + std::to_string(i);
+				written = QDir().mkpath(QString::fromStdString(dir));
+			}
+			written = written && small.write(dir, "s" + std::to_string(i) + "_");
+		}
+		if (!written) {
+			cout << "could not write the series discovery tree\n";
+			return 1;
+		}
+
+		sample_set scan_ms;
+		series_scanner scanner;
+		for (int r = 0; r < options.repeat; r++) {
+			bench_timer timer;
+			if (!scanner.scan(QDir(scan_dir.path()))) {
+				cout << "could not scan the series discovery tree: " << scanner.error << "\n";
+				return 1;
+			}
+			scan_ms.add(timer.elapsed_ms());
+		}
+
+		QJsonObject scan_results;
+		scan_results["scan_ms"] = scan_ms.to_json();
+		scan_results["files"] = scanner.files_found;
+		scan_results["files_per_s"] = scanner.files_found / (scan_ms.percentile(0.5) / 1000.0);
+		scan_results["series_found"] = (int)scanner.series.size();
+		results["series_scan"] = scan_results;
+	}
+
+	// S================== REPORT =================== //
+	const synthetic_series& s = options.series;
+	QJsonObject config;
+	config["rows"] = s.rows;
+	config["columns"] = s.columns;
+	config["slices"] = s.slices;
+	config["bits"] = s.bits;
+	config["transfer_syntax"] = QString::fromStdString(s.transfer_syntax);
+	config["repeat"] = options.repeat;
+	config["scan_files"] = options.scan_files;
+	config["reslice"] = options.direct_copy ? "fast" : "vtk";
+	config["hardware_threads"] = (int)std::thread::hardware_concurrency();
+
+	QJsonObject report;
+	report["benchmark"] = "bench_suite";
+	report["timestamp"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+	report["config"] = config;
+	report["results"] = results;
+	report["peak_rss_mb"] = peak_rss_mb();
+
+	QByteArray json = QJsonDocument(report).toJson();
+
+	if (options.out_path.isEmpty()) {
+		cout << json.constData();
+	}
+	else {
+		QFile out(options.out_path);
+		if (!out.open(QIODevice::WriteOnly) || out.write(json) != json.size()) {
+			cout << "could not write " << options.out_path.toStdString() << "\n";
+			return 1;
+		}
+	}
+
+	return 0;
+}
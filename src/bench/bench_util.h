@@ -0,0 +1,95 @@
+/*
+Small helpers shared by the benchmark programs: a wall-clock timer, a peak resident set
+size (peak RSS) query and summary statistics over repeated measurements.
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// Qt header files
+#include <QJsonObject>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // keep windows.h from defining min/max macros
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+// Wall-clock stopwatch (starts when created)
+class bench_timer {
+public:
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	void restart() {
+		start = std::chrono::steady_clock::now();
+	}
+
+	double elapsed_ms() const {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+};
+
+// Peak resident set size of this process so far, in MB.
+inline double peak_rss_mb() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024.0; // ru_maxrss is in KB on Linux
+#endif
+}
+
+// Repeated measurements of one quantity (e.g. milliseconds per slice).
+class sample_set {
+public:
+	std::vector<double> samples;
+
+	void add(double value) {
+		samples.push_back(value);
+	}
+
+	// Value below which the given fraction (0..1) of the samples lie.
+	double percentile(double fraction) const {
+
+		if (samples.empty())
+			return 0.0;
+		std::vector<double> sorted = samples;
+		std::sort(sorted.begin(), sorted.end());
+		size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+		return sorted[std::min(index, sorted.size() - 1)];
+	}
+
+	double mean() const {
+
+		double sum = 0.0;
+		for (size_t i = 0; i < samples.size(); i++)
+			sum += samples[i];
+		return samples.empty() ? 0.0 : sum / samples.size();
+	}
+
+	// {"count", "min", "mean", "p50", "p95", "p99", "max"} for the JSON report
+	QJsonObject to_json() const {
+
+		QJsonObject json;
+		json["count"] = (int)samples.size();
+		json["min"] = percentile(0.0);
+		json["mean"] = mean();
+		json["p50"] = percentile(0.5);
+		json["p95"] = percentile(0.95);
+		json["p99"] = percentile(0.99);
+		json["max"] = percentile(1.0);
+		return json;
+	}
+};
@@ -0,0 +1,476 @@
+/*
+This header contains a writer for synthetic DICOM series, used by the benchmarks so they do
+not depend on real patient data. A series is a stack of single-frame files holding a simple
+phantom (nested ellipsoids plus a little noise), with configurable matrix size, slice count,
+bit depth and transfer syntax (native, or compressed with the encoders below: RLE, lossless
+JPEG, and baseline JPEG through OpenCV for 8-bit series).
+
+	synthetic_series series;
+	series.rows = series.columns = 512;
+	series.slices = 300;
+	series.write("/tmp/phantom");
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// OpenCV header files
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// Our header files
+#include "dicom_parser.h"
+#include "pixel_codecs.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+// Serializes DICOM elements in a given encoding.
+class dicom_writer {
+
+public:
+	std::vector<unsigned char> bytes;
+	bool explicit_vr = true;
+	bool big_endian = false;
+
+	void u16(uint16_t value) {
+		if (big_endian) {
+			bytes.push_back(value >> 8);
+			bytes.push_back(value & 0xFF);
+		}
+		else {
+			bytes.push_back(value & 0xFF);
+			bytes.push_back(value >> 8);
+		}
+	}
+
+	void u32(uint32_t value) {
+		if (big_endian) {
+			u16(value >> 16);
+			u16(value & 0xFFFF);
+		}
+		else {
+			u16(value & 0xFFFF);
+			u16(value >> 16);
+		}
+	}
+
+	// Element header; item/delimiter tags (group FFFE) never carry a VR.
+	void header(uint16_t group, uint16_t element, const char* vr, uint32_t length) {
+
+		u16(group);
+		u16(element);
+
+		if (!explicit_vr || group == 0xFFFE) {
+			u32(length);
+			return;
+		}
+
+		bytes.push_back(vr[0]);
+		bytes.push_back(vr[1]);
+		std::string v(vr, 2);
+		if (v == "OB" || v == "OW" || v == "SQ" || v == "UN" || v == "UT") {
+			u16(0);
+			u32(length);
+		}
+		else {
+			u16((uint16_t)length);
+		}
+	}
+
+	// Text element, padded to an even length (UIDs with NUL, everything else with a space).
+	void text(uint16_t group, uint16_t element, const char* vr, std::string value) {
+
+		if (value.size() % 2)
+			value += (vr[0] == 'U' && vr[1] == 'I') ? '\0' : ' ';
+		header(group, element, vr, (uint32_t)value.size());
+		bytes.insert(bytes.end(), value.begin(), value.end());
+	}
+
+	void us(uint16_t group, uint16_t element, uint16_t value) {
+		header(group, element, "US", 2);
+		u16(value);
+	}
+
+	// Raw (native) pixel data; the samples must already be in the writer's byte order.
+	void pixel_data(const std::vector<unsigned char>& samples, bool ob) {
+		header(0x7FE0, 0x0010, ob ? "OB" : "OW", (uint32_t)samples.size());
+		bytes.insert(bytes.end(), samples.begin(), samples.end());
+	}
+
+	// Encapsulated pixel data: an empty basic offset table and one fragment holding the frame.
+	void encapsulated_pixel_data(const std::vector<unsigned char>& frame) {
+		header(0x7FE0, 0x0010, "OB", 0xFFFFFFFF);
+		header(0xFFFE, 0xE000, "", 0);
+		header(0xFFFE, 0xE000, "", (uint32_t)(frame.size() + frame.size() % 2));
+		bytes.insert(bytes.end(), frame.begin(), frame.end());
+		if (frame.size() % 2)
+			bytes.push_back(0);
+		header(0xFFFE, 0xE0DD, "", 0);
+	}
+};
+
+
+// Compressors for the transfer syntaxes of pixel_codecs.h (input: little endian samples, first row first).
+class pixel_encoders {
+
+public:
+	// RLE Lossless: one PackBits segment per sample byte, most significant first.
+	static std::vector<unsigned char> rle(const std::vector<unsigned char>& samples, int bytes) {
+
+		size_t count = samples.size() / bytes;
+		std::vector<unsigned char> out(64, 0);
+		put32(out, 0, bytes);
+
+		std::vector<unsigned char> plane(count);
+		for (int s = 0; s < bytes; s++) {
+			put32(out, 4 + 4 * s, (uint32_t)out.size());
+			for (size_t i = 0; i < count; i++)
+				plane[i] = samples[i * bytes + bytes - 1 - s];
+			pack_bits(plane, out);
+			if (out.size() % 2)
+				out.push_back(0); // segments start on even offsets
+		}
+		return out;
+	}
+
+	/*
+	Lossless JPEG (process 14) with a fixed Huffman table that suits smooth images (categories 0-1:
+	3 bits, 2-9: 4 bits, 10-16: 5 bits). The defaults give SV1 (predictor 1, no point transform).
+
+	Args:
+		predictor: selection value 1-7
+		restart_interval: samples between restart markers (0: none)
+		point_transform: low bits dropped from every sample (those come back as zeros)
+	*/
+	static std::vector<unsigned char> jpeg_lossless(const std::vector<unsigned char>& samples, int rows, int columns, int bits,
+		int predictor = 1, int restart_interval = 0, int point_transform = 0) {
+
+		static const unsigned char counts[16] = { 0, 0, 2, 8, 7 };
+		unsigned int codes[17];
+		int lengths[17];
+		int code = 0, k = 0;
+		for (int length = 1; length <= 16; length++, code <<= 1) {
+			for (int i = 0; i < counts[length - 1]; i++, k++, code++) {
+				codes[k] = code;
+				lengths[k] = length;
+			}
+		}
+
+		std::vector<unsigned char> out = { 0xFF, 0xD8 };
+		marker(out, 0xC3, { (unsigned char)bits, (unsigned char)(rows >> 8), (unsigned char)rows,
+			(unsigned char)(columns >> 8), (unsigned char)columns, 1, 1, 0x11, 0 });
+		std::vector<unsigned char> table = { 0x00 };
+		table.insert(table.end(), counts, counts + 16);
+		for (int i = 0; i <= 16; i++)
+			table.push_back((unsigned char)i);
+		marker(out, 0xC4, table);
+		if (restart_interval > 0)
+			marker(out, 0xDD, { (unsigned char)(restart_interval >> 8), (unsigned char)restart_interval });
+		marker(out, 0xDA, { 1, 1, 0x00, (unsigned char)predictor, 0, (unsigned char)point_transform });
+
+		bit_writer writer(out);
+		int bytes = bits > 8 ? 2 : 1;
+		int initial = 1 << (bits - point_transform - 1);
+		bool restarted = true; // the next sample starts the scan or a restart interval
+		int first_row = 0;     // rows of the current restart interval start here
+		int samples_left = restart_interval, restarts = 0;
+
+		std::vector<int> row(columns), above(columns);
+		for (int y = 0; y < rows; y++) {
+			for (int x = 0; x < columns; x++) {
+				if (restart_interval > 0 && samples_left == 0) {
+					writer.flush();
+					out.push_back(0xFF);
+					out.push_back((unsigned char)(0xD0 + (restarts++ & 7)));
+					samples_left = restart_interval;
+					restarted = true;
+					first_row = y;
+				}
+				samples_left--;
+
+				const unsigned char* sample = &samples[((size_t)y * columns + x) * bytes];
+				row[x] = (bytes == 2 ? sample[0] | sample[1] << 8 : sample[0]) >> point_transform;
+
+				// first sample of an interval, first row of an interval, first column, the rest
+				int prediction;
+				if (restarted)
+					prediction = initial;
+				else if (y == first_row)
+					prediction = row[x - 1];
+				else if (x == 0)
+					prediction = above[0];
+				else
+					prediction = predict(predictor, row[x - 1], above[x], above[x - 1]);
+				restarted = false;
+
+				int difference = (row[x] - prediction) & 0xFFFF;
+				if (difference >= 32768)
+					difference -= 65536;
+
+				int magnitude = difference < 0 ? -difference : difference;
+				int category = 0;
+				while (magnitude >> category)
+					category++;
+
+				writer.put(codes[category], lengths[category]);
+				if (category > 0 && category < 16)
+					writer.put(difference < 0 ? difference + (1 << category) - 1 : difference, category);
+			}
+			row.swap(above);
+		}
+		writer.flush();
+
+		out.push_back(0xFF);
+		out.push_back(0xD9);
+		return out;
+	}
+
+	// Baseline JPEG (lossy) of an 8-bit image.
+	static std::vector<unsigned char> jpeg_baseline(const std::vector<unsigned char>& samples, int rows, int columns,
+		int quality = 90) {
+
+		cv::Mat image(rows, columns, CV_8UC1, const_cast<unsigned char*>(samples.data()));
+		std::vector<unsigned char> out;
+		cv::imencode(".jpg", image, out, { cv::IMWRITE_JPEG_QUALITY, quality });
+		return out;
+	}
+
+private:
+	// prediction from the left (a), above (b) and above-left (c) neighbours, ITU T.81 table H.1
+	static int predict(int predictor, int a, int b, int c) {
+
+		switch (predictor) {
+		case 2: return b;
+		case 3: return c;
+		case 4: return a + b - c;
+		case 5: return a + ((b - c) >> 1);
+		case 6: return b + ((a - c) >> 1);
+		case 7: return (a + b) >> 1;
+		default: return a;
+		}
+	}
+
+	static void put32(std::vector<unsigned char>& out, size_t pos, uint32_t value) {
+		for (int i = 0; i < 4; i++)
+			out[pos + i] = (unsigned char)(value >> (8 * i));
+	}
+
+	// PackBits: runs of 3+ equal bytes as repeats, everything else as literals (at most 128 per packet).
+	static void pack_bits(const std::vector<unsigned char>& in, std::vector<unsigned char>& out) {
+
+		size_t i = 0;
+		while (i < in.size()) {
+			size_t run = 1;
+			while (i + run < in.size() && run < 128 && in[i + run] == in[i])
+				run++;
+			if (run >= 3) {
+				out.push_back((unsigned char)(1 - (int)run));
+				out.push_back(in[i]);
+				i += run;
+				continue;
+			}
+
+			size_t literal = 0;
+			while (i + literal < in.size() && literal < 128) {
+				if (i + literal + 2 < in.size() && in[i + literal] == in[i + literal + 1] && in[i + literal] == in[i + literal + 2])
+					break;
+				literal++;
+			}
+			out.push_back((unsigned char)(literal - 1));
+			out.insert(out.end(), in.begin() + i, in.begin() + i + literal);
+			i += literal;
+		}
+	}
+
+	static void marker(std::vector<unsigned char>& out, int code, const std::vector<unsigned char>& segment) {
+		out.push_back(0xFF);
+		out.push_back((unsigned char)code);
+		out.push_back((unsigned char)((segment.size() + 2) >> 8));
+		out.push_back((unsigned char)(segment.size() + 2));
+		out.insert(out.end(), segment.begin(), segment.end());
+	}
+
+	// Entropy coded bits, most significant first, with a zero stuffed after every 0xFF.
+	struct bit_writer {
+		std::vector<unsigned char>& out;
+		uint32_t bits = 0;
+		int count = 0;
+
+		bit_writer(std::vector<unsigned char>& out) : out(out) {}
+
+		void put(unsigned int value, int length) {
+			for (int i = length - 1; i >= 0; i--) {
+				bits = bits << 1 | ((value >> i) & 1);
+				if (++count == 8)
+					emit();
+			}
+		}
+
+		void emit() {
+			out.push_back((unsigned char)bits);
+			if ((bits & 0xFF) == 0xFF)
+				out.push_back(0);
+			bits = 0;
+			count = 0;
+		}
+
+		// pad the last byte with ones
+		void flush() {
+			while (count != 0)
+				put(1, 1);
+		}
+	};
+};
+
+
+// Parameters and writer for one synthetic series.
+class synthetic_series {
+
+public:
+	int rows = 256;
+	int columns = 256;
+	int slices = 100;
+	int bits = 16; // 8 or 16
+	std::string transfer_syntax = TS_EXPLICIT_LITTLE;
+	double pixel_spacing = 0.8;
+
+	// lossless JPEG coding (predictor 1 without restarts or point transform is SV1; other predictors
+	// need TS_JPEG_LOSSLESS)
+	int jpeg_predictor = 1;
+	int jpeg_restart_interval = 0;
+	int jpeg_point_transform = 0;
+	double slice_spacing = 1.5;
+
+	std::string patient_name = "Phantom^Synthetic";
+	std::string series_uid = "1.2.826.0.1.3680043.9.7433.1.1";
+	int series_number = 1;
+
+	// Phantom value at a voxel: body ellipsoid, an inner brighter ellipsoid, a bit of noise.
+	int value(int x, int y, int z) const {
+
+		double u = (x - columns / 2.0) / (columns * 0.45);
+		double v = (y - rows / 2.0) / (rows * 0.35);
+		double w = (z - slices / 2.0) / (slices * 0.48);
+		double r2 = u * u + v * v + w * w;
+
+		int noise = (int)((x * 73856093u ^ y * 19349663u ^ z * 83492791u) % 16);
+		int max_value = bits == 8 ? 255 : 1000;
+
+		if (r2 > 1.0)
+			return 0;
+		if (r2 > 0.3)
+			return std::min(max_value, max_value / 10 + noise);
+		return std::min(max_value, max_value / 2 + (int)((0.3 - r2) * max_value) + noise);
+	}
+
+	// Write the series as <dir>/<prefix>NNNNN.dcm. Returns false if a file could not be written.
+	bool write(const std::string& dir, const std::string& prefix = "slice_") const {
+
+		for (int z = 0; z < slices; z++) {
+			std::vector<unsigned char> file = encode_slice(z);
+
+			char name[32];
+			snprintf(name, sizeof(name), "%05d.dcm", z);
+
+			FILE* f = fopen((dir + "/" + prefix + name).c_str(), "wb");
+			if (f == NULL)
+				return false;
+			bool ok = fwrite(file.data(), 1, file.size(), f) == file.size();
+			fclose(f);
+			if (!ok)
+				return false;
+		}
+		return true;
+	}
+
+	// Bytes of uncompressed pixel data per series (for throughput figures).
+	double pixel_bytes() const {
+		return (double)rows * columns * slices * (bits / 8);
+	}
+
+	// The whole Part 10 file for one slice.
+	std::vector<unsigned char> encode_slice(int z) const {
+
+		dicom_writer out;
+
+		// preamble + file meta information (always explicit VR little endian)
+		out.bytes.assign(128, 0);
+		out.bytes.push_back('D');
+		out.bytes.push_back('I');
+		out.bytes.push_back('C');
+		out.bytes.push_back('M');
+		out.text(0x0002, 0x0010, "UI", transfer_syntax);
+
+		// data set in the requested encoding
+		out.explicit_vr = transfer_syntax != TS_IMPLICIT_LITTLE;
+		out.big_endian = transfer_syntax == TS_EXPLICIT_BIG;
+
+		char number[64];
+		out.text(0x0008, 0x0060, "CS", "CT");
+		out.text(0x0010, 0x0010, "PN", patient_name);
+		out.text(0x0020, 0x000E, "UI", series_uid);
+		snprintf(number, sizeof(number), "%d", series_number);
+		out.text(0x0020, 0x0011, "IS", number);
+		snprintf(number, sizeof(number), "%d", z + 1);
+		out.text(0x0020, 0x0013, "IS", number);
+		snprintf(number, sizeof(number), "0\\0\\%g", z * slice_spacing);
+		out.text(0x0020, 0x0032, "DS", number);
+		out.text(0x0020, 0x0037, "DS", "1\\0\\0\\0\\1\\0");
+		out.us(0x0028, 0x0002, 1);
+		out.us(0x0028, 0x0010, (uint16_t)rows);
+		out.us(0x0028, 0x0011, (uint16_t)columns);
+		snprintf(number, sizeof(number), "%g\\%g", pixel_spacing, pixel_spacing);
+		out.text(0x0028, 0x0030, "DS", number);
+		out.us(0x0028, 0x0100, (uint16_t)bits);
+		out.us(0x0028, 0x0101, (uint16_t)bits);
+		out.us(0x0028, 0x0103, 0);
+
+		if (pixel_codecs::is_supported(transfer_syntax))
+			out.encapsulated_pixel_data(encode_frame(native_samples(z, false)));
+		else
+			out.pixel_data(native_samples(z, out.big_endian), bits == 8);
+		return out.bytes;
+	}
+
+	// Compress one slice (little endian samples) in the series' compressed transfer syntax.
+	std::vector<unsigned char> encode_frame(const std::vector<unsigned char>& samples) const {
+
+		if (transfer_syntax == TS_RLE_LOSSLESS)
+			return pixel_encoders::rle(samples, bits / 8);
+		if (transfer_syntax == TS_JPEG_BASELINE)
+			return pixel_encoders::jpeg_baseline(samples, rows, columns);
+		return pixel_encoders::jpeg_lossless(samples, rows, columns, bits, jpeg_predictor, jpeg_restart_interval,
+			jpeg_point_transform);
+	}
+
+	// The phantom slice as raw samples (first row first) in the given byte order.
+	std::vector<unsigned char> native_samples(int z, bool big_endian) const {
+
+		std::vector<unsigned char> samples;
+		samples.reserve((size_t)rows * columns * (bits / 8));
+
+		for (int y = 0; y < rows; y++) {
+			for (int x = 0; x < columns; x++) {
+				int v = value(x, y, z);
+				if (bits == 8) {
+					samples.push_back((unsigned char)v);
+				}
+				else if (big_endian) {
+					samples.push_back((unsigned char)(v >> 8));
+					samples.push_back((unsigned char)(v & 0xFF));
+				}
+				else {
+					samples.push_back((unsigned char)(v & 0xFF));
+					samples.push_back((unsigned char)(v >> 8));
+				}
+			}
+		}
+		return samples;
+	}
+};
@@ -0,0 +1,190 @@
+/*
+This header contains the colormaps class: the lookup tables used for the 2D slice views and
+the color/opacity transfer functions used for the 3D volume views. It is shared by the
+interactive viewer (ui.h) and the headless batch renderer (batch.h).
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkColorTransferFunction.h>
+#include <vtkLookupTable.h>
+#include <vtkNew.h>
+#include <vtkPiecewiseFunction.h>
+#include <vtkSmartPointer.h>
+
+#include <algorithm>
+
+
+class colormaps {
+
+public:
+	// LUTs for slice color maps
+	vtkNew<vtkLookupTable> highContrastLut;
+	vtkNew<vtkLookupTable> rainbowRedBlueLut;
+	vtkNew<vtkLookupTable> rainbowBlueRedLut;
+	vtkSmartPointer<vtkLookupTable> classExampleLut = vtkSmartPointer<vtkLookupTable>::New();
+	vtkNew<vtkLookupTable> vtkExampleLut;
+	vtkNew<vtkLookupTable> grayScaleLut;
+	vtkNew<vtkLookupTable> customLut;
+
+	// LUTs of the difference view: blue - white - red for overlay - dataset 1, black - red - yellow -
+	// white for the absolute difference
+	vtkNew<vtkLookupTable> differenceLut;
+	vtkNew<vtkLookupTable> absDifferenceLut;
+
+	// ctfs for volume color maps
+	vtkSmartPointer<vtkColorTransferFunction> magma_ctf = vtkSmartPointer<vtkColorTransferFunction>::New();
+	vtkSmartPointer<vtkColorTransferFunction> viridis_ctf = vtkSmartPointer<vtkColorTransferFunction>::New();
+	vtkSmartPointer<vtkColorTransferFunction> class_example_ctf = vtkSmartPointer<vtkColorTransferFunction>::New();
+	vtkSmartPointer<vtkColorTransferFunction> grayscale_ctf = vtkSmartPointer<vtkColorTransferFunction>::New();
+
+	// Populate the color transfer function VTK objects required for the 3D VTKVolume color maps.
+	void populate_ctfs() {
+		// magma
+	   /* magma_ctf->AddRGBPoint(0.0, 0.0, 0.0, 0.0);
+		magma_ctf->AddRGBPoint(0.14, 0.094, 0.007, 0.286);
+		magma_ctf->AddRGBPoint(0.28, 0.309, 0.0, 0.478);
+		magma_ctf->AddRGBPoint(0.46, 0.576, 0.071, 0.502);
+		magma_ctf->AddRGBPoint(0.63, 0.843, 0.271, 0.384);
+		magma_ctf->AddRGBPoint(0.8, 0.976, 0.604, 0.388);
+		magma_ctf->AddRGBPoint(1.0, 0.973, 1.0, 0.729);*/
+		magma_ctf->AddRGBPoint(0.0, 0.0, 0.0, 0.0);
+		magma_ctf->AddRGBPoint(100, 0.094, 0.007, 0.286);
+		magma_ctf->AddRGBPoint(150, 0.309, 0.0, 0.478);
+		magma_ctf->AddRGBPoint(350, 0.576, 0.071, 0.502);
+		magma_ctf->AddRGBPoint(400, 0.843, 0.271, 0.384);
+		magma_ctf->AddRGBPoint(500, 0.976, 0.604, 0.388);
+		magma_ctf->AddRGBPoint(550, 0.973, 1.0, 0.729);
+
+		// viridis
+		viridis_ctf->AddRGBPoint(0.0, 0.0, 0.0, 0.0);
+		viridis_ctf->AddRGBPoint(100, 0.28, 0.035, 0.396);
+		viridis_ctf->AddRGBPoint(200, 0.223, 0.325, 0.556);
+		viridis_ctf->AddRGBPoint(350, 0.058, 0.635, 0.529);
+		viridis_ctf->AddRGBPoint(500, 1.0, 0.913, 0.0);
+
+		// class_example_ctf
+		class_example_ctf->AddRGBPoint(0.0, 0.0, 0.0, 1.0);
+		class_example_ctf->AddRGBPoint(300.0, 1.0, 0.0, 0.0);
+		class_example_ctf->AddRGBPoint(555.0, 1.0, 1.0, 1.0);
+
+		// grayscale_ctf
+		grayscale_ctf->AddRGBPoint(0.0, 0.0, 0.0, 0.0);
+		grayscale_ctf->AddRGBPoint(100, 0.094, 0.094, 0.094);
+		grayscale_ctf->AddRGBPoint(150, 0.309, 0.309, 0.309);
+		grayscale_ctf->AddRGBPoint(350, 0.576, 0.576, 0.576);
+		grayscale_ctf->AddRGBPoint(400, 0.843, 0.843, 0.843);
+		grayscale_ctf->AddRGBPoint(500, 0.976, 0.976, 0.976);
+		grayscale_ctf->AddRGBPoint(550, 0.963, 0.963, 0.963);
+	}
+
+	// Populate the VTK lookup tables (member variables) required for the 2D ImageActor color maps.
+	void populate_luts() {
+
+		// highContrastLut
+		highContrastLut->SetNumberOfColors(256);
+		highContrastLut->Build();
+
+		for (int l = 0; l < 16; ++l)
+		{
+			highContrastLut->SetTableValue(l * 16, 1, 0, 0, 1);
+			highContrastLut->SetTableValue(l * 16 + 1, 0, 1, 0, 1);
+			highContrastLut->SetTableValue(l * 16 + 2, 0, 0, 1, 1);
+			highContrastLut->SetTableValue(l * 16 + 3, 0, 0, 0, 1);
+		}
+
+		// ranbowRedBluelut
+		rainbowRedBlueLut->SetNumberOfColors(256);
+		rainbowRedBlueLut->SetHueRange(0.0, 0.667);
+		rainbowRedBlueLut->Build();
+
+		// rainbowBlueRedlut
+		rainbowBlueRedLut->SetNumberOfColors(256);
+		rainbowBlueRedLut->SetHueRange(0.667, 0.0);
+		rainbowBlueRedLut->Build();
+
+		// classExampleLut
+		classExampleLut->SetNumberOfColors(256);
+		classExampleLut->Build();
+		for (int i = 0; i < 256; i++)
+			classExampleLut->SetTableValue(i, (double)i / 255.0, 
+				(double)i / 255.0, 
+				(double)i / 255.0, 1.0); // value, red, green, blue, opacity
+		classExampleLut->SetRange(0, 255);
+
+		// vtkExampleLut
+		vtkExampleLut->SetNumberOfTableValues(256);
+		vtkExampleLut->SetRange(0.0, 255.0);
+		vtkExampleLut->Build();
+
+		// grayScaleLut
+		grayScaleLut->SetHueRange(0, 0);
+		grayScaleLut->SetSaturationRange(0, 0);
+		grayScaleLut->SetValueRange(0.2, 1.0);
+		grayScaleLut->SetNumberOfColors(256);
+		grayScaleLut->SetHueRange(0.0, 0.667);
+		grayScaleLut->Build();
+
+		// customLut
+		double m_mask_opacity = 1;
+		customLut->SetRange(0, 4);
+		customLut->SetRampToLinear();
+		customLut->SetValueRange(0, 1);
+		customLut->SetHueRange(0, 0);
+		customLut->SetSaturationRange(0, 0);
+
+		customLut->SetNumberOfTableValues(10);
+		customLut->SetTableRange(0, 9);
+		customLut->SetTableValue(0, 0, 0, 0, 0);
+		customLut->SetTableValue(1, 1, 0, 0, m_mask_opacity);
+		customLut->SetTableValue(2, 0, 1, 0, m_mask_opacity);
+		customLut->SetTableValue(3, 1, 1, 0, m_mask_opacity);
+		customLut->SetTableValue(4, 0, 0, 1, m_mask_opacity);
+		customLut->SetTableValue(5, 1, 0, 1, m_mask_opacity);
+		customLut->SetTableValue(6, 0, 1, 1, m_mask_opacity);
+		customLut->SetTableValue(7, 1, 0.5, 0.5, m_mask_opacity);
+		customLut->SetTableValue(8, 0.5, 1, 0.5, m_mask_opacity);
+		customLut->SetTableValue(9, 0.5, 0.5, 1, m_mask_opacity);
+		customLut->Build();
+
+		// differenceLut (negative blue, zero white, positive red)
+		differenceLut->SetNumberOfTableValues(256);
+		for (int i = 0; i < 256; i++) {
+			double t = i / 255.0;
+			if (t < 0.5)
+				differenceLut->SetTableValue(i, 0.23 + 1.54 * t, 0.30 + 1.40 * t, 0.75 + 0.50 * t, 1.0);
+			else
+				differenceLut->SetTableValue(i, 1.0 - 0.58 * (t - 0.5), 1.0 - 1.96 * (t - 0.5), 1.0 - 1.70 * (t - 0.5), 1.0);
+		}
+		differenceLut->SetRange(-1, 1);
+
+		// absDifferenceLut (hot: black, red, yellow, white)
+		absDifferenceLut->SetNumberOfTableValues(256);
+		for (int i = 0; i < 256; i++) {
+			double t = i / 255.0;
+			absDifferenceLut->SetTableValue(i, std::min(1.0, 3 * t), std::min(1.0, std::max(0.0, 3 * t - 1)),
+				std::max(0.0, 3 * t - 2), 1.0);
+		}
+		absDifferenceLut->SetRange(0, 1);
+
+	};
+
+
+	// Constructor: build all the tables
+	colormaps() {
+		populate_ctfs();
+		populate_luts();
+	}
+
+	// The default scalar opacity transfer function for the volume views.
+	static vtkSmartPointer<vtkPiecewiseFunction> make_volume_opacity() {
+
+		vtkSmartPointer<vtkPiecewiseFunction> opacity = vtkSmartPointer<vtkPiecewiseFunction>::New();
+		opacity->AddPoint(0.0, 0.0);
+		opacity->AddPoint(90.0, 0.05);
+		opacity->AddPoint(555.0, 0.1);
+		return opacity;
+	}
+};
@@ -0,0 +1,541 @@
+/*
+This header contains cpu_raycaster, a volume renderer that runs entirely on the CPU, for
+machines without a usable GPU (vtkSmartVolumeMapper then falls back to slow paths). It does
+composite ray casting (no shading, trilinear sampling, like the volume viewport's mapper) of
+one vtkImageData with the colour and opacity functions of a vtkVolumeProperty:
+
+	- the image is split into tiles that are ray cast on all cores (thread_pool.h)
+	- the volume is covered by a grid of macro cells (CELL^3 voxels) that store the min/max voxel
+	  value; rays jump over cells in which the opacity function is zero everywhere
+	- rays stop once they are (almost) opaque
+
+The min/max grid depends only on the volume and is built once by set_volume(). When the
+opacity function changes, only the cells whose value range overlaps the changed part of the
+function are re-evaluated.
+
+	cpu_raycaster raycaster;
+	raycaster.set_volume(dset.image);
+	raycaster.set_transfer_functions(volume_property);   // cheap if nothing changed
+	raycaster.render(raycast_camera(renderer->GetActiveCamera()), width, height, rgba);
+
+The output is premultiplied RGBA (alpha = opacity of the ray), bottom row first like a
+vtkImageData, so it can be composited with over() and put on a background with flatten().
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkCamera.h>
+#include <vtkColorTransferFunction.h>
+#include <vtkImageData.h>
+#include <vtkMath.h>
+#include <vtkPiecewiseFunction.h>
+#include <vtkSmartPointer.h>
+#include <vtkVolumeProperty.h>
+
+// Our header files
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+
+// Where the rays start and where they go (taken from a vtkCamera).
+struct raycast_camera {
+	double position[3];
+	double focal_point[3];
+	double view_up[3];
+	double view_angle = 30.0;   // vertical, degrees
+	bool parallel = false;
+	double parallel_scale = 1.0; // half the view height for parallel projection
+
+	raycast_camera() {}
+
+	explicit raycast_camera(vtkCamera* camera) {
+		camera->GetPosition(position);
+		camera->GetFocalPoint(focal_point);
+		camera->GetViewUp(view_up);
+		view_angle = camera->GetViewAngle();
+		parallel = camera->GetParallelProjection() != 0;
+		parallel_scale = camera->GetParallelScale();
+	}
+
+	// The same view in the frame of a moved volume (m: row-major 4x4 rigid transform from world
+	// coordinates to the volume's, see rigid_transform.h).
+	raycast_camera transformed(const double m[16]) const {
+
+		raycast_camera out = *this;
+		for (int i = 0; i < 3; i++) {
+			out.position[i] = out.focal_point[i] = m[i * 4 + 3];
+			out.view_up[i] = 0.0;
+			for (int j = 0; j < 3; j++) {
+				out.position[i] += m[i * 4 + j] * position[j];
+				out.focal_point[i] += m[i * 4 + j] * focal_point[j];
+				out.view_up[i] += m[i * 4 + j] * view_up[j];
+			}
+		}
+		return out;
+	}
+};
+
+
+// What the last render() did (for the benchmark and the render statistics).
+struct raycast_stats {
+	long long rays = 0;
+	long long samples = 0;         // samples taken (interpolated + composited)
+	long long cells_skipped = 0;   // macro cells jumped over
+	long long rays_terminated = 0; // rays stopped early because they were opaque
+	double visible_cells = 0.0;    // fraction of macro cells that are not fully transparent
+};
+
+
+class cpu_raycaster {
+
+public:
+	// macro cell edge (voxels)
+	static const int CELL = 8;
+
+	// entries of the opacity/colour tables over the volume's value range
+	static const int TABLE_SIZE = 4096;
+
+	// distance between samples, in units of the smallest voxel spacing
+	double sample_factor = 1.0;
+
+	// a ray stops once its opacity reaches this
+	double termination_opacity = 0.98;
+
+	// jump over macro cells where the opacity is zero (off: every sample is taken, which gives the
+	// same image, more slowly)
+	bool skip_empty = true;
+
+	// tile edge (pixels); tiles are the unit of work of the thread pool
+	int tile_size = 32;
+
+	raycast_stats stats;
+
+	/*
+	Use a volume (single component). Builds the min/max macro cell grid on the thread pool.
+	Returns false (and renders nothing afterwards) for volumes it cannot render.
+	*/
+	bool set_volume(vtkImageData* image) {
+
+		TRACE_SCOPE("raycast_build_cells");
+
+		volume = NULL;
+		int* extent = image->GetExtent();
+		for (int i = 0; i < 3; i++) {
+			dims[i] = extent[2 * i + 1] - extent[2 * i] + 1;
+			spacing[i] = image->GetSpacing()[i];
+			origin[i] = image->GetOrigin()[i] + extent[2 * i] * spacing[i];
+			cell_dims[i] = std::max(1, (dims[i] - 1 + CELL - 1) / CELL);
+		}
+		if (image->GetNumberOfScalarComponents() != 1 || dims[0] < 2 || dims[1] < 2 || dims[2] < 2) {
+			cout << "umm the CPU ray caster needs a single component volume with at least 2 voxels per axis\n";
+			return false;
+		}
+
+		scalar_type = image->GetScalarType();
+		voxels = image->GetScalarPointer();
+
+		size_t num_cells = (size_t)cell_dims[0] * cell_dims[1] * cell_dims[2];
+		cell_min.assign(num_cells, 0.0f);
+		cell_max.assign(num_cells, 0.0f);
+
+		thread_pool::shared().parallel_for(cell_dims[2], [&](int k) {
+			switch (scalar_type) {
+				vtkTemplateMacro(build_cells(static_cast<const VTK_TT*>(voxels), k));
+			}
+		});
+
+		value_min = *std::min_element(cell_min.begin(), cell_min.end());
+		value_max = *std::max_element(cell_max.begin(), cell_max.end());
+		if (value_max <= value_min)
+			value_max = value_min + 1.0;
+
+		cell_lo.assign(num_cells, 0);
+		cell_hi.assign(num_cells, 0);
+		for (size_t c = 0; c < num_cells; c++) {
+			cell_lo[c] = table_index(cell_min[c]);
+			cell_hi[c] = table_index(cell_max[c]);
+		}
+
+		volume = image;
+		opacity_time = 0; // tables and cell visibility are rebuilt by the next set_transfer_functions()
+		color_time = 0;
+		nonzero.clear();
+		visible.assign(num_cells, 1);
+		return true;
+	}
+
+	/*
+	Take the scalar colour and opacity functions of a volume property. Nothing is done if they did
+	not change since the last call. An opacity change re-evaluates only the macro cells whose value
+	range overlaps the entries of the table that went from zero to non-zero or back.
+	*/
+	void set_transfer_functions(vtkVolumeProperty* property) {
+
+		if (volume == NULL)
+			return;
+
+		vtkPiecewiseFunction* opacity = property->GetScalarOpacity();
+		vtkColorTransferFunction* color = property->GetRGBTransferFunction();
+		double unit_distance = property->GetScalarOpacityUnitDistance();
+
+		if (color->GetMTime() != color_time) {
+			color_time = color->GetMTime();
+			color_table.resize(3 * TABLE_SIZE);
+			color->GetTable(value_min, value_max, TABLE_SIZE, color_table.data());
+		}
+
+		if (opacity->GetMTime() == opacity_time && unit_distance == opacity_unit_distance && step() == opacity_step)
+			return;
+		opacity_time = opacity->GetMTime();
+		opacity_unit_distance = unit_distance;
+		opacity_step = step();
+
+		TRACE_SCOPE("raycast_opacity");
+
+		// opacity per sample: the function gives it per unit_distance
+		std::vector<float> table(TABLE_SIZE);
+		opacity->GetTable(value_min, value_max, TABLE_SIZE, table.data());
+		opacity_table.resize(TABLE_SIZE);
+		for (int i = 0; i < TABLE_SIZE; i++) {
+			double a = std::min(std::max((double)table[i], 0.0), 1.0);
+			opacity_table[i] = (float)(1.0 - pow(1.0 - a, opacity_step / std::max(unit_distance, 1e-6)));
+		}
+
+		// which entries are non-zero, and the range of entries where that changed
+		std::vector<unsigned char> old_nonzero;
+		old_nonzero.swap(nonzero);
+		nonzero.resize(TABLE_SIZE);
+		int changed_lo = TABLE_SIZE, changed_hi = -1;
+		for (int i = 0; i < TABLE_SIZE; i++) {
+			nonzero[i] = opacity_table[i] > 0.0f;
+			if (old_nonzero.empty() || old_nonzero[i] != nonzero[i]) {
+				changed_lo = std::min(changed_lo, i);
+				changed_hi = i;
+			}
+		}
+		if (changed_hi < 0)
+			return; // same zero/non-zero pattern: no cell changes visibility
+
+		// nonzero_before[i] = number of non-zero entries below i, so a cell is visible iff its range has any
+		nonzero_before.assign(TABLE_SIZE + 1, 0);
+		for (int i = 0; i < TABLE_SIZE; i++)
+			nonzero_before[i + 1] = nonzero_before[i] + nonzero[i];
+
+		for (size_t c = 0; c < visible.size(); c++) {
+			if (cell_hi[c] >= changed_lo && cell_lo[c] <= changed_hi)
+				visible[c] = nonzero_before[cell_hi[c] + 1] - nonzero_before[cell_lo[c]] > 0;
+		}
+	}
+
+	/*
+	Ray cast the volume into a width x height premultiplied RGBA image (4 bytes per pixel, bottom
+	row first). Returns false if there is no volume or no transfer function yet.
+	*/
+	bool render(const raycast_camera& camera, int width, int height, unsigned char* rgba) {
+
+		if (volume == NULL || opacity_table.empty() || color_table.empty() || width <= 0 || height <= 0)
+			return false;
+
+		TRACE_SCOPE("raycast");
+
+		frame f;
+		make_frame(camera, width, height, f);
+
+		std::atomic<long long> samples(0), skipped(0), terminated(0);
+		int tiles_x = (width + tile_size - 1) / tile_size;
+		int tiles_y = (height + tile_size - 1) / tile_size;
+
+		thread_pool::shared().parallel_for(tiles_x * tiles_y, [&](int tile) {
+			int x0 = (tile % tiles_x) * tile_size;
+			int y0 = (tile / tiles_x) * tile_size;
+			int x1 = std::min(x0 + tile_size, width);
+			int y1 = std::min(y0 + tile_size, height);
+
+			tile_counts counts;
+			switch (scalar_type) {
+				vtkTemplateMacro(render_tile(static_cast<const VTK_TT*>(voxels), f, x0, y0, x1, y1, width, rgba, counts));
+			}
+			samples += counts.samples;
+			skipped += counts.skipped;
+			terminated += counts.terminated;
+		});
+
+		stats.rays = (long long)width * height;
+		stats.samples = samples;
+		stats.cells_skipped = skipped;
+		stats.rays_terminated = terminated;
+		stats.visible_cells = visible.empty() ? 0.0 :
+			(double)std::count(visible.begin(), visible.end(), (unsigned char)1) / visible.size();
+		return true;
+	}
+
+	// front = front over back (premultiplied RGBA, count pixels).
+	static void over(unsigned char* front, const unsigned char* back, int count) {
+
+		for (int i = 0; i < count; i++) {
+			int rest = 255 - front[4 * i + 3];
+			for (int c = 0; c < 4; c++)
+				front[4 * i + c] = (unsigned char)std::min(255, front[4 * i + c] + (back[4 * i + c] * rest + 127) / 255);
+		}
+	}
+
+	// Put premultiplied RGBA on an opaque background colour (0..1), in place.
+	static void flatten(unsigned char* rgba, int count, const double background[3]) {
+
+		for (int i = 0; i < count; i++) {
+			int rest = 255 - rgba[4 * i + 3];
+			for (int c = 0; c < 3; c++)
+				rgba[4 * i + c] = (unsigned char)std::min(255, rgba[4 * i + c] + (int)(background[c] * rest + 0.5));
+			rgba[4 * i + 3] = 255;
+		}
+	}
+
+	// Let go of the volume and free the macro cells and tables (renders nothing until set_volume()).
+	void clear() {
+
+		volume = NULL;
+		voxels = NULL;
+		std::vector<float>().swap(cell_min);
+		std::vector<float>().swap(cell_max);
+		std::vector<int>().swap(cell_lo);
+		std::vector<int>().swap(cell_hi);
+		std::vector<unsigned char>().swap(visible);
+		std::vector<float>().swap(opacity_table);
+		std::vector<float>().swap(color_table);
+		std::vector<unsigned char>().swap(nonzero);
+		std::vector<int>().swap(nonzero_before);
+		opacity_time = color_time = 0;
+	}
+
+	// Memory of the macro cell grid and the transfer function tables (the volume is not copied).
+	size_t bytes() const {
+		return (cell_min.size() + cell_max.size() + opacity_table.size() + color_table.size()) * sizeof(float) +
+			(cell_lo.size() + cell_hi.size() + nonzero_before.size()) * sizeof(int) + visible.size() + nonzero.size();
+	}
+
+private:
+	vtkSmartPointer<vtkImageData> volume;
+	const void* voxels = NULL;
+	int scalar_type = 0;
+	int dims[3] = { 0, 0, 0 };
+	double spacing[3] = { 1, 1, 1 };
+	double origin[3] = { 0, 0, 0 };
+
+	// macro cells: cell (i, j, k) covers voxels [i * CELL, (i + 1) * CELL] along x (the shared
+	// face is included, since a sample in the cell interpolates up to the next voxel)
+	int cell_dims[3] = { 0, 0, 0 };
+	std::vector<float> cell_min, cell_max;
+	std::vector<int> cell_lo, cell_hi;     // table entries of cell_min / cell_max
+	std::vector<unsigned char> visible;    // cell has a non-zero opacity somewhere in its range
+
+	// transfer function tables over [value_min, value_max]
+	double value_min = 0.0, value_max = 1.0;
+	std::vector<float> opacity_table;      // opacity per sample
+	std::vector<float> color_table;        // RGB
+	std::vector<unsigned char> nonzero;
+	std::vector<int> nonzero_before;
+	vtkMTimeType opacity_time = 0, color_time = 0;
+	double opacity_unit_distance = 0.0, opacity_step = 0.0;
+
+	// the camera turned into ray origins/directions in continuous voxel index space
+	struct frame {
+		double eye[3];         // perspective: ray origin
+		double forward[3], right[3], up[3];
+		double half_width, half_height; // perspective: tan of the half angles; parallel: half sizes (world)
+		bool parallel;
+		int width, height;
+	};
+
+	struct tile_counts {
+		long long samples = 0, skipped = 0, terminated = 0;
+	};
+
+	double step() const {
+		return sample_factor * std::min(spacing[0], std::min(spacing[1], spacing[2]));
+	}
+
+	int table_index(double value) const {
+		int i = (int)((value - value_min) * (TABLE_SIZE - 1) / (value_max - value_min));
+		return std::min(std::max(i, 0), TABLE_SIZE - 1);
+	}
+
+	// min/max of the macro cells in layer k
+	template <class T>
+	void build_cells(const T* v, int k) {
+
+		size_t row = dims[0], slice = (size_t)dims[0] * dims[1];
+		for (int j = 0; j < cell_dims[1]; j++) {
+			for (int i = 0; i < cell_dims[0]; i++) {
+				T lo = v[k * CELL * slice + j * CELL * row + i * CELL], hi = lo;
+				for (int z = k * CELL; z <= std::min((k + 1) * CELL, dims[2] - 1); z++)
+					for (int y = j * CELL; y <= std::min((j + 1) * CELL, dims[1] - 1); y++) {
+						const T* p = v + z * slice + y * row;
+						for (int x = i * CELL; x <= std::min((i + 1) * CELL, dims[0] - 1); x++) {
+							lo = std::min(lo, p[x]);
+							hi = std::max(hi, p[x]);
+						}
+					}
+				size_t c = ((size_t)k * cell_dims[1] + j) * cell_dims[0] + i;
+				cell_min[c] = (float)lo;
+				cell_max[c] = (float)hi;
+			}
+		}
+	}
+
+	static void normalize(double v[3]) {
+		double length = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		if (length > 0.0)
+			for (int i = 0; i < 3; i++)
+				v[i] /= length;
+	}
+
+	static void cross(const double a[3], const double b[3], double out[3]) {
+		out[0] = a[1] * b[2] - a[2] * b[1];
+		out[1] = a[2] * b[0] - a[0] * b[2];
+		out[2] = a[0] * b[1] - a[1] * b[0];
+	}
+
+	void make_frame(const raycast_camera& camera, int width, int height, frame& f) const {
+
+		for (int i = 0; i < 3; i++) {
+			f.eye[i] = camera.position[i];
+			f.forward[i] = camera.focal_point[i] - camera.position[i];
+		}
+		normalize(f.forward);
+		cross(f.forward, camera.view_up, f.right);
+		normalize(f.right);
+		cross(f.right, f.forward, f.up);
+
+		double aspect = (double)width / height;
+		f.parallel = camera.parallel;
+		if (f.parallel) {
+			f.half_height = camera.parallel_scale;
+			f.half_width = camera.parallel_scale * aspect;
+		}
+		else {
+			f.half_height = tan(vtkMath::RadiansFromDegrees(camera.view_angle / 2.0));
+			f.half_width = f.half_height * aspect;
+		}
+		f.width = width;
+		f.height = height;
+	}
+
+	// Composite the rays of one tile.
+	template <class T>
+	void render_tile(const T* v, const frame& f, int x0, int y0, int x1, int y1, int width, unsigned char* rgba,
+		tile_counts& counts) const {
+
+		double dt = step();
+		double box_max[3] = { dims[0] - 1.0, dims[1] - 1.0, dims[2] - 1.0 };
+		size_t row = dims[0], slice = (size_t)dims[0] * dims[1];
+		double table_scale = (TABLE_SIZE - 1) / (value_max - value_min);
+		float threshold = (float)termination_opacity;
+
+		for (int y = y0; y < y1; y++) {
+			for (int x = x0; x < x1; x++) {
+				unsigned char* out = rgba + 4 * ((size_t)y * width + x);
+				out[0] = out[1] = out[2] = out[3] = 0;
+
+				// ray in world space
+				double sx = ((x + 0.5) / f.width * 2.0 - 1.0) * f.half_width;
+				double sy = ((y + 0.5) / f.height * 2.0 - 1.0) * f.half_height;
+				double o[3], d[3];
+				for (int i = 0; i < 3; i++) {
+					if (f.parallel) {
+						o[i] = f.eye[i] + f.right[i] * sx + f.up[i] * sy;
+						d[i] = f.forward[i];
+					}
+					else {
+						o[i] = f.eye[i];
+						d[i] = f.forward[i] + f.right[i] * sx + f.up[i] * sy;
+					}
+				}
+				normalize(d);
+
+				// to continuous voxel index space (t stays a world distance), clipped to the volume
+				double t0 = 0.0, t1 = 1e300;
+				for (int i = 0; i < 3; i++) {
+					o[i] = (o[i] - origin[i]) / spacing[i];
+					d[i] = d[i] / spacing[i];
+					if (d[i] == 0.0) {
+						if (o[i] < 0.0 || o[i] > box_max[i])
+							t1 = -1.0;
+						continue;
+					}
+					double a = (0.0 - o[i]) / d[i], b = (box_max[i] - o[i]) / d[i];
+					t0 = std::max(t0, std::min(a, b));
+					t1 = std::min(t1, std::max(a, b));
+				}
+				if (t0 > t1)
+					continue;
+
+				// samples are at t0 + k * dt, also after a jump, so skipping does not move them
+				float r = 0.0f, g = 0.0f, b = 0.0f, alpha = 0.0f;
+				for (long long k = 0; t0 + k * dt <= t1;) {
+					double t = t0 + k * dt;
+					double p[3] = { o[0] + t * d[0], o[1] + t * d[1], o[2] + t * d[2] };
+					int ci[3];
+					for (int i = 0; i < 3; i++)
+						ci[i] = std::min(std::max((int)(p[i] / CELL), 0), cell_dims[i] - 1);
+
+					// empty cell: continue at the first sample past it
+					if (skip_empty && !visible[((size_t)ci[2] * cell_dims[1] + ci[1]) * cell_dims[0] + ci[0]]) {
+						double t_exit = t1;
+						for (int i = 0; i < 3; i++) {
+							if (d[i] > 0.0)
+								t_exit = std::min(t_exit, t + ((ci[i] + 1) * CELL - p[i]) / d[i]);
+							else if (d[i] < 0.0)
+								t_exit = std::min(t_exit, t + (ci[i] * CELL - p[i]) / d[i]);
+						}
+						k += (long long)std::max(1.0, ceil((t_exit - t) / dt));
+						counts.skipped++;
+						continue;
+					}
+
+					// trilinear sample
+					int base[3];
+					double w[3];
+					for (int i = 0; i < 3; i++) {
+						base[i] = std::min(std::max((int)p[i], 0), dims[i] - 2);
+						w[i] = std::min(std::max(p[i] - base[i], 0.0), 1.0);
+					}
+					const T* c = v + base[2] * slice + base[1] * row + base[0];
+					double c00 = c[0] + w[0] * (c[1] - (double)c[0]);
+					double c10 = c[row] + w[0] * (c[row + 1] - (double)c[row]);
+					double c01 = c[slice] + w[0] * (c[slice + 1] - (double)c[slice]);
+					double c11 = c[slice + row] + w[0] * (c[slice + row + 1] - (double)c[slice + row]);
+					double value = (c00 + w[1] * (c10 - c00)) + w[2] * ((c01 + w[1] * (c11 - c01)) - (c00 + w[1] * (c10 - c00)));
+
+					int index = std::min(std::max((int)((value - value_min) * table_scale), 0), TABLE_SIZE - 1);
+					float a = opacity_table[index];
+					counts.samples++;
+
+					if (a > 0.0f) {
+						float weight = (1.0f - alpha) * a;
+						r += weight * color_table[3 * index];
+						g += weight * color_table[3 * index + 1];
+						b += weight * color_table[3 * index + 2];
+						alpha += weight;
+						if (alpha >= threshold) {
+							counts.terminated++;
+							break;
+						}
+					}
+					k++;
+				}
+
+				out[0] = (unsigned char)std::min(255.0f, r * 255.0f + 0.5f);
+				out[1] = (unsigned char)std::min(255.0f, g * 255.0f + 0.5f);
+				out[2] = (unsigned char)std::min(255.0f, b * 255.0f + 0.5f);
+				out[3] = (unsigned char)std::min(255.0f, alpha * 255.0f + 0.5f);
+			}
+		}
+	}
+};
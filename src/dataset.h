@@ -0,0 +1,272 @@
+/*
+This header contains the dataset class. A dataset owns the decoded volume for one
+DICOM series. The series is read from disk exactly once, and the resulting vtkImageData
+is shared by the three slice (vtkImageReslice) pipelines and the volume mapper.
+
+Decoded volumes are kept in the on-disk volume cache (volume_cache.h), so reopening a
+series maps the cached volume instead of parsing the DICOM files again. A directory holding
+several series is scanned once (series_scanner.h) and the picked series loaded from the scan.
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkImageData.h>
+#include <vtkSmartPointer.h>
+
+// Qt header files
+#include <QDir>
+#include <QString>
+#include <QStringList>
+
+// Our header files
+#include "dicom_reader.h"
+#include "intensity_histogram.h"
+#include "series_scanner.h"
+#include "thread_pool.h"
+#include "volume_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+// Load states of a dataset slot in the viewer:
+//   EMPTY -> LOADING -> READY, and LOADING -> (previous state) on failure/cancellation.
+//   READY -> EVICTED when the memory budget drops a hidden dataset, EVICTED -> LOADING when shown.
+// While a slot is LOADING no second load may be started for it.
+enum load_state { LOAD_EMPTY, LOAD_LOADING, LOAD_READY, LOAD_EVICTED };
+
+
+class dataset {
+
+public:
+	// the decoded volume (NULL until a series has been loaded)
+	vtkSmartPointer<vtkImageData> image;
+
+	// patient name pulled from the DICOM headers
+	QString patient_name;
+
+	// directory the series was loaded from
+	QString directory;
+
+	// SeriesInstanceUID of the series
+	std::string series_uid;
+
+	// range of the voxel values (kept so it never has to be recomputed from the voxels)
+	double range[2] = { 0.0, 1.0 };
+
+	// histogram of the voxel values, counted while the series was decoded (see
+	// intensity_histogram.h); gives the default window/level. NULL for a volume still being decoded
+	std::shared_ptr<const intensity_histogram> histogram;
+
+	// true if the volume was mapped from the volume cache instead of decoded
+	bool from_cache = false;
+
+	// dataset number stored with the trace spans of a load (-1 = none)
+	int trace_dataset = -1;
+
+	// (optional) progressive display of a load, see parallel_dicom_reader (not called for cache hits)
+	volume_allocated_fn on_allocated;
+	slices_decoded_fn on_slices_decoded;
+
+	/*
+	Read the DICOM series in the specified directory (subdirectories included) into this dataset.
+	Any previously loaded volume is released first. Returns false if the directory could not be
+	read or the load was cancelled.
+
+	Args:
+		cancel: (optional) flag polled while reading; set it from any thread to abort the load
+		progress: (optional) called per file with (files done, total files), for the header scan
+			and then for the decode
+		use_cache: look the series up in (and add it to) the volume cache
+		choices: (optional) if the directory holds several series, nothing is loaded and they are
+			returned here (see series_scanner.h) to be loaded with load(const dicom_series&);
+			without it the series with the most files is loaded
+	*/
+	bool load(QDir dicom_dir, const std::atomic<bool>* cancel = NULL, load_progress_fn progress = load_progress_fn(),
+		bool use_cache = true, std::vector<dicom_series>* choices = NULL) {
+
+		release();
+		TRACE_SCOPE("load_series", trace_dataset);
+
+		std::vector<std::string> files = series_scanner::list_files(dicom_dir);
+
+		// a cache hit skips DICOM parsing completely (apart from one header for the series UID)
+		std::string cache_key;
+		if (use_cache) {
+			cache_key = volume_cache::make_key(dicom_dir.absolutePath(), files, first_series_uid(files));
+			if (load_cached(cache_key, dicom_dir.absolutePath()))
+				return true;
+		}
+
+		// Parse the headers of all files (once, on all cores), grouped into series.
+		series_scanner scanner;
+		scanner.trace_dataset = trace_dataset;
+		if (!scanner.scan_files(files, dicom_dir.absolutePath().toStdString(), cancel, progress)) {
+			if (cancel == NULL || !cancel->load())
+				cout << "umm could not read a DICOM series from " << dicom_dir.absolutePath().toStdString()
+				<< ": " << scanner.error << "\n";
+			return false;
+		}
+
+		if (scanner.series.size() > 1) {
+			if (choices != NULL) {
+				choices->swap(scanner.series);
+				return false;
+			}
+			cout << "directory holds " << scanner.series.size() << " series, reading the largest one\n";
+		}
+
+		// a directory with one series is cached under the directory; one picked out of several under
+		// its own files, so the choice is offered again next time
+		const dicom_series& series = scanner.series[scanner.largest()];
+		if (use_cache && scanner.series.size() > 1)
+			cache_key = volume_cache::make_key(dicom_dir.absolutePath(), series.paths(), series.series_uid);
+		return read_series(series, cancel, progress, cache_key);
+	}
+
+	/*
+	Read a series found by series_scanner (its headers are not parsed again). Any previously
+	loaded volume is released first.
+	*/
+	bool load(const dicom_series& series, const std::atomic<bool>* cancel = NULL, load_progress_fn progress = load_progress_fn(),
+		bool use_cache = true) {
+
+		release();
+		TRACE_SCOPE("load_series", trace_dataset);
+
+		QString root = QString::fromStdString(series.root);
+		std::string cache_key;
+		if (use_cache) {
+			cache_key = volume_cache::make_key(root, series.paths(), series.series_uid);
+			if (load_cached(cache_key, root))
+				return true;
+		}
+		return read_series(series, cancel, progress, cache_key);
+	}
+
+	// Drop the decoded volume. Pipelines still referencing it keep it alive until they are replaced.
+	void release() {
+		image = NULL;
+		patient_name.clear();
+		directory.clear();
+		series_uid.clear();
+		range[0] = 0.0;
+		range[1] = 1.0;
+		histogram = NULL;
+		from_cache = false;
+	}
+
+	bool is_loaded() const {
+		return image != NULL;
+	}
+
+	int* dimensions() {
+		return image->GetDimensions();
+	}
+
+	double* scalar_range() {
+		return range;
+	}
+
+	// Range of the voxel values in the first num_slices slices (of a volume that is still being decoded).
+	void partial_range(int num_slices, double out[2]) {
+
+		int* extent = image->GetExtent();
+		size_t count = (size_t)(extent[1] - extent[0] + 1) * (extent[3] - extent[2] + 1) * num_slices *
+			image->GetNumberOfScalarComponents();
+		out[0] = 0.0;
+		out[1] = 1.0;
+		switch (image->GetScalarType()) {
+			vtkTemplateMacro(value_range(static_cast<const VTK_TT*>(image->GetScalarPointer()), count, out));
+		}
+	}
+
+private:
+	template <class T>
+	static void value_range(const T* values, size_t count, double out[2]) {
+
+		if (count == 0)
+			return;
+		T low = values[0], high = values[0];
+		for (size_t i = 1; i < count; i++) {
+			low = std::min(low, values[i]);
+			high = std::max(high, values[i]);
+		}
+		out[0] = low;
+		out[1] = high;
+	}
+
+	// Map a volume from the volume cache. Returns false on a miss.
+	bool load_cached(const std::string& cache_key, const QString& dicom_dir) {
+
+		cached_volume hit;
+		if (!volume_cache::shared().lookup(cache_key, hit))
+			return false;
+
+		image = hit.image;
+		range[0] = hit.scalar_range[0];
+		range[1] = hit.scalar_range[1];
+		patient_name = QString::fromStdString(hit.patient_name);
+		series_uid = hit.series_uid;
+		histogram = hit.histogram;
+		directory = dicom_dir;
+		from_cache = true;
+		return true;
+	}
+
+	// Decode a scanned series, and store it in the volume cache (in the background) if a key is given.
+	bool read_series(const dicom_series& series, const std::atomic<bool>* cancel, load_progress_fn progress,
+		const std::string& cache_key) {
+
+		parallel_dicom_reader reader;
+		reader.trace_dataset = trace_dataset;
+		reader.on_allocated = on_allocated;
+		reader.on_slices_decoded = on_slices_decoded;
+		if (!reader.read_parsed(series.files, cancel, progress)) {
+			if (cancel == NULL || !cancel->load())
+				cout << "umm could not read a DICOM series from " << series.root << ": " << reader.error << "\n";
+			return false;
+		}
+
+		image = reader.output;
+		histogram = reader.histogram;
+		range[0] = histogram->min_value;
+		range[1] = histogram->max_value;
+		patient_name = QString::fromStdString(reader.patient_name);
+		series_uid = reader.series_uid;
+		directory = QString::fromStdString(series.root);
+
+		// write the cache entry in the background; the volume is not modified after loading
+		if (!cache_key.empty()) {
+			vtkSmartPointer<vtkImageData> volume = image;
+			double volume_range[2] = { range[0], range[1] };
+			std::string name = reader.patient_name;
+			std::string uid = series_uid;
+			std::string key = cache_key;
+			std::shared_ptr<const intensity_histogram> counts = histogram;
+
+			thread_pool::shared().submit([=]() {
+				volume_cache::shared().store(key, volume, volume_range, name, uid, counts);
+			});
+		}
+
+		return true;
+	}
+
+public:
+	// SeriesInstanceUID of the first DICOM image among the files (part of the cache key).
+	static std::string first_series_uid(const std::vector<std::string>& files) {
+
+		for (size_t i = 0; i < files.size(); i++) {
+			dicom_header hdr;
+			if (parallel_dicom_reader::read_header(files[i], hdr))
+				return hdr.series_uid;
+		}
+		return std::string();
+	}
+};
@@ -0,0 +1,178 @@
+/*
+This header contains dataset_layer, one loaded series in the viewer together with everything
+the viewer builds from it: the slice pipelines of the three planes (reslice -> colour map ->
+actor), the raw slices on screen and their colour mapped images, the slab projections, the
+volume with its property, pyramid, level-of-detail mappers and CPU ray casters, and the state
+of its background load. The viewer keeps one layer per loaded series; the first one is the
+reference whose voxel grid the slice sliders step through, the others are drawn over it.
+
+release() drops everything that was built from the volume, so replacing or closing a dataset
+frees its memory right away instead of whenever the next load happens to overwrite it. (The
+viewer takes the layer's actors out of its renderers and its slices out of the slice cache.)
+
+	dataset_layer* layer = new dataset_layer(next_dset_num++);
+	connect(layer->pyramid, SIGNAL(ready(int)), this, SLOT(pyramid_ready(int)));
+	...
+	layer->release();
+	delete layer;
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkImageActor.h>
+#include <vtkImageData.h>
+#include <vtkImageMapToColors.h>
+#include <vtkImageReslice.h>
+#include <vtkLookupTable.h>
+#include <vtkSmartPointer.h>
+#include <vtkSmartVolumeMapper.h>
+#include <vtkVolume.h>
+#include <vtkVolumeProperty.h>
+
+// Qt header files
+#include <QString>
+
+// Our header files
+#include "colormap_kernel.h"
+#include "cpu_raycaster.h"
+#include "dataset.h"
+#include "loader.h"
+#include "rigid_transform.h"
+#include "slab_projector.h"
+#include "slice_cache.h"
+#include "volume_pyramid.h"
+
+#include <memory>
+
+
+class dataset_layer {
+
+public:
+	// volume, axial, coronal, sagittal (index 0 is unused by the slice arrays)
+	static const int NUM_PLANES = 4;
+
+	// id of the dataset: slice cache key, trace tag, loader and pyramid signals ("Dataset <n>")
+	int dset_num;
+
+	// the decoded volume (see dataset.h) and the load state of this layer
+	dataset dset;
+	load_state state = LOAD_EMPTY;
+
+	// background load in flight (NULL when idle)
+	dataset_loader* loader = NULL;
+
+	// drawn in the views; only hidden layers can be evicted by the resource manager
+	bool visible = true;
+
+	// series directory (and the series picked in it, NULL if it holds just one) and patient name, kept
+	// while the volume is evicted so it can be loaded again
+	QString directory;
+	std::shared_ptr<const dicom_series> series;
+	QString patient_name;
+
+	// loading again after an eviction: keep the window/level, opacity and colour map the user had set
+	bool restoring = false;
+
+	// progressive display of a load (see ui::refresh_preview): whether the layer shows a volume that
+	// is still being decoded, the dataset it replaced, and the slices reported and shown so far
+	bool previewing = false;
+	dataset previous;
+	int preview_slices = 0;
+	int preview_shown = 0;
+
+	// slice pipeline of each plane
+	vtkSmartPointer<vtkImageReslice> reslice[NUM_PLANES];
+	vtkSmartPointer<vtkImageMapToColors> imapper[NUM_PLANES];
+	vtkSmartPointer<vtkImageActor> iactor[NUM_PLANES];
+
+	// slice on screen for each plane (NULL while the reslice pipeline is shown), its window/level +
+	// colour mapped image, whether that image is out of date, and the plane's thick-slab window
+	std::shared_ptr<const raw_slice> raw_slices[NUM_PLANES];
+	vtkSmartPointer<vtkImageData> display[NUM_PLANES];
+	bool stale_colours[NUM_PLANES] = {};
+	slab_projector slab[NUM_PLANES];
+
+	// slice look and feel: lookup table (own copy, its range follows window/level), its colours for
+	// the fused colour map, window/level, slice opacity (0..1) and volume colour map (combobox index)
+	vtkSmartPointer<vtkLookupTable> lut = vtkSmartPointer<vtkLookupTable>::New();
+	lut_snapshot lut_colours;
+	double window = 1;
+	double level = 0;
+	double opacity = 1.0;
+	int volume_colormap = 3;
+
+	// placement of the volume relative to the reference layer (see rigid_transform.h), applied to the
+	// reslice geometry and the volume's user matrix; kept while the volume is evicted or reloaded
+	rigid_transform transform;
+
+	// volume view: property, volume, downsampled levels with one mapper each, and the CPU ray caster
+	// of each level (with the volume it was set up for)
+	vtkSmartPointer<vtkVolumeProperty> volume_property = vtkSmartPointer<vtkVolumeProperty>::New();
+	vtkSmartPointer<vtkVolume> volume;
+	volume_pyramid* pyramid;
+	vtkSmartPointer<vtkSmartVolumeMapper> lod_mapper[volume_pyramid::NUM_LEVELS];
+	cpu_raycaster raycaster[volume_pyramid::NUM_LEVELS];
+	vtkImageData* raycast_input[volume_pyramid::NUM_LEVELS] = {};
+
+	explicit dataset_layer(int dset_num) : dset_num(dset_num) {
+		pyramid = new volume_pyramid(dset_num);
+	}
+
+	dataset_layer(const dataset_layer&) = delete;
+	dataset_layer& operator=(const dataset_layer&) = delete;
+
+	// Stop a load that is still running (the window is closing).
+	~dataset_layer() {
+
+		if (loader != NULL) {
+			loader->cancel();
+			loader->wait();
+			delete loader->thread;
+			delete loader;
+		}
+		delete pyramid; // waits for a pyramid build in flight
+	}
+
+	bool is_loaded() const {
+		return dset.is_loaded();
+	}
+
+	// "Dataset 2: Doe^John"
+	QString title() const {
+		return "Dataset " + QString::number(dset_num) + ": " +
+			(patient_name.isEmpty() ? QString("<no data loaded>") : patient_name);
+	}
+
+	/*
+	Drop the volume and everything built from it: slice pipelines, slices and their images, slab
+	windows, pyramid levels, mappers and ray casters. Settings (window/level, opacity, colour map,
+	visibility, transform), the directory and the patient name are kept.
+	*/
+	void release() {
+
+		dset.release();
+		previous.release();
+		previewing = false;
+		preview_slices = preview_shown = 0;
+
+		for (int i = 1; i < NUM_PLANES; i++) {
+			reslice[i] = NULL;
+			imapper[i] = NULL;
+			iactor[i] = NULL;
+			raw_slices[i] = NULL;
+			display[i] = NULL;
+			stale_colours[i] = false;
+			slab[i].clear();
+		}
+
+		volume = NULL;
+		pyramid->clear();
+		for (int i = 0; i < volume_pyramid::NUM_LEVELS; i++) {
+			lod_mapper[i] = NULL;
+			raycaster[i].clear();
+			raycast_input[i] = NULL;
+		}
+	}
+};
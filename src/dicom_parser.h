@@ -0,0 +1,393 @@
+/*
+This header contains a minimal DICOM (Part 10) parser. It only knows the handful of
+attributes the viewer needs (geometry, pixel format, patient/series identification) and
+where the pixel data starts. It works on an in-memory copy of the file and never copies
+the pixel data itself.
+
+Supported encodings: implicit VR little endian, explicit VR little endian, explicit VR
+big endian. Files of other (compressed) transfer syntaxes are parsed as explicit VR little
+endian, and their pixel data is flagged as encapsulated.
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+
+// transfer syntax UIDs the parser distinguishes
+#define TS_IMPLICIT_LITTLE "1.2.840.10008.1.2"
+#define TS_EXPLICIT_LITTLE "1.2.840.10008.1.2.1"
+#define TS_EXPLICIT_BIG "1.2.840.10008.1.2.2"
+
+// result of parse_dicom()
+enum parse_status {
+	PARSE_OK,        // header parsed (pixel_offset/pixel_length are valid if has_pixel_data)
+	PARSE_TRUNCATED, // ran out of bytes before the pixel data; retry with the whole file
+	PARSE_ERROR      // not a DICOM file (or a corrupt one)
+};
+
+// The attributes of one DICOM file that the viewer cares about.
+struct dicom_header {
+	std::string transfer_syntax = TS_IMPLICIT_LITTLE;
+	bool explicit_vr = false;
+	bool big_endian = false;
+
+	std::string patient_name;
+	std::string series_uid;
+	int instance_number = 0;
+
+	// shown when a directory holds several series (see series_scanner.h)
+	std::string modality;
+	std::string series_description;
+	int series_number = 0;
+
+	int rows = 0;
+	int columns = 0;
+	int samples_per_pixel = 1;
+	int bits_allocated = 0;
+	int bits_stored = 0;
+	int pixel_representation = 0; // 0 = unsigned, 1 = signed
+	int number_of_frames = 1;
+
+	double pixel_spacing[2] = { 1.0, 1.0 }; // row spacing, column spacing (mm)
+	double slice_thickness = 0.0;
+	double image_position[3] = { 0.0, 0.0, 0.0 };
+	double image_orientation[6] = { 1.0, 0.0, 0.0, 0.0, 1.0, 0.0 };
+	bool has_position = false;
+	bool has_orientation = false;
+
+	double rescale_slope = 1.0;
+	double rescale_intercept = 0.0;
+
+	// location of the pixel data value inside the file
+	bool has_pixel_data = false;
+	bool encapsulated = false; // undefined length pixel data (compressed fragments)
+	size_t pixel_offset = 0;
+	size_t pixel_length = 0;   // only meaningful when not encapsulated
+};
+
+
+class dicom_parser {
+
+public:
+	/*
+	Parse the header of a DICOM file held in memory, up to (and including the location of)
+	the pixel data element.
+
+	Args:
+		data, size: the file contents (or a prefix of them)
+		hdr: receives the parsed attributes
+	*/
+	static parse_status parse(const unsigned char* data, size_t size, dicom_header& hdr) {
+
+		dicom_parser p(data, size);
+
+		// Part 10 files start with a 128 byte preamble + "DICM" followed by the file meta
+		// information group (always explicit VR little endian)
+		if (size >= 132 && memcmp(data + 128, "DICM", 4) == 0) {
+			p.pos = 132;
+			p.explicit_vr = true;
+			p.big_endian = false;
+
+			parse_status status = p.parse_meta(hdr);
+			if (status != PARSE_OK)
+				return status;
+		}
+		else if (size < 132) {
+			return PARSE_TRUNCATED;
+		}
+		else if (!looks_like_raw_dataset(data, size)) {
+			return PARSE_ERROR;
+		}
+
+		hdr.explicit_vr = hdr.transfer_syntax != TS_IMPLICIT_LITTLE;
+		hdr.big_endian = hdr.transfer_syntax == TS_EXPLICIT_BIG;
+		p.explicit_vr = hdr.explicit_vr;
+		p.big_endian = hdr.big_endian;
+
+		return p.parse_elements(hdr, 0, size);
+	}
+
+private:
+	const unsigned char* data;
+	size_t size;
+	size_t pos = 0;
+	bool explicit_vr = false;
+	bool big_endian = false;
+
+	static const uint32_t UNDEFINED_LENGTH = 0xFFFFFFFF;
+
+	dicom_parser(const unsigned char* data, size_t size) : data(data), size(size) {}
+
+	// Files without a preamble (old ACR-NEMA style) start directly with a group 0008 element.
+	static bool looks_like_raw_dataset(const unsigned char* data, size_t size) {
+		return size >= 8 && data[0] == 0x08 && data[1] == 0x00;
+	}
+
+	uint16_t read16(size_t at) const {
+		return big_endian ? (uint16_t)((data[at] << 8) | data[at + 1])
+			: (uint16_t)(data[at] | (data[at + 1] << 8));
+	}
+
+	uint32_t read32(size_t at) const {
+		return big_endian
+			? ((uint32_t)data[at] << 24) | ((uint32_t)data[at + 1] << 16) | ((uint32_t)data[at + 2] << 8) | data[at + 3]
+			: data[at] | ((uint32_t)data[at + 1] << 8) | ((uint32_t)data[at + 2] << 16) | ((uint32_t)data[at + 3] << 24);
+	}
+
+	// VRs that use a 2 byte reserved field + 4 byte length in explicit VR encodings
+	static bool has_long_length(const char* vr) {
+		static const char* long_vrs[] = { "OB", "OD", "OF", "OL", "OV", "OW", "SQ", "SV", "UC", "UN", "UR", "UT", "UV" };
+		for (int i = 0; i < 13; i++) {
+			if (vr[0] == long_vrs[i][0] && vr[1] == long_vrs[i][1])
+				return true;
+		}
+		return false;
+	}
+
+	/*
+	Read one element header at pos. On success pos points at the value, and tag/vr/length
+	describe it. Item and delimiter tags (FFFE,xxxx) never carry a VR.
+	*/
+	parse_status read_element_header(size_t end, uint32_t& tag, char vr[2], uint32_t& length) {
+
+		if (pos + 8 > end)
+			return PARSE_TRUNCATED;
+
+		uint16_t group = read16(pos);
+		uint16_t element = read16(pos + 2);
+		tag = ((uint32_t)group << 16) | element;
+		vr[0] = vr[1] = 0;
+
+		if (group == 0xFFFE || !explicit_vr) {
+			length = read32(pos + 4);
+			pos += 8;
+			return PARSE_OK;
+		}
+
+		vr[0] = (char)data[pos + 4];
+		vr[1] = (char)data[pos + 5];
+		if (vr[0] < 'A' || vr[0] > 'Z' || vr[1] < 'A' || vr[1] > 'Z')
+			return PARSE_ERROR;
+
+		if (has_long_length(vr)) {
+			if (pos + 12 > end)
+				return PARSE_TRUNCATED;
+			length = read32(pos + 8);
+			pos += 12;
+		}
+		else {
+			length = read16(pos + 6);
+			pos += 8;
+		}
+		return PARSE_OK;
+	}
+
+	// The file meta information group (0002,xxxx); only the transfer syntax is needed.
+	parse_status parse_meta(dicom_header& hdr) {
+
+		while (pos + 8 <= size && read16(pos) == 0x0002) {
+			uint32_t tag, length;
+			char vr[2];
+			parse_status status = read_element_header(size, tag, vr, length);
+			if (status != PARSE_OK)
+				return status;
+			if (length == UNDEFINED_LENGTH)
+				return PARSE_ERROR;
+			if (pos + length > size)
+				return PARSE_TRUNCATED;
+
+			if (tag == 0x00020010)
+				hdr.transfer_syntax = read_string(length);
+
+			pos += length;
+		}
+
+		if (pos + 8 > size)
+			return PARSE_TRUNCATED;
+		return PARSE_OK;
+	}
+
+	/*
+	Walk the elements between pos and end. depth > 0 means we are inside a sequence item,
+	where nothing is recorded (the attributes we need all live at the top level).
+	*/
+	parse_status parse_elements(dicom_header& hdr, int depth, size_t end) {
+
+		while (pos < end) {
+			uint32_t tag, length;
+			char vr[2];
+			parse_status status = read_element_header(end, tag, vr, length);
+			if (status != PARSE_OK)
+				return status;
+
+			// end of the current item
+			if (tag == 0xFFFEE00D)
+				return depth > 0 ? PARSE_OK : PARSE_ERROR;
+
+			// pixel data: remember where it is and stop
+			if (tag == 0x7FE00010 && depth == 0) {
+				hdr.has_pixel_data = true;
+				hdr.pixel_offset = pos;
+				hdr.encapsulated = length == UNDEFINED_LENGTH;
+				hdr.pixel_length = hdr.encapsulated ? 0 : length;
+				return PARSE_OK;
+			}
+
+			if (length == UNDEFINED_LENGTH) {
+				// sequence of undefined length (SQ, or UN/implicit VR holding a sequence)
+				status = skip_sequence(hdr, depth, end);
+				if (status != PARSE_OK)
+					return status;
+				continue;
+			}
+
+			if (pos + length > end)
+				return PARSE_TRUNCATED;
+
+			if (depth == 0)
+				record(hdr, tag, length);
+
+			pos += length;
+		}
+
+		return depth > 0 ? PARSE_TRUNCATED : (hdr.has_pixel_data ? PARSE_OK : PARSE_TRUNCATED);
+	}
+
+	// Skip the items of an undefined length sequence up to its delimiter (FFFE,E0DD).
+	parse_status skip_sequence(dicom_header& hdr, int depth, size_t end) {
+
+		if (depth > 16)
+			return PARSE_ERROR; // nesting this deep means we are lost in garbage
+
+		while (pos < end) {
+			uint32_t tag, length;
+			char vr[2];
+			parse_status status = read_element_header(end, tag, vr, length);
+			if (status != PARSE_OK)
+				return status;
+
+			if (tag == 0xFFFEE0DD)
+				return PARSE_OK;
+			if (tag != 0xFFFEE000)
+				return PARSE_ERROR;
+
+			if (length == UNDEFINED_LENGTH) {
+				status = parse_elements(hdr, depth + 1, end);
+				if (status != PARSE_OK)
+					return status;
+			}
+			else {
+				if (pos + length > end)
+					return PARSE_TRUNCATED;
+				pos += length;
+			}
+		}
+		return PARSE_TRUNCATED;
+	}
+
+	// Text value at pos, without the trailing padding.
+	std::string read_string(uint32_t length) const {
+
+		std::string value((const char*)data + pos, length);
+		while (!value.empty() && (value.back() == ' ' || value.back() == '\0'))
+			value.pop_back();
+		while (!value.empty() && value.front() == ' ')
+			value.erase(0, 1);
+		return value;
+	}
+
+	// Parse up to max_count backslash separated decimal numbers (DS/IS values).
+	int read_numbers(uint32_t length, double* out, int max_count) const {
+
+		std::string value = read_string(length);
+		const char* s = value.c_str();
+		int count = 0;
+
+		while (count < max_count && *s) {
+			char* next;
+			out[count] = strtod(s, &next);
+			if (next == s)
+				break;
+			count++;
+			s = next;
+			while (*s == ' ')
+				s++;
+			if (*s != '\\')
+				break;
+			s++;
+		}
+		return count;
+	}
+
+	int read_us(uint32_t length) const {
+		return length >= 2 ? read16(pos) : 0;
+	}
+
+	// Store the value of a top level element if it is one we care about.
+	void record(dicom_header& hdr, uint32_t tag, uint32_t length) {
+
+		double numbers[6];
+
+		switch (tag) {
+		case 0x00100010: hdr.patient_name = read_string(length); break;
+		case 0x0020000E: hdr.series_uid = read_string(length); break;
+		case 0x00080060: hdr.modality = read_string(length); break;
+		case 0x0008103E: hdr.series_description = read_string(length); break;
+		case 0x00200011:
+			if (read_numbers(length, numbers, 1) == 1)
+				hdr.series_number = (int)numbers[0];
+			break;
+		case 0x00200013:
+			if (read_numbers(length, numbers, 1) == 1)
+				hdr.instance_number = (int)numbers[0];
+			break;
+		case 0x00200032:
+			if (read_numbers(length, numbers, 3) == 3) {
+				memcpy(hdr.image_position, numbers, 3 * sizeof(double));
+				hdr.has_position = true;
+			}
+			break;
+		case 0x00200037:
+			if (read_numbers(length, numbers, 6) == 6) {
+				memcpy(hdr.image_orientation, numbers, 6 * sizeof(double));
+				hdr.has_orientation = true;
+			}
+			break;
+		case 0x00180050:
+			if (read_numbers(length, numbers, 1) == 1)
+				hdr.slice_thickness = numbers[0];
+			break;
+		case 0x00280002: hdr.samples_per_pixel = read_us(length); break;
+		case 0x00280008:
+			if (read_numbers(length, numbers, 1) == 1 && numbers[0] >= 1)
+				hdr.number_of_frames = (int)numbers[0];
+			break;
+		case 0x00280010: hdr.rows = read_us(length); break;
+		case 0x00280011: hdr.columns = read_us(length); break;
+		case 0x00280030:
+			if (read_numbers(length, numbers, 2) == 2) {
+				hdr.pixel_spacing[0] = numbers[0];
+				hdr.pixel_spacing[1] = numbers[1];
+			}
+			break;
+		case 0x00280100: hdr.bits_allocated = read_us(length); break;
+		case 0x00280101: hdr.bits_stored = read_us(length); break;
+		case 0x00280103: hdr.pixel_representation = read_us(length); break;
+		case 0x00281052:
+			if (read_numbers(length, numbers, 1) == 1)
+				hdr.rescale_intercept = numbers[0];
+			break;
+		case 0x00281053:
+			if (read_numbers(length, numbers, 1) == 1)
+				hdr.rescale_slope = numbers[0];
+			break;
+		default:
+			break;
+		}
+	}
+};
@@ -0,0 +1,475 @@
+/*
+This header contains parallel_dicom_reader, a multithreaded replacement for
+vtkDICOMImageReader. Reading a series happens in two parallel passes over the files:
+
+	1. parse the headers of all files, then sort the slices along the slice normal and
+	   allocate the output volume
+	2. decode the pixel data of every file straight into its z-slot of the volume, and count its
+	   voxels into the intensity histogram while they are still in the cache
+	   (intensity_histogram.h; this also gives the value range)
+
+Files are memory mapped, so the header pass only touches the first pages of each file and
+the pixel pass copies straight from the mapping into the volume (no read buffers, no
+per-file heap copies). Rows are only byte swapped for big-endian series; otherwise each row
+is a plain memcpy. The volume keeps the stored values (no rescale), like vtkDICOMImageReader.
+
+The header pass can also be done ahead of time by series_scanner.h, which parses a whole
+directory tree once and groups it into series; read_parsed() then starts at the sort.
+
+Compressed files (RLE and JPEG, see pixel_codecs.h) are decoded into a native buffer first and
+then copied the same way. Files already decode in parallel; the frames of a multi-frame file are
+decoded in parallel as well.
+
+The output is a plain vtkImageData laid out the same way vtkDICOMImageReader lays it out
+(rows flipped so the first row of the image is at the top, slices ascending along the
+normal), so it can be fed to vtkImageReslice / vtkSmartVolumeMapper with SetInputData().
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkImageData.h>
+#include <vtkSmartPointer.h>
+#include <vtkType.h>
+
+// Our header files
+#include "dicom_parser.h"
+#include "intensity_histogram.h"
+#include "mapped_file.h"
+#include "pixel_codecs.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// Called while a series is being read with (files done, total files). It is called from the
+// loading threads, so it must not touch any widgets directly.
+typedef std::function<void(int, int)> load_progress_fn;
+
+// Progressive display of a series while it is read (also called from the loading threads): the
+// output volume once it has been allocated and zero filled, before any pixel data is decoded
+// into it; then the number of slices (z-slots 0..n-1) that hold their final values so far.
+typedef std::function<void(vtkImageData*)> volume_allocated_fn;
+typedef std::function<void(int)> slices_decoded_fn;
+
+
+class parallel_dicom_reader {
+
+public:
+	// the decoded volume (NULL if read() failed)
+	vtkSmartPointer<vtkImageData> output;
+
+	// identification of the series that was read
+	std::string patient_name;
+	std::string series_uid;
+
+	// histogram and exact value range of the decoded volume
+	std::shared_ptr<const intensity_histogram> histogram;
+
+	// rescale slope/intercept of the (first slice of the) series
+	double rescale_slope = 1.0;
+	double rescale_intercept = 0.0;
+
+	// description of what went wrong if read() returned false
+	std::string error;
+
+	// dataset number stored with the trace spans of this read (-1 = none)
+	int trace_dataset = -1;
+
+	// (optional) progressive display; files are decoded roughly in slice order, so the first
+	// slices are ready long before the whole series
+	volume_allocated_fn on_allocated;
+	slices_decoded_fn on_slices_decoded;
+
+	// one file of the series
+	struct slice_file {
+		std::string path;
+		dicom_header header;
+		bool valid = false;
+		int z = 0; // first z-slot of this file in the volume
+	};
+
+	/*
+	Read the series made up of the given files.
+
+	Args:
+		files: paths of the files to read (non-DICOM files are skipped)
+		cancel: (optional) flag polled between files; set it from any thread to abort
+		progress: (optional) called once per decoded file
+	*/
+	bool read(const std::vector<std::string>& files, const std::atomic<bool>* cancel = NULL,
+		load_progress_fn progress = load_progress_fn()) {
+
+		output = NULL;
+		error.clear();
+
+		// S================== PASS 1: HEADERS =================== //
+		std::vector<slice_file> slices(files.size());
+		thread_pool::shared().parallel_for((int)files.size(), [&](int i) {
+			if (cancel != NULL && cancel->load())
+				return;
+			TRACE_SCOPE("parse_header", trace_dataset);
+			slices[i].path = files[i];
+			slices[i].valid = read_header(files[i], slices[i].header);
+		});
+
+		if (cancel != NULL && cancel->load())
+			return fail("cancelled");
+
+		return read_parsed(slices, cancel, progress);
+	}
+
+	/*
+	Read a series whose headers have been parsed already (see series_scanner.h); no file is
+	parsed a second time. Invalid files are skipped, and if the files hold several series the
+	one with the most files is used, as in read().
+	*/
+	bool read_parsed(std::vector<slice_file> slices, const std::atomic<bool>* cancel = NULL,
+		load_progress_fn progress = load_progress_fn()) {
+
+		output = NULL;
+		histogram = NULL;
+		error.clear();
+
+		if (!select_series(slices))
+			return false;
+
+		sort_slices(slices);
+
+		// S================== ALLOCATE VOLUME =================== //
+		const dicom_header& first = slices[0].header;
+
+		int num_slices = 0;
+		for (size_t i = 0; i < slices.size(); i++) {
+			slices[i].z = num_slices;
+			num_slices += slices[i].header.number_of_frames;
+		}
+
+		// the volume holds the stored values like vtkDICOMImageReader (the volume transfer functions
+		// are tuned for those; the rescale slope/intercept are only reported)
+		int stored_type = vtk_scalar_type(first);
+		if (stored_type < 0)
+			return fail("unsupported pixel format (" + std::to_string(first.bits_allocated) + " bits, " +
+				std::to_string(first.samples_per_pixel) + " samples per pixel)");
+
+		vtkSmartPointer<vtkImageData> volume = vtkSmartPointer<vtkImageData>::New();
+		volume->SetDimensions(first.columns, first.rows, num_slices);
+		volume->SetSpacing(first.pixel_spacing[1], first.pixel_spacing[0], slice_spacing(slices));
+		volume->SetOrigin(first.image_position);
+		volume->AllocateScalars(stored_type, 1);
+
+		unsigned char* voxels = static_cast<unsigned char*>(volume->GetScalarPointer());
+		size_t slice_voxels = (size_t)first.columns * first.rows;
+		size_t slice_bytes = slice_voxels * scalar_size(stored_type);
+
+		// the volume is shown before it is complete: undecoded slices must read as 0, not garbage
+		if (on_allocated) {
+			thread_pool::shared().parallel_for(num_slices, [&](int z) {
+				memset(voxels + z * slice_bytes, 0, slice_bytes);
+			});
+			on_allocated(volume);
+		}
+
+		// S================== PASS 2: PIXEL DATA =================== //
+		std::atomic<int> files_done(0);
+		std::atomic<bool> failed(false);
+		std::mutex error_mutex;
+
+		// files decoded so far, and how many from the first one on are done (guarded by decoded_mutex)
+		std::vector<char> decoded(slices.size(), 0);
+		size_t decoded_prefix = 0;
+		std::mutex decoded_mutex;
+
+		histogram_builder counts(stored_type);
+
+		thread_pool::shared().parallel_for((int)slices.size(), [&](int i) {
+			if (failed || (cancel != NULL && cancel->load()))
+				return;
+
+			TRACE_SCOPE("decode_pixels", trace_dataset);
+			std::string file_error;
+			if (!decode_file(slices[i], first, voxels + slices[i].z * slice_bytes, file_error)) {
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (!failed)
+					error = slices[i].path + ": " + file_error;
+				failed = true;
+				return;
+			}
+			counts.add(voxels + slices[i].z * slice_bytes, slice_voxels * slices[i].header.number_of_frames);
+
+			int done = ++files_done;
+			if (progress)
+				progress(done, (int)slices.size());
+
+			if (on_slices_decoded) {
+				std::lock_guard<std::mutex> lock(decoded_mutex); // keeps the reported counts increasing
+				decoded[i] = 1;
+				size_t prefix = decoded_prefix;
+				while (decoded_prefix < slices.size() && decoded[decoded_prefix])
+					decoded_prefix++;
+				if (decoded_prefix > prefix)
+					on_slices_decoded(decoded_prefix < slices.size() ? slices[decoded_prefix].z : num_slices);
+			}
+		});
+
+		if (cancel != NULL && cancel->load())
+			return fail("cancelled");
+		if (failed)
+			return false;
+
+		patient_name = first.patient_name;
+		series_uid = first.series_uid;
+		rescale_slope = first.rescale_slope;
+		rescale_intercept = first.rescale_intercept;
+		histogram = counts.finish(voxels, slice_voxels * num_slices);
+		output = volume;
+
+		return true;
+	}
+
+	// Parse the header of one file (only the pages holding the header are read from disk).
+	static bool read_header(const std::string& path, dicom_header& hdr) {
+
+		mapped_file file;
+		if (!file.open(path))
+			return false;
+
+		parse_status status = dicom_parser::parse(file.data(), file.size(), hdr);
+
+		return status == PARSE_OK && hdr.has_pixel_data && hdr.rows > 0 && hdr.columns > 0;
+	}
+
+	// Position of a slice along the slice normal (cross product of the row and column directions).
+	static double slice_location(const dicom_header& hdr) {
+
+		const double* o = hdr.image_orientation;
+		double normal[3] = {
+			o[1] * o[5] - o[2] * o[4],
+			o[2] * o[3] - o[0] * o[5],
+			o[0] * o[4] - o[1] * o[3] };
+
+		return normal[0] * hdr.image_position[0] + normal[1] * hdr.image_position[1] + normal[2] * hdr.image_position[2];
+	}
+
+	// Sort ascending along the slice normal (or by instance number if positions are missing).
+	static void sort_slices(std::vector<slice_file>& slices) {
+
+		bool have_positions = true;
+		for (size_t i = 0; i < slices.size(); i++)
+			have_positions = have_positions && slices[i].header.has_position;
+
+		std::stable_sort(slices.begin(), slices.end(), [have_positions](const slice_file& a, const slice_file& b) {
+			if (have_positions)
+				return slice_location(a.header) < slice_location(b.header);
+			return a.header.instance_number < b.header.instance_number;
+		});
+	}
+
+private:
+	bool fail(const std::string& message) {
+		error = message;
+		return false;
+	}
+
+	/*
+	Keep only the valid files of one series (with a consistent image size). If the
+	directory holds several series, the one with the most files is used.
+	*/
+	bool select_series(std::vector<slice_file>& slices) {
+
+		std::map<std::string, int> files_per_series;
+		for (size_t i = 0; i < slices.size(); i++) {
+			if (slices[i].valid)
+				files_per_series[slices[i].header.series_uid]++;
+		}
+
+		if (files_per_series.empty())
+			return fail("no DICOM images found");
+
+		std::string series;
+		int most = 0;
+		for (std::map<std::string, int>::iterator it = files_per_series.begin(); it != files_per_series.end(); ++it) {
+			if (it->second > most) {
+				most = it->second;
+				series = it->first;
+			}
+		}
+
+		if (files_per_series.size() > 1)
+			cout << "directory holds " << files_per_series.size() << " series, reading the largest one\n";
+
+		std::vector<slice_file> kept;
+		for (size_t i = 0; i < slices.size(); i++) {
+			if (!slices[i].valid || slices[i].header.series_uid != series)
+				continue;
+
+			const dicom_header& hdr = slices[i].header;
+			if (!kept.empty()) {
+				const dicom_header& first = kept[0].header;
+				if (hdr.rows != first.rows || hdr.columns != first.columns ||
+					hdr.bits_allocated != first.bits_allocated ||
+					hdr.pixel_representation != first.pixel_representation) {
+					cout << "skipping " << slices[i].path << " (image size/format differs from the series)\n";
+					continue;
+				}
+			}
+			kept.push_back(slices[i]);
+		}
+
+		slices.swap(kept);
+		return true;
+	}
+
+	// Distance between slices: from the positions if possible, else the slice thickness.
+	static double slice_spacing(const std::vector<slice_file>& slices) {
+
+		const dicom_header& first = slices.front().header;
+		const dicom_header& last = slices.back().header;
+
+		if (slices.size() > 1 && first.has_position && last.has_position) {
+			double spacing = std::fabs(slice_location(last) - slice_location(first)) / (slices.size() - 1);
+			if (spacing > 0)
+				return spacing;
+		}
+
+		return first.slice_thickness > 0 ? first.slice_thickness : 1.0;
+	}
+
+	static int scalar_size(int scalar_type) {
+
+		switch (scalar_type) {
+		case VTK_SIGNED_CHAR: case VTK_UNSIGNED_CHAR: return 1;
+		case VTK_SHORT: case VTK_UNSIGNED_SHORT: return 2;
+		default: return 4; // int, unsigned int, float
+		}
+	}
+
+	static int vtk_scalar_type(const dicom_header& hdr) {
+
+		if (hdr.samples_per_pixel != 1)
+			return -1;
+
+		bool is_signed = hdr.pixel_representation == 1;
+		switch (hdr.bits_allocated) {
+		case 8: return is_signed ? VTK_SIGNED_CHAR : VTK_UNSIGNED_CHAR;
+		case 16: return is_signed ? VTK_SHORT : VTK_UNSIGNED_SHORT;
+		case 32: return is_signed ? VTK_INT : VTK_UNSIGNED_INT;
+		default: return -1;
+		}
+	}
+
+	/*
+	Decode the pixel data of one file into its z-slot(s), straight from the mapped file. The
+	file's parsed header (slice.header) gives where the pixel data is and how it is encoded, so
+	the file is only mapped, not parsed again. Rows are written bottom-up, which is the
+	orientation vtkDICOMImageReader produces.
+	*/
+	static bool decode_file(const slice_file& slice, const dicom_header& series, unsigned char* dst, std::string& file_error) {
+
+		mapped_file file;
+		if (!file.open(slice.path)) {
+			file_error = "could not read file";
+			return false;
+		}
+		file.advise(mapped_file::ACCESS_SEQUENTIAL);
+
+		const dicom_header& hdr = slice.header;
+		if (hdr.pixel_offset > file.size()) {
+			file_error = "pixel data is truncated"; // (the file changed since its header was parsed)
+			return false;
+		}
+
+		if (hdr.encapsulated)
+			return decode_compressed(file, hdr, series, dst, file_error);
+
+		int bytes_per_voxel = series.bits_allocated / 8;
+		size_t frame_bytes = (size_t)series.columns * bytes_per_voxel * series.rows;
+
+		if (hdr.pixel_offset + frame_bytes * hdr.number_of_frames > file.size()) {
+			file_error = "pixel data is truncated";
+			return false;
+		}
+
+		const unsigned char* src = file.data() + hdr.pixel_offset;
+		bool swap = hdr.big_endian && bytes_per_voxel > 1;
+		for (int f = 0; f < hdr.number_of_frames; f++)
+			copy_frame(src + f * frame_bytes, series, swap, dst + f * frame_bytes);
+
+		return true;
+	}
+
+	// Decode every frame of a compressed file (in parallel) and copy it into its z-slot.
+	static bool decode_compressed(const mapped_file& file, const dicom_header& hdr, const dicom_header& series,
+		unsigned char* dst, std::string& file_error) {
+
+		if (!pixel_codecs::is_supported(hdr.transfer_syntax)) {
+			file_error = "compressed transfer syntax " + hdr.transfer_syntax + " is not supported";
+			return false;
+		}
+
+		std::vector<encoded_frame> frames;
+		if (!pixel_codecs::split_frames(file.data() + hdr.pixel_offset, file.size() - hdr.pixel_offset, hdr.number_of_frames,
+			frames, file_error))
+			return false;
+
+		size_t frame_bytes = (size_t)series.columns * (series.bits_allocated / 8) * series.rows;
+
+		std::mutex error_mutex;
+		std::atomic<bool> failed(false);
+		thread_pool::shared().parallel_for((int)frames.size(), [&](int f) {
+			if (failed.load())
+				return;
+
+			std::vector<unsigned char> native(frame_bytes);
+			std::string error;
+			if (!pixel_codecs::decode(hdr, frames[f], native.data(), error)) {
+				std::lock_guard<std::mutex> lock(error_mutex);
+				if (!failed.exchange(true))
+					file_error = error;
+				return;
+			}
+			copy_frame(native.data(), series, false, dst + f * frame_bytes);
+		});
+
+		return !failed.load();
+	}
+
+	// Copy one frame of native samples (first row first) into the volume, bottom row first,
+	// byte swapping big-endian samples.
+	static void copy_frame(const unsigned char* src, const dicom_header& series, bool swap, unsigned char* dst) {
+
+		int bytes_per_voxel = series.bits_allocated / 8;
+		size_t row_bytes = (size_t)series.columns * bytes_per_voxel;
+
+		for (int r = 0; r < series.rows; r++) {
+			const unsigned char* src_row = src + r * row_bytes;
+			unsigned char* dst_row = dst + (series.rows - 1 - r) * row_bytes;
+
+			if (swap)
+				swap_row(src_row, dst_row, series.columns, bytes_per_voxel);
+			else
+				memcpy(dst_row, src_row, row_bytes);
+		}
+	}
+
+	static void swap_row(const unsigned char* src, unsigned char* dst, int n, int bytes_per_voxel) {
+
+		for (int i = 0; i < n; i++) {
+			for (int b = 0; b < bytes_per_voxel; b++)
+				dst[b] = src[bytes_per_voxel - 1 - b];
+			src += bytes_per_voxel;
+			dst += bytes_per_voxel;
+		}
+	}
+};
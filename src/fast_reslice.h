@@ -0,0 +1,107 @@
+/*
+This header contains fast_reslice, a vtkImageReslice that skips interpolation when it does
+not do anything. For the axial/coronal/sagittal planes at an integer slice position every
+output pixel sits exactly on a voxel, so the slice is copied straight out of the volume
+(slice_extract.h) instead of being resampled.
+
+It is a drop-in replacement (same output extent, spacing and origin, since those are still
+computed by vtkImageReslice). Oblique planes, fractional positions, planes partly outside
+the volume and the features the copy does not implement (slabs, wrap/mirror, a reslice
+transform, scalar conversion) go through the normal vtkImageReslice code.
+
+	vtkSmartPointer<vtkImageReslice> reslice = vtkSmartPointer<fast_reslice>::New();
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkImageData.h>
+#include <vtkImageReslice.h>
+#include <vtkMatrix4x4.h>
+
+// Our header files
+#include "slice_extract.h"
+
+#include <atomic>
+
+
+class fast_reslice : public vtkImageReslice {
+
+public:
+	vtkTypeMacro(fast_reslice, vtkImageReslice);
+
+	static fast_reslice* New() {
+		fast_reslice* result = new fast_reslice;
+		result->InitializeObjectBase();
+		return result;
+	}
+
+	// number of output pieces filled by the direct copy / by vtkImageReslice (for benchmarks)
+	std::atomic<int> fast_pieces;
+	std::atomic<int> resampled_pieces;
+
+	// turn the direct copy off (e.g. to compare against plain vtkImageReslice)
+	bool direct_copy = true;
+
+protected:
+	fast_reslice() : fast_pieces(0), resampled_pieces(0) {}
+
+	void ThreadedRequestData(vtkInformation* request, vtkInformationVector** input_vector,
+		vtkInformationVector* output_vector, vtkImageData*** in_data, vtkImageData** out_data,
+		int out_ext[6], int thread_id) override {
+
+		if (direct_copy && copy_slice(in_data[0][0], out_data[0], out_ext)) {
+			fast_pieces++;
+			return;
+		}
+
+		resampled_pieces++;
+		vtkImageReslice::ThreadedRequestData(request, input_vector, output_vector, in_data, out_data, out_ext, thread_id);
+	}
+
+private:
+	fast_reslice(const fast_reslice&) = delete;
+	void operator=(const fast_reslice&) = delete;
+
+	/*
+	Fill out_ext of the output by copying voxels, if every output pixel of it maps exactly
+	onto a voxel inside the input. Returns false (nothing written) otherwise.
+	*/
+	bool copy_slice(vtkImageData* input, vtkImageData* output, int out_ext[6]) {
+
+		if (input == NULL || output == NULL || GetResliceTransform() != NULL || GetSlabNumberOfSlices() > 1 ||
+			GetWrap() || GetMirror() || GetScalarShift() != 0.0 || GetScalarScale() != 1.0)
+			return false;
+
+		int components = input->GetNumberOfScalarComponents();
+		if (input->GetScalarType() != output->GetScalarType() || components != output->GetNumberOfScalarComponents())
+			return false;
+
+		double axes[4][4] = { { 1, 0, 0, 0 }, { 0, 1, 0, 0 }, { 0, 0, 1, 0 }, { 0, 0, 0, 1 } };
+		if (GetResliceAxes() != NULL) {
+			for (int r = 0; r < 4; r++)
+				for (int c = 0; c < 4; c++)
+					axes[r][c] = GetResliceAxes()->GetElement(r, c);
+		}
+
+		// oblique, fractional, or partly outside (vtkImageReslice fills in the background there)
+		slice_mapping mapping;
+		if (!slice_extract::map_plane(axes, input->GetOrigin(), input->GetSpacing(), output->GetOrigin(),
+			output->GetSpacing(), mapping) || !slice_extract::is_inside(mapping, out_ext, input->GetExtent()))
+			return false;
+
+		int element_size = input->GetScalarSize() * components;
+		const char* in_voxels = static_cast<const char*>(input->GetScalarPointer());
+		const char* in_end = in_voxels + (size_t)input->GetNumberOfPoints() * element_size;
+
+		// in scalars; the overload without an argument stores them in the output, which every thread shares
+		vtkIdType increments[3];
+		output->GetIncrements(increments);
+		slice_extract::copy_slice(mapping, in_voxels, input->GetExtent(), element_size, in_end, out_ext,
+			output->GetScalarPointer(out_ext[0], out_ext[2], out_ext[4]),
+			increments[1] * input->GetScalarSize(), increments[2] * input->GetScalarSize());
+
+		return true;
+	}
+};
@@ -0,0 +1,101 @@
+/*
+This header contains histogram_widget, a small plot of a dataset's intensity histogram (see
+intensity_histogram.h) under its window/level sliders. The x-axis runs over the value range of
+the dataset, counts are drawn on a log scale (so the tissue peaks stay visible next to the
+background spike), and the current window is shaded.
+
+	histogram_widget* plot = new histogram_widget();
+	plot->set_histogram(layer->dset.histogram);
+	plot->set_window(layer->window, layer->level);
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// Qt header files
+#include <QPainter>
+#include <QPaintEvent>
+#include <QString>
+#include <QWidget>
+
+// Our header files
+#include "intensity_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+
+class histogram_widget : public QWidget {
+
+public:
+	explicit histogram_widget(QWidget* parent = NULL) : QWidget(parent) {
+		setMinimumSize(200, 60);
+		setMaximumHeight(80);
+	}
+
+	// Show a histogram (NULL = no data loaded).
+	void set_histogram(std::shared_ptr<const intensity_histogram> h) {
+		histogram = h;
+		update();
+	}
+
+	void set_window(double w, double l) {
+		window = w;
+		level = l;
+		update();
+	}
+
+protected:
+	void paintEvent(QPaintEvent*) override {
+
+		QPainter painter(this);
+		painter.fillRect(rect(), QColor(24, 24, 24));
+
+		if (histogram == NULL || histogram->empty()) {
+			painter.setPen(QColor(140, 140, 140));
+			painter.drawText(rect(), Qt::AlignCenter, "No histogram");
+			return;
+		}
+
+		int label_height = painter.fontMetrics().height();
+		int w = width();
+		int h = height() - label_height;
+		double low = histogram->min_value;
+		double span = std::max(histogram->max_value - low, 1e-9);
+
+		// window (shaded) behind the bars
+		int x0 = (int)std::floor((level - window / 2 - low) / span * w);
+		int x1 = (int)std::ceil((level + window / 2 - low) / span * w);
+		painter.fillRect(QRect(std::max(x0, 0), 0, std::min(x1, w) - std::max(x0, 0), h), QColor(70, 90, 130));
+
+		// one bar per pixel column: the largest bin that falls into it, on a log scale
+		const std::vector<uint64_t>& counts = histogram->counts;
+		int bins = (int)counts.size();
+		double top = std::log1p((double)*std::max_element(counts.begin(), counts.end()));
+		painter.setPen(QColor(210, 210, 210));
+		for (int x = 0; x < w; x++) {
+			int first = (int)((long long)x * bins / w);
+			int last = std::max(first + 1, (int)((long long)(x + 1) * bins / w));
+			uint64_t count = 0;
+			for (int b = first; b < last && b < bins; b++)
+				count = std::max(count, counts[b]);
+			if (count == 0)
+				continue;
+			int bar = (int)std::round(std::log1p((double)count) / top * (h - 1));
+			painter.drawLine(x, h - 1, x, h - 1 - bar);
+		}
+
+		// x-axis: value range
+		painter.setPen(QColor(170, 170, 170));
+		QRect labels(2, h, w - 4, label_height);
+		painter.drawText(labels, Qt::AlignLeft | Qt::AlignVCenter, QString::number(histogram->min_value));
+		painter.drawText(labels, Qt::AlignRight | Qt::AlignVCenter, QString::number(histogram->max_value));
+	}
+
+private:
+	std::shared_ptr<const intensity_histogram> histogram;
+	double window = 1;
+	double level = 0;
+};
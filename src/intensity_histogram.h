@@ -0,0 +1,330 @@
+/*
+This header contains intensity_histogram, the histogram and statistics of the voxel values of a
+volume, and histogram_builder, which accumulates it while the volume is being assembled.
+parallel_dicom_reader adds the voxels of every file right after decoding them (while they are
+still in the cache), so the statistics cost no extra pass over the volume and the value range no
+longer needs a serial GetScalarRange().
+
+8 and 16-bit volumes (nearly every series) are counted per value, in one table per thread that
+is adding at the time, and the tables are merged once at the end. Native 32-bit integer volumes
+(Bits Allocated 32) are counted in a second parallel pass once their range is known; float is
+handled the same way, although the reader never produces it.
+
+The histogram gives the exact value range, percentiles, and a default window/level that is not
+thrown off by a few outlier voxels or by the padding around the field of view:
+
+	histogram_builder builder(VTK_SHORT);
+	thread_pool::shared().parallel_for(num_slices, [&](int z) { builder.add(slice(z), slice_voxels); });
+	std::shared_ptr<const intensity_histogram> histogram = builder.finish(voxels, num_voxels);
+
+	double window, level;
+	histogram->auto_window(window, level);
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkType.h>
+
+// Our header files
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+class intensity_histogram {
+
+public:
+	// at most this many bins (integer volumes with a smaller range get one bin per value)
+	static const int MAX_BINS = 1024;
+
+	// exact range of the values, number of voxels and their mean
+	double min_value = 0.0;
+	double max_value = 0.0;
+	uint64_t total = 0;
+	double mean = 0.0;
+
+	// bin i counts the values in [min_value + i * bin_width, min_value + (i + 1) * bin_width); the
+	// width is a whole number for integer volumes, so every bin holds the same number of values
+	double bin_width = 1.0;
+	std::vector<uint64_t> counts;
+
+	bool empty() const {
+		return total == 0;
+	}
+
+	// Lower edge of a bin.
+	double bin_value(int bin) const {
+		return min_value + bin * bin_width;
+	}
+
+	/*
+	Value below which the given fraction (0..1) of the voxels lies, interpolated within its bin.
+
+	Args:
+		first_bin: (optional) ignore the voxels of the bins below this one
+	*/
+	double percentile(double fraction, int first_bin = 0) const {
+
+		uint64_t counted = 0;
+		for (size_t i = first_bin; i < counts.size(); i++)
+			counted += counts[i];
+		if (counted == 0)
+			return min_value;
+
+		double target = std::min(std::max(fraction, 0.0), 1.0) * counted;
+		double below = 0.0;
+		for (size_t i = first_bin; i < counts.size(); i++) {
+			if (counts[i] > 0 && below + counts[i] >= target) {
+				double value = bin_value((int)i) + bin_width * (target - below) / counts[i];
+				return std::min(std::max(value, min_value), max_value);
+			}
+			below += counts[i];
+		}
+		return max_value;
+	}
+
+	/*
+	Default window/level: from the low to the high percentile of the voxels. The lowest bin is left
+	out when it is a spike (more than a tenth of the volume), which is the padding outside the
+	field of view or the background around the patient; counting it would pull the window down to it.
+	*/
+	void auto_window(double& window, double& level, double low = 0.01, double high = 0.99) const {
+
+		int first_bin = counts.size() > 1 && counts[0] * 10 > total ? 1 : 0;
+		double a = percentile(low, first_bin);
+		double b = percentile(high, first_bin);
+		if (b - a < bin_width) {
+			a = min_value;
+			b = std::max(max_value, min_value + bin_width);
+		}
+		window = b - a;
+		level = (a + b) / 2;
+	}
+
+	/*
+	Build the histogram of an integer volume from its per-value counts.
+
+	Args:
+		value_counts: number of voxels with value first_value + i, for i in [0, n)
+	*/
+	static std::shared_ptr<intensity_histogram> from_values(const uint64_t* value_counts, size_t n, long long first_value) {
+
+		std::shared_ptr<intensity_histogram> out = std::make_shared<intensity_histogram>();
+
+		size_t lowest = 0, highest = n;
+		while (lowest < n && value_counts[lowest] == 0)
+			lowest++;
+		while (highest > lowest && value_counts[highest - 1] == 0)
+			highest--;
+		if (lowest == highest)
+			return out;
+
+		size_t values = highest - lowest;
+		size_t width = (values + MAX_BINS - 1) / MAX_BINS;
+		out->min_value = (double)(first_value + (long long)lowest);
+		out->max_value = (double)(first_value + (long long)highest - 1);
+		out->bin_width = (double)width;
+		out->counts.assign((values + width - 1) / width, 0);
+
+		double sum = 0.0;
+		for (size_t v = lowest; v < highest; v++) {
+			out->counts[(v - lowest) / width] += value_counts[v];
+			out->total += value_counts[v];
+			sum += (double)value_counts[v] * (double)(first_value + (long long)v);
+		}
+		out->mean = sum / out->total;
+		return out;
+	}
+};
+
+
+class histogram_builder {
+
+public:
+	// scalar_type: VTK scalar type of the voxels that will be added
+	explicit histogram_builder(int scalar_type) : scalar_type(scalar_type) {
+
+		switch (scalar_type) {
+		case VTK_CHAR: case VTK_SIGNED_CHAR: table_size = 256; first_value = -128; break;
+		case VTK_UNSIGNED_CHAR: table_size = 256; first_value = 0; break;
+		case VTK_SHORT: table_size = 65536; first_value = -32768; break;
+		case VTK_UNSIGNED_SHORT: table_size = 65536; first_value = 0; break;
+		default: table_size = 0; first_value = 0; break; // 32-bit integer (and float): range now, bins in finish()
+		}
+	}
+
+	histogram_builder(const histogram_builder&) = delete;
+	histogram_builder& operator=(const histogram_builder&) = delete;
+
+	// Count voxels (of the builder's scalar type). May be called from several threads at once.
+	void add(const void* voxels, size_t count) {
+
+		table* t = take_table();
+		switch (scalar_type) {
+		case VTK_CHAR: count_values(static_cast<const signed char*>(voxels), count, *t); break; // (char may be unsigned)
+		case VTK_SIGNED_CHAR: count_values(static_cast<const signed char*>(voxels), count, *t); break;
+		case VTK_UNSIGNED_CHAR: count_values(static_cast<const unsigned char*>(voxels), count, *t); break;
+		case VTK_SHORT: count_values(static_cast<const short*>(voxels), count, *t); break;
+		case VTK_UNSIGNED_SHORT: count_values(static_cast<const unsigned short*>(voxels), count, *t); break;
+		case VTK_INT: value_range(static_cast<const int*>(voxels), count, *t); break;
+		case VTK_UNSIGNED_INT: value_range(static_cast<const unsigned int*>(voxels), count, *t); break;
+		case VTK_FLOAT: value_range(static_cast<const float*>(voxels), count, *t); break;
+		case VTK_DOUBLE: value_range(static_cast<const double*>(voxels), count, *t); break;
+		}
+		return_table(t);
+	}
+
+	/*
+	Merge what has been added into the histogram. The whole volume is only read again for 32-bit
+	and float volumes, which are binned over the range found while adding.
+	*/
+	std::shared_ptr<const intensity_histogram> finish(const void* voxels, size_t count) {
+
+		if (table_size > 0) {
+			std::vector<uint64_t> merged(table_size, 0);
+			for (size_t t = 0; t < tables.size(); t++) {
+				const std::vector<uint64_t>& c = tables[t]->counts;
+				for (size_t v = 0; v < table_size; v++)
+					merged[v] += c[v];
+			}
+			tables.clear();
+			free_tables.clear();
+			return intensity_histogram::from_values(merged.data(), table_size, first_value);
+		}
+
+		switch (scalar_type) {
+		case VTK_INT: return bin_volume(static_cast<const int*>(voxels), count, true);
+		case VTK_UNSIGNED_INT: return bin_volume(static_cast<const unsigned int*>(voxels), count, true);
+		case VTK_FLOAT: return bin_volume(static_cast<const float*>(voxels), count, false);
+		case VTK_DOUBLE: return bin_volume(static_cast<const double*>(voxels), count, false);
+		default: return std::make_shared<intensity_histogram>();
+		}
+	}
+
+private:
+	// counts of one thread, or the value range and the bins of the second pass for wide types
+	struct table {
+		std::vector<uint64_t> counts;
+		double low = 0.0, high = 0.0;
+		bool seen = false;
+		double sum = 0.0;
+		uint64_t total = 0;
+	};
+
+	int scalar_type;
+	size_t table_size;
+	long long first_value;
+
+	// every table made so far, and those not being filled by a thread right now
+	std::mutex mutex;
+	std::vector<std::unique_ptr<table>> tables;
+	std::vector<table*> free_tables;
+
+	table* take_table(size_t size = 0) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!free_tables.empty()) {
+			table* t = free_tables.back();
+			free_tables.pop_back();
+			return t;
+		}
+		tables.push_back(std::unique_ptr<table>(new table()));
+		tables.back()->counts.assign(size > 0 ? size : table_size, 0);
+		return tables.back().get();
+	}
+
+	void return_table(table* t) {
+		std::lock_guard<std::mutex> lock(mutex);
+		free_tables.push_back(t);
+	}
+
+	template <class T>
+	void count_values(const T* values, size_t count, table& t) const {
+
+		uint64_t* counts = t.counts.data() - first_value; // counts[v] for v in the type's range
+		for (size_t i = 0; i < count; i++)
+			counts[values[i]]++;
+	}
+
+	template <class T>
+	static void value_range(const T* values, size_t count, table& t) {
+
+		if (count == 0)
+			return;
+		T low = values[0], high = values[0];
+		for (size_t i = 1; i < count; i++) {
+			low = std::min(low, values[i]);
+			high = std::max(high, values[i]);
+		}
+		t.low = t.seen ? std::min(t.low, (double)low) : (double)low;
+		t.high = t.seen ? std::max(t.high, (double)high) : (double)high;
+		t.seen = true;
+	}
+
+	// Second pass for 32-bit and float volumes: bin every voxel over the range found by add().
+	template <class T>
+	std::shared_ptr<const intensity_histogram> bin_volume(const T* values, size_t count, bool integer) {
+
+		std::shared_ptr<intensity_histogram> out = std::make_shared<intensity_histogram>();
+		bool seen = false;
+		for (size_t t = 0; t < tables.size(); t++) {
+			if (!tables[t]->seen)
+				continue;
+			out->min_value = seen ? std::min(out->min_value, tables[t]->low) : tables[t]->low;
+			out->max_value = seen ? std::max(out->max_value, tables[t]->high) : tables[t]->high;
+			seen = true;
+		}
+		tables.clear();
+		free_tables.clear();
+		if (!seen)
+			return out;
+
+		double span = out->max_value - out->min_value;
+		int bins;
+		if (integer) {
+			double width = std::ceil((span + 1) / intensity_histogram::MAX_BINS);
+			out->bin_width = width;
+			bins = (int)std::ceil((span + 1) / width);
+		}
+		else {
+			out->bin_width = span > 0 ? span / intensity_histogram::MAX_BINS : 1.0;
+			bins = span > 0 ? intensity_histogram::MAX_BINS : 1;
+		}
+
+		const size_t CHUNK = 1 << 20;
+		int num_chunks = (int)((count + CHUNK - 1) / CHUNK);
+		double low = out->min_value, scale = 1.0 / out->bin_width;
+		thread_pool::shared().parallel_for(num_chunks, [&](int c) {
+			table* t = take_table(bins);
+			size_t end = std::min(count, (c + 1) * CHUNK);
+			for (size_t i = c * CHUNK; i < end; i++) {
+				double x = ((double)values[i] - low) * scale;
+				int bin = x >= 0 ? (int)std::min(x, (double)(bins - 1)) : 0; // (NaN goes to bin 0)
+				t->counts[bin]++;
+				t->sum += (double)values[i];
+				t->total++;
+			}
+			return_table(t);
+		});
+
+		out->counts.assign(bins, 0);
+		double sum = 0.0;
+		for (size_t t = 0; t < tables.size(); t++) {
+			for (int b = 0; b < bins; b++)
+				out->counts[b] += tables[t]->counts[b];
+			sum += tables[t]->sum;
+			out->total += tables[t]->total;
+		}
+		tables.clear();
+		free_tables.clear();
+		out->mean = out->total > 0 ? sum / out->total : 0.0;
+		return out;
+	}
+};
@@ -0,0 +1,146 @@
+/*
+This header contains the dataset_loader class, which reads a DICOM series on a worker
+thread so the GUI stays responsive while the series is decoded.
+
+Usage (from the GUI thread):
+
+	dataset_loader* loader = new dataset_loader(dset_num, dicom_dir);
+	loader->start();   // progress(...) and finished(...) arrive back on the GUI thread
+
+Once finished() has been emitted the loaded volume can be taken from loader->result
+(if loader->succeeded). The loader is then deleted with deleteLater().
+
+If the directory holds several series, nothing is loaded: they are in loader->found, and the
+picked one is loaded by a second loader that is given that series (its headers are not parsed again).
+
+While the pixel data is being decoded, slices_ready(...) reports how many slices of loader->preview
+(the volume being filled in) are complete, so the viewports can show them before the load ends.
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// Qt header files
+#include <QCoreApplication>
+#include <QObject>
+#include <QThread>
+#include <QDir>
+
+// Our header files
+#include "dataset.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+
+class dataset_loader : public QObject {
+
+	Q_OBJECT
+public:
+	// which dataset this load is for
+	int dset_num;
+
+	// directory to read the series from, or the series picked from an earlier scan of it
+	QDir dicom_dir;
+	std::shared_ptr<const dicom_series> series;
+
+	// set from any thread to abort the load
+	std::atomic<bool> cancel_requested;
+
+	// output; only valid once finished() has been emitted
+	dataset result;
+	bool succeeded = false;
+	bool cancelled = false;
+
+	// series in the directory when there was more than one to choose from (nothing was loaded)
+	std::vector<dicom_series> found;
+
+	// the volume being decoded (zero where slices are still missing); valid once slices_ready() has been emitted
+	vtkSmartPointer<vtkImageData> preview;
+
+	// the worker thread the load runs on
+	QThread* thread;
+
+	dataset_loader(int dset_num, QDir dicom_dir) : dset_num(dset_num), dicom_dir(dicom_dir), cancel_requested(false) {
+		init();
+	}
+
+	dataset_loader(int dset_num, std::shared_ptr<const dicom_series> series) : dset_num(dset_num),
+		dicom_dir(QString::fromStdString(series->root)), series(series), cancel_requested(false) {
+		init();
+	}
+
+	// Start reading the series on the worker thread.
+	void start() {
+		thread->start();
+	}
+
+	// Ask the load to stop as soon as possible. finished() is still emitted (with cancelled = true).
+	void cancel() {
+		cancel_requested = true;
+	}
+
+	// Block until the worker thread has exited (used when the window closes mid-load, after the GUI
+	// event loop has stopped; the thread's deleteLater() is then never delivered, so the caller
+	// deletes the thread and the loader).
+	void wait() {
+		thread->wait();
+	}
+
+public slots:
+	// Runs on the worker thread.
+	void run() {
+
+		tracer::shared().set_thread_name("loader " + std::to_string(dset_num));
+
+		load_progress_fn report = [this](int done, int total) {
+			emit progress(dset_num, done, total);
+		};
+		if (series)
+			succeeded = result.load(*series, &cancel_requested, report);
+		else
+			succeeded = result.load(dicom_dir, &cancel_requested, report, true, &found);
+		cancelled = cancel_requested;
+
+		// the result is copied into the viewer; its callbacks point at this loader
+		result.on_allocated = volume_allocated_fn();
+		result.on_slices_decoded = slices_decoded_fn();
+
+		// hand the loader back to the GUI thread so it can be deleted there with deleteLater()
+		this->moveToThread(QCoreApplication::instance()->thread());
+
+		emit finished(dset_num);
+	}
+
+private:
+	// Hook the progressive display up to the result and move the loader to its worker thread.
+	void init() {
+
+		result.trace_dataset = dset_num;
+		result.on_allocated = [this](vtkImageData* volume) {
+			preview = volume;
+		};
+		result.on_slices_decoded = [this](int num_slices) {
+			emit slices_ready(this->dset_num, num_slices);
+		};
+
+		thread = new QThread();
+		this->moveToThread(thread);
+
+		connect(thread, SIGNAL(started()), this, SLOT(run()));
+		// (direct: the thread must stop even when the GUI event loop no longer runs, see wait())
+		connect(this, SIGNAL(finished(int)), thread, SLOT(quit()), Qt::DirectConnection);
+		connect(thread, SIGNAL(finished()), thread, SLOT(deleteLater()));
+	}
+
+signals:
+	// A file of the series has been read.
+	void progress(int dset_num, int files_done, int files_total);
+
+	// The first num_slices slices of the preview volume have been decoded.
+	void slices_ready(int dset_num, int num_slices);
+
+	// The load has ended (successfully, with an error, or because it was cancelled).
+	void finished(int dset_num);
+};
@@ -1,32 +1,93 @@
-
 // Qt header files
 #include <QApplication>
 #include <QCoreApplication>
 #include <QFile>
+#include <QStringList>
 
 // Our header files
 #include "ui.h"
+#include "batch.h"
+#include "render_service.h"
+#include "trace.h"
 
-void main()
+int main(int argc, char** argv)
 {
-	// dpi scaling
-	QApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
-	QApplication::setAttribute(Qt::AA_UseHighDpiPixmaps);
+	// --trace <file.json>: record spans from the start and write them as a Chrome trace on exit
+	QString trace_path;
+	bool batch_mode = false;
+	bool serve_mode = false;    // --serve: answer render requests on a local socket (see render_service.h)
+	bool cpu_composite = false; // --cpu-composite: start with CPU compositing of the slices on
+	bool cpu_volume = false;    // --cpu-volume: ray cast the volume view on the CPU
+	int memory_budget_mb = -1;  // --memory-budget <MB>: memory budget of all datasets (0 = no limit)
+	for (int i = 1; i < argc; i++) {
+		if (QString(argv[i]) == "--trace" && i + 1 < argc)
+			trace_path = argv[i + 1];
+		else if (QString(argv[i]) == "--batch")
+			batch_mode = true;
+		else if (QString(argv[i]) == "--serve")
+			serve_mode = true;
+		else if (QString(argv[i]) == "--cpu-composite")
+			cpu_composite = true;
+		else if (QString(argv[i]) == "--cpu-volume")
+			cpu_volume = true;
+		else if (QString(argv[i]) == "--memory-budget" && i + 1 < argc)
+			memory_budget_mb = QString(argv[i + 1]).toInt();
+	}
+
+	if (!trace_path.isEmpty()) {
+		tracer::shared().set_enabled(true);
+		tracer::shared().set_thread_name("main");
+	}
+
+	int exit_code;
+
+	// headless modes: render snapshots of the given series to PNG files and exit (see batch.h), or
+	// serve slice/volume images on a local socket until shut down (see render_service.h)
+	if (batch_mode || serve_mode) {
+		QCoreApplication app(argc, argv);
+
+		QStringList args = app.arguments().mid(1);
+		int trace_arg = args.indexOf("--trace");
+		if (trace_arg >= 0)
+			args.erase(args.begin() + trace_arg, args.begin() + std::min(trace_arg + 2, args.size()));
+
+		if (serve_mode) {
+			render_service service;
+			exit_code = service.run(args);
+		}
+		else {
+			batch_renderer batch;
+			exit_code = batch.run(args);
+		}
+	}
+	else {
+		// dpi scaling
+		QApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
+		QApplication::setAttribute(Qt::AA_UseHighDpiPixmaps);
+
+
+		// Create the Qt application
+		QApplication app(argc, argv);
 
+		// Create the user interface
+		ui myui;
+		myui.cpu_composite_action->setChecked(cpu_composite);
+		myui.cpu_volume_action->setChecked(cpu_volume);
+		if (memory_budget_mb >= 0)
+			myui.resources.budget_bytes = (size_t)memory_budget_mb * 1024 * 1024;
 
-	// Create the Qt application
-	int argc = 0;
-	QApplication app(argc, 0);
+		QFile file("../src/stylesheet.qss");
+		file.open(QFile::ReadOnly);
+		QString styleSheet = QLatin1String(file.readAll());
 
-	// Create the user interface
-	ui myui;
+		app.setStyleSheet(styleSheet);
 
-	QFile file("../src/stylesheet.qss");
-	file.open(QFile::ReadOnly);
-	QString styleSheet = QLatin1String(file.readAll());
+		// Start the Qt application event loop
+		exit_code = app.exec();
+	}
 
-	app.setStyleSheet(styleSheet);
+	if (!trace_path.isEmpty())
+		tracer::shared().write_chrome_json(trace_path);
 
-	// Start the Qt application event loop
-	app.exec();
+	return exit_code;
 }
@@ -0,0 +1,161 @@
+/*
+This header contains mapped_file, a read-only memory mapping of a whole file. Pages are
+only read from disk when they are touched, and the contents are used in place (no read
+buffers, no heap copies).
+
+	mapped_file file;
+	if (file.open(path))
+		parse(file.data(), file.size());
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // keep windows.h from defining min/max macros
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+class mapped_file {
+
+public:
+	// how the pages are going to be accessed (a hint for the OS read-ahead)
+	enum access_hint { ACCESS_NORMAL, ACCESS_SEQUENTIAL };
+
+	mapped_file() {}
+
+	~mapped_file() {
+		close();
+	}
+
+	// mappings are owned by exactly one object
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	/*
+	Map the whole file. Returns false if the file cannot be opened or is empty.
+
+	Args:
+		path: file path (UTF-8)
+		copy_on_write: map the pages writable but private; writes never reach the file
+			(needed when the mapping backs a vtkDataArray, which VTK treats as writable)
+	*/
+	bool open(const std::string& path, bool copy_on_write = false) {
+
+		close();
+
+#ifdef _WIN32
+		int wide_length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, NULL, 0);
+		std::wstring wide_path(wide_length, L'\0');
+		MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, &wide_path[0], wide_length);
+
+		file_handle = CreateFileW(wide_path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file_handle == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0) {
+			close();
+			return false;
+		}
+		length = (size_t)file_size.QuadPart;
+
+		mapping_handle = CreateFileMappingW(file_handle, NULL, copy_on_write ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+		if (mapping_handle == NULL) {
+			close();
+			return false;
+		}
+
+		bytes = static_cast<unsigned char*>(MapViewOfFile(mapping_handle, copy_on_write ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+		if (bytes == NULL) {
+			close();
+			return false;
+		}
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size == 0) {
+			::close(fd);
+			return false;
+		}
+		length = (size_t)info.st_size;
+
+		void* address = mmap(NULL, length, copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // the mapping keeps its own reference to the file
+
+		if (address == MAP_FAILED) {
+			length = 0;
+			return false;
+		}
+		bytes = static_cast<unsigned char*>(address);
+#endif
+
+		return true;
+	}
+
+	void close() {
+
+#ifdef _WIN32
+		if (bytes != NULL)
+			UnmapViewOfFile(bytes);
+		if (mapping_handle != NULL)
+			CloseHandle(mapping_handle);
+		if (file_handle != INVALID_HANDLE_VALUE)
+			CloseHandle(file_handle);
+		mapping_handle = NULL;
+		file_handle = INVALID_HANDLE_VALUE;
+#else
+		if (bytes != NULL)
+			munmap(bytes, length);
+#endif
+		bytes = NULL;
+		length = 0;
+	}
+
+	// Tell the OS how the mapping will be read (no-op where unsupported).
+	void advise(access_hint hint) {
+
+#ifndef _WIN32
+		if (bytes != NULL)
+			madvise(bytes, length, hint == ACCESS_SEQUENTIAL ? MADV_SEQUENTIAL : MADV_NORMAL);
+#else
+		(void)hint;
+#endif
+	}
+
+	bool is_open() const {
+		return bytes != NULL;
+	}
+
+	unsigned char* data() const {
+		return bytes;
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+private:
+	unsigned char* bytes = NULL;
+	size_t length = 0;
+
+#ifdef _WIN32
+	HANDLE file_handle = INVALID_HANDLE_VALUE;
+	HANDLE mapping_handle = NULL;
+#endif
+};
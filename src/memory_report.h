@@ -0,0 +1,266 @@
+/*
+This header contains memory_report, a breakdown of the memory a loaded study costs: per
+dataset the decoded volume, the slice cache, the volume pyramid, the slab and ray caster
+buffers, the images of the visible slices, and an estimate of the GPU textures; plus the
+buffers shared by all datasets and the resident memory of the process next to the memory
+still available on the machine (several viewer instances share one workstation). Datasets the
+resource manager evicted (resource_manager.h) are listed with the budget, holding nothing.
+
+Volumes are stored in their native scalar type (16-bit series stay 16-bit); only the visible
+slices are colour mapped to RGBA. A volume mapped from the volume cache (volume_cache.h) is
+listed separately, since its pages belong to the page cache and are shared between instances.
+
+The ui fills in the numbers (it owns the pipelines), see ui::collect_memory():
+
+	memory_report report;
+	report.datasets.push_back(dataset_memory());
+	report.datasets[0].volume = memory_report::image_bytes(dset.image);
+	...
+	cout << report.to_text().toStdString();
+	report.write_json("memory.json");
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+
+// Qt header files
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // keep windows.h from defining min/max macros
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <unistd.h>
+#endif
+
+
+// Bytes held for one dataset, by owner.
+struct dataset_memory {
+	int id = 0;                // "Dataset <id>"
+	bool loaded = false;
+	bool visible = true;
+	bool evicted = false;      // dropped by the resource manager, loaded again when shown
+	std::string scalar_type;   // native type the volume is stored in
+	int dimensions[3] = { 0, 0, 0 };
+
+	size_t volume = 0;         // decoded voxels on the heap
+	size_t volume_mapped = 0;  // voxels mapped from the volume cache file (page cache)
+	size_t slice_cache = 0;    // raw slices cached/prefetched for the slice views
+	size_t pyramid = 0;        // downsampled levels of the volume view
+	size_t slice_images = 0;   // reslice outputs and colour mapped images of the visible slices
+	size_t slab = 0;           // sliding window buffers of the thick-slab projection
+	size_t raycaster = 0;      // macro cell grid and tables of the CPU ray caster
+	size_t gpu_volume = 0;     // estimate: 3D textures of the volume mappers that have rendered
+	size_t gpu_slices = 0;     // estimate: RGBA textures of the slice actors
+
+	// host memory (mapped volume pages included)
+	size_t host_total() const {
+		return volume + volume_mapped + slice_cache + pyramid + slice_images + slab + raycaster;
+	}
+
+	size_t gpu_total() const {
+		return gpu_volume + gpu_slices;
+	}
+};
+
+
+class memory_report {
+
+public:
+	std::vector<dataset_memory> datasets;
+
+	size_t shared_images = 0;  // composited slices and the ray cast image (all datasets)
+	size_t shared_gpu = 0;     // estimate: their textures
+
+	size_t process_resident = 0;  // resident memory of this process
+	size_t system_available = 0;  // memory the system can still hand out (0 = unknown)
+	size_t budget = 0;            // memory budget of the datasets (0 = no limit)
+
+	// Bytes of an image's scalars (0 for NULL or an image without scalars).
+	static size_t image_bytes(vtkImageData* image) {
+
+		if (image == NULL || image->GetPointData()->GetScalars() == NULL)
+			return 0;
+		return (size_t)image->GetNumberOfPoints() * image->GetScalarSize() * image->GetNumberOfScalarComponents();
+	}
+
+	// Bytes of the RGBA texture a slice image becomes on the GPU.
+	static size_t texture_bytes(vtkImageData* image) {
+
+		if (image == NULL)
+			return 0;
+		return (size_t)image->GetNumberOfPoints() * 4;
+	}
+
+	// Fill in the process and system figures.
+	void measure_process() {
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+			process_resident = counters.WorkingSetSize;
+
+		MEMORYSTATUSEX status;
+		status.dwLength = sizeof(status);
+		if (GlobalMemoryStatusEx(&status))
+			system_available = (size_t)status.ullAvailPhys;
+#else
+		long page = sysconf(_SC_PAGESIZE);
+		unsigned long long size = 0, resident = 0;
+		FILE* statm = fopen("/proc/self/statm", "r");
+		if (statm != NULL) {
+			if (fscanf(statm, "%llu %llu", &size, &resident) == 2)
+				process_resident = (size_t)(resident * page);
+			fclose(statm);
+		}
+
+		FILE* meminfo = fopen("/proc/meminfo", "r");
+		if (meminfo != NULL) {
+			char line[256];
+			unsigned long long kb;
+			while (fgets(line, sizeof(line), meminfo) != NULL) {
+				if (sscanf(line, "MemAvailable: %llu kB", &kb) == 1) {
+					system_available = (size_t)(kb * 1024);
+					break;
+				}
+			}
+			fclose(meminfo);
+		}
+#endif
+	}
+
+	// Host memory of all datasets and the shared images.
+	size_t host_total() const {
+
+		size_t total = shared_images;
+		for (size_t d = 0; d < datasets.size(); d++)
+			total += datasets[d].host_total();
+		return total;
+	}
+
+	size_t gpu_total() const {
+
+		size_t total = shared_gpu;
+		for (size_t d = 0; d < datasets.size(); d++)
+			total += datasets[d].gpu_total();
+		return total;
+	}
+
+	// Human readable table (for a message box or the console).
+	QString to_text() const {
+
+		QString text;
+		for (size_t d = 0; d < datasets.size(); d++) {
+			const dataset_memory& m = datasets[d];
+			text += "Dataset " + QString::number(m.id) + ": ";
+			if (m.evicted) {
+				text += "evicted (loaded again when shown)\n\n";
+				continue;
+			}
+			if (!m.loaded) {
+				text += "not loaded\n\n";
+				continue;
+			}
+			text += QString::number(m.dimensions[0]) + " x " + QString::number(m.dimensions[1]) + " x " +
+				QString::number(m.dimensions[2]) + " " + QString::fromStdString(m.scalar_type) +
+				(m.visible ? "" : " (hidden)") + "\n";
+			text += line("  Volume", m.volume);
+			if (m.volume_mapped > 0)
+				text += line("  Volume (mapped from cache)", m.volume_mapped);
+			text += line("  Slice cache", m.slice_cache);
+			text += line("  Volume pyramid", m.pyramid);
+			text += line("  Visible slice images", m.slice_images);
+			text += line("  Slab buffers", m.slab);
+			text += line("  CPU ray caster", m.raycaster);
+			text += line("  GPU volume textures (est.)", m.gpu_volume);
+			text += line("  GPU slice textures (est.)", m.gpu_slices);
+			text += line("  Host total", m.host_total()) + "\n";
+		}
+
+		text += line("Shared images (composite, ray cast)", shared_images);
+		text += line("Host total", host_total());
+		if (budget > 0)
+			text += line("Memory budget", budget);
+		text += line("GPU total (est.)", gpu_total());
+		text += line("Process resident", process_resident);
+		if (system_available > 0)
+			text += line("Available on this machine", system_available);
+		return text;
+	}
+
+	QJsonObject to_json() const {
+
+		QJsonObject report;
+		QJsonArray dsets;
+		for (size_t d = 0; d < datasets.size(); d++) {
+			const dataset_memory& m = datasets[d];
+			QJsonObject dset;
+			dset["id"] = m.id;
+			dset["loaded"] = m.loaded;
+			dset["visible"] = m.visible;
+			dset["evicted"] = m.evicted;
+			if (m.loaded) {
+				dset["scalar_type"] = QString::fromStdString(m.scalar_type);
+				dset["dimensions"] = QString::number(m.dimensions[0]) + "x" + QString::number(m.dimensions[1]) + "x" +
+					QString::number(m.dimensions[2]);
+			}
+			dset["volume_bytes"] = (double)m.volume;
+			dset["volume_mapped_bytes"] = (double)m.volume_mapped;
+			dset["slice_cache_bytes"] = (double)m.slice_cache;
+			dset["pyramid_bytes"] = (double)m.pyramid;
+			dset["slice_image_bytes"] = (double)m.slice_images;
+			dset["slab_bytes"] = (double)m.slab;
+			dset["raycaster_bytes"] = (double)m.raycaster;
+			dset["gpu_volume_bytes_estimate"] = (double)m.gpu_volume;
+			dset["gpu_slice_bytes_estimate"] = (double)m.gpu_slices;
+			dset["host_total_bytes"] = (double)m.host_total();
+			dsets.append(dset);
+		}
+		report["datasets"] = dsets;
+
+		report["shared_image_bytes"] = (double)shared_images;
+		report["shared_gpu_bytes_estimate"] = (double)shared_gpu;
+		report["host_total_bytes"] = (double)host_total();
+		report["budget_bytes"] = (double)budget;
+		report["gpu_total_bytes_estimate"] = (double)gpu_total();
+		report["process_resident_bytes"] = (double)process_resident;
+		report["system_available_bytes"] = (double)system_available;
+		return report;
+	}
+
+	// Write to_json() to a file. Returns false if the file could not be written.
+	bool write_json(const QString& path) const {
+
+		QFile file(path);
+		QByteArray json = QJsonDocument(to_json()).toJson();
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+			cout << "umm could not write memory report to " << path.toStdString() << "\n";
+			return false;
+		}
+		return true;
+	}
+
+	// "12.3 MB"
+	static QString megabytes(size_t bytes) {
+		return QString::number(bytes / (1024.0 * 1024.0), 'f', 1) + " MB";
+	}
+
+private:
+	static QString line(const QString& label, size_t bytes) {
+		return label + ": " + megabytes(bytes) + "\n";
+	}
+};
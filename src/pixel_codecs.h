@@ -0,0 +1,570 @@
+/*
+This header contains the decoders for compressed (encapsulated) DICOM pixel data:
+
+	RLE Lossless             1.2.840.10008.1.2.5      PackBits byte planes (PS3.5 Annex G)
+	JPEG Lossless            1.2.840.10008.1.2.4.57   Huffman coded prediction differences (T.81 process 14)
+	JPEG Lossless, SV1       1.2.840.10008.1.2.4.70
+	JPEG Baseline            1.2.840.10008.1.2.4.50   8-bit DCT, decoded by OpenCV (libjpeg)
+	JPEG Extended            1.2.840.10008.1.2.4.51   8-bit images only (OpenCV's libjpeg has no 12-bit)
+
+JPEG-LS and JPEG 2000 files are rejected with an error naming the transfer syntax.
+
+split_frames() finds the compressed bytes of each frame among the fragments of the pixel data
+element; decode() turns one frame into native little endian samples, first row first (the layout
+of uncompressed pixel data), which the reader then copies into the volume like any other file.
+Every call works on its own buffers, so frames can be decoded on all cores at once.
+
+	std::vector<encoded_frame> frames;
+	pixel_codecs::split_frames(file + hdr.pixel_offset, size - hdr.pixel_offset, hdr.number_of_frames, frames, error);
+	pixel_codecs::decode(hdr, frames[0], native, error);
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// OpenCV header files
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+// Our header files
+#include "dicom_parser.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+// compressed transfer syntax UIDs the decoders handle
+#define TS_RLE_LOSSLESS "1.2.840.10008.1.2.5"
+#define TS_JPEG_BASELINE "1.2.840.10008.1.2.4.50"
+#define TS_JPEG_EXTENDED "1.2.840.10008.1.2.4.51"
+#define TS_JPEG_LOSSLESS "1.2.840.10008.1.2.4.57"
+#define TS_JPEG_LOSSLESS_SV1 "1.2.840.10008.1.2.4.70"
+
+
+// The compressed bytes of one frame (joined only if the frame spans several fragments).
+struct encoded_frame {
+	const unsigned char* data = NULL;
+	size_t size = 0;
+	std::vector<unsigned char> joined;
+};
+
+
+class pixel_codecs {
+
+public:
+	static bool is_supported(const std::string& transfer_syntax) {
+		return transfer_syntax == TS_RLE_LOSSLESS || transfer_syntax == TS_JPEG_BASELINE || transfer_syntax == TS_JPEG_EXTENDED ||
+			transfer_syntax == TS_JPEG_LOSSLESS || transfer_syntax == TS_JPEG_LOSSLESS_SV1;
+	}
+
+	/*
+	Split encapsulated pixel data into frames: the basic offset table (first item) gives where each
+	frame starts; without one, a single frame is made of every fragment, and several frames need
+	one fragment each.
+
+	Args:
+		data, size: the pixel data value (the first item, up to the end of the file)
+		number_of_frames: frames in the file
+		frames: receives one entry per frame (pointing into data)
+	*/
+	static bool split_frames(const unsigned char* data, size_t size, int number_of_frames, std::vector<encoded_frame>& frames,
+		std::string& error) {
+
+		std::vector<uint32_t> offsets; // basic offset table
+		std::vector<std::pair<size_t, size_t>> fragments; // (position of the item, length)
+		size_t pos = 0;
+		bool first = true;
+
+		while (true) {
+			if (pos + 8 > size) {
+				error = "encapsulated pixel data is truncated";
+				return false;
+			}
+			uint32_t tag = (uint32_t)read16(data + pos) << 16 | read16(data + pos + 2);
+			uint32_t length = read32(data + pos + 4);
+			if (tag == 0xFFFEE0DD)
+				break;
+			if (tag != 0xFFFEE000 || length == 0xFFFFFFFF || pos + 8 + length > size) {
+				error = "corrupt encapsulated pixel data";
+				return false;
+			}
+
+			if (first) {
+				for (uint32_t i = 0; i + 4 <= length; i += 4)
+					offsets.push_back(read32(data + pos + 8 + i));
+				first = false;
+			}
+			else {
+				fragments.push_back(std::make_pair(pos, (size_t)length));
+			}
+			pos += 8 + length;
+		}
+
+		if (fragments.empty()) {
+			error = "encapsulated pixel data has no fragments";
+			return false;
+		}
+
+		// which fragments belong to which frame
+		std::vector<size_t> frame_start(number_of_frames + 1, fragments.size());
+		if (number_of_frames == 1) {
+			frame_start[0] = 0;
+		}
+		else if ((int)offsets.size() == number_of_frames) {
+			size_t base = fragments[0].first; // offsets count from the first fragment's item tag
+			size_t f = 0;
+			for (int i = 0; i < number_of_frames; i++) {
+				while (f < fragments.size() && fragments[f].first - base < offsets[i])
+					f++;
+				if (f == fragments.size() || fragments[f].first - base != offsets[i]) {
+					error = "basic offset table does not match the fragments";
+					return false;
+				}
+				frame_start[i] = f;
+			}
+		}
+		else if ((int)fragments.size() == number_of_frames) {
+			for (int i = 0; i < number_of_frames; i++)
+				frame_start[i] = i;
+		}
+		else {
+			error = "cannot tell which fragments make up each frame";
+			return false;
+		}
+
+		frames.assign(number_of_frames, encoded_frame());
+		for (int i = 0; i < number_of_frames; i++) {
+			encoded_frame& frame = frames[i];
+			size_t begin = frame_start[i], end = frame_start[i + 1];
+			if (end - begin == 1) {
+				frame.data = data + fragments[begin].first + 8;
+				frame.size = fragments[begin].second;
+				continue;
+			}
+			for (size_t f = begin; f < end; f++) {
+				const unsigned char* fragment = data + fragments[f].first + 8;
+				frame.joined.insert(frame.joined.end(), fragment, fragment + fragments[f].second);
+			}
+			frame.data = frame.joined.data();
+			frame.size = frame.joined.size();
+		}
+		return true;
+	}
+
+	/*
+	Decode one frame into native samples.
+
+	Args:
+		hdr: header of the file (transfer syntax, rows, columns, bits allocated, pixel representation)
+		frame: the compressed frame
+		out: rows * columns * bits_allocated / 8 bytes, little endian samples, first row first
+	*/
+	static bool decode(const dicom_header& hdr, const encoded_frame& frame, unsigned char* out, std::string& error) {
+
+		if (hdr.samples_per_pixel != 1) {
+			error = "compressed images with several samples per pixel are not supported";
+			return false;
+		}
+
+		const std::string& ts = hdr.transfer_syntax;
+		if (ts == TS_RLE_LOSSLESS)
+			return decode_rle(hdr, frame.data, frame.size, out, error);
+		if (ts == TS_JPEG_LOSSLESS || ts == TS_JPEG_LOSSLESS_SV1)
+			return decode_jpeg_lossless(hdr, frame.data, frame.size, out, error);
+		if (ts == TS_JPEG_BASELINE || ts == TS_JPEG_EXTENDED)
+			return decode_jpeg_dct(hdr, frame.data, frame.size, out, error);
+
+		error = "compressed transfer syntax " + ts + " is not supported";
+		return false;
+	}
+
+private:
+	static uint16_t read16(const unsigned char* p) {
+		return (uint16_t)(p[0] | p[1] << 8);
+	}
+
+	static uint32_t read32(const unsigned char* p) {
+		return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+	}
+
+	// S================== RLE =================== //
+
+	/*
+	RLE Lossless: a 64 byte header (segment count + 15 offsets), then one PackBits segment per
+	byte of a sample, most significant byte first.
+	*/
+	static bool decode_rle(const dicom_header& hdr, const unsigned char* data, size_t size, unsigned char* out, std::string& error) {
+
+		int bytes = hdr.bits_allocated / 8;
+		size_t pixels = (size_t)hdr.rows * hdr.columns;
+
+		if (size < 64 || (int)read32(data) != bytes) {
+			error = "RLE header does not match the image";
+			return false;
+		}
+
+		for (int s = 0; s < bytes; s++) {
+			size_t begin = read32(data + 4 + 4 * s);
+			size_t end = s + 1 < bytes ? read32(data + 8 + 4 * s) : size;
+			if (begin < 64 || begin > end || end > size) {
+				error = "corrupt RLE segment offsets";
+				return false;
+			}
+			// segment s holds byte (bytes - 1 - s) of each little endian sample
+			if (!unpack_bits(data + begin, end - begin, out + (bytes - 1 - s), bytes, pixels)) {
+				error = "RLE segment is too short";
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// PackBits: n >= 0 copies n + 1 bytes, -127 <= n < 0 repeats the next byte 1 - n times.
+	static bool unpack_bits(const unsigned char* src, size_t size, unsigned char* dst, int stride, size_t count) {
+
+		size_t pos = 0, done = 0;
+		while (done < count && pos < size) {
+			int n = (signed char)src[pos++];
+			if (n >= 0) {
+				size_t run = std::min((size_t)n + 1, std::min(count - done, size - pos));
+				for (size_t i = 0; i < run; i++)
+					dst[(done + i) * stride] = src[pos + i];
+				pos += n + 1;
+				done += run;
+			}
+			else if (n != -128 && pos < size) {
+				size_t run = std::min((size_t)(1 - n), count - done);
+				unsigned char value = src[pos++];
+				for (size_t i = 0; i < run; i++)
+					dst[(done + i) * stride] = value;
+				done += run;
+			}
+		}
+		return done == count;
+	}
+
+	// S================== JPEG LOSSLESS =================== //
+
+	// A DC Huffman table: canonical codes by length, with a 9-bit lookup for the short ones.
+	struct huffman_table {
+		bool defined = false;
+		int maxcode[17];
+		int mincode[17];
+		int valptr[17];
+		int num_values = 0;
+		unsigned char values[256];
+		uint16_t lookup[512]; // (code length << 8) | value, 0 = longer code
+
+		/*
+		Build the table from the DHT counts (codes per length 1..16) and symbols (num_symbols <= 256,
+		the sum of counts). Returns false (and leaves the table undefined) if the counts ask for more
+		codes of a length than there are.
+		*/
+		bool build(const unsigned char counts[16], const unsigned char* symbols, int num_symbols) {
+
+			defined = false;
+			num_values = num_symbols;
+			memcpy(values, symbols, num_symbols);
+			memset(lookup, 0, sizeof(lookup));
+
+			int code = 0, k = 0;
+			for (int length = 1; length <= 16; length++) {
+				if (code + counts[length - 1] > 1 << length)
+					return false; // over-subscribed: codes of this length would not fit in length bits
+				valptr[length] = k;
+				mincode[length] = code;
+				for (int i = 0; i < counts[length - 1]; i++, code++, k++) {
+					if (length <= 9) {
+						int first = code << (9 - length);
+						for (int j = 0; j < 1 << (9 - length); j++)
+							lookup[first + j] = (uint16_t)(length << 8 | values[k]);
+					}
+				}
+				maxcode[length] = counts[length - 1] ? code - 1 : -1;
+				code <<= 1;
+			}
+			defined = true;
+			return true;
+		}
+	};
+
+	// Entropy coded data: skips stuffed zero bytes and stops (feeding zeros) at a marker.
+	struct bit_reader {
+		const unsigned char* data;
+		size_t size;
+		size_t pos;
+		uint32_t bits = 0;
+		int count = 0;
+		bool at_marker = false;
+
+		bit_reader(const unsigned char* data, size_t size, size_t pos) : data(data), size(size), pos(pos) {}
+
+		void fill() {
+			while (count <= 24) {
+				unsigned int byte = 0;
+				if (!at_marker && pos < size) {
+					byte = data[pos];
+					if (byte == 0xFF) {
+						if (pos + 1 < size && data[pos + 1] == 0x00)
+							pos += 2;
+						else {
+							at_marker = true;
+							byte = 0;
+						}
+					}
+					else {
+						pos++;
+					}
+				}
+				bits |= byte << (24 - count);
+				count += 8;
+			}
+		}
+
+		int peek(int n) {
+			fill();
+			return (int)(bits >> (32 - n));
+		}
+
+		void skip(int n) {
+			bits <<= n;
+			count -= n;
+		}
+
+		int get(int n) {
+			if (n == 0)
+				return 0;
+			int value = peek(n);
+			skip(n);
+			return value;
+		}
+
+		// Drop the padding before a restart marker and step over the marker.
+		void restart() {
+			bits = 0;
+			count = 0;
+			at_marker = false;
+			while (pos + 1 < size && !(data[pos] == 0xFF && data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7))
+				pos++;
+			pos = std::min(pos + 2, size);
+		}
+
+		// The next Huffman coded symbol (-1 for an invalid code).
+		int decode(const huffman_table& table) {
+
+			int entry = table.lookup[peek(9)];
+			if (entry != 0) {
+				skip(entry >> 8);
+				return entry & 0xFF;
+			}
+			int code = peek(16);
+			for (int length = 10; length <= 16; length++) {
+				int prefix = code >> (16 - length);
+				if (prefix <= table.maxcode[length]) {
+					int index = table.valptr[length] + prefix - table.mincode[length];
+					if (prefix < table.mincode[length] || index >= table.num_values)
+						return -1;
+					skip(length);
+					return table.values[index];
+				}
+			}
+			return -1;
+		}
+	};
+
+	/*
+	Lossless JPEG (process 14, one component): every sample is a prediction from its neighbours
+	(left, above, above-left, per the predictor of the scan) plus a Huffman coded difference.
+	*/
+	static bool decode_jpeg_lossless(const dicom_header& hdr, const unsigned char* data, size_t size, unsigned char* out,
+		std::string& error) {
+
+		huffman_table tables[4];
+		int precision = 0, height = 0, width = 0, restart_interval = 0;
+		int predictor = 1, point_transform = 0, table_id = 0;
+		size_t pos = 2;
+
+		if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+			error = "not a JPEG stream";
+			return false;
+		}
+
+		// markers up to the start of scan
+		while (true) {
+			while (pos < size && data[pos] != 0xFF)
+				pos++;
+			while (pos < size && data[pos] == 0xFF)
+				pos++;
+			if (pos + 2 >= size) {
+				error = "JPEG stream ends before the scan";
+				return false;
+			}
+			int marker = data[pos++];
+			size_t length = (size_t)data[pos] << 8 | data[pos + 1];
+			const unsigned char* segment = data + pos + 2;
+			if (length < 2 || pos + length > size) {
+				error = "corrupt JPEG marker segment";
+				return false;
+			}
+
+			if (marker == 0xC3) { // SOF3
+				if (length < 11 || segment[5] != 1) {
+					error = "only single component lossless JPEG is supported";
+					return false;
+				}
+				precision = segment[0];
+				height = segment[1] << 8 | segment[2];
+				width = segment[3] << 8 | segment[4];
+			}
+			else if ((marker >= 0xC0 && marker <= 0xCF) && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+				error = "JPEG frame type is not lossless Huffman (SOF" + std::to_string(marker - 0xC0) + ")";
+				return false;
+			}
+			else if (marker == 0xC4) { // DHT
+				size_t p = 0;
+				while (p + 17 <= length - 2) {
+					int id = segment[p] & 0x0F;
+					const unsigned char* counts = segment + p + 1;
+					int num_symbols = 0;
+					for (int i = 0; i < 16; i++)
+						num_symbols += counts[i];
+					if (id > 3 || num_symbols > 256 || p + 17 + num_symbols > length - 2) {
+						error = "corrupt JPEG Huffman table";
+						return false;
+					}
+					if (!tables[id].build(counts, segment + p + 17, num_symbols)) {
+						error = "corrupt JPEG Huffman table";
+						return false;
+					}
+					p += 17 + num_symbols;
+				}
+			}
+			else if (marker == 0xDD && length >= 4) { // DRI
+				restart_interval = segment[0] << 8 | segment[1];
+			}
+			else if (marker == 0xDA) { // SOS
+				if (length < 8 || segment[0] != 1) {
+					error = "only single component lossless JPEG is supported";
+					return false;
+				}
+				table_id = segment[2] >> 4;
+				predictor = segment[3];
+				point_transform = segment[5] & 0x0F;
+				pos += length;
+				break;
+			}
+			pos += length;
+		}
+
+		if (height == 0)
+			height = hdr.rows;
+		if (width != hdr.columns || height != hdr.rows || precision < 2 || precision > 16 || precision > hdr.bits_allocated) {
+			error = "JPEG image does not match the DICOM header";
+			return false;
+		}
+		if (table_id > 3 || !tables[table_id].defined || predictor < 1 || predictor > 7 || point_transform >= precision) {
+			error = "JPEG scan refers to a missing Huffman table, predictor or point transform";
+			return false;
+		}
+
+		bit_reader reader(data, size, pos);
+		const huffman_table& table = tables[table_id];
+		std::vector<int> rows[2] = { std::vector<int>(width), std::vector<int>(width) };
+		int initial = 1 << (precision - point_transform - 1);
+		int bytes = hdr.bits_allocated / 8;
+		bool sign_extend = hdr.pixel_representation == 1 && precision < 8 * bytes;
+
+		bool restarted = true; // the next sample starts the scan or a restart interval
+		int first_row = 0;     // rows of the current restart interval start here
+		int samples_left = restart_interval;
+
+		for (int y = 0; y < height; y++) {
+			std::vector<int>& row = rows[y & 1];
+			const std::vector<int>& above = rows[(y + 1) & 1];
+
+			for (int x = 0; x < width; x++) {
+				if (restart_interval > 0 && samples_left == 0) {
+					reader.restart();
+					samples_left = restart_interval;
+					restarted = true;
+					first_row = y;
+				}
+				samples_left--;
+
+				int prediction;
+				if (restarted)
+					prediction = initial;
+				else if (y == first_row)
+					prediction = row[x - 1];
+				else if (x == 0)
+					prediction = above[0];
+				else
+					prediction = predict(predictor, row[x - 1], above[x], above[x - 1]);
+				restarted = false;
+
+				int category = reader.decode(table);
+				if (category < 0 || category > 16) {
+					error = "corrupt JPEG entropy coded data";
+					return false;
+				}
+				int difference;
+				if (category == 16)
+					difference = 32768;
+				else {
+					difference = reader.get(category);
+					if (category > 0 && difference < 1 << (category - 1))
+						difference += 1 - (1 << category);
+				}
+				row[x] = (prediction + difference) & 0xFFFF;
+
+				int value = (row[x] << point_transform) & 0xFFFF;
+				if (sign_extend && (value & (1 << (precision - 1))))
+					value |= ~((1 << precision) - 1);
+
+				unsigned char* sample = out + ((size_t)y * width + x) * bytes;
+				sample[0] = (unsigned char)value;
+				if (bytes > 1)
+					sample[1] = (unsigned char)(value >> 8);
+			}
+		}
+		return true;
+	}
+
+	static int predict(int predictor, int a, int b, int c) {
+
+		switch (predictor) {
+		case 1: return a;
+		case 2: return b;
+		case 3: return c;
+		case 4: return a + b - c;
+		case 5: return a + ((b - c) >> 1);
+		case 6: return b + ((a - c) >> 1);
+		default: return (a + b) >> 1;
+		}
+	}
+
+	// S================== JPEG BASELINE/EXTENDED =================== //
+
+	// 8-bit DCT JPEG through OpenCV's codec.
+	static bool decode_jpeg_dct(const dicom_header& hdr, const unsigned char* data, size_t size, unsigned char* out,
+		std::string& error) {
+
+		if (hdr.bits_allocated != 8) {
+			error = "only 8-bit JPEG baseline/extended images are supported";
+			return false;
+		}
+
+		cv::Mat image = cv::imdecode(cv::Mat(1, (int)size, CV_8UC1, const_cast<unsigned char*>(data)), cv::IMREAD_GRAYSCALE);
+		if (image.empty() || image.rows != hdr.rows || image.cols != hdr.columns || image.type() != CV_8UC1) {
+			error = "JPEG image could not be decoded or does not match the DICOM header";
+			return false;
+		}
+
+		for (int y = 0; y < image.rows; y++)
+			memcpy(out + (size_t)y * hdr.columns, image.ptr<unsigned char>(y), hdr.columns);
+		return true;
+	}
+};
@@ -0,0 +1,122 @@
+/*
+This header contains render_scheduler, which coalesces render requests. Slots that change
+what a viewport shows call request(viewport) instead of rendering; every viewport that was
+requested is then rendered once at the next display frame, however many requests came in
+meanwhile. When nothing has been rendered for a frame, the render happens right away (on
+the next pass of the event loop), so a single change is not delayed.
+
+	render_scheduler* scheduler = new render_scheduler(4, [this](int i) { window_arr[i]->Render(); }, this);
+	scheduler->request(AXIAL);
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// Qt header files
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QObject>
+#include <QScreen>
+#include <QTimer>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+
+// Counters since the scheduler was created (or reset).
+struct render_stats {
+	long long requests = 0;   // request() calls
+	long long renders = 0;    // Render() calls actually made
+	long long coalesced = 0;  // requests that were folded into a render already pending
+	long long frames = 0;     // frames that rendered at least one viewport
+};
+
+
+class render_scheduler : public QObject {
+
+	Q_OBJECT
+public:
+	/*
+	Args:
+		num_viewports: viewports are numbered 0 .. num_viewports - 1
+		render_fn: renders one viewport
+		parent: owning QObject
+	*/
+	render_scheduler(int num_viewports, std::function<void(int)> render_fn, QObject* parent = NULL)
+		: QObject(parent), render_fn(render_fn), dirty(num_viewports, false) {
+
+		// one frame at the refresh rate of the primary screen (60 Hz if unknown)
+		double refresh_rate = 60.0;
+		if (QGuiApplication::primaryScreen() != NULL && QGuiApplication::primaryScreen()->refreshRate() > 1.0)
+			refresh_rate = QGuiApplication::primaryScreen()->refreshRate();
+		frame_ms = std::max(1, (int)(1000.0 / refresh_rate));
+
+		timer.setSingleShot(true);
+		connect(&timer, SIGNAL(timeout()), this, SLOT(flush()));
+		since_last_frame.start();
+	}
+
+	// Mark a viewport as needing a render at the next frame.
+	void request(int viewport) {
+
+		stats.requests++;
+		if (dirty[viewport]) {
+			stats.coalesced++;
+			return;
+		}
+		dirty[viewport] = true;
+
+		if (!timer.isActive()) {
+			int wait = frame_ms - (int)since_last_frame.elapsed();
+			timer.start(std::max(0, wait));
+		}
+	}
+
+	// Render everything that is pending now (e.g. before grabbing a screenshot).
+	void render_now() {
+		timer.stop();
+		flush();
+	}
+
+	const render_stats& get_stats() const {
+		return stats;
+	}
+
+	void reset_stats() {
+		stats = render_stats();
+	}
+
+	int frame_interval_ms() const {
+		return frame_ms;
+	}
+
+public slots:
+	// Render every dirty viewport once.
+	void flush() {
+
+		bool rendered = false;
+		for (size_t i = 0; i < dirty.size(); i++) {
+			if (!dirty[i])
+				continue;
+			dirty[i] = false; // before rendering, so a request made while rendering schedules another frame
+			render_fn((int)i);
+			stats.renders++;
+			rendered = true;
+		}
+
+		if (rendered) {
+			stats.frames++;
+			since_last_frame.restart();
+		}
+	}
+
+private:
+	std::function<void(int)> render_fn;
+	std::vector<bool> dirty;
+	render_stats stats;
+
+	QTimer timer;
+	QElapsedTimer since_last_frame;
+	int frame_ms = 16;
+};
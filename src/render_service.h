@@ -0,0 +1,911 @@
+/*
+This header contains render_service, the headless server mode of the application. It listens on
+a local socket (TCP on 127.0.0.1, or a named local socket: a Unix domain socket / Windows pipe),
+and answers requests for slice images and volume snapshots of DICOM series, so web viewers and QA
+scripts can use the viewer's rendering without starting a GUI per image.
+
+Started from main.cxx with:
+
+	final_project --serve [--port N | --socket <name>] [--workers N] [--batch N] [--memory-mb N]
+
+(--trace <file.json> works here too, see main.cxx.)
+
+Protocol: one JSON object per line in, a JSON header line (plus payload) out. Requests may be
+pipelined; replies can come back in another order and are matched by the "id" of the request.
+
+	{"id": 7, "series": "/data/ct1", "plane": "axial", "index": 120, "window": 400, "level": 40,
+	 "colormap": "grayscale", "format": "png"}
+	{"id": 8, "series": "/data/ct1", "plane": "volume", "azimuth": 30, "elevation": 10,
+	 "colormap": "viridis", "size": [512, 512]}
+
+	-> {"id": 7, "ok": true, "format": "png", "width": 512, "height": 512, "slices": 300, "bytes": 81234, "ms": 1.9}\n
+	   <81234 bytes of PNG>
+	-> {"id": 9, "ok": false, "error": "..."}\n        (no payload)
+
+"plane" is axial, coronal, sagittal or volume. Slices have the volume's own size; "index" defaults
+to the middle slice and window/level to the series' default (see intensity_histogram::auto_window).
+Slice colour maps: grayscale, high_contrast, rainbow, rainbow_reversed, example, custom;
+volume colour maps: map1, viridis, magma, grayscale (as in the viewer). "format" is png or rgba
+(raw RGBA, bottom row first like a vtkImageData). {"command": "stats"} returns the counters below,
+{"command": "shutdown"} stops the server. In a reply, "ms" is the time the request spent in the
+server (queued and rendered) and "slices" the number of slices of the plane.
+
+How requests are served:
+	- every decoded volume is shared by all workers and all connections (volume_store): a series is
+	  loaded once (through the on-disk volume cache), requests for it that arrive during the load wait
+	  for it, and volumes are dropped least recently used first beyond the memory limit
+	- a pool of render workers takes the queued requests; a worker takes up to --batch queued
+	  requests for the same series at once, looks the volume up once and renders identical requests
+	  (e.g. several clients showing the same slice) only once
+	- slices come from each volume's slice cache (direct copy, slice_cache.h) and are window/levelled
+	  and coloured by the SIMD kernel of colormap_kernel.h; volume snapshots are ray cast on the CPU
+	  (cpu_raycaster.h), so no worker needs an OpenGL context
+	- images are PNG-encoded with vtkPNGWriter (in memory) by the worker that rendered them
+
+Use bench/bench_serve to measure requests per second and latency percentiles against a server.
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkImageData.h>
+#include <vtkImageReslice.h>
+#include <vtkMath.h>
+#include <vtkMatrix4x4.h>
+#include <vtkPNGWriter.h>
+#include <vtkSmartPointer.h>
+#include <vtkUnsignedCharArray.h>
+#include <vtkVolumeProperty.h>
+
+// Qt header files
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QIODevice>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTcpSocket>
+
+// Our header files
+#include "colormap_kernel.h"
+#include "colormaps.h"
+#include "cpu_raycaster.h"
+#include "dataset.h"
+#include "fast_reslice.h"
+#include "slice_cache.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+// One decoded series as the render workers share it.
+struct served_volume {
+	dataset dset;
+
+	// voxels per axis and world bounds, set at load time: vtkImageData::GetDimensions() and
+	// GetBounds() store what they compute in the image, so the workers must not call them
+	int dims[3] = { 0, 0, 0 };
+	double bounds[6] = { 0, 0, 0, 0, 0, 0 };
+
+	// raw slices of the three planes (slice indices along the volume's own axes)
+	slice_cache slices;
+
+	// volume snapshots; one ray caster per volume (its cell grid is built once), used by one worker at a time
+	std::mutex raycast_mutex;
+	cpu_raycaster raycaster;
+	bool raycaster_ready = false;
+
+	// set under volume_store::mutex
+	bool loading = true;
+	std::string error;
+	size_t bytes = 0;
+	long long last_used = 0;
+};
+
+
+/*
+The decoded volumes of the server, keyed by series directory, shared by all render workers. A
+series that is not loaded yet is loaded by the first worker that asks for it; the others wait
+for that load instead of starting their own.
+*/
+class volume_store {
+
+public:
+	// volumes are dropped (least recently used first) while they hold more than this
+	size_t max_bytes = (size_t)4096 * 1024 * 1024;
+
+	// use the on-disk volume cache (volume_cache.h)
+	bool use_cache = true;
+
+	// counters (read by the stats command)
+	std::atomic<long long> hits{ 0 };
+	std::atomic<long long> loads{ 0 };
+
+	/*
+	The volume of a series, loaded now if needed. Returns NULL (with a message) if it could not be
+	loaded. The volume stays valid while the caller holds it, even if it is dropped from the store.
+	*/
+	std::shared_ptr<served_volume> get(const QString& series_dir, std::string& error) {
+
+		QString key = QDir(series_dir).absolutePath();
+
+		std::shared_ptr<served_volume> volume;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			std::map<QString, std::shared_ptr<served_volume>>::iterator found = volumes.find(key);
+			if (found != volumes.end()) {
+				volume = found->second;
+				volume->last_used = ++use_counter;
+				loaded.wait(lock, [&]() { return !volume->loading; });
+				if (!volume->error.empty()) {
+					error = volume->error;
+					return NULL;
+				}
+				hits++;
+				return volume;
+			}
+
+			volume = std::make_shared<served_volume>();
+			volume->last_used = ++use_counter;
+			volume->dset.trace_dataset = next_trace_id++;
+			volumes[key] = volume;
+		}
+
+		// load outside the lock (other series are served meanwhile)
+		std::string load_error;
+		if (!load(*volume, key))
+			load_error = "could not load a DICOM series from " + key.toStdString();
+		loads++;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		volume->loading = false;
+		if (!load_error.empty()) {
+			volume->error = load_error;
+			volumes.erase(key); // (a later request tries again)
+		}
+		else {
+			volume->bytes = (size_t)volume->dset.image->GetActualMemorySize() * 1024;
+			evict(volume.get());
+		}
+		loaded.notify_all();
+
+		if (!load_error.empty()) {
+			error = load_error;
+			return NULL;
+		}
+		return volume;
+	}
+
+	// Loaded volumes and the bytes they hold.
+	void usage(int& count, size_t& bytes) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		count = 0;
+		bytes = 0;
+		for (std::map<QString, std::shared_ptr<served_volume>>::iterator it = volumes.begin(); it != volumes.end(); ++it) {
+			if (!it->second->loading) {
+				count++;
+				bytes += it->second->bytes + it->second->slices.bytes();
+			}
+		}
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable loaded;
+	std::map<QString, std::shared_ptr<served_volume>> volumes;
+	long long use_counter = 0;
+	int next_trace_id = 1;
+
+	// Decode the series and set up its slice planes (same planes as the viewer).
+	bool load(served_volume& volume, const QString& series_dir) {
+
+		if (!volume.dset.load(QDir(series_dir), NULL, load_progress_fn(), use_cache))
+			return false;
+
+		vtkImageData* image = volume.dset.image;
+		if (image->GetNumberOfScalarComponents() != 1) {
+			cout << "umm " << series_dir.toStdString() << " has more than one component per voxel\n";
+			return false;
+		}
+
+		int* extent = image->GetExtent();
+		for (int i = 0; i < 3; i++) {
+			volume.dims[i] = extent[2 * i + 1] - extent[2 * i] + 1;
+			double first = image->GetOrigin()[i] + extent[2 * i] * image->GetSpacing()[i];
+			double last = image->GetOrigin()[i] + extent[2 * i + 1] * image->GetSpacing()[i];
+			volume.bounds[2 * i] = std::min(first, last);
+			volume.bounds[2 * i + 1] = std::max(first, last);
+		}
+
+		double planes[4][16] = {
+			{ 0 },
+			{ 1, 0, 0, 0,   0, 1, 0, 0,   0, 0, 1, 0,   0, 0, 0, 1 },  // axial
+			{ 1, 0, 0, 0,   0, 0, 1, 0,   0, -1, 0, 0,  0, 0, 0, 1 },  // coronal
+			{ 0, 0, -1, 0,  1, 0, 0, 0,   0, -1, 0, 0,  0, 0, 0, 1 } }; // sagittal
+
+		// slice index i of a plane is voxel row i of the volume along the plane normal
+		volume.slices.max_bytes = 64 * 1024 * 1024;
+		volume.slices.set_reference(image->GetOrigin(), image->GetSpacing());
+
+		// the reslice filters only give the slice geometry of each plane (the slices themselves are copied)
+		int map[] = { -1, 2, 1, 0 };
+		for (int i = 1; i < 4; i++) {
+			vtkSmartPointer<vtkMatrix4x4> axes = vtkSmartPointer<vtkMatrix4x4>::New();
+			axes->DeepCopy(planes[i]);
+			axes->SetElement(map[i], 3, image->GetOrigin()[map[i]]);
+
+			vtkSmartPointer<vtkImageReslice> reslice = vtkSmartPointer<fast_reslice>::New();
+			reslice->SetInputData(image);
+			reslice->SetOutputDimensionality(2);
+			reslice->SetResliceAxes(axes);
+			reslice->SetInterpolationModeToLinear();
+			reslice->Update();
+			volume.slices.set_plane(0, i, image, axes, reslice->GetOutput());
+		}
+		return true;
+	}
+
+	// Drop the least recently used volumes (not keep) while over max_bytes (mutex held).
+	void evict(served_volume* keep) {
+
+		while (true) {
+			size_t total = 0;
+			std::map<QString, std::shared_ptr<served_volume>>::iterator oldest = volumes.end();
+			for (std::map<QString, std::shared_ptr<served_volume>>::iterator it = volumes.begin(); it != volumes.end(); ++it) {
+				if (it->second->loading)
+					continue;
+				total += it->second->bytes;
+				if (it->second.get() != keep && (oldest == volumes.end() || it->second->last_used < oldest->second->last_used))
+					oldest = it;
+			}
+			if (total <= max_bytes || oldest == volumes.end())
+				return;
+			volumes.erase(oldest);
+		}
+	}
+};
+
+
+// One parsed request.
+struct render_request {
+	QJsonValue id;
+	QString series;
+	int plane = 1;            // 0 = volume, 1..3 = axial, coronal, sagittal (as in ui.h)
+	int index = -1;           // slice index (-1 = middle slice)
+	bool has_window = false;  // window/level given (else the series' default)
+	double window = 0, level = 0;
+	int colormap = 0;         // see slice_luts / volume_ctfs
+	bool png = true;          // else raw RGBA
+	int width = 512, height = 512;     // volume snapshots only
+	double azimuth = 0, elevation = 0; // volume snapshots only (degrees)
+
+	// Requests that give the same image (the id is not part of it).
+	QString image_key() const {
+		return QString("%1|%2|%3|%4|%5|%6|%7|%8|%9|%10|%11").arg(plane).arg(index).arg(has_window).arg(window).arg(level)
+			.arg(colormap).arg(png).arg(width).arg(height).arg(azimuth).arg(elevation);
+	}
+};
+
+
+class render_service : public QObject {
+
+	Q_OBJECT
+public:
+	static const int VOLUME = 0;
+	static const int AXIAL = 1;
+	static const int CORONAL = 2;
+	static const int SAGITTAL = 3;
+
+	// listening address: TCP port on 127.0.0.1, or a local socket name if set
+	quint16 port = 7575;
+	QString socket_name;
+
+	// render worker threads (0 = one per hardware thread)
+	int num_workers = 0;
+
+	// most requests a worker takes at once (all for the same series)
+	int batch_size = 16;
+
+	// requests waiting beyond this are answered with an error
+	int max_queued = 4096;
+
+	volume_store volumes;
+
+	render_service() {
+
+		// replies are written to the sockets on the thread that owns them (the main thread)
+		connect(this, SIGNAL(reply_ready(quint64, QByteArray)), this, SLOT(send_reply(quint64, QByteArray)),
+			Qt::QueuedConnection);
+	}
+
+	~render_service() {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	/*
+	Parse the command line, start listening and serve until a shutdown command. Returns the
+	process exit code.
+	*/
+	int run(const QStringList& args) {
+
+		for (int i = 0; i < args.size(); i++) {
+			const QString& arg = args[i];
+			bool has_value = i + 1 < args.size();
+
+			if (arg == "--serve")
+				continue;
+			else if (arg == "--port" && has_value)
+				port = (quint16)args[++i].toInt();
+			else if (arg == "--socket" && has_value)
+				socket_name = args[++i];
+			else if (arg == "--workers" && has_value)
+				num_workers = args[++i].toInt();
+			else if (arg == "--batch" && has_value)
+				batch_size = std::max(1, args[++i].toInt());
+			else if (arg == "--memory-mb" && has_value)
+				volumes.max_bytes = (size_t)std::max(1, args[++i].toInt()) * 1024 * 1024;
+			else if (arg == "--no-cache")
+				volumes.use_cache = false;
+			else {
+				cout << "unknown or incomplete option " << arg.toStdString() << "\n";
+				print_usage();
+				return 1;
+			}
+		}
+
+		if (!listen())
+			return 1;
+
+		if (num_workers <= 0)
+			num_workers = std::max(1, (int)std::thread::hardware_concurrency());
+		for (int i = 0; i < num_workers; i++)
+			workers.push_back(std::thread(&render_service::worker_loop, this, i));
+
+		cout << "serving on " << (socket_name.isEmpty() ? "127.0.0.1:" + QString::number(port) : socket_name).toStdString()
+			<< " with " << num_workers << " render workers\n";
+
+		return QCoreApplication::exec();
+	}
+
+signals:
+	// A reply (header line and payload) for a connection is ready (emitted by the workers).
+	void reply_ready(quint64 connection, QByteArray reply);
+
+private slots:
+	void new_connection() {
+
+		while (true) {
+			QIODevice* socket = NULL;
+			if (tcp_server != NULL && tcp_server->hasPendingConnections())
+				socket = tcp_server->nextPendingConnection();
+			else if (local_server != NULL && local_server->hasPendingConnections())
+				socket = local_server->nextPendingConnection();
+			if (socket == NULL)
+				return;
+
+			quint64 id = next_connection++;
+			socket->setProperty("connection", id);
+			connections[id] = socket;
+			connect(socket, SIGNAL(readyRead()), this, SLOT(read_requests()));
+			connect(socket, SIGNAL(disconnected()), this, SLOT(connection_closed()));
+		}
+	}
+
+	// Queue every complete request line of a connection.
+	void read_requests() {
+
+		QIODevice* socket = qobject_cast<QIODevice*>(sender());
+		quint64 connection = socket->property("connection").toULongLong();
+
+		while (socket->canReadLine()) {
+			QByteArray line = socket->readLine().trimmed();
+			if (line.isEmpty())
+				continue;
+
+			QJsonParseError parse_error;
+			QJsonDocument document = QJsonDocument::fromJson(line, &parse_error);
+			if (!document.isObject()) {
+				send_reply(connection, error_reply(QJsonValue(), "request is not a JSON object: " + parse_error.errorString()));
+				continue;
+			}
+			QJsonObject object = document.object();
+
+			QString command = object["command"].toString();
+			if (command == "stats") {
+				send_reply(connection, header_line(stats(object["id"])));
+				continue;
+			}
+			if (command == "shutdown") {
+				QJsonObject reply;
+				reply["id"] = object["id"];
+				reply["ok"] = true;
+				send_reply(connection, header_line(reply));
+				QCoreApplication::quit();
+				continue;
+			}
+
+			queued_request request;
+			request.connection = connection;
+			request.received.start();
+			QString error;
+			if (!parse_request(object, request.request, error)) {
+				send_reply(connection, error_reply(object["id"], error));
+				continue;
+			}
+
+			bool accepted;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				accepted = (int)queue.size() < max_queued;
+				if (accepted)
+					queue.push_back(request);
+			}
+			if (accepted)
+				wake.notify_one();
+			else
+				send_reply(connection, error_reply(object["id"], "server busy (too many queued requests)"));
+		}
+	}
+
+	void connection_closed() {
+
+		QIODevice* socket = qobject_cast<QIODevice*>(sender());
+		connections.erase(socket->property("connection").toULongLong());
+		socket->deleteLater(); // (replies still being rendered for it are dropped in send_reply)
+	}
+
+	void send_reply(quint64 connection, QByteArray reply) {
+
+		std::map<quint64, QIODevice*>::iterator found = connections.find(connection);
+		if (found != connections.end())
+			found->second->write(reply);
+	}
+
+private:
+	struct queued_request {
+		quint64 connection;
+		render_request request;
+		QElapsedTimer received;
+	};
+
+	// what a worker renders with (VTK objects are not shared between workers)
+	struct worker_state {
+		colormaps maps;
+		std::vector<lut_snapshot> slice_luts;
+		std::vector<vtkSmartPointer<vtkColorTransferFunction>> volume_ctfs;
+		vtkSmartPointer<vtkVolumeProperty> volume_property;
+		vtkSmartPointer<vtkPNGWriter> png_writer;
+		vtkSmartPointer<vtkImageData> image;
+		std::vector<unsigned char> rgba;
+	};
+
+	QTcpServer* tcp_server = NULL;
+	QLocalServer* local_server = NULL;
+	std::map<quint64, QIODevice*> connections; // (main thread)
+	quint64 next_connection = 1;
+
+	std::vector<std::thread> workers;
+	std::deque<queued_request> queue;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	// counters (read by the stats command)
+	std::atomic<long long> served{ 0 };
+	std::atomic<long long> failed{ 0 };
+	std::atomic<long long> batches{ 0 };
+	std::atomic<long long> shared_renders{ 0 }; // requests answered with another request's image
+
+	static const char* const* slice_lut_names() {
+		static const char* const names[] = { "grayscale", "high_contrast", "rainbow", "rainbow_reversed", "example", "custom", NULL };
+		return names;
+	}
+
+	static const char* const* volume_ctf_names() {
+		static const char* const names[] = { "map1", "viridis", "magma", "grayscale", NULL };
+		return names;
+	}
+
+	static int find_name(const char* const* names, const QString& name) {
+		for (int i = 0; names[i] != NULL; i++) {
+			if (name == names[i])
+				return i;
+		}
+		return -1;
+	}
+
+	bool listen() {
+
+		if (!socket_name.isEmpty()) {
+			local_server = new QLocalServer(this);
+			QLocalServer::removeServer(socket_name); // (left over from a server that crashed)
+			if (!local_server->listen(socket_name)) {
+				cout << "umm could not listen on " << socket_name.toStdString() << ": " << local_server->errorString().toStdString() << "\n";
+				return false;
+			}
+			connect(local_server, SIGNAL(newConnection()), this, SLOT(new_connection()));
+		}
+		else {
+			tcp_server = new QTcpServer(this);
+			if (!tcp_server->listen(QHostAddress::LocalHost, port)) {
+				cout << "umm could not listen on port " << port << ": " << tcp_server->errorString().toStdString() << "\n";
+				return false;
+			}
+			connect(tcp_server, SIGNAL(newConnection()), this, SLOT(new_connection()));
+		}
+		return true;
+	}
+
+	static bool parse_request(const QJsonObject& object, render_request& request, QString& error) {
+
+		request.id = object["id"];
+		request.series = object["series"].toString();
+		if (request.series.isEmpty()) {
+			error = "no series given";
+			return false;
+		}
+
+		QString plane = object["plane"].toString("axial");
+		const char* plane_names[] = { "volume", "axial", "coronal", "sagittal" };
+		request.plane = -1;
+		for (int i = 0; i < 4; i++) {
+			if (plane == plane_names[i])
+				request.plane = i;
+		}
+		if (request.plane < 0) {
+			error = "unknown plane " + plane;
+			return false;
+		}
+
+		request.index = object["index"].toInt(-1);
+		if (object.contains("window") || object.contains("level")) {
+			request.has_window = true;
+			request.window = object["window"].toDouble(1.0);
+			request.level = object["level"].toDouble(0.0);
+			if (request.window <= 0) {
+				error = "window must be positive";
+				return false;
+			}
+		}
+
+		QString colormap = object["colormap"].toString("grayscale");
+		request.colormap = find_name(request.plane == VOLUME ? volume_ctf_names() : slice_lut_names(), colormap);
+		if (request.colormap < 0) {
+			error = "unknown colormap " + colormap;
+			return false;
+		}
+
+		QString format = object["format"].toString("png");
+		if (format != "png" && format != "rgba") {
+			error = "unknown format " + format;
+			return false;
+		}
+		request.png = format == "png";
+
+		if (request.plane == VOLUME) {
+			QJsonArray size = object["size"].toArray();
+			if (size.size() == 2) {
+				request.width = size[0].toInt();
+				request.height = size[1].toInt();
+			}
+			if (request.width <= 0 || request.height <= 0 || request.width > 4096 || request.height > 4096) {
+				error = "size must be within 1..4096";
+				return false;
+			}
+			request.azimuth = object["azimuth"].toDouble(0.0);
+			request.elevation = object["elevation"].toDouble(0.0);
+		}
+		return true;
+	}
+
+	// A header line (JSON and a newline).
+	static QByteArray header_line(const QJsonObject& header) {
+		return QJsonDocument(header).toJson(QJsonDocument::Compact) + "\n";
+	}
+
+	static QByteArray error_reply(const QJsonValue& id, const QString& error) {
+
+		QJsonObject header;
+		header["id"] = id;
+		header["ok"] = false;
+		header["error"] = error;
+		return header_line(header);
+	}
+
+	QJsonObject stats(const QJsonValue& id) {
+
+		int count;
+		size_t bytes;
+		volumes.usage(count, bytes);
+
+		QJsonObject reply;
+		reply["id"] = id;
+		reply["ok"] = true;
+		reply["served"] = (double)served;
+		reply["failed"] = (double)failed;
+		reply["batches"] = (double)batches;
+		reply["shared_renders"] = (double)shared_renders;
+		reply["volume_hits"] = (double)volumes.hits;
+		reply["volume_loads"] = (double)volumes.loads;
+		reply["volumes"] = count;
+		reply["volume_mb"] = bytes / (1024.0 * 1024.0);
+		reply["workers"] = num_workers;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			reply["queued"] = (int)queue.size();
+		}
+		return reply;
+	}
+
+	// S================== RENDER WORKERS =================== //
+
+	void worker_loop(int worker_num) {
+
+		tracer::shared().set_thread_name("render worker " + std::to_string(worker_num));
+
+		worker_state state;
+		state.slice_luts.push_back(lut_snapshot(state.maps.grayScaleLut));
+		state.slice_luts.push_back(lut_snapshot(state.maps.highContrastLut));
+		state.slice_luts.push_back(lut_snapshot(state.maps.rainbowRedBlueLut));
+		state.slice_luts.push_back(lut_snapshot(state.maps.rainbowBlueRedLut));
+		state.slice_luts.push_back(lut_snapshot(state.maps.vtkExampleLut));
+		state.slice_luts.push_back(lut_snapshot(state.maps.customLut));
+		state.volume_ctfs.push_back(state.maps.class_example_ctf);
+		state.volume_ctfs.push_back(state.maps.viridis_ctf);
+		state.volume_ctfs.push_back(state.maps.magma_ctf);
+		state.volume_ctfs.push_back(state.maps.grayscale_ctf);
+
+		state.volume_property = vtkSmartPointer<vtkVolumeProperty>::New();
+		state.volume_property->ShadeOff();
+		state.volume_property->SetInterpolationType(VTK_LINEAR_INTERPOLATION);
+		state.volume_property->SetScalarOpacity(colormaps::make_volume_opacity());
+
+		state.png_writer = vtkSmartPointer<vtkPNGWriter>::New();
+		state.png_writer->WriteToMemoryOn();
+		state.png_writer->SetCompressionLevel(1); // (a fast, slightly larger PNG; the link is local)
+		state.image = vtkSmartPointer<vtkImageData>::New();
+
+		while (true) {
+			std::vector<queued_request> batch;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+				if (stopping)
+					return;
+				take_batch(batch);
+			}
+			serve_batch(state, batch);
+		}
+	}
+
+	// The oldest request and the next queued ones for the same series (mutex held).
+	void take_batch(std::vector<queued_request>& batch) {
+
+		batch.push_back(queue.front());
+		queue.pop_front();
+
+		const QString& series = batch[0].request.series;
+		for (std::deque<queued_request>::iterator it = queue.begin(); it != queue.end() && (int)batch.size() < batch_size;) {
+			if (it->request.series == series) {
+				batch.push_back(*it);
+				it = queue.erase(it);
+			}
+			else
+				++it;
+		}
+		batches++;
+	}
+
+	void serve_batch(worker_state& state, std::vector<queued_request>& batch) {
+
+		std::string error;
+		std::shared_ptr<served_volume> volume = volumes.get(batch[0].request.series, error);
+
+		// identical requests in the batch share one image
+		std::map<QString, std::pair<QJsonObject, QByteArray>> rendered;
+
+		for (size_t i = 0; i < batch.size(); i++) {
+			const render_request& request = batch[i].request;
+			if (volume == NULL) {
+				failed++;
+				emit reply_ready(batch[i].connection, error_reply(request.id, QString::fromStdString(error)));
+				continue;
+			}
+
+			QString key = request.image_key();
+			std::map<QString, std::pair<QJsonObject, QByteArray>>::iterator found = rendered.find(key);
+			if (found == rendered.end()) {
+				std::pair<QJsonObject, QByteArray> image;
+				QString render_error;
+				if (!render(state, *volume, request, image.first, image.second, render_error)) {
+					failed++;
+					emit reply_ready(batch[i].connection, error_reply(request.id, render_error));
+					continue;
+				}
+				found = rendered.insert(std::make_pair(key, image)).first;
+			}
+			else {
+				shared_renders++;
+			}
+
+			QJsonObject header = found->second.first;
+			header["id"] = request.id;
+			header["ok"] = true;
+			header["ms"] = batch[i].received.nsecsElapsed() / 1e6; // (queued + rendered)
+			served++;
+			emit reply_ready(batch[i].connection, header_line(header) + found->second.second);
+		}
+	}
+
+	// Render one request into an encoded image and the header fields that describe it.
+	bool render(worker_state& state, served_volume& volume, const render_request& request, QJsonObject& header,
+		QByteArray& payload, QString& error) {
+
+		TRACE_SCOPE("serve_request", volume.dset.trace_dataset, request.plane);
+
+		int width, height, slices = 0;
+		if (request.plane == VOLUME) {
+			width = request.width;
+			height = request.height;
+			state.rgba.resize(4 * (size_t)width * height);
+			if (!render_volume(state, volume, request, state.rgba.data())) {
+				error = "the volume of this series cannot be rendered";
+				return false;
+			}
+		}
+		else if (!render_slice(state, volume, request, width, height, slices, error)) {
+			return false;
+		}
+
+		header["format"] = request.png ? "png" : "rgba";
+		header["width"] = width;
+		header["height"] = height;
+		if (request.plane != VOLUME)
+			header["slices"] = slices; // (the index range of the plane, for a client's slider)
+
+		if (request.png) {
+			TRACE_SCOPE("encode_png", volume.dset.trace_dataset, request.plane);
+			vtkImageData* image = state.image;
+			image->SetExtent(0, width - 1, 0, height - 1, 0, 0);
+			image->AllocateScalars(VTK_UNSIGNED_CHAR, 4);
+			memcpy(image->GetScalarPointer(), state.rgba.data(), 4 * (size_t)width * height);
+			state.png_writer->SetInputData(image);
+			state.png_writer->Write();
+			vtkUnsignedCharArray* png = state.png_writer->GetResult();
+			if (state.png_writer->GetErrorCode() != 0 || png == NULL) {
+				error = "could not encode the image";
+				return false;
+			}
+			payload = QByteArray(reinterpret_cast<const char*>(png->GetPointer(0)), (int)png->GetNumberOfTuples());
+		}
+		else {
+			payload = QByteArray(reinterpret_cast<const char*>(state.rgba.data()), (int)state.rgba.size());
+		}
+		header["bytes"] = payload.size();
+		return true;
+	}
+
+	// A slice through the volume's slice cache and the fused window/level + colour map kernel, into state.rgba.
+	bool render_slice(worker_state& state, served_volume& volume, const render_request& request, int& width, int& height,
+		int& slices, QString& error) {
+
+		int map[] = { -1, 2, 1, 0 };
+		slices = volume.dims[map[request.plane]];
+		int index = request.index >= 0 ? request.index : slices / 2;
+		if (index >= slices) {
+			error = QString("index %1 is beyond the last slice (%2)").arg(index).arg(slices - 1);
+			return false;
+		}
+
+		std::shared_ptr<const raw_slice> slice = volume.slices.get(0, request.plane, index);
+		if (slice == NULL) {
+			error = "the slice could not be extracted";
+			return false;
+		}
+
+		double window = request.window, level = request.level;
+		if (!request.has_window)
+			default_window(volume.dset, window, level);
+
+		width = slice->width;
+		height = slice->height;
+		state.rgba.resize(4 * (size_t)width * height);
+		colormap_kernel::apply(slice->values.data(), slice->scalar_type, width * height, state.slice_luts[request.colormap],
+			window, level, state.rgba.data());
+		return true;
+	}
+
+	// A snapshot of the volume ray cast on the CPU, on a black background.
+	bool render_volume(worker_state& state, served_volume& volume, const render_request& request, unsigned char* rgba) {
+
+		std::lock_guard<std::mutex> lock(volume.raycast_mutex);
+		if (!volume.raycaster_ready) {
+			if (!volume.raycaster.set_volume(volume.dset.image))
+				return false;
+			volume.raycaster_ready = true;
+		}
+
+		state.volume_property->SetColor(state.volume_ctfs[request.colormap]);
+		volume.raycaster.set_transfer_functions(state.volume_property);
+		if (!volume.raycaster.render(orbit_camera(volume.bounds, request.azimuth, request.elevation), request.width,
+			request.height, rgba))
+			return false;
+
+		const double background[3] = { 0, 0, 0 };
+		cpu_raycaster::flatten(rgba, request.width * request.height, background);
+		return true;
+	}
+
+	/*
+	The camera of vtkRenderer::ResetCamera() (looking down -z at the volume bounds, 30 degree view
+	angle) turned about the volume centre by azimuth (about the view up) and elevation.
+	*/
+	static raycast_camera orbit_camera(const double bounds[6], double azimuth, double elevation) {
+
+		double centre[3], radius = 0;
+		for (int i = 0; i < 3; i++) {
+			centre[i] = (bounds[2 * i] + bounds[2 * i + 1]) / 2;
+			radius += (bounds[2 * i + 1] - bounds[2 * i]) * (bounds[2 * i + 1] - bounds[2 * i]);
+		}
+		radius = std::max(1e-6, std::sqrt(radius) / 2);
+
+		raycast_camera camera;
+		double distance = radius / std::sin(vtkMath::RadiansFromDegrees(camera.view_angle) / 2);
+		double a = vtkMath::RadiansFromDegrees(azimuth), e = vtkMath::RadiansFromDegrees(elevation);
+		double direction[3] = { std::cos(e) * std::sin(a), std::sin(e), std::cos(e) * std::cos(a) };
+		double up[3] = { -std::sin(e) * std::sin(a), std::cos(e), -std::sin(e) * std::cos(a) };
+		for (int i = 0; i < 3; i++) {
+			camera.focal_point[i] = centre[i];
+			camera.position[i] = centre[i] + distance * direction[i];
+			camera.view_up[i] = up[i];
+		}
+		return camera;
+	}
+
+	// The viewer's default window/level of a series (see intensity_histogram::auto_window).
+	static void default_window(dataset& dset, double& window, double& level) {
+
+		if (dset.histogram != NULL && !dset.histogram->empty()) {
+			dset.histogram->auto_window(window, level);
+			return;
+		}
+		double* range = dset.scalar_range();
+		window = std::max(1.0, range[1] - range[0]);
+		level = (range[0] + range[1]) / 2;
+	}
+
+	static void print_usage() {
+		cout << "usage: final_project --serve [--port N | --socket <name>] [--workers N] [--batch N]\n"
+			"                     [--memory-mb N] [--no-cache]\n";
+	}
+};
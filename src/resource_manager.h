@@ -0,0 +1,92 @@
+/*
+This header contains resource_manager, which keeps the loaded datasets within one memory
+budget. The viewer reports what every dataset holds (volume, pyramid, cached slices, ...; see
+memory_report.h) and whether it is visible; when the total is over the budget, the manager
+names the hidden datasets whose decoded volumes should be dropped, least recently visible first.
+Visible datasets are never picked, so a budget smaller than what is on screen is exceeded rather
+than breaking the views. An evicted dataset is loaded again when it is shown (the volume cache
+makes that a file mapping rather than a decode).
+
+GUI thread only:
+
+	resources.budget_bytes = 2048ull * 1024 * 1024;
+	resources.set_usage(layer->dset_num, bytes, layer->visible);
+	std::vector<int> victims = resources.evictions();
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+
+class resource_manager {
+
+public:
+	// upper bound for the memory of all datasets together (0 = no limit)
+	size_t budget_bytes = (size_t)4096 * 1024 * 1024;
+
+	// evictions so far
+	long long evicted = 0;
+
+	/*
+	Report what a dataset holds now. Visible datasets count as just used; hidden ones keep the time
+	they were last visible, which orders them for eviction.
+	*/
+	void set_usage(int dset_num, size_t bytes, bool visible) {
+
+		usage& u = entries[dset_num];
+		u.bytes = bytes;
+		u.visible = visible;
+		if (visible || u.last_visible == 0)
+			u.last_visible = ++clock;
+	}
+
+	// Forget a dataset (closed, or evicted and now holding nothing).
+	void remove(int dset_num) {
+		entries.erase(dset_num);
+	}
+
+	size_t total_bytes() const {
+
+		size_t total = 0;
+		for (std::map<int, usage>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+			total += it->second.bytes;
+		return total;
+	}
+
+	// Hidden datasets to evict (in this order) to get back within the budget. Empty if within it.
+	std::vector<int> evictions() const {
+
+		std::vector<int> victims;
+		size_t total = total_bytes();
+		if (budget_bytes == 0 || total <= budget_bytes)
+			return victims;
+
+		std::vector<std::pair<long long, int>> hidden; // (last visible, dataset)
+		for (std::map<int, usage>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+			if (!it->second.visible && it->second.bytes > 0)
+				hidden.push_back(std::make_pair(it->second.last_visible, it->first));
+		}
+		std::sort(hidden.begin(), hidden.end());
+
+		for (size_t i = 0; i < hidden.size() && total > budget_bytes; i++) {
+			victims.push_back(hidden[i].second);
+			total -= entries.at(hidden[i].second).bytes;
+		}
+		return victims;
+	}
+
+private:
+	struct usage {
+		size_t bytes = 0;
+		bool visible = true;
+		long long last_visible = 0;
+	};
+
+	std::map<int, usage> entries;
+	long long clock = 0;
+};
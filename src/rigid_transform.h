@@ -0,0 +1,167 @@
+/*
+This header contains rigid_transform, the placement of an overlay relative to dataset 1: a
+rotation about the centre of the overlay's volume followed by a translation (in mm, world
+axes). The viewer never resamples the volume for it. The slice reslice filters get its inverse
+as their reslice transform, and the vtkVolume gets it as its user matrix, so a nudge only
+changes a few matrices.
+
+	M = T(translation) * T(centre) * Rz * Ry * Rx * T(-centre)
+
+Transforms are saved as JSON (the parameters, the centre and the resulting matrix), so an
+alignment can be loaded again or replayed in other tools:
+
+	rigid_transform t;
+	t.translation[0] = 2.5;
+	t.rotation[2] = -1.0;
+	double to_world[16];
+	t.matrix(centre, to_world);
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// Qt header files
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QString>
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+
+struct rigid_transform {
+
+	// limits of the parameters (the ranges of the viewer's align spin boxes)
+	static constexpr double MAX_TRANSLATION_MM = 1000.0;
+	static constexpr double MAX_ROTATION_DEG = 180.0;
+
+	// mm along the world x, y, z axes
+	double translation[3] = { 0, 0, 0 };
+
+	// degrees about the x, y, z axes through the volume centre (applied x first)
+	double rotation[3] = { 0, 0, 0 };
+
+	bool is_identity() const {
+		for (int i = 0; i < 3; i++) {
+			if (translation[i] != 0 || rotation[i] != 0)
+				return false;
+		}
+		return true;
+	}
+
+	/*
+	The 4x4 matrix (row major) that takes a point of the volume to where it is shown.
+
+	Args:
+		centre: centre of the volume (world coordinates) the rotation is about
+	*/
+	void matrix(const double centre[3], double m[16]) const {
+
+		double r[3][3];
+		rotation_matrix(r);
+
+		for (int i = 0; i < 3; i++) {
+			double shift = centre[i] + translation[i];
+			for (int j = 0; j < 3; j++) {
+				m[i * 4 + j] = r[i][j];
+				shift -= r[i][j] * centre[j];
+			}
+			m[i * 4 + 3] = shift;
+		}
+		m[12] = m[13] = m[14] = 0;
+		m[15] = 1;
+	}
+
+	// The inverse of matrix(): takes a world point to the volume point shown there.
+	void inverse_matrix(const double centre[3], double m[16]) const {
+
+		double forward[16];
+		matrix(centre, forward);
+
+		// rotation transposed, translation rotated back
+		for (int i = 0; i < 3; i++) {
+			m[i * 4 + 3] = 0;
+			for (int j = 0; j < 3; j++) {
+				m[i * 4 + j] = forward[j * 4 + i];
+				m[i * 4 + 3] -= forward[j * 4 + i] * forward[j * 4 + 3];
+			}
+		}
+		m[12] = m[13] = m[14] = 0;
+		m[15] = 1;
+	}
+
+	// Parameters, centre and matrix as JSON.
+	QJsonObject to_json(const double centre[3]) const {
+
+		double m[16];
+		matrix(centre, m);
+
+		QJsonArray t, r, c, rows;
+		for (int i = 0; i < 3; i++) {
+			t.append(translation[i]);
+			r.append(rotation[i]);
+			c.append(centre[i]);
+		}
+		for (int i = 0; i < 16; i++)
+			rows.append(m[i]);
+
+		QJsonObject out;
+		out["translation_mm"] = t;
+		out["rotation_deg"] = r;
+		out["centre"] = c;
+		out["matrix"] = rows;
+		return out;
+	}
+
+	// Keep the translation within +-MAX_TRANSLATION_MM (after a nudge or drag).
+	void clamp_translation() {
+		double limit = MAX_TRANSLATION_MM; // (a copy: std::min/max take references)
+		for (int i = 0; i < 3; i++)
+			translation[i] = std::min(std::max(translation[i], -limit), limit);
+	}
+
+	/*
+	Read the parameters written by to_json(). Returns false (with a message, and the transform
+	unchanged) if they are missing or outside the limits.
+	*/
+	bool from_json(const QJsonObject& in, std::string& error) {
+
+		QJsonArray t = in["translation_mm"].toArray();
+		QJsonArray r = in["rotation_deg"].toArray();
+		if (t.size() != 3 || r.size() != 3) {
+			error = "translation_mm and rotation_deg must hold 3 numbers each";
+			return false;
+		}
+		for (int i = 0; i < 3; i++) {
+			if (!t[i].isDouble() || !r[i].isDouble()) {
+				error = "translation_mm and rotation_deg must hold 3 numbers each";
+				return false;
+			}
+			if (!(std::fabs(t[i].toDouble()) <= MAX_TRANSLATION_MM) || !(std::fabs(r[i].toDouble()) <= MAX_ROTATION_DEG)) {
+				error = "translations must be within +-" + std::to_string((int)MAX_TRANSLATION_MM) + " mm and rotations within +-" +
+					std::to_string((int)MAX_ROTATION_DEG) + " degrees";
+				return false;
+			}
+		}
+		for (int i = 0; i < 3; i++) {
+			translation[i] = t[i].toDouble();
+			rotation[i] = r[i].toDouble();
+		}
+		return true;
+	}
+
+private:
+	// Rz * Ry * Rx
+	void rotation_matrix(double r[3][3]) const {
+
+		const double to_radians = 3.14159265358979323846 / 180.0;
+		double cx = std::cos(rotation[0] * to_radians), sx = std::sin(rotation[0] * to_radians);
+		double cy = std::cos(rotation[1] * to_radians), sy = std::sin(rotation[1] * to_radians);
+		double cz = std::cos(rotation[2] * to_radians), sz = std::sin(rotation[2] * to_radians);
+
+		r[0][0] = cz * cy; r[0][1] = cz * sy * sx - sz * cx; r[0][2] = cz * sy * cx + sz * sx;
+		r[1][0] = sz * cy; r[1][1] = sz * sy * sx + cz * cx; r[1][2] = sz * sy * cx - cz * sx;
+		r[2][0] = -sy;     r[2][1] = cy * sx;                r[2][2] = cy * cx;
+	}
+};
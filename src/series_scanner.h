@@ -0,0 +1,208 @@
+/*
+This header contains series_scanner, which finds the DICOM series in a directory tree. The
+header of every file is parsed on all cores (only up to the pixel data element, and files are
+memory mapped, so just their first pages are read), the files are grouped by SeriesInstanceUID
+and each series is sorted along the slice normal (ImagePositionPatient).
+
+Exports often mix several series and many thousands of files in one tree, which
+vtkDICOMImageReader would read as a single series. The viewer lets the user pick a series when
+there is more than one. The scan keeps the parsed headers, so loading the picked series
+(dataset::load(const dicom_series&)) only decodes pixel data and never parses a header again.
+
+	series_scanner scanner;
+	if (scanner.scan(QDir(path), &cancel))
+		for (size_t i = 0; i < scanner.series.size(); i++)
+			cout << scanner.series[i].label().toStdString() << "\n";
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// Qt header files
+#include <QDir>
+#include <QDirIterator>
+#include <QString>
+#include <QStringList>
+
+// Our header files
+#include "dicom_reader.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+
+// One series found by the scanner, with the parsed headers of its files.
+struct dicom_series {
+	std::string root;          // directory that was scanned (the series may span subdirectories)
+	std::string series_uid;
+	std::string patient_name;
+	std::string modality;
+	std::string description;
+	int series_number = 0;
+	int rows = 0;
+	int columns = 0;
+	int num_slices = 0;        // frames of all files
+
+	// files sorted along the slice normal (or by instance number), headers parsed
+	std::vector<parallel_dicom_reader::slice_file> files;
+
+	std::vector<std::string> paths() const {
+
+		std::vector<std::string> out(files.size());
+		for (size_t i = 0; i < files.size(); i++)
+			out[i] = files[i].path;
+		return out;
+	}
+
+	// "CT series 3: Chest 1.25mm - 240 slices of 512 x 512 (Doe^John)"
+	QString label() const {
+
+		QString text = QString::fromStdString(modality.empty() ? std::string("Series") : modality + " series");
+		text += " " + QString::number(series_number);
+		if (!description.empty())
+			text += ": " + QString::fromStdString(description);
+		text += " - " + QString::number(num_slices) + " slices of " + QString::number(columns) + " x " + QString::number(rows);
+		if (!patient_name.empty())
+			text += " (" + QString::fromStdString(patient_name) + ")";
+		return text;
+	}
+};
+
+
+class series_scanner {
+
+public:
+	// series found by the last scan, by patient, series number and UID
+	std::vector<dicom_series> series;
+
+	// files looked at, and how many of them were not DICOM images (no pixel data, unreadable)
+	int files_found = 0;
+	int files_skipped = 0;
+
+	// description of what went wrong if scan() returned false
+	std::string error;
+
+	// dataset number stored with the trace spans of a scan (-1 = none)
+	int trace_dataset = -1;
+
+	// The files of a directory tree (subdirectories included), sorted by path.
+	static std::vector<std::string> list_files(QDir dir) {
+
+		QStringList paths;
+		QDirIterator it(dir.absolutePath(), QDir::Files, QDirIterator::Subdirectories);
+		while (it.hasNext())
+			paths.append(it.next());
+		paths.sort();
+
+		std::vector<std::string> files(paths.size());
+		for (int i = 0; i < paths.size(); i++)
+			files[i] = paths[i].toStdString();
+		return files;
+	}
+
+	/*
+	Find the series in a directory tree.
+
+	Args:
+		cancel: (optional) flag polled between files; set it from any thread to abort
+		progress: (optional) called with (files parsed, total files) every few hundred files
+	*/
+	bool scan(QDir dir, const std::atomic<bool>* cancel = NULL, load_progress_fn progress = load_progress_fn()) {
+		return scan_files(list_files(dir), dir.absolutePath().toStdString(), cancel, progress);
+	}
+
+	// Find the series among the given files (listed from the directory root).
+	bool scan_files(const std::vector<std::string>& files, const std::string& root, const std::atomic<bool>* cancel = NULL,
+		load_progress_fn progress = load_progress_fn()) {
+
+		TRACE_SCOPE("scan_series", trace_dataset);
+
+		series.clear();
+		error.clear();
+		files_found = (int)files.size();
+		files_skipped = 0;
+
+		// S================== PARSE HEADERS =================== //
+		std::vector<parallel_dicom_reader::slice_file> parsed(files.size());
+		std::atomic<int> files_done(0);
+		thread_pool::shared().parallel_for((int)files.size(), [&](int i) {
+			if (cancel != NULL && cancel->load())
+				return;
+			parsed[i].path = files[i];
+			parsed[i].valid = parallel_dicom_reader::read_header(files[i], parsed[i].header);
+
+			int done = ++files_done;
+			if (progress && (done % 256 == 0 || done == (int)files.size()))
+				progress(done, (int)files.size());
+		});
+
+		if (cancel != NULL && cancel->load())
+			return fail("cancelled");
+
+		// S================== GROUP BY SERIES =================== //
+		std::map<std::string, size_t> index; // series UID -> position in series
+		for (size_t i = 0; i < parsed.size(); i++) {
+			if (!parsed[i].valid) {
+				files_skipped++;
+				continue;
+			}
+			const dicom_header& hdr = parsed[i].header;
+			std::map<std::string, size_t>::iterator it = index.find(hdr.series_uid);
+			if (it == index.end()) {
+				it = index.insert(std::make_pair(hdr.series_uid, series.size())).first;
+				series.push_back(dicom_series());
+				dicom_series& s = series.back();
+				s.root = root;
+				s.series_uid = hdr.series_uid;
+				s.patient_name = hdr.patient_name;
+				s.modality = hdr.modality;
+				s.description = hdr.series_description;
+				s.series_number = hdr.series_number;
+				s.rows = hdr.rows;
+				s.columns = hdr.columns;
+			}
+			dicom_series& s = series[it->second];
+			s.num_slices += hdr.number_of_frames;
+			s.files.push_back(std::move(parsed[i]));
+		}
+
+		if (series.empty())
+			return fail("no DICOM images found");
+
+		// each series in slice order (one series per task)
+		thread_pool::shared().parallel_for((int)series.size(), [&](int i) {
+			parallel_dicom_reader::sort_slices(series[i].files);
+		});
+
+		std::sort(series.begin(), series.end(), [](const dicom_series& a, const dicom_series& b) {
+			if (a.patient_name != b.patient_name)
+				return a.patient_name < b.patient_name;
+			if (a.series_number != b.series_number)
+				return a.series_number < b.series_number;
+			return a.series_uid < b.series_uid;
+		});
+		return true;
+	}
+
+	// Index of the series with the most files (what a directory load without a choice reads).
+	int largest() const {
+
+		int best = -1;
+		for (size_t i = 0; i < series.size(); i++) {
+			if (best < 0 || series[i].files.size() > series[best].files.size())
+				best = (int)i;
+		}
+		return best;
+	}
+
+private:
+	bool fail(const std::string& message) {
+		error = message;
+		return false;
+	}
+};
@@ -0,0 +1,320 @@
+/*
+This header contains slab_projector, the thick-slab projections of the slice views: the
+maximum (MIP), minimum (MinIP) or average intensity over a range of slices, computed from the
+raw slices of the slice cache (slice_cache.h).
+
+The slab is kept as a sliding window. Moving it by one slice only reduces the slice coming in
+and drops the one going out, so a 50 slice slab costs about as much per step as a single slice:
+
+	- average: running sum (+ incoming, - outgoing)
+	- MIP/MinIP: min/max are not invertible, so the window is a queue built from two stacks: the
+	  back stack keeps the min/max of everything pushed since the last transfer, the front stack
+	  the min/max of each element to the end of the stack. Popping from an empty front stack
+	  moves the back stack over (one pass over the window every slab-thickness steps).
+
+The reductions run on the thread pool in chunks of 64K voxels, with AVX2 for 16-bit voxels.
+
+	slab_projector slab;
+	std::shared_ptr<const raw_slice> mip = slab.project(first, last, SLAB_MIP,
+		[&](int index) { return slices.get(1, AXIAL, index); });
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkType.h>
+
+// Our header files
+#include "slice_cache.h"
+#include "slice_extract.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+
+enum slab_mode { SLAB_MIP, SLAB_MINIP, SLAB_AVERAGE };
+
+
+class slab_projector {
+
+public:
+	// fetches the raw slice at a slice index (NULL if it cannot be produced)
+	typedef std::function<std::shared_ptr<const raw_slice>(int)> slice_source;
+
+	// how the last project() call got its result (for the render statistics)
+	int slices_reduced = 0;
+	bool rebuilt = false;
+
+	/*
+	The projection of slices first..last (inclusive). Returns NULL if one of the slices cannot be
+	produced (the caller then uses vtkImageReslice's slab mode instead).
+	*/
+	std::shared_ptr<const raw_slice> project(int first, int last, slab_mode mode, const slice_source& get) {
+
+		TRACE_SCOPE("slab_projection");
+		slices_reduced = 0;
+		rebuilt = false;
+
+		// slide the window if that is less work than starting over
+		int moves = std::abs(first - window_first) + std::abs(last - window_last);
+		bool forward = first >= window_first && last >= window_last;
+		bool backward = first <= window_first && last <= window_last;
+		bool slide = !window.empty() && mode == window_mode && (forward || backward) && moves <= last - first + 1 &&
+			(forward == moving_forward || moves == 0);
+
+		if (!slide) {
+			bool jump_forward = first >= window_first; // a jump counts as a move in its direction
+			clear();
+			window_mode = mode;
+			moving_forward = jump_forward;
+			window_first = moving_forward ? first : last + 1;
+			window_last = window_first - 1;
+			rebuilt = true;
+		}
+
+		// grow the leading edge, then drop the trailing edge
+		if (moving_forward) {
+			for (int i = window_last + 1; i <= last; i++)
+				if (!push(get(i))) return fail();
+			for (int i = window_first; i < first; i++)
+				pop();
+		}
+		else {
+			for (int i = window_first - 1; i >= first; i--)
+				if (!push(get(i))) return fail();
+			for (int i = window_last; i > last; i--)
+				pop();
+		}
+		window_first = first;
+		window_last = last;
+
+		return result();
+	}
+
+	// Memory of the running reductions (the window's slices are shared with the slice cache).
+	size_t bytes() const {
+
+		size_t total = back_agg.size() + sum.size() * sizeof(double);
+		for (size_t i = 0; i < front_agg.size(); i++)
+			total += front_agg[i].size();
+		return total;
+	}
+
+	// Forget the window (e.g. when the plane or dataset changes).
+	void clear() {
+		window.clear();
+		front_agg.clear();
+		front_count = 0;
+		back_agg.clear();
+		sum.clear();
+		window_first = 0;
+		window_last = -1;
+	}
+
+private:
+	// slices in the window, oldest (first to be dropped) first
+	std::deque<std::shared_ptr<const raw_slice>> window;
+	int window_first = 0, window_last = -1;
+	slab_mode window_mode = SLAB_MIP;
+	bool moving_forward = true;
+
+	// MIP/MinIP: front stack = window[0 .. front_count), front_agg[i] = reduction of window[i .. front_count);
+	// back stack = the rest of the window, back_agg = its reduction
+	std::deque<std::vector<char>> front_agg;
+	int front_count = 0;
+	std::vector<char> back_agg;
+
+	// average: sum of the window
+	std::vector<double> sum;
+
+	std::shared_ptr<const raw_slice> fail() {
+		clear();
+		return NULL;
+	}
+
+	bool push(const std::shared_ptr<const raw_slice>& slice) {
+
+		if (slice == NULL)
+			return false;
+		if (!window.empty() && (slice->values.size() != window.front()->values.size() || slice->scalar_type != window.front()->scalar_type))
+			return false;
+
+		window.push_back(slice);
+		slices_reduced++;
+
+		if (window_mode == SLAB_AVERAGE) {
+			if (sum.empty())
+				sum.assign((size_t)slice->width * slice->height, 0.0);
+			accumulate(*slice, 1.0);
+		}
+		else if (window.size() - front_count == 1) {
+			back_agg = slice->values;
+		}
+		else {
+			reduce(back_agg, slice->values, slice->scalar_type, window_mode);
+		}
+		return true;
+	}
+
+	void pop() {
+
+		if (window.empty())
+			return;
+
+		if (window_mode == SLAB_AVERAGE) {
+			accumulate(*window.front(), -1.0);
+			window.pop_front();
+			return;
+		}
+
+		// front stack empty: move the back stack over, building the suffix reductions
+		if (front_count == 0) {
+			front_count = (int)window.size();
+			front_agg.assign(window.size(), std::vector<char>());
+			front_agg[front_count - 1] = window[front_count - 1]->values;
+			for (int i = front_count - 2; i >= 0; i--) {
+				front_agg[i] = window[i]->values;
+				reduce(front_agg[i], front_agg[i + 1], window[i]->scalar_type, window_mode);
+				slices_reduced++;
+			}
+			back_agg.clear();
+		}
+
+		window.pop_front();
+		front_agg.pop_front();
+		front_count--;
+	}
+
+	// The projection of the current window, in the geometry of its slices.
+	std::shared_ptr<const raw_slice> result() {
+
+		if (window.empty())
+			return NULL;
+
+		const raw_slice& any = *window.front();
+		std::shared_ptr<raw_slice> out = std::make_shared<raw_slice>();
+		out->scalar_type = any.scalar_type;
+		out->width = any.width;
+		out->height = any.height;
+		std::copy(any.extent, any.extent + 6, out->extent);
+		std::copy(any.origin, any.origin + 3, out->origin);
+		std::copy(any.spacing, any.spacing + 3, out->spacing);
+
+		if (window_mode == SLAB_AVERAGE) {
+			out->values.resize(any.values.size());
+			switch (any.scalar_type) {
+				vtkTemplateMacro(average(reinterpret_cast<VTK_TT*>(out->values.data()), (double)window.size()));
+			}
+		}
+		else if (front_count == 0) {
+			out->values = back_agg;
+		}
+		else {
+			out->values = front_agg.front();
+			if ((int)window.size() > front_count)
+				reduce(out->values, back_agg, any.scalar_type, window_mode);
+		}
+		return out;
+	}
+
+	void accumulate(const raw_slice& slice, double sign) {
+		switch (slice.scalar_type) {
+			vtkTemplateMacro(accumulate(reinterpret_cast<const VTK_TT*>(slice.values.data()), sign));
+		}
+	}
+
+	template <class T>
+	void accumulate(const T* values, double sign) {
+		double* s = sum.data();
+		thread_pool::shared().parallel_for(chunks(sum.size()), [&](int c) {
+			size_t end = std::min(sum.size(), (c + 1) * CHUNK);
+			for (size_t i = c * CHUNK; i < end; i++)
+				s[i] += sign * values[i];
+		});
+	}
+
+	template <class T>
+	void average(T* out, double count) {
+		const double* s = sum.data();
+		bool integer = std::numeric_limits<T>::is_integer;
+		thread_pool::shared().parallel_for(chunks(sum.size()), [&](int c) {
+			size_t end = std::min(sum.size(), (c + 1) * CHUNK);
+			for (size_t i = c * CHUNK; i < end; i++)
+				out[i] = (T)(integer ? std::floor(s[i] / count + 0.5) : s[i] / count);
+		});
+	}
+
+	// elements per task of the thread pool
+	static const size_t CHUNK = 64 * 1024;
+
+	static int chunks(size_t count) {
+		return (int)((count + CHUNK - 1) / CHUNK);
+	}
+
+	// dst = max(dst, src) (MIP) or min(dst, src) (MinIP), element by element, across the thread pool.
+	static void reduce(std::vector<char>& dst, const std::vector<char>& src, int scalar_type, slab_mode mode) {
+		switch (scalar_type) {
+			vtkTemplateMacro(reduce_all(reinterpret_cast<VTK_TT*>(dst.data()), reinterpret_cast<const VTK_TT*>(src.data()),
+				dst.size() / sizeof(VTK_TT), mode == SLAB_MIP));
+		}
+	}
+
+	template <class T>
+	static void reduce_all(T* dst, const T* src, size_t count, bool maximum) {
+		thread_pool::shared().parallel_for(chunks(count), [&](int c) {
+			size_t begin = c * CHUNK;
+			size_t n = std::min(count, begin + CHUNK) - begin;
+			size_t done = reduce_avx2(dst + begin, src + begin, n, maximum);
+			if (maximum)
+				for (size_t i = done; i < n; i++)
+					dst[begin + i] = std::max(dst[begin + i], src[begin + i]);
+			else
+				for (size_t i = done; i < n; i++)
+					dst[begin + i] = std::min(dst[begin + i], src[begin + i]);
+		});
+	}
+
+	// 16 voxels per step for 16-bit scans; returns the number of voxels done (the caller finishes the rest).
+	template <class T>
+	static size_t reduce_avx2(T*, const T*, size_t, bool) {
+		return 0;
+	}
+
+	static size_t reduce_avx2(short* dst, const short* src, size_t count, bool maximum) {
+		return slice_extract::has_avx2() ? reduce_16(dst, src, count, maximum, true) : 0;
+	}
+
+	static size_t reduce_avx2(unsigned short* dst, const unsigned short* src, size_t count, bool maximum) {
+		return slice_extract::has_avx2() ? reduce_16(dst, src, count, maximum, false) : 0;
+	}
+
+#ifdef SLICE_EXTRACT_X86
+	SLICE_EXTRACT_AVX2 static size_t reduce_16(void* dst, const void* src, size_t count, bool maximum, bool is_signed) {
+
+		__m256i* d = static_cast<__m256i*>(dst);
+		const __m256i* s = static_cast<const __m256i*>(src);
+		size_t steps = count / 16;
+		for (size_t i = 0; i < steps; i++) {
+			__m256i a = _mm256_loadu_si256(d + i);
+			__m256i b = _mm256_loadu_si256(s + i);
+			__m256i r = is_signed ? (maximum ? _mm256_max_epi16(a, b) : _mm256_min_epi16(a, b))
+				: (maximum ? _mm256_max_epu16(a, b) : _mm256_min_epu16(a, b));
+			_mm256_storeu_si256(d + i, r);
+		}
+		return steps * 16;
+	}
+#else
+	static size_t reduce_16(void*, const void*, size_t, bool, bool) {
+		return 0;
+	}
+#endif
+};
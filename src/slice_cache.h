@@ -0,0 +1,412 @@
+/*
+This header contains slice_cache, an LRU cache of extracted axial/coronal/sagittal slices
+(raw voxel values, before window/level and colour mapping) for every dataset. While the
+user drags a slice slider, the next slices in the direction of the drag are extracted on
+the thread pool, so scrubbing back and forth through a region is served from memory.
+
+Slices are extracted with the direct copy of slice_extract.h, so no VTK pipeline object is
+touched off the GUI thread. Slices that cannot be copied directly (oblique or between
+voxels) are not cached; get() returns NULL for them and the caller uses its vtkImageReslice
+pipeline instead. Colour mapping is a separate pass (colormap_kernel.h) done at display time,
+so changing the window/level or lookup table never invalidates the cache.
+
+Memory is bounded by max_bytes. Everything cached for a dataset is dropped when its volume
+or plane geometry changes. For a volume that is still being decoded, set_decoded_slices()
+limits extraction to the slices already written; the rest of a coronal/sagittal slice is
+left zero, so nothing is read while a decode thread writes it.
+
+	slices.set_plane(1, AXIAL, volume, reslice_axes, reslice->GetOutput());
+	std::shared_ptr<const raw_slice> slice = slices.get(1, AXIAL, index);
+	slices.prefetch(1, AXIAL, index, +1);
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkImageData.h>
+#include <vtkMatrix4x4.h>
+#include <vtkSmartPointer.h>
+
+// Our header files
+#include "slice_extract.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <vector>
+
+
+// One extracted slice: voxel values in the geometry of the plane's vtkImageReslice output.
+struct raw_slice {
+	std::vector<char> values;  // width * height scalars, row by row
+	int scalar_type;           // VTK scalar type of the volume
+	int width, height;
+	int extent[6];
+	double origin[3];
+	double spacing[3];
+};
+
+
+class slice_cache {
+
+public:
+	// upper bound for the pixels held by the cache
+	size_t max_bytes = 256 * 1024 * 1024;
+
+	// slices produced ahead of the slider while it is moving
+	int prefetch_depth = 8;
+
+	// counters (GUI thread)
+	long long hits = 0;
+	long long misses = 0;
+
+	slice_cache() {}
+
+	slice_cache(const slice_cache&) = delete;
+	slice_cache& operator=(const slice_cache&) = delete;
+
+	// Wait for in-flight prefetches; they hold pointers to this cache.
+	~slice_cache() {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this]() { return in_flight == 0; });
+	}
+
+	/*
+	Slice geometry shared by every dataset: slider index i of a plane puts the plane at
+	origin[axis] + i * spacing[axis] (dataset 1's voxel grid). Clears the cache.
+	*/
+	void set_reference(const double origin[3], const double spacing[3]) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		memcpy(reference_origin, origin, sizeof(reference_origin));
+		memcpy(reference_spacing, spacing, sizeof(reference_spacing));
+		for (std::map<int, int>::iterator it = generations.begin(); it != generations.end(); ++it)
+			it->second++;
+		drop_entries(-1);
+	}
+
+	/*
+	Register (or replace) the source of one plane of a dataset. Drops that dataset's slices.
+
+	Args:
+		volume: the dataset's volume
+		axes: the plane's reslice axes (the translation along the plane normal is ignored)
+		reslice_output: output of the plane's vtkImageReslice (for extent, origin and spacing)
+	*/
+	void set_plane(int dset_num, int plane_idx, vtkImageData* volume, vtkMatrix4x4* axes, vtkImageData* reslice_output) {
+
+		std::shared_ptr<plane_source> source = std::make_shared<plane_source>();
+		source->volume = volume;
+		source->axis = plane_axis(plane_idx);
+		for (int r = 0; r < 4; r++)
+			for (int c = 0; c < 4; c++)
+				source->axes[r][c] = axes->GetElement(r, c);
+		reslice_output->GetExtent(source->out_ext);
+		reslice_output->GetOrigin(source->out_origin);
+		reslice_output->GetSpacing(source->out_spacing);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		sources[std::make_pair(dset_num, plane_idx)] = source;
+		generations[dset_num]++;
+		drop_entries(dset_num);
+	}
+
+	// Drop a dataset's slices but keep its planes (e.g. while its volume is still being decoded).
+	void invalidate(int dset_num) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		generations[dset_num]++;
+		drop_entries(dset_num);
+	}
+
+	/*
+	Only read the first count slices (z) of a dataset's volume, or all of them for -1 (a volume
+	whose decode finished or failed). Drops that dataset's slices.
+	*/
+	void set_decoded_slices(int dset_num, int count) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (count < 0)
+			decoded_slices.erase(dset_num);
+		else
+			decoded_slices[dset_num] = count;
+		generations[dset_num]++;
+		drop_entries(dset_num);
+	}
+
+	// Forget a dataset completely (e.g. before it is reloaded).
+	void remove_dataset(int dset_num) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int plane_idx = 1; plane_idx < 4; plane_idx++)
+			sources.erase(std::make_pair(dset_num, plane_idx));
+		decoded_slices.erase(dset_num);
+		generations[dset_num]++;
+		drop_entries(dset_num);
+	}
+
+	/*
+	The slice at a slider index, from the cache or extracted now. Returns NULL if the slice
+	cannot be produced by a direct copy (the caller then uses vtkImageReslice).
+	*/
+	std::shared_ptr<const raw_slice> get(int dset_num, int plane_idx, int index) {
+
+		job request;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			slice_key key(dset_num, plane_idx, index);
+			std::map<slice_key, std::list<entry>::iterator>::iterator found = lookup.find(key);
+			if (found != lookup.end()) {
+				lru.splice(lru.begin(), lru, found->second); // most recently used
+				hits++;
+				return found->second->slice;
+			}
+
+			misses++;
+			if (!make_job(key, request))
+				return NULL;
+		}
+
+		std::shared_ptr<const raw_slice> slice = produce(request);
+		if (slice != NULL)
+			insert(request, slice);
+		return slice;
+	}
+
+	/*
+	Produce the next prefetch_depth slices after index in the given direction (+1/-1), and
+	the one just behind it, on the thread pool. Slices already cached or queued are skipped.
+	*/
+	void prefetch(int dset_num, int plane_idx, int index, int direction) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (int d = -1; d <= prefetch_depth; d++) {
+			if (d == 0)
+				continue;
+
+			slice_key key(dset_num, plane_idx, index + d * direction);
+			job request;
+			if (lookup.count(key) || pending.count(key) || !make_job(key, request))
+				continue;
+
+			pending.insert(key);
+			in_flight++;
+
+			thread_pool::shared().submit([this, request]() {
+				std::shared_ptr<const raw_slice> slice = produce(request);
+				if (slice != NULL)
+					insert(request, slice);
+
+				std::lock_guard<std::mutex> lock(mutex);
+				pending.erase(request.key);
+				in_flight--;
+				idle.notify_all();
+			});
+		}
+	}
+
+	// Bytes currently held.
+	size_t bytes() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return total_bytes;
+	}
+
+	// Bytes currently held for one dataset.
+	size_t bytes(int dset_num) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		size_t total = 0;
+		for (std::list<entry>::const_iterator it = lru.begin(); it != lru.end(); ++it) {
+			if (std::get<0>(it->key) == dset_num)
+				total += it->bytes;
+		}
+		return total;
+	}
+
+	// Apply a new max_bytes right away.
+	void set_max_bytes(size_t bytes_allowed) {
+		std::lock_guard<std::mutex> lock(mutex);
+		max_bytes = bytes_allowed;
+		evict();
+	}
+
+private:
+	// dataset, plane, slider index
+	typedef std::tuple<int, int, int> slice_key;
+
+	// everything needed to produce one slice of a plane
+	struct plane_source {
+		vtkSmartPointer<vtkImageData> volume;
+		int axis;              // axis along the plane normal
+		double axes[4][4];
+		int out_ext[6];
+		double out_origin[3];
+		double out_spacing[3];
+	};
+
+	// one slice to produce (copied into worker tasks)
+	struct job {
+		slice_key key;
+		int generation;
+		double position; // world position of the plane along its normal
+		int decoded_slices; // slices (z) of the volume that may be read, -1: all
+		std::shared_ptr<const plane_source> source;
+	};
+
+	struct entry {
+		slice_key key;
+		std::shared_ptr<const raw_slice> slice;
+		size_t bytes;
+	};
+
+	std::mutex mutex;
+	std::condition_variable idle;
+	int in_flight = 0;
+
+	double reference_origin[3] = { 0, 0, 0 };
+	double reference_spacing[3] = { 1, 1, 1 };
+
+	std::map<std::pair<int, int>, std::shared_ptr<const plane_source>> sources;
+	std::map<int, int> generations; // bumped whenever a dataset's cached slices become stale
+	std::map<int, int> decoded_slices; // datasets still being decoded (see set_decoded_slices())
+
+	std::list<entry> lru; // most recently used first
+	std::map<slice_key, std::list<entry>::iterator> lookup;
+	std::set<slice_key> pending;
+	size_t total_bytes = 0;
+
+	static int plane_axis(int plane_idx) {
+		static const int map[] = { -1, 2, 1, 0 }; // same as ui.h
+		return map[plane_idx];
+	}
+
+	// Fill in a job for a key (mutex held). False if the dataset/plane is unknown or the index is out of range.
+	bool make_job(const slice_key& key, job& request) {
+
+		int dset_num = std::get<0>(key);
+		std::map<std::pair<int, int>, std::shared_ptr<const plane_source>>::iterator source =
+			sources.find(std::make_pair(dset_num, std::get<1>(key)));
+		if (source == sources.end() || std::get<2>(key) < 0)
+			return false;
+
+		request.key = key;
+		request.generation = generations[dset_num];
+		request.position = reference_origin[source->second->axis] + std::get<2>(key) * reference_spacing[source->second->axis];
+		request.source = source->second;
+		std::map<int, int>::const_iterator decoded = decoded_slices.find(dset_num);
+		request.decoded_slices = decoded == decoded_slices.end() ? -1 : decoded->second;
+		return true;
+	}
+
+	// Copy the slice out of the volume. NULL if it is not a direct copy.
+	static std::shared_ptr<const raw_slice> produce(const job& request) {
+
+		const plane_source& source = *request.source;
+		vtkImageData* volume = source.volume;
+		TRACE_SCOPE("slice_cache_fill", std::get<0>(request.key), std::get<1>(request.key));
+
+		if (volume->GetNumberOfScalarComponents() != 1)
+			return NULL;
+
+		double axes[4][4];
+		memcpy(axes, source.axes, sizeof(axes));
+		axes[source.axis][3] = request.position;
+
+		slice_mapping mapping;
+		if (!slice_extract::map_plane(axes, volume->GetOrigin(), volume->GetSpacing(), source.out_origin,
+			source.out_spacing, mapping) || !slice_extract::is_inside(mapping, source.out_ext, volume->GetExtent()))
+			return NULL;
+
+		std::shared_ptr<raw_slice> slice = std::make_shared<raw_slice>();
+		slice->scalar_type = volume->GetScalarType();
+		slice->width = source.out_ext[1] - source.out_ext[0] + 1;
+		slice->height = source.out_ext[3] - source.out_ext[2] + 1;
+		memcpy(slice->extent, source.out_ext, sizeof(slice->extent));
+		memcpy(slice->origin, source.out_origin, sizeof(slice->origin));
+		memcpy(slice->spacing, source.out_spacing, sizeof(slice->spacing));
+
+		int scalar_size = volume->GetScalarSize();
+		const char* in_voxels = static_cast<const char*>(volume->GetScalarPointer());
+		const char* in_end = in_voxels + (size_t)volume->GetNumberOfPoints() * scalar_size;
+
+		ptrdiff_t row_bytes = (ptrdiff_t)slice->width * scalar_size;
+		slice->values.resize((size_t)slice->width * slice->height * scalar_size);
+
+		int* in_ext = volume->GetExtent();
+		int decoded_ext[6];
+		memcpy(decoded_ext, in_ext, sizeof(decoded_ext));
+		if (request.decoded_slices >= 0)
+			decoded_ext[5] = std::min(in_ext[5], in_ext[4] + request.decoded_slices - 1);
+
+		if (slice_extract::is_inside(mapping, source.out_ext, decoded_ext)) {
+			slice_extract::copy_slice(mapping, in_voxels, in_ext, scalar_size, in_end, source.out_ext,
+				slice->values.data(), row_bytes, (ptrdiff_t)slice->width * slice->height * scalar_size);
+		}
+		else {
+			// partly decoded volume: copy the rows that lie in the decoded slices, the others stay zero
+			for (int j = source.out_ext[2]; j <= source.out_ext[3]; j++) {
+				int row_ext[6] = { source.out_ext[0], source.out_ext[1], j, j, source.out_ext[4], source.out_ext[5] };
+				if (slice_extract::is_inside(mapping, row_ext, decoded_ext))
+					slice_extract::copy_slice(mapping, in_voxels, in_ext, scalar_size, in_end, row_ext,
+						slice->values.data() + (j - source.out_ext[2]) * row_bytes, row_bytes, row_bytes);
+			}
+		}
+
+		return slice;
+	}
+
+	// Add a produced slice, unless its dataset changed in the meantime.
+	void insert(const job& request, const std::shared_ptr<const raw_slice>& slice) {
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (generations[std::get<0>(request.key)] != request.generation || lookup.count(request.key))
+			return;
+
+		entry e;
+		e.key = request.key;
+		e.slice = slice;
+		e.bytes = slice->values.size();
+
+		lru.push_front(e);
+		lookup[request.key] = lru.begin();
+		total_bytes += e.bytes;
+		evict();
+	}
+
+	// Drop least recently used slices until the cache fits in max_bytes (mutex held).
+	void evict() {
+
+		while (total_bytes > max_bytes && !lru.empty()) {
+			total_bytes -= lru.back().bytes;
+			lookup.erase(lru.back().key);
+			lru.pop_back();
+		}
+	}
+
+	// Drop every slice of a dataset, or of all datasets for -1 (mutex held).
+	void drop_entries(int dset_num) {
+
+		for (std::list<entry>::iterator it = lru.begin(); it != lru.end();) {
+			if (dset_num < 0 || std::get<0>(it->key) == dset_num) {
+				total_bytes -= it->bytes;
+				lookup.erase(it->key);
+				it = lru.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+	}
+};
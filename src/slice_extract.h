@@ -0,0 +1,296 @@
+/*
+This header contains slice_extract, the direct slice copy behind fast_reslice (fast_reslice.h)
+and the slice cache (slice_cache.h). An axis-aligned slice at an integer position is just a
+strided walk through the volume:
+
+	slice_mapping mapping;
+	if (slice_extract::map_plane(axes, in_origin, in_spacing, out_origin, out_spacing, mapping) &&
+		slice_extract::is_inside(mapping, out_ext, in_ext))
+		slice_extract::copy_slice(mapping, in_voxels, in_ext, element_size, in_end, out_ext, out, row_bytes, slice_bytes);
+
+Each output row is a memcpy for unit strides (axial rows), an AVX2 gather for 2- and 4-byte
+voxels with other strides (coronal/sagittal rows, the cache-hostile case) and a plain loop
+otherwise. The AVX2 path is picked at run time, so the binary still runs on CPUs without it.
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SLICE_EXTRACT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// functions using AVX2 intrinsics (MSVC accepts them without a target attribute)
+#if defined(SLICE_EXTRACT_X86) && (defined(__GNUC__) || defined(__clang__))
+#define SLICE_EXTRACT_AVX2 __attribute__((target("avx2")))
+#else
+#define SLICE_EXTRACT_AVX2
+#endif
+
+
+// Output index (i, j, k) -> input index base + i * step[0] + j * step[1] + k * step[2].
+struct slice_mapping {
+	long long base[3];
+	long long step[3][3]; // step[c] = input index change per output index c
+};
+
+
+class slice_extract {
+
+public:
+	/*
+	Work out how output pixels map onto input voxels. Returns false unless every output pixel
+	sits exactly on a voxel (axis-aligned plane, integer position, integer sampling).
+
+	Args:
+		axes: reslice axes (output coordinates -> world), row major
+		in_origin, in_spacing: input volume geometry
+		out_origin, out_spacing: output slice geometry
+	*/
+	static bool map_plane(const double axes[4][4], const double in_origin[3], const double in_spacing[3],
+		const double out_origin[3], const double out_spacing[3], slice_mapping& mapping) {
+
+		if (axes[3][0] != 0.0 || axes[3][1] != 0.0 || axes[3][2] != 0.0 || axes[3][3] != 1.0)
+			return false; // perspective
+
+		for (int r = 0; r < 3; r++) {
+			double world = axes[r][3];
+			for (int c = 0; c < 3; c++)
+				world += axes[r][c] * out_origin[c];
+
+			if (!to_integer((world - in_origin[r]) / in_spacing[r], mapping.base[r]))
+				return false; // fractional position
+
+			for (int c = 0; c < 3; c++) {
+				if (!to_integer(axes[r][c] * out_spacing[c] / in_spacing[r], mapping.step[c][r]))
+					return false; // oblique plane or non-integer sampling
+			}
+		}
+		return true;
+	}
+
+	// True if every pixel of out_ext maps inside in_ext (checking the corners is enough, the mapping is affine).
+	static bool is_inside(const slice_mapping& mapping, const int out_ext[6], const int in_ext[6]) {
+
+		for (int corner = 0; corner < 8; corner++) {
+			int i = out_ext[(corner & 1) ? 1 : 0];
+			int j = out_ext[(corner & 2) ? 3 : 2];
+			int k = out_ext[(corner & 4) ? 5 : 4];
+			for (int r = 0; r < 3; r++) {
+				long long index = mapping.base[r] + i * mapping.step[0][r] + j * mapping.step[1][r] + k * mapping.step[2][r];
+				if (index < in_ext[2 * r] || index > in_ext[2 * r + 1])
+					return false;
+			}
+		}
+		return true;
+	}
+
+	/*
+	Copy out_ext of a slice out of the volume (the mapping must be inside, see is_inside()).
+
+	Args:
+		in_voxels, in_ext, in_end: the volume (first voxel, extent, end of the buffer)
+		element_size: bytes per voxel (scalar size * components)
+		out: where pixel (out_ext[0], out_ext[2], out_ext[4]) goes
+		row_bytes, slice_bytes: distance between output rows / slices
+	*/
+	static void copy_slice(const slice_mapping& mapping, const void* in_voxels, const int in_ext[6], int element_size,
+		const void* in_end, const int out_ext[6], void* out, ptrdiff_t row_bytes, ptrdiff_t slice_bytes) {
+
+		// element strides of the input volume (relative to its extent)
+		long long in_x = in_ext[1] - in_ext[0] + 1;
+		long long in_y = in_ext[3] - in_ext[2] + 1;
+		long long in_stride[3] = { 1, in_x, in_x * in_y };
+
+		long long stride = 0;
+		for (int r = 0; r < 3; r++)
+			stride += mapping.step[0][r] * in_stride[r];
+
+		const char* in_bytes = static_cast<const char*>(in_voxels);
+		char* out_bytes = static_cast<char*>(out);
+		int row_length = out_ext[1] - out_ext[0] + 1;
+
+		for (int k = out_ext[4]; k <= out_ext[5]; k++) {
+			for (int j = out_ext[2]; j <= out_ext[3]; j++) {
+				long long offset = 0;
+				for (int r = 0; r < 3; r++) {
+					long long index = mapping.base[r] + out_ext[0] * mapping.step[0][r] + j * mapping.step[1][r] + k * mapping.step[2][r];
+					offset += (index - in_ext[2 * r]) * in_stride[r];
+				}
+
+				char* row = out_bytes + (k - out_ext[4]) * slice_bytes + (j - out_ext[2]) * row_bytes;
+				copy_row(in_bytes + offset * element_size, (ptrdiff_t)stride, row, row_length, element_size, in_voxels, in_end);
+			}
+		}
+	}
+
+	// True if the CPU (and OS) support AVX2; checked once.
+	static bool has_avx2() {
+		static const bool supported = detect_avx2();
+		return supported;
+	}
+
+	/*
+	Copy count elements from src, src + stride, src + 2*stride, ... to dst (contiguous).
+
+	Args:
+		src: first element to copy
+		stride: distance between source elements, in elements (may be negative)
+		dst: output row
+		count: number of elements
+		element_size: bytes per element (scalar size * components)
+		volume_begin, volume_end: bounds of the source buffer; the gather reads 4 bytes per
+			2-byte element, so it is only used where that stays inside the buffer
+	*/
+	static void copy_row(const void* src, ptrdiff_t stride, void* dst, int count, int element_size,
+		const void* volume_begin, const void* volume_end) {
+
+		if (count <= 0)
+			return;
+
+		if (stride == 1) {
+			memcpy(dst, src, (size_t)count * element_size);
+			return;
+		}
+
+		switch (element_size) {
+		case 1:
+			copy_strided(static_cast<const uint8_t*>(src), stride, static_cast<uint8_t*>(dst), count);
+			break;
+		case 2:
+			if (can_gather(src, stride, count, 2, volume_begin, volume_end))
+				gather_u16(static_cast<const uint16_t*>(src), stride, static_cast<uint16_t*>(dst), count);
+			else
+				copy_strided(static_cast<const uint16_t*>(src), stride, static_cast<uint16_t*>(dst), count);
+			break;
+		case 4:
+			if (can_gather(src, stride, count, 4, volume_begin, volume_end))
+				gather_u32(static_cast<const uint32_t*>(src), stride, static_cast<uint32_t*>(dst), count);
+			else
+				copy_strided(static_cast<const uint32_t*>(src), stride, static_cast<uint32_t*>(dst), count);
+			break;
+		case 8:
+			copy_strided(static_cast<const uint64_t*>(src), stride, static_cast<uint64_t*>(dst), count);
+			break;
+		default: {
+			const char* s = static_cast<const char*>(src);
+			char* d = static_cast<char*>(dst);
+			for (int i = 0; i < count; i++)
+				memcpy(d + (size_t)i * element_size, s + (ptrdiff_t)i * stride * element_size, element_size);
+		}
+		}
+	}
+
+private:
+	// value rounded to an integer, if it is one (up to floating point noise)
+	static bool to_integer(double value, long long& result) {
+		double rounded = std::floor(value + 0.5);
+		result = (long long)rounded;
+		return std::fabs(value - rounded) < 1e-4;
+	}
+
+	template <class T>
+	static void copy_strided(const T* src, ptrdiff_t stride, T* dst, int count) {
+		for (int i = 0; i < count; i++)
+			dst[i] = src[(ptrdiff_t)i * stride];
+	}
+
+	/*
+	The gathers use 32-bit byte offsets and always load 4 bytes, so a row qualifies if its byte
+	span fits in an int32 and (for 2-byte elements) 2 bytes past its highest element are
+	still inside the volume.
+	*/
+	static bool can_gather(const void* src, ptrdiff_t stride, int count, int element_size,
+		const void* volume_begin, const void* volume_end) {
+
+		if (count < 8 || !has_avx2())
+			return false;
+
+		ptrdiff_t span = 15 * stride * element_size; // widest offset within one step of the kernels
+		if (span > INT32_MAX || span < -INT32_MAX)
+			return false;
+
+		const char* first = static_cast<const char*>(src);
+		const char* last = first + (ptrdiff_t)(count - 1) * stride * element_size;
+		const char* low = stride > 0 ? first : last;
+		const char* high = stride > 0 ? last : first;
+
+		return low >= static_cast<const char*>(volume_begin) && high + 4 <= static_cast<const char*>(volume_end);
+	}
+
+#ifdef SLICE_EXTRACT_X86
+	// 16 elements per step: two 8-lane 32-bit gathers, low halves packed to 16 bits.
+	SLICE_EXTRACT_AVX2 static void gather_u16(const uint16_t* src, ptrdiff_t stride, uint16_t* dst, int count) {
+
+		int step = (int)(stride * 2);
+		__m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(step));
+		__m256i low_half = _mm256_set1_epi32(0xFFFF);
+
+		int i = 0;
+		for (; i + 16 <= count; i += 16) {
+			const char* p = reinterpret_cast<const char*>(src + (ptrdiff_t)i * stride);
+			__m256i a = _mm256_i32gather_epi32(reinterpret_cast<const int*>(p), offsets, 1);
+			__m256i b = _mm256_i32gather_epi32(reinterpret_cast<const int*>(p + 8 * (ptrdiff_t)step), offsets, 1);
+
+			// packus works per 128-bit lane (a0-3 b0-3 a4-7 b4-7), so put the quarters back in order
+			__m256i packed = _mm256_packus_epi32(_mm256_and_si256(a, low_half), _mm256_and_si256(b, low_half));
+			packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), packed);
+		}
+
+		copy_strided(src + (ptrdiff_t)i * stride, stride, dst + i, count - i);
+	}
+
+	// 8 elements per step with one 32-bit gather.
+	SLICE_EXTRACT_AVX2 static void gather_u32(const uint32_t* src, ptrdiff_t stride, uint32_t* dst, int count) {
+
+		int step = (int)(stride * 4);
+		__m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(step));
+
+		int i = 0;
+		for (; i + 8 <= count; i += 8) {
+			const int* p = reinterpret_cast<const int*>(src + (ptrdiff_t)i * stride);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_i32gather_epi32(p, offsets, 1));
+		}
+
+		copy_strided(src + (ptrdiff_t)i * stride, stride, dst + i, count - i);
+	}
+
+	static bool detect_avx2() {
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		bool os_saves_ymm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		return os_saves_ymm && (info[1] & (1 << 5));
+#else
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+#else
+	static void gather_u16(const uint16_t* src, ptrdiff_t stride, uint16_t* dst, int count) {
+		copy_strided(src, stride, dst, count);
+	}
+
+	static void gather_u32(const uint32_t* src, ptrdiff_t stride, uint32_t* dst, int count) {
+		copy_strided(src, stride, dst, count);
+	}
+
+	static bool detect_avx2() {
+		return false;
+	}
+#endif
+};
@@ -0,0 +1,145 @@
+/*
+This header contains a small thread pool that is shared by everything in the application
+that wants to use more than one core (series decoding, slice prefetching, ...).
+
+	thread_pool::shared().parallel_for(num_files, [&](int i) { decode(i); });
+	thread_pool::shared().submit([=]() { prefetch(k); });
+
+parallel_for() also runs work on the calling thread, so it is safe to call it from inside
+a pool task (it just runs serially if every worker is busy).
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class thread_pool {
+
+public:
+	// num_threads = 0 means one worker per hardware thread
+	explicit thread_pool(int num_threads = 0) {
+
+		if (num_threads <= 0)
+			num_threads = (int)std::thread::hardware_concurrency();
+		if (num_threads <= 0)
+			num_threads = 1;
+
+		for (int i = 0; i < num_threads; i++)
+			workers.push_back(std::thread(&thread_pool::worker_loop, this));
+	}
+
+	~thread_pool() {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+
+		for (size_t i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	// The process-wide pool.
+	static thread_pool& shared() {
+		static thread_pool pool;
+		return pool;
+	}
+
+	int size() const {
+		return (int)workers.size();
+	}
+
+	// Queue a task to run on one of the workers.
+	void submit(std::function<void()> task) {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(std::move(task));
+		}
+		wake.notify_one();
+	}
+
+	// Run fn(i) for every i in [0, count) across the workers and the calling thread.
+	// Returns once every index has been processed.
+	void parallel_for(int count, const std::function<void(int)>& fn) {
+
+		if (count <= 0)
+			return;
+
+		// shared with the helper tasks; helpers that start after all the work is done just
+		// find no indices left, so the state must outlive this call
+		std::shared_ptr<parallel_for_state> state = std::make_shared<parallel_for_state>();
+		state->count = count;
+		state->fn = &fn;
+
+		int num_helpers = std::min(size(), count - 1);
+		for (int i = 0; i < num_helpers; i++)
+			submit([state]() { run_indices(*state); });
+
+		run_indices(*state);
+
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->all_done.wait(lock, [&]() { return state->done == state->count; });
+	}
+
+private:
+	// bookkeeping for one parallel_for() call
+	struct parallel_for_state {
+		std::atomic<int> next{ 0 };
+		int count = 0;
+		int done = 0; // guarded by mutex
+		const std::function<void(int)>* fn = NULL;
+		std::mutex mutex;
+		std::condition_variable all_done;
+	};
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	// Pull indices until there are none left, then report how many this thread processed.
+	static void run_indices(parallel_for_state& state) {
+
+		int processed = 0;
+		for (int i = state.next++; i < state.count; i = state.next++) {
+			(*state.fn)(i);
+			processed++;
+		}
+
+		if (processed > 0) {
+			std::lock_guard<std::mutex> lock(state.mutex);
+			state.done += processed;
+			if (state.done == state.count)
+				state.all_done.notify_all();
+		}
+	}
+
+	void worker_loop() {
+
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+				if (stopping && tasks.empty())
+					return;
+				task = std::move(tasks.front());
+				tasks.pop_front();
+			}
+			task();
+		}
+	}
+};
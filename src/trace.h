@@ -0,0 +1,284 @@
+/*
+This header contains a lightweight tracer for the hot paths (file parsing, pixel decoding,
+reslicing, colour mapping, rendering). Spans are recorded per thread and can be exported
+as a Chrome trace-event JSON file (open it in chrome://tracing or ui.perfetto.dev).
+
+	void decode(...) {
+		TRACE_SCOPE("decode", dset_num, -1);
+		...
+	}
+
+Tracing is always compiled in. While it is disabled a span costs one relaxed atomic load,
+so the macros can stay in release builds. Enable it with tracer::shared().set_enabled(true)
+(Tools menu) or by starting the application with --trace <file.json>.
+
+VTK filters execute lazily inside Render(), so they are traced with trace_algorithm(), which
+turns the filter's StartEvent/EndEvent into a span.
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkAlgorithm.h>
+#include <vtkCallbackCommand.h>
+#include <vtkCommand.h>
+#include <vtkSmartPointer.h>
+
+// Qt header files
+#include <QFile>
+#include <QString>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// One finished span.
+struct trace_event {
+	const char* name;    // must be a string literal (only the pointer is stored)
+	int64_t start_us;    // microseconds since the tracer was created
+	int64_t duration_us;
+	int dataset;         // dataset number (1, 2, ...) or -1
+	int plane;           // plane index (0 = volume, 1 = axial, ...) or -1
+};
+
+
+class tracer {
+
+public:
+	// spans kept per thread; older spans are dropped once a thread's buffer is full
+	static const size_t MAX_EVENTS_PER_THREAD = 1 << 20;
+
+	// The process-wide tracer.
+	static tracer& shared() {
+		static tracer instance;
+		return instance;
+	}
+
+	// Checked on every span, so keep it a single relaxed load.
+	bool enabled() const {
+		return is_enabled.load(std::memory_order_relaxed);
+	}
+
+	void set_enabled(bool on) {
+		is_enabled.store(on, std::memory_order_relaxed);
+	}
+
+	// Microseconds since the tracer was created (the time base of every span).
+	int64_t now_us() const {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	// Record a finished span on the calling thread.
+	void record(const char* name, int64_t start_us, int64_t end_us, int dataset, int plane) {
+
+		thread_buffer& buffer = local_buffer();
+		trace_event event = { name, start_us, end_us - start_us, dataset, plane };
+
+		std::lock_guard<std::mutex> lock(buffer.mutex); // only contended while exporting
+		if (buffer.events.size() < MAX_EVENTS_PER_THREAD)
+			buffer.events.push_back(event);
+		else
+			buffer.dropped++;
+	}
+
+	// Name the calling thread in exported traces (e.g. "pool worker").
+	void set_thread_name(const std::string& name) {
+		thread_buffer& buffer = local_buffer();
+		std::lock_guard<std::mutex> lock(buffer.mutex);
+		buffer.name = name;
+	}
+
+	// Forget every recorded span (the threads stay registered).
+	void clear() {
+
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		for (size_t i = 0; i < buffers.size(); i++) {
+			std::lock_guard<std::mutex> buffer_lock(buffers[i]->mutex);
+			buffers[i]->events.clear();
+			buffers[i]->dropped = 0;
+		}
+	}
+
+	// Number of spans recorded so far (over all threads).
+	size_t event_count() {
+
+		size_t count = 0;
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		for (size_t i = 0; i < buffers.size(); i++) {
+			std::lock_guard<std::mutex> buffer_lock(buffers[i]->mutex);
+			count += buffers[i]->events.size();
+		}
+		return count;
+	}
+
+	/*
+	Write everything recorded so far as a Chrome trace-event JSON file. Spans become
+	complete ("X") events with the dataset and plane in their args; every thread gets a
+	thread_name metadata event. Returns false if the file could not be written.
+	*/
+	bool write_chrome_json(const QString& path) {
+
+		QFile file(path);
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+			cout << "umm could not write trace to " << path.toStdString() << "\n";
+			return false;
+		}
+
+		std::string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		char line[512];
+		bool first = true;
+
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		for (size_t t = 0; t < buffers.size(); t++) {
+			thread_buffer& buffer = *buffers[t];
+			std::lock_guard<std::mutex> buffer_lock(buffer.mutex);
+
+			std::string thread_name = buffer.name.empty() ? "thread " + std::to_string(buffer.tid) : buffer.name;
+			snprintf(line, sizeof(line),
+				"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\",\"dropped_spans\":%llu}}",
+				first ? "" : ",\n", buffer.tid, escape(thread_name).c_str(), (unsigned long long)buffer.dropped);
+			json += line;
+			first = false;
+
+			for (size_t i = 0; i < buffer.events.size(); i++) {
+				const trace_event& e = buffer.events[i];
+				snprintf(line, sizeof(line),
+					",\n{\"name\":\"%s\",\"cat\":\"dicom\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld,"
+					"\"args\":{\"dataset\":%d,\"plane\":%d}}",
+					e.name, buffer.tid, (long long)e.start_us, (long long)e.duration_us, e.dataset, e.plane);
+				json += line;
+			}
+		}
+		json += "\n]}\n";
+
+		return file.write(json.data(), json.size()) == (qint64)json.size();
+	}
+
+private:
+	// spans of one thread; the thread appends, the exporter reads
+	struct thread_buffer {
+		std::mutex mutex;
+		std::vector<trace_event> events;
+		uint64_t dropped = 0;
+		std::string name;
+		int tid = 0;
+	};
+
+	std::atomic<bool> is_enabled;
+	std::chrono::steady_clock::time_point epoch;
+
+	// every thread that ever recorded a span (buffers outlive their threads so they can be exported)
+	std::mutex registry_mutex;
+	std::vector<std::shared_ptr<thread_buffer>> buffers;
+
+	tracer() : is_enabled(false), epoch(std::chrono::steady_clock::now()) {}
+
+	// The calling thread's buffer, registered on first use.
+	thread_buffer& local_buffer() {
+
+		thread_local std::shared_ptr<thread_buffer> buffer;
+		if (!buffer) {
+			buffer = std::make_shared<thread_buffer>();
+			std::lock_guard<std::mutex> lock(registry_mutex);
+			buffer->tid = (int)buffers.size() + 1;
+			buffers.push_back(buffer);
+		}
+		return *buffer;
+	}
+
+	static std::string escape(const std::string& text) {
+
+		std::string out;
+		for (size_t i = 0; i < text.size(); i++) {
+			if (text[i] == '"' || text[i] == '\\')
+				out += '\\';
+			if ((unsigned char)text[i] >= 0x20)
+				out += text[i];
+		}
+		return out;
+	}
+};
+
+
+// RAII span: records [construction, destruction) if tracing was enabled at construction.
+class trace_scope {
+
+public:
+	trace_scope(const char* name, int dataset = -1, int plane = -1) : name(name), dataset(dataset), plane(plane) {
+		start_us = tracer::shared().enabled() ? tracer::shared().now_us() : -1;
+	}
+
+	~trace_scope() {
+		if (start_us >= 0)
+			tracer::shared().record(name, start_us, tracer::shared().now_us(), dataset, plane);
+	}
+
+	trace_scope(const trace_scope&) = delete;
+	trace_scope& operator=(const trace_scope&) = delete;
+
+private:
+	const char* name;
+	int dataset;
+	int plane;
+	int64_t start_us;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+// Trace the rest of the enclosing block: TRACE_SCOPE("name", dataset, plane)
+#define TRACE_SCOPE(...) trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+
+/*
+Trace every execution of a VTK filter (its RequestData, which usually runs inside some
+Render() call) as a span.
+
+Args:
+	algorithm: the filter to observe
+	name: span name (string literal)
+	dataset, plane: tags stored with the span
+*/
+inline void trace_algorithm(vtkAlgorithm* algorithm, const char* name, int dataset, int plane) {
+
+	struct observed_span {
+		const char* name;
+		int dataset;
+		int plane;
+		int64_t start_us;
+	};
+
+	struct callbacks {
+		static void on_event(vtkObject*, unsigned long event_id, void* client_data, void*) {
+
+			observed_span* span = static_cast<observed_span*>(client_data);
+			tracer& t = tracer::shared();
+
+			if (event_id == vtkCommand::StartEvent)
+				span->start_us = t.enabled() ? t.now_us() : -1;
+			else if (span->start_us >= 0)
+				t.record(span->name, span->start_us, t.now_us(), span->dataset, span->plane);
+		}
+
+		static void delete_span(void* client_data) {
+			delete static_cast<observed_span*>(client_data);
+		}
+	};
+
+	observed_span* span = new observed_span{ name, dataset, plane, -1 };
+
+	vtkSmartPointer<vtkCallbackCommand> command = vtkSmartPointer<vtkCallbackCommand>::New();
+	command->SetCallback(callbacks::on_event);
+	command->SetClientData(span);
+	command->SetClientDataDeleteCallback(callbacks::delete_span);
+
+	algorithm->AddObserver(vtkCommand::StartEvent, command);
+	algorithm->AddObserver(vtkCommand::EndEvent, command);
+}
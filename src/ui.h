@@ -7,26 +7,73 @@ general purpose DICOM reader. The VTK library is used to implement
 the visualization in this application. 
 
 Notable features:
-- Ability to load and view two separate DICOM datasets. The user is able to 
-choose a directory for each dataset.
-- The second dataset overlays on top of the first dataset.
+- Ability to load and view any number of DICOM datasets. The user is able to 
+choose a directory for each dataset (File > Add DICOM overlay... for more than two).
+- Further datasets overlay on top of the first dataset. The controls of the second column
+apply to the overlay picked in its dataset list, which can also be hidden or closed.
 - For each dataset, the axial/coronal/sagittal slices are shown in 3 separate 
 viewports. 
 - The volume rendering is also visualized in a separate viewport.
 - User is able to change the opacity of the slice renderings.
 - User is able to change the colormap for the volume renderings.
 - The patient name (pulled from the DICOM data) is displayed for each dataset.
+- Series are loaded on a background thread, so the window stays responsive. Load progress
+is shown in the status bar, and a load can be cancelled (File > Cancel loading).
+- A directory is searched for DICOM files in all its subdirectories; the file headers are parsed
+on all cores and grouped into series, and if there is more than one the user picks which to load
+(the picked series is decoded from the headers already parsed).
+- Slices are shown while the series is still being decoded: the axial slider grows as slices
+arrive, coronal/sagittal slices fill in, and the volume view appears once the load is done.
+- Decoded volumes are kept in an on-disk cache, so reopening a series is almost instant. The
+cache can be inspected and cleared from the File menu.
+- Parsing, decoding, reslicing, colour mapping and rendering can be traced (Tools menu or
+--trace <file>) and exported as a Chrome/Perfetto trace.
+- Slices are copied straight out of the volume (SIMD gather) instead of being interpolated,
+since the slider always puts the plane exactly on a row of voxels.
+- Extracted slices are cached, and the next slices in the direction the slider is dragged
+are prefetched on worker threads (memory limit under Tools > Slice cache size).
+- Window/level of the slice views can be changed per dataset. Window/level and the slice colour
+map are applied in one SIMD pass over the raw slice, so dragging them never re-runs the reslice.
+- The intensity histogram of every series is counted on all cores while it is decoded (no extra
+pass over the volume) and shown under the window/level sliders. The default window/level spans
+the 1st to 99th percentile (the background/padding spike left out), so a few outlier voxels no
+longer flatten the contrast; the Auto button goes back to it.
+- Optionally (Tools > Composite slices on CPU, or --cpu-composite) the overlay slices are blended
+over the dataset 1 slice on the CPU, so each view uploads and draws one texture (faster with
+software OpenGL such as Mesa llvmpipe). Opacity changes then only re-run the blend.
+- The volume view renders a 2x or 4x downsampled copy of the volume (built in the background
+after a load) while the camera is rotated or zoomed, picked to hold the target frame rate
+(Tools > Volume frame rate), and refines to full resolution once the interaction stops.
+- The volume view can be ray cast on the CPU instead (Tools > CPU volume rendering, or
+--cpu-volume; switched on automatically when no GPU volume mapper is available): tiles on all
+cores, empty-space skipping over a min/max macro-cell grid and early ray termination.
+- Each slice view can show a thick slab (maximum, minimum or average intensity over up to 500
+slices; the controls under the slice label). Moving the slab by one slice only adds the slice
+coming in and drops the one going out, so dragging a 50-slice slab is about as fast as one slice.
+- Slider and colormap changes are rendered at most once per display frame per viewport; Tools >
+Render statistics shows how many renders were coalesced.
+- The status bar shows the memory the loaded study costs; Tools > Memory usage breaks it down per
+dataset (volume, slice cache, pyramid, slice images, GPU texture estimates) and Tools > Export
+memory report... saves the breakdown as JSON.
+- All datasets share one memory budget (Tools > Memory budget..., or --memory-budget <MB>).
+Over the budget, hidden overlays are unloaded, least recently shown first; showing one again
+reloads it from the volume cache with its settings kept.
+- The selected overlay can be moved and rotated against dataset 1 (Tools > Align overlay...):
+numeric entry, Ctrl+arrow/PgUp/PgDn nudges (with Shift they rotate), and while the dialog is
+open a left-drag in a slice view moves the overlay in that plane and the wheel rotates it about
+the plane's normal. The transform only changes the overlay's reslice geometry and its volume's
+matrix (the volume is never resampled), and can be exported as JSON and loaded again.
+- The slice views can show the selected overlay minus dataset 1, or the absolute difference, with
+their own colour map over a range around zero (Difference, second column). The difference of a
+view is computed (one SIMD pass that also colours it) only when one of its two slices changed; an
+overlay with another voxel grid (or moved) is resliced onto dataset 1's slice grid first.
 
 Pressing improvements/TODOs:
-- Add ability to change window/level for the slice views.
 - Add ability to specify custom color maps (for volume and slice views).
-- Add ability to translate/move one DICOM dataset in a viewport (for some datasets, 
-it becomes difficult to observe differences when both datasets are overlaid *exactly*
-on top of each other).
 
 Expected behavior:
-- Dataset 1 and dataset 2 are loaded once, in whatever order. If dataset 1 is uploaded 
-multiple times, behavior is undefined.
+- Datasets are loaded in whatever order, and any dataset can be loaded again (replaced).
+The replaced volume and everything built from it are released right away.
 - The application is robust enough to never crash even with unexpected usage.
 
 */
@@ -43,6 +90,7 @@ multiple times, behavior is undefined.
 #include <vtkImageData.h>
 #include <vtkImageMapper3D.h>
 #include <vtkImageReslice.h>
+#include <vtkInteractorObserver.h>
 #include <vtkMatrix4x4.h>
 #include <vtkProperty.h>
 #include <vtkRenderWindow.h>
@@ -56,22 +104,67 @@ multiple times, behavior is undefined.
 #include <vtkImageMapper3D.h>
 #include <vtkLookupTable.h>
 #include <vtkImageMapToColors.h>
+#include <vtkCommand.h>
+#include <vtkInteractorStyleTrackballCamera.h>
+#include <vtkTransform.h>
+#include <vtkVolume.h>
 
 // Qt header files
-#include <QMainWindow.h>
-#include <QLayout.h>
-#include <QPushButton.h>
-#include <QLabel.h>
-#include <QSlider.h>
+#include <QMainWindow>
+#include <QLayout>
+#include <QPushButton>
+#include <QLabel>
+#include <QSlider>
 #include <QVTKOpenGLNativeWidget.h>
-#include <QString.h>
+#include <QString>
 #include <qsignalmapper.h>
-#include <QFileDialog.h>
-#include <QDir.h>
-#include <QTextStream.h>
-#include <QMenuBar.h>
-#include <QMenu.h>
-#include <QComboBox.h>
+#include <QFileDialog>
+#include <QDir>
+#include <QTextStream>
+#include <QMenuBar>
+#include <QMenu>
+#include <QComboBox>
+#include <QInputDialog>
+#include <QMessageBox>
+#include <QProgressBar>
+#include <QStatusBar>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QSpinBox>
+#include <QCheckBox>
+#include <QDialog>
+#include <QDoubleSpinBox>
+#include <QFile>
+#include <QGridLayout>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QShortcut>
+
+// Our header files
+#include "colormap_kernel.h"
+#include "colormaps.h"
+#include "cpu_raycaster.h"
+#include "dataset.h"
+#include "dataset_layer.h"
+#include "fast_reslice.h"
+#include "histogram_widget.h"
+#include "loader.h"
+#include "memory_report.h"
+#include "render_scheduler.h"
+#include "resource_manager.h"
+#include "rigid_transform.h"
+#include "slab_projector.h"
+#include "slice_blend.h"
+#include "slice_cache.h"
+#include "slice_difference.h"
+#include "trace.h"
+#include "volume_pyramid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
 
 
 // Class that represents the main window for our application
@@ -99,12 +192,25 @@ public:
 	// dataset column headings
 	QLabel* col0_heading, * col1_heading;
 
+	// overlay the second column's controls apply to, and whether it is drawn
+	QComboBox* overlay_combobox;
+	QCheckBox* overlay_visible_checkbox;
+
 	// opacity sliders
 	QSlider* opacity_slider0, * opacity_slider1;
 
 	// slice opacity slider labels
 	QLabel* opacity_label0, * opacity_label1;
 
+	// slice window/level sliders and their labels
+	QSlider* window_slider0, * window_slider1, * level_slider0, * level_slider1;
+	QLabel* window_label0, * window_label1, * level_label0, * level_label1;
+
+	// intensity histogram of each column's dataset with its window shaded, and the buttons that
+	// put window/level back to the histogram's default (see intensity_histogram.h)
+	histogram_widget* histogram_widget0, * histogram_widget1;
+	QPushButton* auto_window_button0, * auto_window_button1;
+
 	// 3 sliders to control slice # for each of the 3 planes 
 	// (and accompanying labels) (one extra for index purposes)
 	QSlider* slider_arr[NUM_VIEWPORTS]; // 0th element is blank
@@ -114,24 +220,111 @@ public:
 	QVTKOpenGLNativeWidget* viewport_arr[NUM_VIEWPORTS];
 	vtkSmartPointer<vtkGenericOpenGLRenderWindow> window_arr[NUM_VIEWPORTS];
 
-	// vtk actors, filters, renderers for dataset 1
+	// slice planes (shared by all datasets) and renderers
 	vtkSmartPointer<vtkMatrix4x4> reslice_axes_arr[NUM_VIEWPORTS];
-	vtkSmartPointer<vtkImageReslice> reslice_arr[NUM_VIEWPORTS];
-	vtkSmartPointer<vtkImageActor> iactor_arr[NUM_VIEWPORTS];
 	vtkSmartPointer<vtkRenderer> renderer_arr[NUM_VIEWPORTS];
 
-	// vtk reslice filter, actors for dataset 2
-	vtkSmartPointer<vtkImageReslice> reslice_arr2[NUM_VIEWPORTS];
-	vtkSmartPointer<vtkImageActor> iactor_arr2[NUM_VIEWPORTS];
-
-	// vtk volume property for dataset 1, 2
-	vtkSmartPointer<vtkVolumeProperty> volume_property_arr[2];
+	// loaded datasets with their pipelines and settings (see dataset_layer.h). layers[0] is dataset 1,
+	// the reference the slice sliders step through; the others are overlays, drawn in this order
+	std::vector<dataset_layer*> layers;
+	int next_dset_num = 1;
+
+	// keeps the datasets within the memory budget by unloading hidden overlays (see resource_manager.h)
+	resource_manager resources;
+
+	// renders dirty viewports at most once per display frame (slots call scheduler->request())
+	render_scheduler* scheduler;
+
+	// raw slices for all datasets, prefetched along the slider drag (see slice_cache.h)
+	slice_cache slices;
+
+	// CPU compositing of the datasets' slices (see slice_blend.h): the blended image of each
+	// plane, whether it is out of date, and whether the plane is currently shown composited
+	bool cpu_compositing = false;
+	QAction* cpu_composite_action;
+	vtkSmartPointer<vtkImageData> composite_arr[NUM_VIEWPORTS];
+	bool stale_composite_arr[NUM_VIEWPORTS] = {};
+	bool composited_arr[NUM_VIEWPORTS] = {};
+
+	// difference view (see slice_difference.h): the slice views show the selected overlay minus
+	// dataset 1 (or the absolute difference) over +-difference range with their own colour maps
+	// (indexed by mode) instead of the datasets' slices. The overlay is resliced onto dataset 1's
+	// slice grid when its own slices do not cover the same pixels, and each plane remembers what its
+	// difference image was computed from, so only the planes whose slices changed are computed again
+	QComboBox* difference_combobox;
+	QSpinBox* difference_range_spinbox;
+	difference_mode difference = DIFFERENCE_OFF;
+	lut_snapshot difference_colours[3];
+	vtkSmartPointer<vtkImageReslice> difference_reslice_arr[NUM_VIEWPORTS];
+	struct difference_inputs {
+		std::shared_ptr<const raw_slice> slice1, slice2; // (NULL: the image below was used)
+		vtkImageData* image1 = NULL, * image2 = NULL;
+		vtkMTimeType time1 = 0, time2 = 0;
+		int mode = DIFFERENCE_OFF;
+		int range = 0;
+		bool operator==(const difference_inputs& o) const {
+			return slice1 == o.slice1 && slice2 == o.slice2 && image1 == o.image1 && image2 == o.image2 &&
+				time1 == o.time1 && time2 == o.time2 && mode == o.mode && range == o.range;
+		}
+	};
+	difference_inputs difference_shown_arr[NUM_VIEWPORTS];
+
+	// thick-slab projection of each slice plane (see slab_projector.h): MIP/MinIP/average and the
+	// slab thickness in slices (1 = a plain slice); each dataset keeps its sliding windows
+	QComboBox* slab_mode_arr[NUM_VIEWPORTS];
+	QSpinBox* slab_thickness_arr[NUM_VIEWPORTS];
+
+	// last slice index and drag direction (+1/-1) of each slice slider, for prefetching
+	int last_slice_arr[NUM_VIEWPORTS] = { 0, 0, 0, 0 };
+	int scroll_direction_arr[NUM_VIEWPORTS] = { 1, 1, 1, 1 };
+
+	// volume viewport level of detail (see volume_pyramid.h; each dataset has its downsampled
+	// volumes and one mapper per level): the level being rendered and the measured render time of
+	// each level (-1 = not measured yet)
+	int volume_level = 0;
+	double level_render_ms[volume_pyramid::NUM_LEVELS] = { -1, -1, -1 };
+	QElapsedTimer volume_render_clock;
+
+	// frame rate the volume view aims for while the camera moves, and how long the camera has to
+	// be still before the view is rendered at full resolution again
+	int volume_target_fps = 15;
+	int volume_refine_ms = 300;
+	QTimer* refine_timer;
+
+	// CPU ray casting of the volume view (see cpu_raycaster.h; each dataset has one ray caster per
+	// pyramid level): the image it renders into, shown by an image actor in a second layer of the
+	// volume window
+	bool cpu_volume = false;
+	QAction* cpu_volume_action;
+	std::vector<unsigned char> raycast_layer;
+	vtkSmartPointer<vtkImageData> raycast_image;
+	vtkSmartPointer<vtkImageActor> raycast_actor;
+	vtkSmartPointer<vtkRenderer> raycast_renderer;
 
 	// colormap comboboxes
 	QComboBox* color_combobox0, * color_combobox1;
 
-	bool is_data1_loaded = false;
-	bool is_data2_loaded = false;
+	// folds the slices_ready reports of the loads (see loader.h) into a few preview updates per second
+	QTimer* preview_timer;
+
+	// load progress + cancel button (shown in the status bar while a load is running)
+	QProgressBar* load_progress_bar;
+	QPushButton* cancel_load_button;
+
+	// memory of the loaded study and of the process (status bar, refreshed every few seconds)
+	QLabel* memory_label;
+	QTimer* memory_timer;
+
+	// alignment of the selected overlay against dataset 1 (see rigid_transform.h): the dialog with its
+	// translation (mm) and rotation (degrees) and the nudge steps, the keyboard nudges (enabled while
+	// the dialog is open), and the slice viewport being dragged with the last mouse position
+	QDialog* align_dialog;
+	QLabel* align_label;
+	QDoubleSpinBox* align_spin_arr[6];
+	QDoubleSpinBox* align_step_mm, * align_step_deg;
+	std::vector<QShortcut*> align_shortcuts;
+	int drag_plane = 0;
+	int drag_last[2] = { 0, 0 };
 
 	// matrices that defines planes for slicing
 	// https://public.kitware.com/pipermail/vtkusers/2016-January/093908.html
@@ -156,131 +349,8 @@ public:
 	// summarize above in an array of int arrays
 	double* plane_arr[4] = { NULL, axial_plane, coronal_plane, sagittal_plane };
 
-	// LUTs for slice color maps
-	vtkNew<vtkLookupTable> highContrastLut;
-	vtkNew<vtkLookupTable> rainbowRedBlueLut;
-	vtkNew<vtkLookupTable> rainbowBlueRedLut;
-	vtkSmartPointer<vtkLookupTable> classExampleLut = vtkSmartPointer<vtkLookupTable>::New();
-	vtkNew<vtkLookupTable> vtkExampleLut;
-	vtkNew<vtkLookupTable> grayScaleLut;
-	vtkNew<vtkLookupTable> customLut;
-
-	// ctfs for volume color maps
-	vtkSmartPointer<vtkColorTransferFunction> magma_ctf = vtkSmartPointer<vtkColorTransferFunction>::New();
-	vtkSmartPointer<vtkColorTransferFunction> viridis_ctf = vtkSmartPointer<vtkColorTransferFunction>::New();
-	vtkSmartPointer<vtkColorTransferFunction> class_example_ctf = vtkSmartPointer<vtkColorTransferFunction>::New();
-	vtkSmartPointer<vtkColorTransferFunction> grayscale_ctf = vtkSmartPointer<vtkColorTransferFunction>::New();
-
-	// Populate the color transfer function VTK objects required for the 3D VTKVolume color maps.
-	void populate_ctfs() {
-		// magma
-	   /* magma_ctf->AddRGBPoint(0.0, 0.0, 0.0, 0.0);
-		magma_ctf->AddRGBPoint(0.14, 0.094, 0.007, 0.286);
-		magma_ctf->AddRGBPoint(0.28, 0.309, 0.0, 0.478);
-		magma_ctf->AddRGBPoint(0.46, 0.576, 0.071, 0.502);
-		magma_ctf->AddRGBPoint(0.63, 0.843, 0.271, 0.384);
-		magma_ctf->AddRGBPoint(0.8, 0.976, 0.604, 0.388);
-		magma_ctf->AddRGBPoint(1.0, 0.973, 1.0, 0.729);*/
-		magma_ctf->AddRGBPoint(0.0, 0.0, 0.0, 0.0);
-		magma_ctf->AddRGBPoint(100, 0.094, 0.007, 0.286);
-		magma_ctf->AddRGBPoint(150, 0.309, 0.0, 0.478);
-		magma_ctf->AddRGBPoint(350, 0.576, 0.071, 0.502);
-		magma_ctf->AddRGBPoint(400, 0.843, 0.271, 0.384);
-		magma_ctf->AddRGBPoint(500, 0.976, 0.604, 0.388);
-		magma_ctf->AddRGBPoint(550, 0.973, 1.0, 0.729);
-
-		// viridis
-		viridis_ctf->AddRGBPoint(0.0, 0.0, 0.0, 0.0);
-		viridis_ctf->AddRGBPoint(100, 0.28, 0.035, 0.396);
-		viridis_ctf->AddRGBPoint(200, 0.223, 0.325, 0.556);
-		viridis_ctf->AddRGBPoint(350, 0.058, 0.635, 0.529);
-		viridis_ctf->AddRGBPoint(500, 1.0, 0.913, 0.0);
-
-		// class_example_ctf
-		class_example_ctf->AddRGBPoint(0.0, 0.0, 0.0, 1.0);
-		class_example_ctf->AddRGBPoint(300.0, 1.0, 0.0, 0.0);
-		class_example_ctf->AddRGBPoint(555.0, 1.0, 1.0, 1.0);
-
-		// grayscale_ctf
-		grayscale_ctf->AddRGBPoint(0.0, 0.0, 0.0, 0.0);
-		grayscale_ctf->AddRGBPoint(100, 0.094, 0.094, 0.094);
-		grayscale_ctf->AddRGBPoint(150, 0.309, 0.309, 0.309);
-		grayscale_ctf->AddRGBPoint(350, 0.576, 0.576, 0.576);
-		grayscale_ctf->AddRGBPoint(400, 0.843, 0.843, 0.843);
-		grayscale_ctf->AddRGBPoint(500, 0.976, 0.976, 0.976);
-		grayscale_ctf->AddRGBPoint(550, 0.963, 0.963, 0.963);
-	}
-
-	// Populate the VTK lookup tables (member variables) required for the 2D ImageActor color maps.
-	void populate_luts() {
-
-		// highContrastLut
-		highContrastLut->SetNumberOfColors(256);
-		highContrastLut->Build();
-
-		for (int l = 0; l < 16; ++l)
-		{
-			highContrastLut->SetTableValue(l * 16, 1, 0, 0, 1);
-			highContrastLut->SetTableValue(l * 16 + 1, 0, 1, 0, 1);
-			highContrastLut->SetTableValue(l * 16 + 2, 0, 0, 1, 1);
-			highContrastLut->SetTableValue(l * 16 + 3, 0, 0, 0, 1);
-		}
-
-		// ranbowRedBluelut
-		rainbowRedBlueLut->SetNumberOfColors(256);
-		rainbowRedBlueLut->SetHueRange(0.0, 0.667);
-		rainbowRedBlueLut->Build();
-
-		// rainbowBlueRedlut
-		rainbowBlueRedLut->SetNumberOfColors(256);
-		rainbowBlueRedLut->SetHueRange(0.667, 0.0);
-		rainbowBlueRedLut->Build();
-
-		// classExampleLut
-		classExampleLut->SetNumberOfColors(256);
-		classExampleLut->Build();
-		for (int i = 0; i < 256; i++)
-			classExampleLut->SetTableValue(i, (double)i / 255.0, 
-				(double)i / 255.0, 
-				(double)i / 255.0, 1.0); // value, red, green, blue, opacity
-		classExampleLut->SetRange(0, 255);
-
-		// vtkExampleLut
-		vtkExampleLut->SetNumberOfTableValues(256);
-		vtkExampleLut->SetRange(0.0, 255.0);
-		vtkExampleLut->Build();
-
-		// grayScaleLut
-		grayScaleLut->SetHueRange(0, 0);
-		grayScaleLut->SetSaturationRange(0, 0);
-		grayScaleLut->SetValueRange(0.2, 1.0);
-		grayScaleLut->SetNumberOfColors(256);
-		grayScaleLut->SetHueRange(0.0, 0.667);
-		grayScaleLut->Build();
-
-		// customLut
-		double m_mask_opacity = 1;
-		customLut->SetRange(0, 4);
-		customLut->SetRampToLinear();
-		customLut->SetValueRange(0, 1);
-		customLut->SetHueRange(0, 0);
-		customLut->SetSaturationRange(0, 0);
-
-		customLut->SetNumberOfTableValues(10);
-		customLut->SetTableRange(0, 9);
-		customLut->SetTableValue(0, 0, 0, 0, 0);
-		customLut->SetTableValue(1, 1, 0, 0, m_mask_opacity);
-		customLut->SetTableValue(2, 0, 1, 0, m_mask_opacity);
-		customLut->SetTableValue(3, 1, 1, 0, m_mask_opacity);
-		customLut->SetTableValue(4, 0, 0, 1, m_mask_opacity);
-		customLut->SetTableValue(5, 1, 0, 1, m_mask_opacity);
-		customLut->SetTableValue(6, 0, 1, 1, m_mask_opacity);
-		customLut->SetTableValue(7, 1, 0.5, 0.5, m_mask_opacity);
-		customLut->SetTableValue(8, 0.5, 1, 0.5, m_mask_opacity);
-		customLut->SetTableValue(9, 0.5, 0.5, 1, m_mask_opacity);
-		customLut->Build();
-
-	};
+	// LUTs for slice color maps, ctfs for volume color maps
+	colormaps maps;
 
 	// Constructor (happens when created)
 	ui() {
@@ -293,9 +363,6 @@ public:
 		this->setWindowState(Qt::WindowMaximized);
 		this->setMinimumSize(1200, 900);
 
-		populate_ctfs();
-		populate_luts();
-
 
 
 		// S======================= WIDGETS ======================= //
@@ -304,12 +371,69 @@ public:
 		QWidget* widget = new QWidget();
 		widget->setObjectName("central_widget");
 
-		// Add two menu itmes to QMainWindow's in-built menu bar 
+		// Add menu itmes to QMainWindow's in-built menu bar 
 		QAction* load_dset1_action = new QAction("Load DICOM dataset 1");
-		QAction* load_dset2_action = new QAction("Load DICOM dataset 2");
+		QAction* load_overlay_action = new QAction("Load DICOM overlay...");
+		QAction* add_overlay_action = new QAction("Add DICOM overlay...");
+		QAction* close_overlay_action = new QAction("Close selected overlay");
+		QAction* cancel_load_action = new QAction("Cancel loading");
+		QAction* cache_info_action = new QAction("Volume cache info");
+		QAction* clear_cache_action = new QAction("Clear volume cache");
 		auto fileMenu = menuBar()->addMenu("&File");
 		fileMenu->addAction(load_dset1_action);
-		fileMenu->addAction(load_dset2_action);
+		fileMenu->addAction(load_overlay_action);
+		fileMenu->addAction(add_overlay_action);
+		fileMenu->addAction(close_overlay_action);
+		fileMenu->addSeparator();
+		fileMenu->addAction(cancel_load_action);
+		fileMenu->addSeparator();
+		fileMenu->addAction(cache_info_action);
+		fileMenu->addAction(clear_cache_action);
+
+		// tracing of the hot paths (see trace.h)
+		QAction* tracing_action = new QAction("Enable tracing");
+		tracing_action->setCheckable(true);
+		tracing_action->setChecked(tracer::shared().enabled()); // already on with --trace
+		QAction* export_trace_action = new QAction("Export trace...");
+		auto toolsMenu = menuBar()->addMenu("&Tools");
+		toolsMenu->addAction(tracing_action);
+		toolsMenu->addAction(export_trace_action);
+		toolsMenu->addSeparator();
+		QAction* slice_cache_action = new QAction("Slice cache size...");
+		toolsMenu->addAction(slice_cache_action);
+		QAction* render_stats_action = new QAction("Render statistics");
+		toolsMenu->addAction(render_stats_action);
+		QAction* memory_usage_action = new QAction("Memory usage");
+		toolsMenu->addAction(memory_usage_action);
+		QAction* export_memory_action = new QAction("Export memory report...");
+		toolsMenu->addAction(export_memory_action);
+		QAction* memory_budget_action = new QAction("Memory budget...");
+		toolsMenu->addAction(memory_budget_action);
+		cpu_composite_action = new QAction("Composite slices on CPU");
+		cpu_composite_action->setCheckable(true);
+		toolsMenu->addAction(cpu_composite_action);
+		QAction* volume_fps_action = new QAction("Volume frame rate...");
+		toolsMenu->addAction(volume_fps_action);
+		cpu_volume_action = new QAction("CPU volume rendering");
+		cpu_volume_action->setCheckable(true);
+		toolsMenu->addAction(cpu_volume_action);
+		toolsMenu->addSeparator();
+		QAction* align_action = new QAction("Align overlay...");
+		toolsMenu->addAction(align_action);
+
+		// load progress in the status bar (hidden while nothing is loading)
+		load_progress_bar = new QProgressBar();
+		load_progress_bar->setMaximumWidth(300);
+		cancel_load_button = new QPushButton("Cancel");
+		statusBar()->addPermanentWidget(load_progress_bar);
+		statusBar()->addPermanentWidget(cancel_load_button);
+		load_progress_bar->hide();
+		cancel_load_button->hide();
+
+		memory_label = new QLabel();
+		statusBar()->addPermanentWidget(memory_label);
+		memory_timer = new QTimer(this);
+		memory_timer->setInterval(2000);
 
 		// initialize Qt viewports and VTK render windows
 		for (int i = 0; i < NUM_VIEWPORTS; i++) {
@@ -331,6 +455,48 @@ public:
 
 		}
 
+		// interactive changes (sliders, colormaps) are rendered through the scheduler
+		scheduler = new render_scheduler(NUM_VIEWPORTS, [this](int i) { render_viewport(i, -1); }, this);
+
+		// volume view: coarse levels while the camera moves, full resolution once it has been still
+		// for volume_refine_ms; every render of the view is timed to pick the level
+		vtkSmartPointer<vtkInteractorStyleTrackballCamera> volume_style = vtkSmartPointer<vtkInteractorStyleTrackballCamera>::New();
+		viewport_arr[VOLUME]->GetInteractor()->SetInteractorStyle(volume_style);
+		viewport_arr[VOLUME]->GetInteractor()->SetDesiredUpdateRate(volume_target_fps);
+		volume_style->AddObserver(vtkCommand::StartInteractionEvent, this, &ui::volume_interaction_started);
+		volume_style->AddObserver(vtkCommand::EndInteractionEvent, this, &ui::volume_interaction_ended);
+		window_arr[VOLUME]->AddObserver(vtkCommand::StartEvent, this, &ui::volume_render_started);
+		window_arr[VOLUME]->AddObserver(vtkCommand::EndEvent, this, &ui::volume_render_ended);
+
+		// slice views: while the align dialog is open, a left-drag moves the selected overlay and the
+		// wheel rotates it (ahead of the camera interaction, which align_mouse() then aborts)
+		unsigned long align_events[5] = { vtkCommand::LeftButtonPressEvent, vtkCommand::LeftButtonReleaseEvent,
+			vtkCommand::MouseMoveEvent, vtkCommand::MouseWheelForwardEvent, vtkCommand::MouseWheelBackwardEvent };
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			for (int e = 0; e < 5; e++)
+				viewport_arr[i]->GetInteractor()->AddObserver(align_events[e], this, &ui::align_mouse, 1.0f);
+		}
+
+		refine_timer = new QTimer(this);
+		refine_timer->setSingleShot(true);
+
+		preview_timer = new QTimer(this);
+		preview_timer->setSingleShot(true);
+		preview_timer->setInterval(100);
+
+		// CPU ray casting: the volume renderer's StartEvent ray casts into raycast_image, which the
+		// layer 1 renderer draws over it (only while CPU volume rendering is on)
+		raycast_image = vtkSmartPointer<vtkImageData>::New();
+		raycast_actor = vtkSmartPointer<vtkImageActor>::New();
+		raycast_actor->GetMapper()->SetInputData(raycast_image);
+		raycast_renderer = vtkSmartPointer<vtkRenderer>::New();
+		raycast_renderer->SetLayer(1);
+		raycast_renderer->InteractiveOff(); // the interactor keeps moving renderer_arr[VOLUME]'s camera
+		raycast_renderer->AddActor(raycast_actor);
+		raycast_renderer->GetActiveCamera()->ParallelProjectionOn();
+		window_arr[VOLUME]->SetNumberOfLayers(2);
+		renderer_arr[VOLUME]->AddObserver(vtkCommand::StartEvent, this, &ui::raycast_volume);
+
 		// initialize sliders for each of the 3 slice planes
 		for (int i = 1; i < NUM_VIEWPORTS; i++) {
 			slider_arr[i] = new QSlider();
@@ -346,6 +512,17 @@ public:
 			slider_label_arr[i]->setStyleSheet(
 				"padding: 2px; background-color: white; color: black; border-radius:3px"
 			);
+
+			// initialize slab controls for the 3 planes
+			slab_mode_arr[i] = new QComboBox();
+			slab_mode_arr[i]->addItem("MIP");
+			slab_mode_arr[i]->addItem("MinIP");
+			slab_mode_arr[i]->addItem("Average");
+
+			slab_thickness_arr[i] = new QSpinBox();
+			slab_thickness_arr[i]->setRange(1, 500);
+			slab_thickness_arr[i]->setSuffix(" slices");
+			slab_thickness_arr[i]->setToolTip("Slab thickness (1 = single slice)");
 		}
 
 
@@ -358,6 +535,27 @@ public:
 		col1_heading->setObjectName("col1_heading");
 		col1_heading->setAlignment(Qt::AlignCenter);
 
+		// overlay list of the second column (filled by add_layer)
+		overlay_combobox = new QComboBox();
+		overlay_visible_checkbox = new QCheckBox("Visible");
+		overlay_visible_checkbox->setChecked(true);
+		QLabel* overlay_combobox_label = new QLabel("Overlay:");
+
+		// difference view of the selected overlay against dataset 1
+		difference_combobox = new QComboBox();
+		difference_combobox->addItem("Off");
+		difference_combobox->addItem("Overlay - dataset 1");
+		difference_combobox->addItem("|Overlay - dataset 1|");
+		difference_range_spinbox = new QSpinBox();
+		difference_range_spinbox->setRange(1, 100000);
+		difference_range_spinbox->setValue(200);
+		difference_range_spinbox->setPrefix("+-");
+		difference_range_spinbox->setToolTip("Differences shown from -range (blue) to +range (red), or from 0 to range");
+		difference_range_spinbox->setEnabled(false);
+		QLabel* difference_label = new QLabel("Difference:");
+		difference_colours[DIFFERENCE_SIGNED] = lut_snapshot(maps.differenceLut.Get());
+		difference_colours[DIFFERENCE_ABSOLUTE] = lut_snapshot(maps.absDifferenceLut.Get());
+
 		// initialize opacity slider labels
 		opacity_label0 = new QLabel("Slice Opacity: -");
 
@@ -374,6 +572,23 @@ public:
 		opacity_slider1->setRange(0, 100);
 		opacity_slider1->setValue(70);
 
+		// initialize window/level sliders (ranges are set from the data in reset_controls)
+		QSlider** wl_sliders[4] = { &window_slider0, &window_slider1, &level_slider0, &level_slider1 };
+		QLabel** wl_labels[4] = { &window_label0, &window_label1, &level_label0, &level_label1 };
+		for (int i = 0; i < 4; i++) {
+			*wl_sliders[i] = new QSlider();
+			(*wl_sliders[i])->setOrientation(Qt::Horizontal);
+			*wl_labels[i] = new QLabel(i < 2 ? "Window: -" : "Level: -");
+		}
+
+		// initialize histograms and auto window/level buttons
+		histogram_widget0 = new histogram_widget();
+		histogram_widget1 = new histogram_widget();
+		auto_window_button0 = new QPushButton("Auto");
+		auto_window_button1 = new QPushButton("Auto");
+		auto_window_button0->setToolTip("Window/level from the 1st to the 99th percentile of the intensities");
+		auto_window_button1->setToolTip("Window/level from the 1st to the 99th percentile of the intensities");
+
 		// initialize colormap comboboxes
 		color_combobox0 = new QComboBox();
 		color_combobox0->addItem("Map 1");
@@ -392,9 +607,12 @@ public:
 		QLabel* color_combobox_label0 = new QLabel("Volume Color Map:");
 		QLabel* color_combobox_label1 = new QLabel("Volume Color Map:");
 
-		// initialize volume properties
-		volume_property_arr[0] = vtkSmartPointer<vtkVolumeProperty>::New();
-		volume_property_arr[1] = vtkSmartPointer<vtkVolumeProperty>::New();
+		// dataset 1 (the reference) and an empty dataset 2 overlay
+		add_layer();
+		add_layer();
+
+		// overlay alignment dialog and its keyboard nudges
+		build_align_dialog();
 
 
 
@@ -410,10 +628,18 @@ public:
 		QVBoxLayout* layout_col0 = new QVBoxLayout();
 		QVBoxLayout* layout_col1 = new QVBoxLayout();
 
+		// horizontal layouts for the overlay list and the difference view
+		QHBoxLayout* layout_overlay_row = new QHBoxLayout();
+		QHBoxLayout* layout_difference_row = new QHBoxLayout();
+
 		// 2 horizontal layouts for opacity slider rows
 		QHBoxLayout* layout_opacity_row0 = new QHBoxLayout();
 		QHBoxLayout* layout_opacity_row1 = new QHBoxLayout();
 
+		// 2 horizontal layouts for window/level slider rows
+		QHBoxLayout* layout_window_level_row0 = new QHBoxLayout();
+		QHBoxLayout* layout_window_level_row1 = new QHBoxLayout();
+
 		// 2 horizontal layouts for color combobx rows
 		QHBoxLayout* layout_combobox_row0 = new QHBoxLayout();
 		QHBoxLayout* layout_combobox_row1 = new QHBoxLayout();
@@ -443,27 +669,57 @@ public:
 		// populate col0, col1
 		layout_col0->addWidget(col0_heading, Qt::AlignCenter);
 		layout_col0->addLayout(layout_opacity_row0);
+		layout_col0->addLayout(layout_window_level_row0);
+		layout_col0->addWidget(histogram_widget0);
 		layout_col0->addLayout(layout_combobox_row0);
 		layout_opacity_row0->addStretch();
 		layout_opacity_row0->addWidget(opacity_label0);
 		layout_opacity_row0->addWidget(opacity_slider0);
 		layout_opacity_row0->addStretch();
+		layout_window_level_row0->addStretch();
+		layout_window_level_row0->addWidget(window_label0);
+		layout_window_level_row0->addWidget(window_slider0);
+		layout_window_level_row0->addWidget(level_label0);
+		layout_window_level_row0->addWidget(level_slider0);
+		layout_window_level_row0->addWidget(auto_window_button0);
+		layout_window_level_row0->addStretch();
 		layout_combobox_row0->addStretch();
 		layout_combobox_row0->addWidget(color_combobox_label0);
 		layout_combobox_row0->addWidget(color_combobox0);
 		layout_combobox_row0->addStretch();
 
 		layout_col1->addWidget(col1_heading, Qt::AlignCenter);
+		layout_col1->addLayout(layout_overlay_row);
+		layout_col1->addLayout(layout_difference_row);
 		layout_col1->addLayout(layout_opacity_row1);
+		layout_col1->addLayout(layout_window_level_row1);
+		layout_col1->addWidget(histogram_widget1);
 		layout_col1->addLayout(layout_combobox_row1);
 		layout_opacity_row1->addStretch();
 		layout_opacity_row1->addWidget(opacity_label1);
 		layout_opacity_row1->addWidget(opacity_slider1);
 		layout_opacity_row1->addStretch();
+		layout_window_level_row1->addStretch();
+		layout_window_level_row1->addWidget(window_label1);
+		layout_window_level_row1->addWidget(window_slider1);
+		layout_window_level_row1->addWidget(level_label1);
+		layout_window_level_row1->addWidget(level_slider1);
+		layout_window_level_row1->addWidget(auto_window_button1);
+		layout_window_level_row1->addStretch();
 		layout_combobox_row1->addStretch();
 		layout_combobox_row1->addWidget(color_combobox_label1);
 		layout_combobox_row1->addWidget(color_combobox1);
 		layout_combobox_row1->addStretch();
+		layout_overlay_row->addStretch();
+		layout_overlay_row->addWidget(overlay_combobox_label);
+		layout_overlay_row->addWidget(overlay_combobox);
+		layout_overlay_row->addWidget(overlay_visible_checkbox);
+		layout_overlay_row->addStretch();
+		layout_difference_row->addStretch();
+		layout_difference_row->addWidget(difference_label);
+		layout_difference_row->addWidget(difference_combobox);
+		layout_difference_row->addWidget(difference_range_spinbox);
+		layout_difference_row->addStretch();
 
 		// populate row1
 		layout_row1->addSpacing(25); // no slider for volume view
@@ -483,6 +739,13 @@ public:
 		for (int i = 1; i < NUM_VIEWPORTS; i++) {
 			viewport_arr[i]->setLayout(layout_slice_label_arr[i]);
 			layout_slice_label_arr[i]->addWidget(slider_label_arr[i]);
+
+			QHBoxLayout* layout_slab = new QHBoxLayout();
+			layout_slab->addStretch();
+			layout_slab->addWidget(slab_mode_arr[i]);
+			layout_slab->addWidget(slab_thickness_arr[i]);
+			layout_slab->addStretch();
+			layout_slice_label_arr[i]->addLayout(layout_slab);
 			layout_slice_label_arr[i]->addStretch();
 		}
 
@@ -494,8 +757,71 @@ public:
 		// file menu: load DICOM dataset actions
 		connect(load_dset1_action, SIGNAL(triggered()),
 			this, SLOT(load_dset1()));
-		connect(load_dset2_action, SIGNAL(triggered()),
-			this, SLOT(load_dset2()));
+		connect(load_overlay_action, SIGNAL(triggered()),
+			this, SLOT(load_overlay()));
+		connect(add_overlay_action, SIGNAL(triggered()),
+			this, SLOT(add_overlay()));
+		connect(close_overlay_action, SIGNAL(triggered()),
+			this, SLOT(close_overlay()));
+		connect(cancel_load_action, SIGNAL(triggered()),
+			this, SLOT(cancel_loads()));
+		connect(cancel_load_button, SIGNAL(clicked()),
+			this, SLOT(cancel_loads()));
+
+		// file menu: volume cache actions
+		connect(cache_info_action, SIGNAL(triggered()),
+			this, SLOT(show_cache_info()));
+		connect(clear_cache_action, SIGNAL(triggered()),
+			this, SLOT(clear_cache()));
+
+		// tools menu: tracing actions
+		connect(tracing_action, SIGNAL(toggled(bool)),
+			this, SLOT(set_tracing(bool)));
+		connect(export_trace_action, SIGNAL(triggered()),
+			this, SLOT(export_trace()));
+		connect(slice_cache_action, SIGNAL(triggered()),
+			this, SLOT(set_slice_cache_size()));
+		connect(render_stats_action, SIGNAL(triggered()),
+			this, SLOT(show_render_stats()));
+		connect(memory_usage_action, SIGNAL(triggered()),
+			this, SLOT(show_memory_usage()));
+		connect(export_memory_action, SIGNAL(triggered()),
+			this, SLOT(export_memory_report()));
+		connect(memory_budget_action, SIGNAL(triggered()),
+			this, SLOT(set_memory_budget()));
+		connect(memory_timer, SIGNAL(timeout()),
+			this, SLOT(update_memory_label()));
+		connect(cpu_composite_action, SIGNAL(toggled(bool)),
+			this, SLOT(set_cpu_compositing(bool)));
+		connect(volume_fps_action, SIGNAL(triggered()),
+			this, SLOT(set_volume_frame_rate()));
+		connect(cpu_volume_action, SIGNAL(toggled(bool)),
+			this, SLOT(set_cpu_volume(bool)));
+		connect(align_action, SIGNAL(triggered()),
+			this, SLOT(show_align_dialog()));
+
+		// progressive loading
+		connect(preview_timer, SIGNAL(timeout()),
+			this, SLOT(refresh_preview()));
+
+		memory_timer->start();
+		update_memory_label();
+
+		// volume level of detail
+		connect(refine_timer, SIGNAL(timeout()),
+			this, SLOT(refine_volume()));
+
+		// overlay list
+		connect(overlay_combobox, SIGNAL(currentIndexChanged(int)),
+			this, SLOT(overlay_selected(int)));
+		connect(overlay_visible_checkbox, SIGNAL(toggled(bool)),
+			this, SLOT(overlay_visibility_changed(bool)));
+
+		// difference view
+		connect(difference_combobox, SIGNAL(currentIndexChanged(int)),
+			this, SLOT(difference_changed(int)));
+		connect(difference_range_spinbox, SIGNAL(valueChanged(int)),
+			this, SLOT(difference_changed(int)));
 
 		// connect slice sliders
 		connect(slider_arr[AXIAL], SIGNAL(valueChanged(int)),
@@ -505,22 +831,106 @@ public:
 		connect(slider_arr[SAGITTAL], SIGNAL(valueChanged(int)),
 			this, SLOT(slice_slider_changed(int)));
 
+		// connect slab controls
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			connect(slab_mode_arr[i], SIGNAL(currentIndexChanged(int)),
+				this, SLOT(slab_changed(int)));
+			connect(slab_thickness_arr[i], SIGNAL(valueChanged(int)),
+				this, SLOT(slab_changed(int)));
+		}
+
 		// connect opacity sliders
 		connect(opacity_slider0, SIGNAL(valueChanged(int)),
 			this, SLOT(opacity_slider_changed(int)));
 		connect(opacity_slider1, SIGNAL(valueChanged(int)),
 			this, SLOT(opacity_slider_changed(int)));
 
+		// connect window/level sliders
+		connect(window_slider0, SIGNAL(valueChanged(int)),
+			this, SLOT(window_level_changed(int)));
+		connect(level_slider0, SIGNAL(valueChanged(int)),
+			this, SLOT(window_level_changed(int)));
+		connect(window_slider1, SIGNAL(valueChanged(int)),
+			this, SLOT(window_level_changed(int)));
+		connect(level_slider1, SIGNAL(valueChanged(int)),
+			this, SLOT(window_level_changed(int)));
+		connect(auto_window_button0, SIGNAL(clicked()),
+			this, SLOT(auto_window_level()));
+		connect(auto_window_button1, SIGNAL(clicked()),
+			this, SLOT(auto_window_level()));
+
 		// connect combo boxes
 		connect(color_combobox0, SIGNAL(currentIndexChanged(int)),
 			this, SLOT(combobox_changed(int)));
 		connect(color_combobox1, SIGNAL(currentIndexChanged(int)),
 			this, SLOT(combobox_changed(int)));
 
+		// dataset names and settings in the two columns
+		update_controls();
+
 		// Display the window
 		this->show();
 	}
 
+	// Destructor: stop any load that is still running before the window goes away.
+	~ui() {
+
+		for (size_t l = 0; l < layers.size(); l++)
+			delete layers[l]; // cancels and waits for its load
+	}
+
+	/*
+	Create the next dataset (dataset 1 first, which becomes the reference) with the default look:
+	grayscale at full opacity for the reference, magma at DSET2_OPACITY for overlays. Overlays are
+	added to the overlay list and selected.
+	*/
+	dataset_layer* add_layer() {
+
+		bool reference = layers.empty();
+		dataset_layer* layer = new dataset_layer(next_dset_num++);
+		layer->lut->DeepCopy((reference ? maps.grayScaleLut : maps.customLut).Get());
+		layer->opacity = reference ? 1.0 : DSET2_OPACITY;
+		layer->volume_colormap = reference ? 3 : 2; // grayscale, magma
+		connect(layer->pyramid, SIGNAL(ready(int)),
+			this, SLOT(pyramid_ready(int)));
+		layers.push_back(layer);
+
+		if (!reference) {
+			overlay_combobox->addItem(overlay_title(layer), layer->dset_num);
+			overlay_combobox->setCurrentIndex(overlay_combobox->count() - 1);
+		}
+		return layer;
+	}
+
+	// The dataset with this id (NULL if it has been closed).
+	dataset_layer* find_layer(int dset_num) {
+
+		for (size_t l = 0; l < layers.size(); l++) {
+			if (layers[l]->dset_num == dset_num)
+				return layers[l];
+		}
+		return NULL;
+	}
+
+	// The overlay picked in the overlay list (NULL if there are no overlays).
+	dataset_layer* selected_overlay() {
+
+		if (overlay_combobox->currentIndex() < 0)
+			return NULL;
+		return find_layer(overlay_combobox->currentData().toInt());
+	}
+
+	// "Dataset 3", "Dataset 3 (hidden)", "Dataset 3 (unloaded)"
+	QString overlay_title(dataset_layer* layer) {
+
+		QString title = "Dataset " + QString::number(layer->dset_num);
+		if (layer->state == LOAD_EVICTED)
+			title += " (unloaded)";
+		else if (!layer->visible)
+			title += " (hidden)";
+		return title;
+	}
+
 	/*
 	Pop up a dialog window that allows user to choose a directory. Returns a QDir object containing
 	the absolute path to the user-specified data directory.
@@ -543,22 +953,19 @@ public:
 	}
 
 	/*
-	Used to render slices of the DICOM data.
+	Used to render slices of the DICOM data. The volume is taken from the layer (it must have
+	been loaded already).
 
 	Args:
-		dset_num: (int) either 1 or 2 (indicate whether loading dset1 or dset2)
-
-	if dset_num = 2 then the following is a list of reused/new VTK pointers
-	(new)
-	- reslice_arr2
-	- iactor_arr2
+		plane_idx: (int) AXIAL, CORONAL or SAGITTAL
+		layer: (dataset_layer*) the dataset to show; layers[0] also sets the slider ranges
 
-	(old)
+	The layer gets its own reslice filter, colour mapper and actor for the plane; shared are
 	- reslice_axes_arr
 	- renderer_arr
 	- window_arr
 	*/
-	void load_DICOM_image(QDir dicom_dir, int plane_idx, int dset_num) {
+	void load_DICOM_image(int plane_idx, dataset_layer* layer) {
 
 		// S================== CHECK ARGUMENTS =================== //
 		// rmb, 0 is a dummy idx to account for the volume viewport
@@ -568,8 +975,8 @@ public:
 		}
 
 		// sanity checking input
-		if (!(dset_num == 1 || dset_num == 2)) {
-			cout << "umm dset_num should be 1 or 2";
+		if (layer == NULL || !layer->is_loaded()) {
+			cout << "umm layer should be a loaded dataset";
 			return;
 		}
 		cout << "loading data\n";
@@ -577,84 +984,88 @@ public:
 
 
 		// S================== VTK PIPELINE =================== //
-		// Reader -> ImageReslice -> ImageActor -> (ColorMapper) -> Renderer -> RenderWindow
-
-		vtkSmartPointer<vtkDICOMImageReader> reader = vtkSmartPointer<vtkDICOMImageReader>::New();
-
-		// TODO: figure out a better way to convert QString to a char * to pass to SetDirectoryName
-		reader->SetDirectoryName(dicom_dir.absolutePath().toStdString().c_str());
-		reader->Update(); // Force update, since we need to get information about the data dimensions
+		// Dataset -> ImageReslice -> ImageActor -> (ColorMapper) -> Renderer -> RenderWindow
 
-		int* dims = reader->GetOutput()->GetDimensions(); // Get the data dimensions
-		double* range = reader->GetOutput()->GetScalarRange(); // Get the range of intensity values
+		vtkImageData* image = layer->dset.image;
 
-		// Create local pointers for the arrays containing the vtk reslice and actor objects. Then, based 
-		// on whether dset1 or dset2 is being loaded, set these pointers appropriately (dset2 uses separate 
-		// reslice and actor objects).
-		vtkSmartPointer<vtkImageReslice>* curr_reslice_arr;
-		vtkSmartPointer<vtkImageActor>* curr_iactor_arr;
+		int* dims = image->GetDimensions(); // Get the data dimensions
 
 		// maps plane_idx to the "missing" axis ( e.g. axial (plane_idx=1) misses z (2) )
 		int map[] = { -1, 2, 1, 0 };
 
-		if (dset_num == 1) {
-			curr_reslice_arr = reslice_arr;
-			curr_iactor_arr = iactor_arr;
-			is_data1_loaded = false;
-
-			// Tell our slice slider widget what the min/max slice numbers are (only once, for dset1)
+		bool reference = layer == layers[0];
+		if (reference) {
+			// Tell our slice slider widget what the min/max slice numbers are (only for the reference)
 			slider_arr[plane_idx]->setRange(0, dims[map[plane_idx]] - 1);
-		}
-		else {
-			curr_reslice_arr = reslice_arr2;
-			curr_iactor_arr = iactor_arr2;
-			is_data2_loaded = false;
+
+			// start at the first slice (the sliders are reset to 0 afterwards)
+			reslice_axes_arr[plane_idx]->SetElement(map[plane_idx], 3, image->GetOrigin()[map[plane_idx]]);
 		}
 
 		// Create an actor for the image. You'll notice we skipped the mapper step. This is because
 		// image actors have a default mapper we can use as is if we don't want to change 
-		// the colormap etc.
-		curr_iactor_arr[plane_idx] = vtkSmartPointer<vtkImageActor>::New();
+		// the colormap etc. (The actor of a previous volume leaves the renderer.)
+		if (layer->iactor[plane_idx] != NULL)
+			renderer_arr[plane_idx]->RemoveActor(layer->iactor[plane_idx]);
+		vtkSmartPointer<vtkImageActor> actor = vtkSmartPointer<vtkImageActor>::New();
+		layer->iactor[plane_idx] = actor;
+		actor->SetOpacity(layer->opacity);
+		actor->SetVisibility(layer->visible);
 
 		// vtkImageReslice is the filter that does the slicing (slices a 3D dataset to become 2D)
-		curr_reslice_arr[plane_idx] = vtkSmartPointer<vtkImageReslice>::New();
-		curr_reslice_arr[plane_idx]->SetInputConnection(reader->GetOutputPort()); // connect the reader to this filter
-		curr_reslice_arr[plane_idx]->SetOutputDimensionality(2);
-		curr_reslice_arr[plane_idx]->SetResliceAxes(reslice_axes_arr[plane_idx]); // tell it what plane to slice with
-		curr_reslice_arr[plane_idx]->SetInterpolationModeToLinear();
-		curr_reslice_arr[plane_idx]->Update();
-
-
-		// colormap mapper
+		vtkSmartPointer<vtkImageReslice> reslice = vtkSmartPointer<fast_reslice>::New(); // copies axis-aligned slices directly
+		layer->reslice[plane_idx] = reslice;
+		reslice->SetInputData(image); // connect the shared volume to this filter
+		reslice->SetOutputDimensionality(2);
+		reslice->SetResliceAxes(reslice_axes_arr[plane_idx]); // tell it what plane to slice with
+		reslice->SetInterpolationModeToLinear();
+		configure_slab(plane_idx, reslice); // thick slabs the slice cache cannot serve
+		trace_algorithm(reslice, "reslice", layer->dset_num, plane_idx);
+		reslice->Update();
+
+
+		// colormap mapper (the layer's own lookup table, over its window/level)
 		vtkSmartPointer<vtkImageMapToColors> imapper = vtkSmartPointer<vtkImageMapToColors>::New();
+		layer->imapper[plane_idx] = imapper;
 		imapper->PassAlphaToOutputOn();
-		if (dset_num == 1) {
-			grayScaleLut->SetRange(range);
-			imapper->SetLookupTable(grayScaleLut);
-		}
-		else { // dset2
-			customLut->SetRange(range);
-			imapper->SetLookupTable(customLut);
-
-			// set default opacity for dset2 slices
-			curr_iactor_arr[plane_idx]->SetOpacity(DSET2_OPACITY);
-		}
+		layer->lut->SetRange(layer->level - layer->window / 2, layer->level + layer->window / 2);
+		imapper->SetLookupTable(layer->lut);
 
-		imapper->SetInputConnection(curr_reslice_arr[plane_idx]->GetOutputPort());
+		imapper->SetInputConnection(reslice->GetOutputPort());
+		trace_algorithm(imapper, "map_to_colors", layer->dset_num, plane_idx);
 		imapper->Update();
 
 		// VTKMapper -> VTKImageActor
-		curr_iactor_arr[plane_idx]->GetMapper()->SetInputConnection(imapper->GetOutputPort());
+		actor->GetMapper()->SetInputConnection(imapper->GetOutputPort());
+
+		// let the slice cache produce this plane's slices from now on
+		slices.set_plane(layer->dset_num, plane_idx, image, reslice_axes_arr[plane_idx], reslice->GetOutput());
+
+		// a moved dataset is sampled through its transform (set after the slice cache took the
+		// unmoved slice geometry, which it serves again once the dataset is reset)
+		reslice->SetResliceTransform(reslice_transform(layer));
+
+		layer->slab[plane_idx].clear();
+		if (layers[0]->is_loaded())
+			show_slice(plane_idx, layer, reference ? 0 : slider_arr[plane_idx]->value());
 
 
 		// VTKImageActor -> VTKRenderer (initialized in constructor)
-		renderer_arr[plane_idx]->AddActor(curr_iactor_arr[plane_idx]); // Add the actor to the renderer
+		renderer_arr[plane_idx]->AddActor(actor); // Add the actor to the renderer
+
+		// the reference is drawn first, the overlays over it in their order
+		for (size_t l = 1; l < layers.size() && reference; l++) {
+			if (layers[l]->iactor[plane_idx] != NULL) {
+				renderer_arr[plane_idx]->RemoveActor(layers[l]->iactor[plane_idx]);
+				renderer_arr[plane_idx]->AddActor(layers[l]->iactor[plane_idx]);
+			}
+		}
 
 		// VTKRenderer > VTKOpenGLRenderWindow
 		window_arr[plane_idx]->AddRenderer(renderer_arr[plane_idx]);
 
 		// Render (display the image)
-		window_arr[plane_idx]->Render();
+		render_viewport(plane_idx, layer->dset_num);
 
 		// Ensure we aren't clipping any of the image (cameras have a front and back plane that 
 		// clips for performance)
@@ -663,280 +1074,2054 @@ public:
 
 		cout << "finished loading data\n\n";
 
-		if (dset_num == 1) {
-			is_data1_loaded = true;
-		}
-		else {
-			is_data2_loaded = true;
-		}
-
 	}
 
 	/*
-	Render DICOM as volume
+	Render DICOM as volume. The volume is taken from the layer (it must have been loaded already).
 	*/
-	void load_DICOM_volume(QDir dicom_dir, int dset_num) {
+	void load_DICOM_volume(dataset_layer* layer) {
 
 		// sanity checking input
-		if (!(dset_num == 1 || dset_num == 2)) {
-			cout << "umm dset_num should be 1 or 2";
+		if (layer == NULL || !layer->is_loaded()) {
+			cout << "umm layer should be a loaded dataset";
 			return;
 		}
 
 		cout << "loading data\n";
 
-		if (dset_num == 1) {
-			is_data1_loaded = false;
-		}
-		else {
-			is_data2_loaded = false;
-		}
-
-		// Read all the DICOM files in the specified directory.
-		vtkSmartPointer<vtkDICOMImageReader> reader = vtkSmartPointer<vtkDICOMImageReader>::New();
-		reader->SetDirectoryName(dicom_dir.absolutePath().toStdString().c_str());
-		reader->Update(); // Force update, since we need to get information about the data dimensions
+		dataset& dset = layer->dset;
 
-		QString dset_name;
-
-		if (dset_num == 1) {
-			is_data1_loaded = false;
-			dset_name = "Dataset 1: " + QString(reader->GetPatientName());
-			col0_heading->setText(dset_name); // display patient name as dset name in GUI
-		}
-		else {
-			is_data2_loaded = false;
-			dset_name = "Dataset 2: " + QString(reader->GetPatientName());
-			col1_heading->setText(dset_name);
-		}
+		// display patient name as dset name in GUI
+		update_titles();
 
 		/* Code taken from in-class example */
 
-		// volume mapper
-		vtkSmartPointer<vtkSmartVolumeMapper> volumeMapper = vtkSmartPointer<vtkSmartVolumeMapper>::New();
-		volumeMapper->SetBlendModeToComposite(); // composite
-		volumeMapper->SetInputConnection(reader->GetOutputPort());
-		//volumeMapper->SetRequestedRenderModeToRayCast();
-		volumeMapper->SetRequestedRenderModeToGPU();
+		// volume mapper (full resolution; the coarse levels get theirs once the pyramid is built)
+		vtkSmartPointer<vtkSmartVolumeMapper> volumeMapper = make_volume_mapper(dset.image);
+		for (int i = 0; i < volume_pyramid::NUM_LEVELS; i++) {
+			layer->lod_mapper[i] = NULL;
+			layer->raycast_input[i] = NULL; // CPU ray casters set up for the previous volume
+		}
+		layer->lod_mapper[0] = volumeMapper;
 
 
 		// volume properties
-		volume_property_arr[dset_num-1]->ShadeOff();
-		volume_property_arr[dset_num - 1]->SetInterpolationType(VTK_LINEAR_INTERPOLATION);
+		vtkVolumeProperty* property = layer->volume_property;
+		property->ShadeOff();
+		property->SetInterpolationType(VTK_LINEAR_INTERPOLATION);
 
 		// opacity
-		vtkSmartPointer<vtkPiecewiseFunction> opacity = vtkSmartPointer<vtkPiecewiseFunction>::New();
-		opacity->AddPoint(0.0, 0.0);
-		opacity->AddPoint(90.0, 0.05);
-		opacity->AddPoint(555.0, 0.1);
-		volume_property_arr[dset_num - 1]->SetScalarOpacity(opacity);
+		property->SetScalarOpacity(colormaps::make_volume_opacity());
 
 		// colormap
-		if (dset_num == 1) {
-			volume_property_arr[dset_num - 1]->SetColor(grayscale_ctf);
-		}
-		else {
-			volume_property_arr[dset_num - 1]->SetColor(magma_ctf);
-		}
+		property->SetColor(volume_ctf(layer->volume_colormap));
 		
 
-		// VolumeMapper, VolumeProperty -> Volume
+		// VolumeMapper, VolumeProperty -> Volume (replacing the volume of a previous load)
+		if (layer->volume != NULL)
+			renderer_arr[0]->RemoveViewProp(layer->volume);
 		vtkSmartPointer<vtkVolume> volume = vtkSmartPointer<vtkVolume>::New();
+		layer->volume = volume;
 		volume->SetMapper(volumeMapper);
-		volume->SetProperty(volume_property_arr[dset_num - 1]);
+		volume->SetProperty(property);
+		place_volume(layer); // (where the user moved the dataset, see apply_transform)
 
 		// Volume -> Renderer
 		renderer_arr[0]->AddViewProp(volume);
 		renderer_arr[0]->ResetCamera();
 
+		// the render times measured so far were for other volumes
+		set_volume_level(0);
+		for (int i = 0; i < volume_pyramid::NUM_LEVELS; i++)
+			level_render_ms[i] = -1;
+
+		// the CPU ray caster draws the volume itself
+		volume->SetVisibility(!cpu_volume && layer->visible);
+
 		// Renderer -> VTKOpenGLRenderWindow
 		window_arr[0]->AddRenderer(renderer_arr[0]);
-		window_arr[0]->Render();
-
-		cout << "finished loading data\n";
+		render_viewport(VOLUME, layer->dset_num);
 
-		if (dset_num == 1) {
-			is_data1_loaded = true;
-		}
-		else {
-			is_data2_loaded = true;
+		// no GPU volume rendering here (vtkSmartVolumeMapper fell back): ray cast on the CPU instead
+		if (!cpu_volume && volumeMapper->GetLastUsedRenderMode() != vtkSmartVolumeMapper::GPURenderMode) {
+			cpu_volume_action->setChecked(true);
+			statusBar()->showMessage("GPU volume rendering not available, using CPU ray casting", 5000);
 		}
+
+		// downsampled levels for interaction, built in the background (pyramid_ready() when done)
+		layer->pyramid->build(dset.image);
+
+		cout << "finished loading data\n";
 	}
 
-	// Check that directory is valid.
-	bool is_valid(QDir dicom_dir) {
+	// Volume colour map of a colormap combobox index.
+	vtkColorTransferFunction* volume_ctf(int index) {
 
+		vtkSmartPointer<vtkColorTransferFunction> map[4] = {
+			maps.class_example_ctf, maps.viridis_ctf, maps.magma_ctf, maps.grayscale_ctf };
+		return map[std::max(0, std::min(index, 3))];
+	}
 
-		QTextStream qt_cout(stdout);
-		qt_cout << dicom_dir.path();
+	// A composite volume mapper for one level of a dataset's volume.
+	vtkSmartPointer<vtkSmartVolumeMapper> make_volume_mapper(vtkImageData* image) {
 
-		if (!dicom_dir.exists() || dicom_dir.count() == 0) {
-			cout << "wrong directory!";
-			return false;
+		vtkSmartPointer<vtkSmartVolumeMapper> volumeMapper = vtkSmartPointer<vtkSmartVolumeMapper>::New();
+		volumeMapper->SetBlendModeToComposite(); // composite
+		volumeMapper->SetInputData(image);
+		//volumeMapper->SetRequestedRenderModeToRayCast();
+		volumeMapper->SetRequestedRenderModeToGPU();
+		return volumeMapper;
+	}
+
+	/*
+	Render the volume view from a pyramid level (0 = full resolution). Datasets whose pyramid is
+	not built yet stay at full resolution.
+	*/
+	void set_volume_level(int level) {
+
+		volume_level = level;
+		for (size_t l = 0; l < layers.size(); l++) {
+			dataset_layer* layer = layers[l];
+			if (layer->volume == NULL)
+				continue;
+			int usable = level;
+			while (usable > 0 && layer->lod_mapper[usable] == NULL)
+				usable--;
+			layer->volume->SetMapper(layer->lod_mapper[usable]);
 		}
+	}
 
-		// directory not changed/dialog box closed
-		if (QString::compare(dicom_dir.path(), ".") == 0) {
-			return false;
+	/*
+	The finest level expected to render within one frame at volume_target_fps. Levels that have not
+	been rendered yet are estimated from a measured neighbour (each level is assumed to take half
+	the time of the one above it, i.e. ray cost grows with the number of samples per ray).
+	*/
+	int choose_volume_level() {
+
+		double budget_ms = 1000.0 / volume_target_fps;
+		for (int level = 0; level < volume_pyramid::NUM_LEVELS; level++) {
+			double estimate = -1;
+			for (int m = 0; m < volume_pyramid::NUM_LEVELS && estimate < 0; m++) {
+				if (level_render_ms[m] >= 0)
+					estimate = level_render_ms[m] * pow(2.0, m - level);
+			}
+			if (estimate <= budget_ms) // also when nothing has been measured yet
+				return level;
 		}
+		return volume_pyramid::NUM_LEVELS - 1;
+	}
 
-		return true;
+	// Camera rotation/zoom starts in the volume view: switch to a level that keeps up.
+	void volume_interaction_started(vtkObject*, unsigned long, void*) {
+
+		refine_timer->stop();
+		set_volume_level(choose_volume_level());
 	}
 
+	// Camera stopped: refine to full resolution if it stays still for volume_refine_ms.
+	void volume_interaction_ended(vtkObject*, unsigned long, void*) {
 
+		if (volume_level != 0)
+			refine_timer->start(volume_refine_ms);
+	}
 
-public slots:
+	void volume_render_started(vtkObject*, unsigned long, void*) {
+		volume_render_clock.start();
+	}
 
+	// Keep a running average of the render time of the level just rendered.
+	void volume_render_ended(vtkObject*, unsigned long, void*) {
 
-	void load_dset1() {
+		double ms = volume_render_clock.nsecsElapsed() / 1e6;
+		double& average = level_render_ms[volume_level];
+		average = average < 0 ? ms : 0.7 * average + 0.3 * ms;
+	}
 
-		QDir dicom_dir = choose_directory();
-		//QDir dicom_dir = QDir("../data/hw2-dataset");
+	/*
+	Ray cast the volume view on the CPU (renderer_arr[VOLUME]'s StartEvent, so it runs on every
+	render of the view, including the interactor's). Each visible dataset is ray cast at the pyramid level
+	its volume currently uses; the images are composited nearest first (exact for volumes that do
+	not overlap) and put on the renderer's background.
+	*/
+	void raycast_volume(vtkObject*, unsigned long, void*) {
 
-		if (!is_valid(dicom_dir))
+		if (!cpu_volume)
 			return;
 
+		int* size = renderer_arr[VOLUME]->GetSize();
+		int width = size[0], height = size[1];
+		if (width <= 0 || height <= 0)
+			return;
 
-		load_DICOM_image(dicom_dir, AXIAL, 1);
-		load_DICOM_image(dicom_dir, CORONAL, 1);
-		load_DICOM_image(dicom_dir, SAGITTAL, 1);
-		load_DICOM_volume(dicom_dir, 1);
+		raycast_camera camera(renderer_arr[VOLUME]->GetActiveCamera());
+		size_t pixels = (size_t)width * height;
+
+		// datasets nearest to the camera first
+		std::vector<std::pair<double, int>> order;
+		for (size_t l = 0; l < layers.size(); l++) {
+			if (layers[l]->volume == NULL || !layers[l]->visible)
+				continue;
+			double* center = layers[l]->volume->GetCenter();
+			double distance = 0.0;
+			for (int i = 0; i < 3; i++)
+				distance += (center[i] - camera.position[i]) * (center[i] - camera.position[i]);
+			order.push_back(std::make_pair(distance, (int)l));
+		}
+		std::sort(order.begin(), order.end());
+
+		raycast_layer.assign(4 * pixels, 0);
+		std::vector<unsigned char> behind(4 * pixels);
+		for (size_t n = 0; n < order.size(); n++) {
+			dataset_layer* layer = layers[order[n].second];
+			int level = 0;
+			for (int i = 1; i < volume_pyramid::NUM_LEVELS; i++) {
+				if (layer->lod_mapper[i] != NULL && layer->volume->GetMapper() == layer->lod_mapper[i])
+					level = i;
+			}
 
-		// ==== Restore UI elements to default positions after loading data 
-		// (useful in case user messed with UI elements before loading data)
+			vtkImageData* input = layer->lod_mapper[level]->GetInput();
+			cpu_raycaster& raycaster = layer->raycaster[level];
+			if (layer->raycast_input[level] != input) {
+				layer->raycast_input[level] = input;
+				raycaster.set_volume(input);
+			}
+			raycaster.set_transfer_functions(layer->volume_property);
+
+			// a moved dataset is ray cast in its own frame
+			raycast_camera view = camera;
+			if (!layer->transform.is_identity()) {
+				double to_volume[16];
+				layer->transform.inverse_matrix(layer->dset.image->GetCenter(), to_volume);
+				view = camera.transformed(to_volume);
+			}
 
-		// slice sliders
-		for (int i = 1; i < NUM_VIEWPORTS; i++) {
-			slider_arr[i]->setValue(0);
+			unsigned char* target = n == 0 ? raycast_layer.data() : behind.data();
+			if (raycaster.render(view, width, height, target) && n > 0)
+				cpu_raycaster::over(raycast_layer.data(), behind.data(), (int)pixels);
 		}
+		cpu_raycaster::flatten(raycast_layer.data(), (int)pixels, renderer_arr[VOLUME]->GetBackground());
 
-		// opacity sliders
-		opacity_label0->setText("Slice Opacity: 100");
-		opacity_slider0->setValue(100);
+		// show it pixel for pixel in the overlay
+		int* extent = raycast_image->GetExtent();
+		if (extent[1] != width - 1 || extent[3] != height - 1) {
+			raycast_image->SetExtent(0, width - 1, 0, height - 1, 0, 0);
+			raycast_image->AllocateScalars(VTK_UNSIGNED_CHAR, 4);
+		}
+		memcpy(raycast_image->GetScalarPointer(), raycast_layer.data(), raycast_layer.size());
+		raycast_image->Modified();
+
+		vtkCamera* overlay_camera = raycast_renderer->GetActiveCamera();
+		overlay_camera->SetFocalPoint((width - 1) / 2.0, (height - 1) / 2.0, 0.0);
+		overlay_camera->SetPosition((width - 1) / 2.0, (height - 1) / 2.0, 1.0);
+		overlay_camera->SetViewUp(0, 1, 0);
+		overlay_camera->SetParallelScale(height / 2.0);
+		overlay_camera->SetClippingRange(0.5, 1.5);
+	}
+
+	// Render one viewport. Traced as a "render" span tagged with the dataset that triggered it
+	// (-1 for frames of the render scheduler, which may cover changes to several datasets).
+	void render_viewport(int plane_idx, int dset_num) {
 
-		// colormap combobox
-		color_combobox0->setCurrentIndex(3); //grayscale
+		// slices whose window/level changed since they were last coloured, then their blend
+		for (size_t l = 0; l < layers.size() && plane_idx != VOLUME; l++) {
+			if (layers[l]->stale_colours[plane_idx])
+				map_slice(plane_idx, layers[l]);
+		}
+		if (plane_idx != VOLUME && stale_composite_arr[plane_idx])
+			composite_slices(plane_idx);
 
+		TRACE_SCOPE("render", dset_num, plane_idx);
+		window_arr[plane_idx]->Render();
 	}
 
-	void load_dset2() {
+	/*
+	Show the slice for a slider index: the raw slice from the slice cache (or, for a thick slab,
+	the projection of the slab's slices by slab_projector), window/levelled and colour mapped by
+	colormap_kernel, or the reslice -> colour map pipeline if the slice cannot be copied directly
+	(see slice_cache.h) or the dataset has been moved (see apply_transform).
+	*/
+	void show_slice(int plane_idx, dataset_layer* layer, int index) {
 
-		QDir dicom_dir = choose_directory();
-		//QDir dicom_dir = QDir("../data/VHF-Pelvis");
+		int dset_num = layer->dset_num;
+		int first, last;
+		if (!layer->transform.is_identity()) {
+			layer->raw_slices[plane_idx] = NULL;
+		}
+		else if (slab_range(plane_idx, index, first, last)) {
+			slab_mode mode = (slab_mode)slab_mode_arr[plane_idx]->currentIndex();
+			layer->raw_slices[plane_idx] = layer->slab[plane_idx].project(first, last, mode,
+				[this, dset_num, plane_idx](int i) { return slices.get(dset_num, plane_idx, i); });
+		}
+		else {
+			layer->raw_slices[plane_idx] = slices.get(dset_num, plane_idx, index);
+		}
+		map_slice(plane_idx, layer);
+		connect_slice_actor(plane_idx, layer);
+	}
 
-		if (!is_valid(dicom_dir))
+	/*
+	The slider indices covered by a plane's slab around a slider index, clipped to the slider
+	range. Returns false if the plane shows a single slice.
+	*/
+	bool slab_range(int plane_idx, int index, int& first, int& last) {
+
+		int thickness = slab_thickness_arr[plane_idx]->value();
+		first = index - (thickness - 1) / 2;
+		last = first + thickness - 1;
+		first = std::max(first, slider_arr[plane_idx]->minimum());
+		last = std::min(last, slider_arr[plane_idx]->maximum());
+		return thickness > 1;
+	}
+
+	// Set up the slab of a reslice filter (used when the slab cannot be projected from the slice cache).
+	void configure_slab(int plane_idx, vtkImageReslice* reslice) {
+
+		reslice->SetSlabNumberOfSlices(slab_thickness_arr[plane_idx]->value());
+		reslice->SetSlabSliceSpacingFraction(1.0);
+		switch (slab_mode_arr[plane_idx]->currentIndex()) {
+		case SLAB_MIP: reslice->SetSlabModeToMax(); break;
+		case SLAB_MINIP: reslice->SetSlabModeToMin(); break;
+		default: reslice->SetSlabModeToMean(); break;
+		}
+	}
+
+	// Point a slice actor at its coloured raw slice, or at its reslice -> colour map pipeline.
+	void connect_slice_actor(int plane_idx, dataset_layer* layer) {
+
+		vtkImageActor* actor = layer->iactor[plane_idx];
+		if (layer->raw_slices[plane_idx] != NULL)
+			actor->GetMapper()->SetInputData(layer->display[plane_idx]);
+		else
+			actor->GetMapper()->SetInputConnection(layer->imapper[plane_idx]->GetOutputPort());
+	}
+
+	/*
+	Colour the raw slice on screen for a dataset/plane with the dataset's window/level and lookup
+	table, into its display image (reused while the slice size stays the same).
+	*/
+	void map_slice(int plane_idx, dataset_layer* layer) {
+
+		layer->stale_colours[plane_idx] = false;
+		stale_composite_arr[plane_idx] = true;
+
+		const raw_slice* slice = layer->raw_slices[plane_idx].get();
+		if (slice == NULL)
 			return;
 
-		load_DICOM_image(dicom_dir, AXIAL, 2);
-		load_DICOM_image(dicom_dir, CORONAL, 2);
-		load_DICOM_image(dicom_dir, SAGITTAL, 2);
-		load_DICOM_volume(dicom_dir, 2);
+		TRACE_SCOPE("window_level", layer->dset_num, plane_idx);
+
+		vtkSmartPointer<vtkImageData>& display = layer->display[plane_idx];
+		if (display == NULL)
+			display = vtkSmartPointer<vtkImageData>::New();
 
-		// ==== Restore UI elements to default positions after loading data 
-		// (useful in case user messed with UI elements before loading data)
-		opacity_label1->setText("Slice Opacity: " + QString::number(DSET2_OPACITY * 100));
-		opacity_slider1->setValue(DSET2_OPACITY * 100);
+		if (!std::equal(slice->extent, slice->extent + 6, display->GetExtent())) {
+			display->SetExtent(const_cast<int*>(slice->extent));
+			display->AllocateScalars(VTK_UNSIGNED_CHAR, 4);
+		}
+		display->SetOrigin(const_cast<double*>(slice->origin));
+		display->SetSpacing(const_cast<double*>(slice->spacing));
 
-		// colormap combobox
-		color_combobox1->setCurrentIndex(2); // magma
+		colormap_kernel::apply(slice->values.data(), slice->scalar_type, slice->width * slice->height,
+			layer->lut_colours, layer->window, layer->level,
+			static_cast<unsigned char*>(display->GetScalarPointer()));
+		display->Modified();
 	}
 
+	/*
+	With CPU compositing on, blend the slices of the visible overlays of a plane over the dataset 1
+	slice (in layer order) into one image and show only that (dataset 1's actor, at full opacity;
+	the overlays' actors are hidden). All slices must have been coloured by map_slice and cover
+	the same pixels; otherwise, or with compositing off, the actors are drawn by the renderer as
+	usual. In the difference view the image shown this way is the difference of the selected overlay
+	and dataset 1 instead (see difference_slices).
+	*/
+	void composite_slices(int plane_idx) {
 
-	void slice_slider_changed(int value) {
+		stale_composite_arr[plane_idx] = false;
 
-		if (!is_data1_loaded) {
-			cout << "data not loaded yet!\n";
+		if (difference != DIFFERENCE_OFF && difference_slices(plane_idx)) {
+			show_composite(plane_idx);
 			return;
 		}
+		difference_shown_arr[plane_idx] = difference_inputs(); // (the image is about to be a blend)
+
+		dataset_layer* base = layers[0];
+		const raw_slice* slice1 = base->raw_slices[plane_idx].get();
+
+		std::vector<dataset_layer*> upper;
+		bool possible = cpu_compositing && slice1 != NULL;
+		for (size_t l = 1; l < layers.size() && possible; l++) {
+			dataset_layer* layer = layers[l];
+			if (layer->iactor[plane_idx] == NULL || !layer->visible)
+				continue;
+			const raw_slice* slice = layer->raw_slices[plane_idx].get();
+			if (slice == NULL || !same_geometry(*slice1, *slice))
+				possible = false;
+			else
+				upper.push_back(layer);
+		}
 
-		QObject* caller = sender(); // determine axial/coronal/sagittal slice
-		int plane_idx;
+		if (!possible || upper.empty()) {
+			if (composited_arr[plane_idx]) {
+				composited_arr[plane_idx] = false;
+				if (base->iactor[plane_idx] != NULL) {
+					connect_slice_actor(plane_idx, base);
+					base->iactor[plane_idx]->SetOpacity(base->opacity);
+				}
+				for (size_t l = 1; l < layers.size(); l++) {
+					if (layers[l]->iactor[plane_idx] != NULL)
+						layers[l]->iactor[plane_idx]->SetVisibility(layers[l]->visible);
+				}
+			}
+			return;
+		}
 
-		if (caller == slider_arr[AXIAL])
-			plane_idx = 1;
-		else if (caller == slider_arr[CORONAL])
-			plane_idx = 2;
-		else if (caller == slider_arr[SAGITTAL])
-			plane_idx = 3;
+		TRACE_SCOPE("composite", -1, plane_idx);
 
-		int map[] = { -1, 2, 1, 0 };
+		vtkSmartPointer<vtkImageData>& composite = composite_arr[plane_idx];
+		if (composite == NULL)
+			composite = vtkSmartPointer<vtkImageData>::New();
 
-		// Set the slice
-		reslice_axes_arr[plane_idx]->SetElement(map[plane_idx], 3, value);
-		reslice_arr[plane_idx]->Modified();
+		if (!std::equal(slice1->extent, slice1->extent + 6, composite->GetExtent())) {
+			composite->SetExtent(const_cast<int*>(slice1->extent));
+			composite->AllocateScalars(VTK_UNSIGNED_CHAR, 4);
+		}
+		composite->SetOrigin(const_cast<double*>(slice1->origin));
+		composite->SetSpacing(const_cast<double*>(slice1->spacing));
+
+		// the first overlay over dataset 1, then each further overlay over the (opaque) result
+		unsigned char* out = static_cast<unsigned char*>(composite->GetScalarPointer());
+		int count = slice1->width * slice1->height;
+		slice_blend::over(static_cast<unsigned char*>(base->display[plane_idx]->GetScalarPointer()), base->opacity,
+			static_cast<unsigned char*>(upper[0]->display[plane_idx]->GetScalarPointer()), upper[0]->opacity, count, out);
+		for (size_t n = 1; n < upper.size(); n++) {
+			slice_blend::over(out, 1.0,
+				static_cast<unsigned char*>(upper[n]->display[plane_idx]->GetScalarPointer()), upper[n]->opacity, count, out);
+		}
+		composite->Modified();
 
-		// Update the slice label
-		slider_label_arr[plane_idx]->setText(
-			slice_label_texts[plane_idx] + QString::number(value)
-		);
+		show_composite(plane_idx);
+	}
 
-		// Re-render the image data
-		window_arr[plane_idx]->Render();
+	// Show a plane's composite image on dataset 1's actor (at full opacity) and hide the overlays' actors.
+	void show_composite(int plane_idx) {
 
+		layers[0]->iactor[plane_idx]->GetMapper()->SetInputData(composite_arr[plane_idx]);
+		layers[0]->iactor[plane_idx]->SetOpacity(1.0);
+		for (size_t l = 1; l < layers.size(); l++) {
+			if (layers[l]->iactor[plane_idx] != NULL)
+				layers[l]->iactor[plane_idx]->VisibilityOff();
+		}
+		composited_arr[plane_idx] = true;
 	}
 
 	/*
-	Defines behavior for when opacity slider values are changed by dragging the slider.
-	Note that each of dset1 and dset2 have their own opacity slider. This fxn is called
-	when either of the two sliders are changed. The caller slider is checked, and based on
-	the caller, the appropriate ImageActor's opacity is changed:
+	Put the difference of the selected overlay's slice and dataset 1's slice of a plane into the
+	plane's composite image (difference mode and range, see slice_difference.h). The difference is
+	taken over dataset 1's slice grid: the overlay's own slice when it covers the same pixels,
+	otherwise the overlay resliced onto that grid through the shared plane (and the overlay's
+	transform), which handles a different spacing, extent or placement. Nothing is computed if
+	neither slice changed since the image was made. Returns false if there is no difference to show
+	(no visible, loaded overlay).
+	*/
+	bool difference_slices(int plane_idx) {
 
-		ImageActor->SetOpacity(0.5);
+		dataset_layer* base = layers[0];
+		dataset_layer* overlay = selected_overlay();
+		if (base->state != LOAD_READY || base->iactor[plane_idx] == NULL || overlay == NULL || overlay->state != LOAD_READY ||
+			!overlay->visible || overlay->iactor[plane_idx] == NULL)
+			return false;
+		if (base->dset.image->GetNumberOfScalarComponents() != 1 || overlay->dset.image->GetNumberOfScalarComponents() != 1)
+			return false;
+
+		difference_inputs inputs;
+		inputs.mode = difference;
+		inputs.range = difference_range_spinbox->value();
+
+		// dataset 1's slice (raw, or from its reslice pipeline) gives the grid
+		int extent[6];
+		double origin[3], spacing[3];
+		inputs.slice1 = base->raw_slices[plane_idx];
+		if (inputs.slice1 != NULL) {
+			std::copy(inputs.slice1->extent, inputs.slice1->extent + 6, extent);
+			std::copy(inputs.slice1->origin, inputs.slice1->origin + 3, origin);
+			std::copy(inputs.slice1->spacing, inputs.slice1->spacing + 3, spacing);
+		}
+		else {
+			base->reslice[plane_idx]->Update();
+			inputs.image1 = base->reslice[plane_idx]->GetOutput();
+			inputs.time1 = inputs.image1->GetMTime();
+			inputs.image1->GetExtent(extent);
+			inputs.image1->GetOrigin(origin);
+			inputs.image1->GetSpacing(spacing);
+		}
 
-	As usual, the appropriate VTKWindow needs to be re-rendered:
+		// the overlay's slice if it is on that grid, else the overlay resliced onto it
+		inputs.slice2 = overlay->raw_slices[plane_idx];
+		if (inputs.slice2 == NULL || !same_grid(extent, origin, spacing, inputs.slice2->extent, inputs.slice2->origin, inputs.slice2->spacing)) {
+			inputs.slice2 = NULL;
+			vtkImageReslice* reslice = difference_reslice(plane_idx, overlay, extent, origin, spacing);
+			reslice->Update();
+			inputs.image2 = reslice->GetOutput();
+			inputs.time2 = inputs.image2->GetMTime();
+		}
 
-		VtkWindow->Render();
-	*/
-	void opacity_slider_changed(int value) {
+		if (composited_arr[plane_idx] && inputs == difference_shown_arr[plane_idx])
+			return true; // this plane's slices did not change
+
+		TRACE_SCOPE("difference", overlay->dset_num, plane_idx);
+
+		vtkSmartPointer<vtkImageData>& composite = composite_arr[plane_idx];
+		if (composite == NULL)
+			composite = vtkSmartPointer<vtkImageData>::New();
+		if (!std::equal(extent, extent + 6, composite->GetExtent())) {
+			composite->SetExtent(extent);
+			composite->AllocateScalars(VTK_UNSIGNED_CHAR, 4);
+		}
+		composite->SetOrigin(origin);
+		composite->SetSpacing(spacing);
+
+		int count = (extent[1] - extent[0] + 1) * (extent[3] - extent[2] + 1) * (extent[5] - extent[4] + 1);
+		const void* values1 = inputs.slice1 != NULL ? (const void*)inputs.slice1->values.data() : inputs.image1->GetScalarPointer();
+		const void* values2 = inputs.slice2 != NULL ? (const void*)inputs.slice2->values.data() : inputs.image2->GetScalarPointer();
+		int type1 = inputs.slice1 != NULL ? inputs.slice1->scalar_type : inputs.image1->GetScalarType();
+		int type2 = inputs.slice2 != NULL ? inputs.slice2->scalar_type : inputs.image2->GetScalarType();
+
+		// signed: -range .. +range, absolute: 0 .. range
+		double range = inputs.range;
+		double window = difference == DIFFERENCE_SIGNED ? 2 * range : range;
+		double level = difference == DIFFERENCE_SIGNED ? 0.0 : range / 2;
+		slice_difference::apply(values1, type1, values2, type2, count, difference, difference_colours[difference],
+			window, level, static_cast<unsigned char*>(composite->GetScalarPointer()));
+		composite->Modified();
+
+		difference_shown_arr[plane_idx] = inputs;
+		return true;
+	}
 
+	/*
+	The reslice that samples an overlay on a slice grid of dataset 1 (for the difference view): the
+	shared plane of the view, the overlay's transform and slab, and the given output grid. Setting
+	the same values again does not modify it, so it only runs again when the plane, the grid or the
+	overlay changed.
+	*/
+	vtkImageReslice* difference_reslice(int plane_idx, dataset_layer* overlay, const int extent[6], const double origin[3],
+		const double spacing[3]) {
+
+		vtkSmartPointer<vtkImageReslice>& reslice = difference_reslice_arr[plane_idx];
+		if (reslice == NULL) {
+			reslice = vtkSmartPointer<vtkImageReslice>::New();
+			reslice->SetOutputDimensionality(2);
+			reslice->SetResliceAxes(reslice_axes_arr[plane_idx]);
+			reslice->SetInterpolationModeToLinear();
+			trace_algorithm(reslice, "difference_reslice", -1, plane_idx);
+		}
+		if (reslice->GetInput() != overlay->dset.image.Get())
+			reslice->SetInputData(overlay->dset.image);
+		reslice->SetResliceTransform(overlay->reslice[plane_idx]->GetResliceTransform());
+		configure_slab(plane_idx, reslice);
+		reslice->SetOutputExtent(const_cast<int*>(extent));
+		reslice->SetOutputOrigin(const_cast<double*>(origin));
+		reslice->SetOutputSpacing(const_cast<double*>(spacing));
+		return reslice;
+	}
 
-		QObject* caller = sender(); // determine dset1/dset2 opacity slider
+	// Compute the difference view (or go back to the slices) in every slice view at its next render.
+	void refresh_difference() {
 
-		if (caller == opacity_slider0) {
-			if (!is_data1_loaded) {
-				cout << "dset1 not loaded yet!\n";
-				return;
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			difference_shown_arr[i] = difference_inputs();
+			stale_composite_arr[i] = true;
+			scheduler->request(i);
+		}
+	}
 
+	/*
+	What the loaded study costs: every buffer the viewer holds per dataset (see memory_report.h),
+	with the GPU textures estimated from the images the actors and volume mappers were given.
+	*/
+	memory_report collect_memory() {
+
+		memory_report report;
+		report.budget = resources.budget_bytes;
+		for (size_t l = 0; l < layers.size(); l++) {
+			dataset_layer* layer = layers[l];
+			report.datasets.push_back(dataset_memory());
+			dataset_memory& m = report.datasets.back();
+			dataset& dset = layer->dset;
+			m.id = layer->dset_num;
+			m.visible = layer->visible;
+			m.evicted = layer->state == LOAD_EVICTED;
+			m.loaded = dset.is_loaded();
+			if (!m.loaded)
+				continue;
+
+			m.scalar_type = dset.image->GetScalarTypeAsString();
+			dset.image->GetDimensions(m.dimensions);
+			if (dset.from_cache)
+				m.volume_mapped = memory_report::image_bytes(dset.image);
+			else
+				m.volume = memory_report::image_bytes(dset.image);
+			m.slice_cache = slices.bytes(layer->dset_num);
+			m.pyramid = layer->pyramid->bytes();
+
+			for (int i = 0; i < volume_pyramid::NUM_LEVELS; i++) {
+				m.raycaster += layer->raycaster[i].bytes();
+				// a level's texture is uploaded the first time it is rendered
+				if (!cpu_volume && layer->visible && layer->lod_mapper[i] != NULL && (i == 0 || level_render_ms[i] >= 0))
+					m.gpu_volume += memory_report::image_bytes(layer->lod_mapper[i]->GetInput());
 			}
-			opacity_label0->setText("Slice Opacity: " + QString::number(value));
 
-			// change opacity for all image/slice actors
-			for (int i = 1; i < NUM_VIEWPORTS; i++) {
-				double opacity = ((double)value) / 100;
-				iactor_arr[i]->SetOpacity(opacity);
-				window_arr[i]->Render();
+			for (int plane_idx = 1; plane_idx < NUM_VIEWPORTS; plane_idx++) {
+				vtkImageActor* actor = layer->iactor[plane_idx];
+				if (actor == NULL)
+					continue; // still being built (preview)
+
+				m.slice_images += memory_report::image_bytes(layer->reslice[plane_idx]->GetOutput()) +
+					memory_report::image_bytes(layer->imapper[plane_idx]->GetOutput()) + memory_report::image_bytes(layer->display[plane_idx]);
+
+				// a slab projection is owned by the slab, not by the slice cache
+				m.slab += layer->slab[plane_idx].bytes();
+				if (slab_thickness_arr[plane_idx]->value() > 1 && layer->raw_slices[plane_idx] != NULL)
+					m.slab += layer->raw_slices[plane_idx]->values.size();
+
+				if (actor->GetVisibility() && actor->GetInput() != composite_arr[plane_idx])
+					m.gpu_slices += memory_report::texture_bytes(actor->GetInput());
 			}
 		}
 
-		else if (caller == opacity_slider1) {
-			if (!is_data2_loaded) {
-				cout << "dset2 not loaded yet!\n";
-				return;
+		for (int plane_idx = 1; plane_idx < NUM_VIEWPORTS; plane_idx++) {
+			report.shared_images += memory_report::image_bytes(composite_arr[plane_idx]);
+			if (difference_reslice_arr[plane_idx] != NULL)
+				report.shared_images += memory_report::image_bytes(difference_reslice_arr[plane_idx]->GetOutput());
+			if (composited_arr[plane_idx])
+				report.shared_gpu += memory_report::texture_bytes(composite_arr[plane_idx]);
+		}
+		report.shared_images += raycast_layer.size() + memory_report::image_bytes(raycast_image);
+		if (cpu_volume)
+			report.shared_gpu += memory_report::texture_bytes(raycast_image);
+
+		report.measure_process();
+		return report;
+	}
 
-			}
-			opacity_label1->setText("Slice Opacity: " + QString::number(value));
+	// Whether two slices cover the same pixels (same extent, origin and spacing).
+	static bool same_geometry(const raw_slice& a, const raw_slice& b) {
+		return same_grid(a.extent, a.origin, a.spacing, b.extent, b.origin, b.spacing);
+	}
 
-			// change opacity for all image/slice actors
-			for (int i = 1; i < NUM_VIEWPORTS; i++) {
-				double opacity = ((double)value) / 100;
-				iactor_arr2[i]->SetOpacity(opacity);
-				window_arr[i]->Render();
-			}
+	static bool same_grid(const int extent_a[6], const double origin_a[3], const double spacing_a[3],
+		const int extent_b[6], const double origin_b[3], const double spacing_b[3]) {
+
+		if (!std::equal(extent_a, extent_a + 6, extent_b))
+			return false;
+
+		for (int i = 0; i < 3; i++) {
+			if (fabs(origin_a[i] - origin_b[i]) > 1e-4 * spacing_a[i] || fabs(spacing_a[i] - spacing_b[i]) > 1e-6 * spacing_a[i])
+				return false;
 		}
+		return true;
 	}
 
-	void combobox_changed(int new_index) {
+	/*
+	Start reading a series on a worker thread. The slice viewports show the slices decoded so far
+	while it runs (refresh_preview()); all viewports are populated by load_finished() once the
+	volume is ready. A dataset that is already loading cannot be loaded again until that
+	load finishes or is cancelled.
+
+	Args:
+		series: (optional) the series to read, picked from an earlier scan of dicom_dir (see
+			load_finished()); without it the directory is scanned and, if it holds several series, the
+			user is asked which one to load
+	*/
+	void start_load(dataset_layer* layer, QDir dicom_dir, std::shared_ptr<const dicom_series> series = NULL) {
+
+		int dset_num = layer->dset_num;
+		if (layer->state == LOAD_LOADING) {
+			statusBar()->showMessage("Dataset " + QString::number(dset_num) +
+				" is still loading (cancel it first)", 5000);
+			return;
+		}
 
-		QObject* caller = sender(); // determine dset1/dset2 opacity slider
+		layer->state = LOAD_LOADING;
+		layer->directory = dicom_dir.absolutePath();
+		layer->series = series;
 
-		int idx = (caller == color_combobox0) ? 0 : 1;
+		dataset_loader* loader = series ? new dataset_loader(dset_num, series) : new dataset_loader(dset_num, dicom_dir);
+		layer->loader = loader;
 
-		vtkSmartPointer<vtkColorTransferFunction> map[4] = {
-			class_example_ctf, viridis_ctf, magma_ctf, grayscale_ctf };
+		connect(loader, SIGNAL(progress(int, int, int)),
+			this, SLOT(load_progress(int, int, int)));
+		connect(loader, SIGNAL(slices_ready(int, int)),
+			this, SLOT(load_slices_ready(int, int)));
+		connect(loader, SIGNAL(finished(int)),
+			this, SLOT(load_finished(int)));
+		layer->preview_slices = 0;
+		layer->preview_shown = 0;
+
+		load_progress_bar->setRange(0, 0); // busy indicator until the file count is known
+		load_progress_bar->setFormat("Dataset " + QString::number(dset_num) + ": %v / %m files");
+		load_progress_bar->show();
+		cancel_load_button->show();
+
+		loader->start();
+	}
+
+	/*
+	Restore a dataset's settings to their defaults after loading data (window/level from the
+	intensity histogram, the default opacity and colour map) and show them in the controls; for dataset 1 the slice sliders
+	go back to the first slice too (useful in case user messed with UI elements before loading data)
+	*/
+	void reset_controls(dataset_layer* layer) {
+
+		bool reference = layer == layers[0];
+
+		default_window(layer, layer->window, layer->level);
+
+		layer->opacity = reference ? 1.0 : DSET2_OPACITY;
+		layer->volume_colormap = reference ? 3 : 2; // grayscale, magma
+		apply_layer_settings(layer);
+		update_controls();
+
+		// slice sliders
+		for (int i = 1; i < NUM_VIEWPORTS && reference; i++) {
+			slider_arr[i]->setValue(0);
+		}
+	}
+
+	/*
+	Default window/level of a dataset on the sliders' integer steps: the histogram's (1st to 99th
+	percentile, see intensity_histogram::auto_window), or the whole intensity range without one
+	(a volume that is still being decoded).
+	*/
+	void default_window(dataset_layer* layer, double& window, double& level) {
+
+		int low, high;
+		whole_range(layer->dset.scalar_range(), low, high);
+		window = high - low;
+		level = (low + high) / 2;
+
+		std::shared_ptr<const intensity_histogram> histogram = layer->dset.histogram;
+		if (histogram != NULL && !histogram->empty()) {
+			double w, l;
+			histogram->auto_window(w, l);
+			window = std::min(std::max(round(w), 1.0), (double)(high - low));
+			level = std::min(std::max(round(l), (double)low), (double)high);
+		}
+	}
+
+	// The intensity range of a dataset on the window/level sliders' integer steps.
+	void whole_range(double* range, int& low, int& high) {
+
+		low = (int)floor(range[0]);
+		high = std::max((int)ceil(range[1]), low + 1);
+	}
+
+	/*
+	Apply a dataset's settings to what the viewer draws of it: slice opacity and visibility, the
+	lookup table range and colours (the slices are coloured again before their next render), and
+	the volume's colour map and visibility.
+	*/
+	void apply_layer_settings(dataset_layer* layer) {
+
+		layer->lut->SetRange(layer->level - layer->window / 2, layer->level + layer->window / 2);
+
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			if (layer->iactor[i] == NULL)
+				continue;
+			layer->iactor[i]->SetOpacity(layer->opacity);
+			layer->iactor[i]->SetVisibility(layer->visible);
+
+			// a hidden dataset's slice is not kept up to date (see slice_slider_changed)
+			if (layer->visible && layer->is_loaded() && layers[0]->is_loaded())
+				show_slice(i, layer, slider_arr[i]->value());
+			layer->stale_colours[i] = true;
+			stale_composite_arr[i] = true; // composited planes keep dataset 1 opaque and the overlays hidden
+			scheduler->request(i);
+		}
+
+		if (layer->volume != NULL) {
+			layer->volume_property->SetColor(volume_ctf(layer->volume_colormap));
+			layer->volume->SetVisibility(!cpu_volume && layer->visible);
+			scheduler->request(VOLUME);
+		}
+	}
+
+	/*
+	Show the settings of dataset 1 (first column) and of the selected overlay (second column) in
+	the controls. Signals are blocked, so nothing is applied again.
+	*/
+	void update_controls() {
+
+		dataset_layer* columns[2] = { layers[0], selected_overlay() };
+		QSlider* opacity_sliders[2] = { opacity_slider0, opacity_slider1 };
+		QLabel* opacity_labels[2] = { opacity_label0, opacity_label1 };
+		QSlider* window_sliders[2] = { window_slider0, window_slider1 };
+		QSlider* level_sliders[2] = { level_slider0, level_slider1 };
+		QLabel* window_labels[2] = { window_label0, window_label1 };
+		QLabel* level_labels[2] = { level_label0, level_label1 };
+		QComboBox* color_comboboxes[2] = { color_combobox0, color_combobox1 };
+		histogram_widget* histograms[2] = { histogram_widget0, histogram_widget1 };
+		QPushButton* auto_buttons[2] = { auto_window_button0, auto_window_button1 };
+
+		for (int c = 0; c < 2; c++) {
+			dataset_layer* layer = columns[c];
+			bool ready = layer != NULL && layer->state == LOAD_READY;
+
+			QWidget* widgets[4] = { opacity_sliders[c], window_sliders[c], level_sliders[c], color_comboboxes[c] };
+			for (int w = 0; w < 4; w++)
+				widgets[w]->blockSignals(true);
+
+			if (layer != NULL) {
+				opacity_sliders[c]->setValue((int)round(layer->opacity * 100));
+				color_comboboxes[c]->setCurrentIndex(layer->volume_colormap);
+			}
+			if (ready) {
+				// window slider goes from 1 to the intensity range, level slider over the range
+				int low, high;
+				whole_range(layer->dset.scalar_range(), low, high);
+				window_sliders[c]->setRange(1, high - low);
+				level_sliders[c]->setRange(low, high);
+				window_sliders[c]->setValue((int)layer->window);
+				level_sliders[c]->setValue((int)layer->level);
+			}
+			opacity_labels[c]->setText("Slice Opacity: " + (ready ? QString::number(opacity_sliders[c]->value()) : QString("-")));
+			window_labels[c]->setText("Window: " + (ready ? QString::number(window_sliders[c]->value()) : QString("-")));
+			level_labels[c]->setText("Level: " + (ready ? QString::number(level_sliders[c]->value()) : QString("-")));
+			histograms[c]->set_histogram(ready ? layer->dset.histogram : NULL);
+			if (ready)
+				histograms[c]->set_window(layer->window, layer->level);
+			auto_buttons[c]->setEnabled(ready);
+
+			for (int w = 0; w < 4; w++)
+				widgets[w]->blockSignals(false);
+		}
+
+		dataset_layer* overlay = columns[1];
+		overlay_visible_checkbox->blockSignals(true);
+		overlay_visible_checkbox->setChecked(overlay == NULL || overlay->visible);
+		overlay_visible_checkbox->setEnabled(overlay != NULL);
+		overlay_visible_checkbox->blockSignals(false);
+
+		update_align_controls();
+		update_titles();
+	}
+
+	// Dataset names in the column headings and the overlay list.
+	void update_titles() {
+
+		col0_heading->setText(layers[0]->title());
+
+		dataset_layer* overlay = selected_overlay();
+		col1_heading->setText(overlay != NULL ? overlay->title() : QString("No overlay"));
+
+		for (int i = 0; i < overlay_combobox->count(); i++) {
+			dataset_layer* layer = find_layer(overlay_combobox->itemData(i).toInt());
+			if (layer != NULL)
+				overlay_combobox->setItemText(i, overlay_title(layer));
+		}
+	}
+
+	/*
+	Take a dataset off the views and free everything built from its volume right away: its slice
+	actors and volume leave the renderers, its slices leave the slice cache, and the layer drops
+	the rest (see dataset_layer::release). Its settings and directory are kept.
+	*/
+	void release_layer(dataset_layer* layer) {
+
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			if (layer->iactor[i] == NULL)
+				continue;
+			renderer_arr[i]->RemoveActor(layer->iactor[i]);
+			stale_composite_arr[i] = true;
+			scheduler->request(i);
+		}
+		if (layer->volume != NULL) {
+			renderer_arr[VOLUME]->RemoveViewProp(layer->volume);
+			scheduler->request(VOLUME);
+		}
+
+		// the difference view's reslices may hold the volume
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			difference_reslice_arr[i] = NULL;
+			difference_shown_arr[i] = difference_inputs();
+		}
+
+		slices.remove_dataset(layer->dset_num);
+		layer->release();
+	}
+
+	/*
+	Report what every dataset holds to the resource manager and unload the hidden overlays it picks
+	to get back within the memory budget. An unloaded overlay keeps its directory and settings and
+	is loaded again (from the volume cache) when it is shown. Returns true if anything was unloaded.
+	*/
+	bool enforce_memory_budget(const memory_report& report) {
+
+		for (size_t d = 0; d < report.datasets.size(); d++) {
+			const dataset_memory& m = report.datasets[d];
+			dataset_layer* layer = find_layer(m.id);
+			if (layer != NULL && layer->state == LOAD_READY)
+				resources.set_usage(m.id, m.host_total(), layer->visible);
+			else if (layer == NULL || layer->state != LOAD_LOADING)
+				resources.remove(m.id);
+		}
+
+		std::vector<int> victims = resources.evictions();
+		for (size_t v = 0; v < victims.size(); v++) {
+			dataset_layer* layer = find_layer(victims[v]);
+			TRACE_SCOPE("evict", layer->dset_num);
+
+			release_layer(layer);
+			layer->state = LOAD_EVICTED;
+			resources.remove(layer->dset_num);
+			resources.evicted++;
+
+			statusBar()->showMessage("Dataset " + QString::number(layer->dset_num) +
+				" unloaded to stay within the memory budget (shown again on demand)", 5000);
+		}
+
+		if (!victims.empty())
+			update_titles();
+		return !victims.empty();
+	}
+
+	/*
+	The overlay alignment dialog (non-modal, Tools > Align overlay...): translation and rotation of
+	the selected overlay with the step of the spin box arrows and of the keyboard nudges, and the
+	buttons to reset, export and load the transform. The keyboard nudges are application shortcuts,
+	so they work whether the dialog or the main window has the focus:
+
+		Ctrl+Left/Right, Ctrl+Down/Up, Ctrl+PgDn/PgUp              move along x, y, z
+		Ctrl+Shift+Down/Up, Ctrl+Shift+PgDn/PgUp, Ctrl+Shift+Left/Right  rotate about x, y, z
+	*/
+	void build_align_dialog() {
+
+		align_dialog = new QDialog(this);
+		align_dialog->setWindowTitle("Align overlay");
+		align_dialog->setModal(false);
+
+		align_label = new QLabel();
+		const char* names[6] = { "Move x (mm):", "Move y (mm):", "Move z (mm):",
+			"Rotate x (deg):", "Rotate y (deg):", "Rotate z (deg):" };
+
+		QGridLayout* grid = new QGridLayout();
+		grid->addWidget(align_label, 0, 0, 1, 4);
+		for (int p = 0; p < 6; p++) {
+			QDoubleSpinBox* spin = new QDoubleSpinBox();
+			align_spin_arr[p] = spin;
+			spin->setDecimals(2);
+			spin->setKeyboardTracking(false); // typed values are applied once, not per digit
+			if (p < 3) {
+				spin->setRange(-rigid_transform::MAX_TRANSLATION_MM, rigid_transform::MAX_TRANSLATION_MM);
+				spin->setSingleStep(1.0);
+			}
+			else {
+				spin->setRange(-rigid_transform::MAX_ROTATION_DEG, rigid_transform::MAX_ROTATION_DEG);
+				spin->setSingleStep(0.5);
+				spin->setWrapping(true);
+			}
+			grid->addWidget(new QLabel(names[p]), 1 + p % 3, p < 3 ? 0 : 2);
+			grid->addWidget(spin, 1 + p % 3, p < 3 ? 1 : 3);
+		}
+
+		align_step_mm = new QDoubleSpinBox();
+		align_step_mm->setRange(0.01, 100.0);
+		align_step_mm->setValue(1.0);
+		align_step_mm->setSuffix(" mm");
+		align_step_deg = new QDoubleSpinBox();
+		align_step_deg->setRange(0.01, 45.0);
+		align_step_deg->setValue(0.5);
+		align_step_deg->setSuffix(" deg");
+		grid->addWidget(new QLabel("Step:"), 4, 0);
+		grid->addWidget(align_step_mm, 4, 1);
+		grid->addWidget(new QLabel("Step:"), 4, 2);
+		grid->addWidget(align_step_deg, 4, 3);
+
+		QLabel* hint = new QLabel("Ctrl+arrows/PgUp/PgDn move the overlay, with Shift they rotate it.\n"
+			"Drag in a slice view to move it in that plane, the wheel rotates it.");
+		grid->addWidget(hint, 5, 0, 1, 4);
+
+		QPushButton* reset_button = new QPushButton("Reset");
+		QPushButton* export_button = new QPushButton("Export transform...");
+		QPushButton* load_button = new QPushButton("Load transform...");
+		QHBoxLayout* buttons = new QHBoxLayout();
+		buttons->addWidget(reset_button);
+		buttons->addStretch();
+		buttons->addWidget(load_button);
+		buttons->addWidget(export_button);
+		grid->addLayout(buttons, 6, 0, 1, 4);
+		align_dialog->setLayout(grid);
+
+		// keyboard nudges: parameter p gets nudged down by the first key of its pair, up by the second
+		int keys[6][2] = {
+			{ Qt::Key_Left, Qt::Key_Right }, { Qt::Key_Down, Qt::Key_Up }, { Qt::Key_PageDown, Qt::Key_PageUp },
+			{ Qt::Key_Down, Qt::Key_Up }, { Qt::Key_PageDown, Qt::Key_PageUp }, { Qt::Key_Left, Qt::Key_Right } };
+		QSignalMapper* nudge_mapper = new QSignalMapper(this);
+		for (int p = 0; p < 6; p++) {
+			for (int d = 0; d < 2; d++) {
+				int modifiers = p < 3 ? Qt::CTRL : Qt::CTRL | Qt::SHIFT;
+				QShortcut* shortcut = new QShortcut(QKeySequence(modifiers + keys[p][d]), this);
+				shortcut->setContext(Qt::ApplicationShortcut);
+				shortcut->setEnabled(false);
+				connect(shortcut, SIGNAL(activated()), nudge_mapper, SLOT(map()));
+				nudge_mapper->setMapping(shortcut, p * 2 + d);
+				align_shortcuts.push_back(shortcut);
+			}
+		}
+
+		for (int p = 0; p < 6; p++)
+			connect(align_spin_arr[p], SIGNAL(valueChanged(double)),
+				this, SLOT(align_changed(double)));
+		connect(align_step_mm, SIGNAL(valueChanged(double)),
+			this, SLOT(align_step_changed(double)));
+		connect(align_step_deg, SIGNAL(valueChanged(double)),
+			this, SLOT(align_step_changed(double)));
+		connect(nudge_mapper, SIGNAL(mapped(int)),
+			this, SLOT(nudge_alignment(int)));
+		connect(reset_button, SIGNAL(clicked()),
+			this, SLOT(reset_alignment()));
+		connect(export_button, SIGNAL(clicked()),
+			this, SLOT(export_alignment()));
+		connect(load_button, SIGNAL(clicked()),
+			this, SLOT(load_alignment()));
+		connect(align_dialog, SIGNAL(finished(int)),
+			this, SLOT(align_dialog_closed(int)));
+	}
+
+	// Whether the align dialog is open (keyboard and mouse nudges apply to the selected overlay).
+	bool aligning() {
+		return align_dialog->isVisible();
+	}
+
+	// Show the selected overlay's transform in the align dialog (signals blocked, nothing is applied).
+	void update_align_controls() {
+
+		dataset_layer* layer = selected_overlay();
+		bool ready = layer != NULL && layer->state == LOAD_READY;
+		align_label->setText(layer == NULL ? QString("No overlay selected") :
+			"Dataset " + QString::number(layer->dset_num) + " against dataset 1" + (ready ? QString() : QString(" (not loaded)")));
+
+		for (int p = 0; p < 6; p++) {
+			align_spin_arr[p]->blockSignals(true);
+			align_spin_arr[p]->setValue(layer == NULL ? 0.0 : p < 3 ? layer->transform.translation[p] : layer->transform.rotation[p - 3]);
+			align_spin_arr[p]->setEnabled(ready);
+			align_spin_arr[p]->blockSignals(false);
+		}
+	}
+
+	// Give a dataset a new transform: show it in the align dialog and apply it to the views.
+	void set_transform(dataset_layer* layer, const rigid_transform& transform) {
+
+		layer->transform = transform;
+		layer->transform.clamp_translation(); // (a nudge or drag may go past what the spin boxes show)
+		if (layer == selected_overlay())
+			update_align_controls();
+		apply_transform(layer);
+	}
+
+	/*
+	Apply a dataset's transform to what the viewer draws of it. The reslice filters of the three
+	planes get the inverse (world -> volume) as their reslice transform, so they sample the volume
+	where it is now shown; the slice cache only copies axis-aligned slices, so the slices of a
+	moved dataset come from vtkImageReslice (plain, as fast_reslice falls back) until it is reset.
+	The volume gets the transform as its user matrix, which the GPU mapper and the CPU ray caster
+	(see raycast_volume) both honour. Nothing is resampled; all four viewports are rendered at the
+	next frame.
+	*/
+	void apply_transform(dataset_layer* layer) {
+
+		if (!layer->is_loaded())
+			return;
+
+		TRACE_SCOPE("transform", layer->dset_num);
+
+		vtkSmartPointer<vtkTransform> to_volume = reslice_transform(layer);
+		if (to_volume != NULL)
+			slices.invalidate(layer->dset_num); // (its cached slices are not shown while it is moved)
+
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			if (layer->reslice[i] == NULL)
+				continue;
+			layer->reslice[i]->SetResliceTransform(to_volume);
+			layer->slab[i].clear();
+			if (layer->visible && layers[0]->is_loaded())
+				show_slice(i, layer, slider_arr[i]->value());
+			stale_composite_arr[i] = true;
+			scheduler->request(i);
+		}
+
+		place_volume(layer);
+		scheduler->request(VOLUME);
+	}
+
+	// The reslice transform of a dataset's slice planes: world -> volume (NULL if it has not been moved).
+	vtkSmartPointer<vtkTransform> reslice_transform(dataset_layer* layer) {
+
+		if (layer->transform.is_identity())
+			return NULL;
+
+		double m[16];
+		layer->transform.inverse_matrix(layer->dset.image->GetCenter(), m);
+		vtkSmartPointer<vtkTransform> to_volume = vtkSmartPointer<vtkTransform>::New();
+		to_volume->SetMatrix(m);
+		return to_volume;
+	}
+
+	// Put a dataset's volume where its transform moves it (user matrix of the vtkVolume).
+	void place_volume(dataset_layer* layer) {
+
+		if (layer->volume == NULL)
+			return;
+
+		if (layer->transform.is_identity()) {
+			layer->volume->SetUserMatrix(NULL);
+			return;
+		}
+		double m[16];
+		layer->transform.matrix(layer->dset.image->GetCenter(), m);
+		vtkSmartPointer<vtkMatrix4x4> matrix = vtkSmartPointer<vtkMatrix4x4>::New();
+		matrix->DeepCopy(m);
+		layer->volume->SetUserMatrix(matrix);
+	}
+
+	/*
+	Mouse events of the slice viewports (observed ahead of the interactor style). While the align
+	dialog is open, a left-drag moves the selected overlay by the mouse motion in the plane of the
+	view and the wheel rotates it about the plane's normal by the rotation step. Returns true for
+	the events it used, which keeps them from the camera interaction.
+	*/
+	bool align_mouse(vtkObject* caller, unsigned long event, void*) {
+
+		dataset_layer* layer = selected_overlay();
+		if (!aligning() || layer == NULL || layer->state != LOAD_READY) {
+			drag_plane = 0;
+			return false;
+		}
+
+		int plane_idx = 0;
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			if (caller == viewport_arr[i]->GetInteractor())
+				plane_idx = i;
+		}
+		if (plane_idx == 0)
+			return false;
+
+		int* position = viewport_arr[plane_idx]->GetInteractor()->GetEventPosition();
+		rigid_transform transform = layer->transform;
+		int map[] = { -1, 2, 1, 0 };
+
+		switch (event) {
+		case vtkCommand::LeftButtonPressEvent:
+			drag_plane = plane_idx;
+			drag_last[0] = position[0];
+			drag_last[1] = position[1];
+			return true;
+
+		case vtkCommand::LeftButtonReleaseEvent:
+			if (drag_plane == 0)
+				return false;
+			drag_plane = 0;
+			return true;
+
+		case vtkCommand::MouseMoveEvent: {
+			if (drag_plane != plane_idx)
+				return false;
+
+			// the mouse motion in world coordinates, at the depth of the slice (the camera's focal point)
+			vtkRenderer* renderer = renderer_arr[plane_idx];
+			double focal[3], display[3], from[4], to[4];
+			renderer->GetActiveCamera()->GetFocalPoint(focal);
+			vtkInteractorObserver::ComputeWorldToDisplay(renderer, focal[0], focal[1], focal[2], display);
+			vtkInteractorObserver::ComputeDisplayToWorld(renderer, drag_last[0], drag_last[1], display[2], from);
+			vtkInteractorObserver::ComputeDisplayToWorld(renderer, position[0], position[1], display[2], to);
+			drag_last[0] = position[0];
+			drag_last[1] = position[1];
+
+			for (int i = 0; i < 3; i++) {
+				if (i != map[plane_idx]) // (stay on the slice)
+					transform.translation[i] += to[i] - from[i];
+			}
+			set_transform(layer, transform);
+			return true;
+		}
+
+		case vtkCommand::MouseWheelForwardEvent:
+		case vtkCommand::MouseWheelBackwardEvent: {
+			double step = event == vtkCommand::MouseWheelForwardEvent ? align_step_deg->value() : -align_step_deg->value();
+			double& angle = transform.rotation[map[plane_idx]];
+			angle = wrap_degrees(angle + step);
+			set_transform(layer, transform);
+			return true;
+		}
+		}
+		return false;
+	}
+
+	// An angle in (-180, 180].
+	static double wrap_degrees(double angle) {
+
+		angle = fmod(angle, 360.0);
+		if (angle > 180.0)
+			angle -= 360.0;
+		else if (angle <= -180.0)
+			angle += 360.0;
+		return angle;
+	}
+
+	// Check that directory is valid.
+	bool is_valid(QDir dicom_dir) {
+
+
+		QTextStream qt_cout(stdout);
+		qt_cout << dicom_dir.path();
+
+		if (!dicom_dir.exists() || dicom_dir.count() == 0) {
+			cout << "wrong directory!";
+			return false;
+		}
+
+		// directory not changed/dialog box closed
+		if (QString::compare(dicom_dir.path(), ".") == 0) {
+			return false;
+		}
+
+		return true;
+	}
+
+
+
+public slots:
+
+
+	void load_dset1() {
+
+		QDir dicom_dir = choose_directory();
+		//QDir dicom_dir = QDir("../data/hw2-dataset");
+
+		if (!is_valid(dicom_dir))
+			return;
+
+		start_load(layers[0], dicom_dir);
+	}
+
+	// Load a series into the selected overlay (replacing what it shows), or into a new one.
+	void load_overlay() {
+
+		QDir dicom_dir = choose_directory();
+		//QDir dicom_dir = QDir("../data/VHF-Pelvis");
+
+		if (!is_valid(dicom_dir))
+			return;
+
+		dataset_layer* layer = selected_overlay();
+		start_load(layer != NULL ? layer : add_layer(), dicom_dir);
+	}
+
+	// Load a series as a new overlay on top of the others.
+	void add_overlay() {
+
+		QDir dicom_dir = choose_directory();
+
+		if (!is_valid(dicom_dir))
+			return;
+
+		start_load(add_layer(), dicom_dir);
+	}
+
+	// Close the selected overlay and free its memory (not while it is loading).
+	void close_overlay() {
+
+		dataset_layer* layer = selected_overlay();
+		if (layer == NULL)
+			return;
+
+		int dset_num = layer->dset_num;
+		if (layer->state == LOAD_LOADING) {
+			statusBar()->showMessage("Dataset " + QString::number(dset_num) +
+				" is still loading (cancel it first)", 5000);
+			return;
+		}
+
+		release_layer(layer);
+		resources.remove(dset_num);
+		layers.erase(std::find(layers.begin(), layers.end(), layer));
+		delete layer;
+
+		overlay_combobox->removeItem(overlay_combobox->currentIndex()); // selects another overlay
+		update_controls();
+		update_memory_label();
+
+		statusBar()->showMessage("Dataset " + QString::number(dset_num) + " closed", 5000);
+	}
+
+	/*
+	Called (on the GUI thread) every time the loader has read another file.
+	*/
+	void load_progress(int dset_num, int files_done, int files_total) {
+
+		load_progress_bar->setRange(0, files_total);
+		load_progress_bar->setValue(files_done);
+		load_progress_bar->setFormat("Dataset " + QString::number(dset_num) + ": %v / %m files");
+	}
+
+	/*
+	Called (on the GUI thread) when a background load has ended. On success whatever the dataset
+	showed before is released, the decoded volume is moved into it and the viewports are (re)built
+	from it. On failure or cancellation the dataset goes back to the state it was in before the
+	load started. If the directory held several series the user picks one, which is then loaded
+	from the headers the scan already parsed.
+	*/
+	void load_finished(int dset_num) {
+
+		dataset_layer* layer = find_layer(dset_num);
+		if (layer == NULL)
+			return; // (datasets are not closed while loading)
+
+		dataset_loader* loader = layer->loader;
+		layer->loader = NULL;
+
+		bool previewed = layer->previewing;
+		bool restoring = layer->restoring;
+		layer->restoring = false;
+
+		if (loader->succeeded) {
+			release_layer(layer);
+			layer->dset = loader->result;
+			layer->patient_name = layer->dset.patient_name;
+
+			show_dataset(layer, restoring);
+			load_DICOM_volume(layer);
+
+			layer->state = LOAD_READY;
+			if (restoring)
+				update_controls();
+			else
+				reset_controls(layer);
+
+			statusBar()->showMessage("Dataset " + QString::number(dset_num) +
+				(layer->dset.from_cache ? " loaded (from volume cache)" : " loaded"), 5000);
+		}
+		else {
+			layer->previewing = false;
+			layer->preview_slices = 0;
+			layer->preview_shown = 0;
+
+			// put back the dataset the partly decoded one replaced (the volume view still shows it)
+			if (previewed) {
+				slices.set_decoded_slices(dset_num, -1);
+				layer->dset = layer->previous;
+				layer->previous = dataset();
+				if (layer->is_loaded()) {
+					show_dataset(layer, false);
+					reset_controls(layer);
+				}
+				else {
+					hide_slices(layer);
+				}
+			}
+
+			if (layer->is_loaded())
+				layer->state = LOAD_READY;
+			else
+				layer->state = restoring ? LOAD_EVICTED : LOAD_EMPTY;
+			update_controls();
+
+			if (!loader->found.empty() && !loader->cancelled)
+				pick_series(layer, loader->found);
+			else
+				statusBar()->showMessage("Dataset " + QString::number(dset_num) +
+					(loader->cancelled ? " loading cancelled" : " could not be loaded"), 5000);
+		}
+
+		loader->deleteLater();
+
+		// hide the progress widgets once nothing is loading anymore
+		bool loading = false;
+		for (size_t l = 0; l < layers.size(); l++)
+			loading = loading || layers[l]->loader != NULL;
+		if (!loading) {
+			load_progress_bar->hide();
+			cancel_load_button->hide();
+		}
+
+		// a new volume may have pushed the datasets over the memory budget
+		update_memory_label();
+	}
+
+	// Ask which of the series found in a directory to load into the layer (the largest is preselected).
+	void pick_series(dataset_layer* layer, const std::vector<dicom_series>& found) {
+
+		QStringList labels;
+		int largest = 0;
+		for (size_t i = 0; i < found.size(); i++) {
+			labels.append(found[i].label());
+			if (found[i].files.size() > found[largest].files.size())
+				largest = (int)i;
+		}
+
+		bool ok = false;
+		QString choice = QInputDialog::getItem(this, "Dataset " + QString::number(layer->dset_num),
+			QString::number(found.size()) + " series found in " + layer->directory + ", load:", labels, largest, false, &ok);
+		int picked = labels.indexOf(choice);
+		if (!ok || picked < 0)
+			return;
+
+		start_load(layer, QDir(layer->directory), std::make_shared<dicom_series>(found[picked]));
+	}
+
+	/*
+	Called (on the GUI thread) as a load decodes the slices of its series: the first num_slices
+	slices of the volume are complete. The first report is shown right away (time to first image),
+	later ones at most every preview_timer interval.
+	*/
+	void load_slices_ready(int dset_num, int num_slices) {
+
+		dataset_layer* layer = find_layer(dset_num);
+		if (layer == NULL || sender() != layer->loader)
+			return; // a report from a load that has been replaced
+
+		// slider indices are slices of dataset 1, so the overlays wait for it
+		if (layer != layers[0] && !layers[0]->is_loaded())
+			return;
+
+		layer->preview_slices = num_slices;
+		if (!layer->previewing)
+			refresh_preview();
+		else if (!preview_timer->isActive())
+			preview_timer->start();
+	}
+
+	/*
+	Show the slices decoded so far of every load that is running. The first time, the partly
+	decoded volume replaces the dataset in the slice viewports (window/level from the slices
+	decoded so far, unless the dataset is reloaded after an eviction); after that, the slice cache
+	is invalidated and the slices on screen extracted again. The axial slider of dataset 1 only
+	reaches the slices already decoded. Coronal and sagittal slices fill in as slices arrive: the
+	slice cache only reads the decoded slices (z < num_slices) and leaves the rest of the plane
+	zero, since the decode threads are still writing there.
+	*/
+	void refresh_preview() {
+
+		for (size_t l = 0; l < layers.size(); l++) {
+			dataset_layer* layer = layers[l];
+			bool reference = l == 0;
+			dataset_loader* loader = layer->loader;
+			int num_slices = layer->preview_slices;
+			if (loader == NULL || loader->preview == NULL || num_slices == 0 || num_slices == layer->preview_shown)
+				continue;
+
+			TRACE_SCOPE("preview", layer->dset_num);
+
+			// (before show_dataset(), which extracts the first slices)
+			slices.set_decoded_slices(layer->dset_num, num_slices);
+
+			if (!layer->previewing) {
+				layer->previewing = true;
+				layer->previous = layer->dset;
+
+				dataset preview;
+				preview.image = loader->preview;
+				preview.partial_range(num_slices, preview.range);
+				layer->dset = preview;
+				show_dataset(layer, layer->restoring);
+
+				if (reference) {
+					for (int i = 1; i < NUM_VIEWPORTS; i++)
+						slider_arr[i]->setValue(0);
+				}
+				statusBar()->showMessage("Dataset " + QString::number(layer->dset_num) + ": showing slices as they are decoded", 5000);
+			}
+			layer->preview_shown = num_slices;
+
+			if (reference)
+				slider_arr[AXIAL]->setMaximum(num_slices - 1);
+
+			layer->dset.image->Modified(); // for the reslice pipelines
+			for (int i = 1; i < NUM_VIEWPORTS; i++) {
+				layer->slab[i].clear();
+				show_slice(i, layer, slider_arr[i]->value());
+				scheduler->request(i);
+			}
+		}
+	}
+
+	/*
+	Build the slice viewports of a dataset from its volume (after a load, or for a volume that is
+	still being decoded). The window/level starts at the whole intensity range unless keep_settings
+	is set (a dataset reloaded after an eviction).
+	*/
+	void show_dataset(dataset_layer* layer, bool keep_settings) {
+
+		// slider indices are slices of dataset 1
+		if (layer == layers[0])
+			slices.set_reference(layer->dset.image->GetOrigin(), layer->dset.image->GetSpacing());
+
+		// slice colours and window/level for the fused colour map
+		if (!keep_settings) {
+			double* range = layer->dset.scalar_range();
+			layer->window = std::max(range[1] - range[0], 1.0);
+			layer->level = (range[0] + range[1]) / 2;
+		}
+		layer->lut_colours = lut_snapshot(layer->lut.Get());
+
+		load_DICOM_image(AXIAL, layer);
+		load_DICOM_image(CORONAL, layer);
+		load_DICOM_image(SAGITTAL, layer);
+	}
+
+	// Take a dataset's slices off the slice viewports (a load that was being shown failed, and the dataset was empty).
+	void hide_slices(dataset_layer* layer) {
+
+		slices.remove_dataset(layer->dset_num);
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			if (layer->iactor[i] != NULL)
+				renderer_arr[i]->RemoveActor(layer->iactor[i]);
+			layer->raw_slices[i] = NULL;
+			layer->slab[i].clear();
+			stale_composite_arr[i] = true;
+			scheduler->request(i);
+		}
+	}
+
+	// Cancel every load that is still running.
+	void cancel_loads() {
+
+		for (size_t l = 0; l < layers.size(); l++) {
+			if (layers[l]->loader != NULL)
+				layers[l]->loader->cancel();
+		}
+	}
+
+
+	// Show how big the volume cache is and where it lives.
+	void show_cache_info() {
+
+		cache_stats stats = volume_cache::shared().stats();
+
+		QMessageBox::information(this, "Volume cache",
+			"Entries: " + QString::number(stats.entries) +
+			(stats.partial_entries > 0 ? " (and " + QString::number(stats.partial_entries) + " being written)" : QString()) + "\n" +
+			"Size: " + QString::number(stats.bytes / (1024.0 * 1024.0), 'f', 1) + " MB" +
+			" (limit " + QString::number(stats.max_bytes / (1024.0 * 1024.0), 'f', 0) + " MB)\n" +
+			"Location: " + stats.directory);
+	}
+
+	// Delete every cached volume (volumes currently on screen stay loaded).
+	void clear_cache() {
+
+		volume_cache::shared().clear();
+		statusBar()->showMessage("Volume cache cleared", 5000);
+	}
+
+	// Turn span recording on or off (spans recorded so far are kept).
+	void set_tracing(bool on) {
+
+		tracer::shared().set_enabled(on);
+		statusBar()->showMessage(on ? "Tracing enabled" : "Tracing disabled", 5000);
+	}
+
+	// Save the spans recorded so far as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+	void export_trace() {
+
+		QString path = QFileDialog::getSaveFileName(this, tr("Export Trace"),
+			QDir::currentPath() + "/trace.json", tr("Chrome trace (*.json)"));
+		if (path.isEmpty())
+			return;
+
+		size_t spans = tracer::shared().event_count();
+		if (tracer::shared().write_chrome_json(path))
+			statusBar()->showMessage("Wrote " + QString::number(spans) + " spans to " + path, 5000);
+		else
+			statusBar()->showMessage("Could not write " + path, 5000);
+	}
+
+	// Ask for the memory budget of the slice cache (in MB).
+	void set_slice_cache_size() {
+
+		bool ok;
+		int mb = QInputDialog::getInt(this, "Slice cache",
+			"Memory for prefetched slices in MB (in use: " + QString::number(slices.bytes() / (1024.0 * 1024.0), 'f', 1) + " MB):",
+			(int)(slices.max_bytes / (1024 * 1024)), 0, 65536, 64, &ok);
+		if (ok)
+			slices.set_max_bytes((size_t)mb * 1024 * 1024);
+	}
+
+	// Blend the datasets' slices on the CPU (one texture per view) or let the renderer draw them all.
+	void set_cpu_compositing(bool on) {
+
+		cpu_compositing = on;
+		for (int i = 1; i < NUM_VIEWPORTS && layers[0]->state == LOAD_READY; i++) {
+			stale_composite_arr[i] = true;
+			scheduler->request(i);
+		}
+	}
+
+	// The downsampled levels of a dataset's volume are ready: give each its own mapper (so switching
+	// levels never re-uploads a volume to the GPU).
+	void pyramid_ready(int dset_num) {
+
+		dataset_layer* layer = find_layer(dset_num);
+		if (layer == NULL || !layer->pyramid->is_ready() || layer->volume == NULL)
+			return; // a newer load is already building its pyramid
+
+		for (int i = 1; i < volume_pyramid::NUM_LEVELS; i++)
+			layer->lod_mapper[i] = make_volume_mapper(layer->pyramid->level(i));
+
+		statusBar()->showMessage("Dataset " + QString::number(dset_num) + " volume pyramid ready (" +
+			QString::number(layer->pyramid->bytes() / (1024.0 * 1024.0), 'f', 1) + " MB)", 5000);
+	}
+
+	// Full resolution again after the camera has been still for a moment.
+	void refine_volume() {
+
+		set_volume_level(0);
+		scheduler->request(VOLUME);
+	}
+
+	// Ray cast the volume view on the CPU, or go back to vtkSmartVolumeMapper.
+	void set_cpu_volume(bool on) {
+
+		cpu_volume = on;
+		for (size_t l = 0; l < layers.size(); l++) {
+			if (layers[l]->volume != NULL)
+				layers[l]->volume->SetVisibility(!on && layers[l]->visible);
+		}
+
+		if (on && !window_arr[VOLUME]->HasRenderer(raycast_renderer))
+			window_arr[VOLUME]->AddRenderer(raycast_renderer);
+		else if (!on)
+			window_arr[VOLUME]->RemoveRenderer(raycast_renderer);
+
+		// the render times measured so far were for the other renderer
+		for (int i = 0; i < volume_pyramid::NUM_LEVELS; i++)
+			level_render_ms[i] = -1;
+		scheduler->request(VOLUME);
+	}
+
+	// Ask for the frame rate the volume view should hold while the camera moves.
+	void set_volume_frame_rate() {
+
+		size_t pyramid_bytes = 0;
+		for (size_t l = 0; l < layers.size(); l++)
+			pyramid_bytes += layers[l]->pyramid->bytes();
+
+		bool ok;
+		int fps = QInputDialog::getInt(this, "Volume rendering",
+			"Target frame rate while rotating/zooming (downsampled volumes: " +
+			QString::number(pyramid_bytes / (1024.0 * 1024.0), 'f', 1) + " MB):",
+			volume_target_fps, 1, 120, 1, &ok);
+		if (ok) {
+			volume_target_fps = fps;
+			viewport_arr[VOLUME]->GetInteractor()->SetDesiredUpdateRate(fps);
+		}
+	}
+
+	// Show how many render requests the scheduler folded together (then start counting afresh).
+	void show_render_stats() {
+
+		const render_stats& stats = scheduler->get_stats();
+		double saved = stats.requests > 0 ? 100.0 * stats.coalesced / stats.requests : 0.0;
+
+		QMessageBox::information(this, "Render statistics",
+			"Render requests: " + QString::number(stats.requests) + "\n" +
+			"Renders: " + QString::number(stats.renders) + " in " + QString::number(stats.frames) + " frames\n" +
+			"Coalesced: " + QString::number(stats.coalesced) + " (" + QString::number(saved, 'f', 1) + "% of requests)\n" +
+			"Frame interval: " + QString::number(scheduler->frame_interval_ms()) + " ms");
+
+		scheduler->reset_stats();
+	}
+
+	// Show the memory breakdown of the loaded study.
+	void show_memory_usage() {
+
+		QMessageBox::information(this, "Memory usage", collect_memory().to_text());
+	}
+
+	// Save the memory breakdown as JSON (e.g. to compare viewer instances on one workstation).
+	void export_memory_report() {
+
+		QString path = QFileDialog::getSaveFileName(this, tr("Export Memory Report"),
+			QDir::currentPath() + "/memory.json", tr("JSON (*.json)"));
+		if (path.isEmpty())
+			return;
+
+		if (collect_memory().write_json(path))
+			statusBar()->showMessage("Wrote memory report to " + path, 5000);
+		else
+			statusBar()->showMessage("Could not write " + path, 5000);
+	}
+
+	// Refresh the memory figures in the status bar, unloading hidden overlays if the datasets are
+	// over the memory budget.
+	void update_memory_label() {
+
+		memory_report report = collect_memory();
+		if (enforce_memory_budget(report))
+			report = collect_memory();
+
+		QString text = "Study: " + memory_report::megabytes(report.host_total());
+		if (resources.budget_bytes > 0)
+			text += " of " + memory_report::megabytes(resources.budget_bytes);
+		text += "  Process: " + memory_report::megabytes(report.process_resident);
+		if (report.system_available > 0)
+			text += "  Available: " + memory_report::megabytes(report.system_available);
+		memory_label->setText(text);
+	}
+
+	// Ask for the memory budget of all datasets together (in MB, 0 = no limit).
+	void set_memory_budget() {
+
+		bool ok;
+		int mb = QInputDialog::getInt(this, "Memory budget",
+			"Memory for all datasets in MB, 0 = no limit (in use: " + memory_report::megabytes(resources.total_bytes()) +
+			", unloaded so far: " + QString::number(resources.evicted) + "):",
+			(int)(resources.budget_bytes / (1024 * 1024)), 0, 1048576, 256, &ok);
+		if (ok) {
+			resources.budget_bytes = (size_t)mb * 1024 * 1024;
+			update_memory_label();
+		}
+	}
+
+	// Another overlay was picked: show its settings in the second column.
+	void overlay_selected(int) {
+
+		update_controls();
+		if (difference != DIFFERENCE_OFF)
+			refresh_difference();
+	}
+
+	/*
+	Show or hide the selected overlay. Hidden overlays are not kept up to date and may be unloaded
+	to stay within the memory budget; showing an unloaded one loads it again from its directory
+	(a file mapping when the volume cache has it) with its settings kept.
+	*/
+	void overlay_visibility_changed(bool on) {
+
+		dataset_layer* layer = selected_overlay();
+		if (layer == NULL)
+			return;
+
+		layer->visible = on;
+		if (on && layer->state == LOAD_EVICTED) {
+			layer->restoring = true;
+			start_load(layer, QDir(layer->directory), layer->series);
+		}
+		apply_layer_settings(layer);
+		update_titles();
+		update_memory_label();
+	}
+
+	void slice_slider_changed(int value) {
+
+		dataset_layer* reference = layers[0];
+		if (!reference->is_loaded()) { // (may still be loading, see refresh_preview)
+			cout << "data not loaded yet!\n";
+			return;
+		}
+
+		QObject* caller = sender(); // determine axial/coronal/sagittal slice
+		int plane_idx;
+
+		if (caller == slider_arr[AXIAL])
+			plane_idx = 1;
+		else if (caller == slider_arr[CORONAL])
+			plane_idx = 2;
+		else if (caller == slider_arr[SAGITTAL])
+			plane_idx = 3;
+
+		int map[] = { -1, 2, 1, 0 };
+
+		// Set the slice. The slider value is a slice index of dataset 1, so the plane goes exactly
+		// through a row of voxels and fast_reslice can copy it instead of interpolating.
+		int axis = map[plane_idx];
+		vtkImageData* image = reference->dset.image;
+		reslice_axes_arr[plane_idx]->SetElement(axis, 3, image->GetOrigin()[axis] + value * image->GetSpacing()[axis]);
+		reference->reslice[plane_idx]->Modified();
+
+		// (hidden datasets catch up when they are shown again, see apply_layer_settings)
+		for (size_t l = 0; l < layers.size(); l++) {
+			if (layers[l]->is_loaded() && layers[l]->visible)
+				show_slice(plane_idx, layers[l], value);
+		}
+
+		// Update the slice label
+		slider_label_arr[plane_idx]->setText(
+			slice_label_texts[plane_idx] + QString::number(value)
+		);
+
+		// Re-render the image data (at the next frame)
+		scheduler->request(plane_idx);
+
+		// get the next slices ready in the direction the slider is moving
+		if (value != last_slice_arr[plane_idx])
+			scroll_direction_arr[plane_idx] = value > last_slice_arr[plane_idx] ? 1 : -1;
+		last_slice_arr[plane_idx] = value;
+
+		// (for a slab, beyond its leading edge)
+		int first, last;
+		int leading = slab_range(plane_idx, value, first, last) ? (scroll_direction_arr[plane_idx] > 0 ? last : first) : value;
+		for (size_t l = 0; l < layers.size(); l++) {
+			if (layers[l]->is_loaded() && layers[l]->visible && layers[l]->transform.is_identity())
+				slices.prefetch(layers[l]->dset_num, plane_idx, leading, scroll_direction_arr[plane_idx]);
+		}
+
+	}
+
+	/*
+	Called when the slab mode or thickness of a plane changes. The slab is projected again from
+	scratch (slab_projector), and the reslice filters are set up for slabs it cannot serve.
+	*/
+	void slab_changed(int) {
+
+		int plane_idx = 0;
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			if (sender() == slab_mode_arr[i] || sender() == slab_thickness_arr[i])
+				plane_idx = i;
+		}
+		if (plane_idx == 0 || !layers[0]->is_loaded())
+			return;
+
+		for (size_t l = 0; l < layers.size(); l++) {
+			dataset_layer* layer = layers[l];
+			if (!layer->is_loaded())
+				continue;
+			configure_slab(plane_idx, layer->reslice[plane_idx]);
+			layer->slab[plane_idx].clear();
+			if (layer->visible)
+				show_slice(plane_idx, layer, slider_arr[plane_idx]->value());
+		}
+		scheduler->request(plane_idx);
+	}
+
+	/*
+	Defines behavior for when opacity slider values are changed by dragging the slider.
+	The first slider belongs to dataset 1, the second one to the selected overlay. The caller
+	slider is checked, and based on the caller, the opacity of that dataset's ImageActors is
+	changed:
+
+		ImageActor->SetOpacity(0.5);
+
+	As usual, the appropriate VTKWindow needs to be re-rendered (through the render scheduler,
+	so a fast drag renders each window once per frame):
+
+		scheduler->request(plane_idx);
+	*/
+	void opacity_slider_changed(int value) {
+
+
+		QObject* caller = sender(); // determine dset1/overlay opacity slider
+		dataset_layer* layer = caller == opacity_slider0 ? layers[0] : selected_overlay();
+
+		if (layer == NULL || layer->state != LOAD_READY) {
+			cout << "dataset not loaded yet!\n";
+			return;
+		}
+		layer->opacity = ((double)value) / 100;
+		(caller == opacity_slider0 ? opacity_label0 : opacity_label1)->setText("Slice Opacity: " + QString::number(value));
+
+		// change opacity for all image/slice actors
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			layer->iactor[i]->SetOpacity(layer->opacity);
+			stale_composite_arr[i] = true; // composited planes only need the blend redone
+			scheduler->request(i);
+		}
+	}
+
+	/*
+	Window/level slider of dataset 1 or of the selected overlay moved. Only the colouring of the
+	slices on screen is redone (lazily, right before the next render of each plane); the reslice
+	never runs again. The lookup table range is updated too, for planes shown through the reslice
+	pipeline.
+	*/
+	void window_level_changed(int value) {
+
+		QObject* caller = sender(); // determine dset1/overlay window/level slider
+		int idx = (caller == window_slider0 || caller == level_slider0) ? 0 : 1;
+		dataset_layer* layer = idx == 0 ? layers[0] : selected_overlay();
+
+		if (layer == NULL || layer->state != LOAD_READY)
+			return;
+
+		QSlider* window_slider = idx == 0 ? window_slider0 : window_slider1;
+		QSlider* level_slider = idx == 0 ? level_slider0 : level_slider1;
+		layer->window = window_slider->value();
+		layer->level = level_slider->value();
+
+		(idx == 0 ? window_label0 : window_label1)->setText("Window: " + QString::number(window_slider->value()));
+		(idx == 0 ? level_label0 : level_label1)->setText("Level: " + QString::number(level_slider->value()));
+
+		layer->lut->SetRange(layer->level - layer->window / 2, layer->level + layer->window / 2);
+		(idx == 0 ? histogram_widget0 : histogram_widget1)->set_window(layer->window, layer->level);
+
+		for (int i = 1; i < NUM_VIEWPORTS; i++) {
+			layer->stale_colours[i] = true;
+			scheduler->request(i);
+		}
+	}
+
+	// Put a column's window/level back to the default from its dataset's histogram.
+	void auto_window_level() {
+
+		dataset_layer* layer = sender() == auto_window_button0 ? layers[0] : selected_overlay();
+		if (layer == NULL || layer->state != LOAD_READY)
+			return;
+
+		default_window(layer, layer->window, layer->level);
+		apply_layer_settings(layer);
+		update_controls();
+	}
+
+	// Open the overlay alignment dialog; the keyboard and mouse nudges work while it is open.
+	void show_align_dialog() {
+
+		update_align_controls();
+		align_dialog->show();
+		align_dialog->raise();
+		for (size_t i = 0; i < align_shortcuts.size(); i++)
+			align_shortcuts[i]->setEnabled(true);
+	}
+
+	void align_dialog_closed(int) {
+
+		for (size_t i = 0; i < align_shortcuts.size(); i++)
+			align_shortcuts[i]->setEnabled(false);
+		drag_plane = 0;
+	}
+
+	// A value was entered in the align dialog: the selected overlay takes all six.
+	void align_changed(double) {
+
+		dataset_layer* layer = selected_overlay();
+		if (layer == NULL || layer->state != LOAD_READY)
+			return;
+
+		rigid_transform transform;
+		for (int i = 0; i < 3; i++) {
+			transform.translation[i] = align_spin_arr[i]->value();
+			transform.rotation[i] = align_spin_arr[i + 3]->value();
+		}
+		layer->transform = transform;
+		apply_transform(layer);
+	}
+
+	// The spin box arrows (and mouse wheel over them) step by the nudge steps.
+	void align_step_changed(double) {
+
+		for (int p = 0; p < 6; p++)
+			align_spin_arr[p]->setSingleStep(p < 3 ? align_step_mm->value() : align_step_deg->value());
+	}
+
+	// Keyboard nudge of the selected overlay: parameter code / 2 (x, y, z move, then x, y, z rotation),
+	// down for an even code and up for an odd one.
+	void nudge_alignment(int code) {
+
+		dataset_layer* layer = selected_overlay();
+		if (layer == NULL || layer->state != LOAD_READY)
+			return;
+
+		int p = code / 2;
+		double sign = code % 2 == 1 ? 1.0 : -1.0;
+		rigid_transform transform = layer->transform;
+		if (p < 3)
+			transform.translation[p] += sign * align_step_mm->value();
+		else
+			transform.rotation[p - 3] = wrap_degrees(transform.rotation[p - 3] + sign * align_step_deg->value());
+		set_transform(layer, transform);
+	}
+
+	// Put the selected overlay back exactly over dataset 1.
+	void reset_alignment() {
+
+		dataset_layer* layer = selected_overlay();
+		if (layer != NULL && layer->state == LOAD_READY)
+			set_transform(layer, rigid_transform());
+	}
+
+	// Save the selected overlay's transform (parameters and matrix, see rigid_transform.h) as JSON.
+	void export_alignment() {
+
+		dataset_layer* layer = selected_overlay();
+		if (layer == NULL || layer->state != LOAD_READY)
+			return;
+
+		QString path = QFileDialog::getSaveFileName(this, tr("Export Transform"),
+			QDir::currentPath() + "/transform.json", tr("JSON (*.json)"));
+		if (path.isEmpty())
+			return;
+
+		QJsonObject json = layer->transform.to_json(layer->dset.image->GetCenter());
+		json["moving_series_uid"] = QString::fromStdString(layer->dset.series_uid);
+		json["moving_directory"] = layer->directory;
+		json["fixed_series_uid"] = QString::fromStdString(layers[0]->dset.series_uid);
+		json["fixed_directory"] = layers[0]->directory;
+
+		QByteArray text = QJsonDocument(json).toJson();
+		QFile file(path);
+		if (file.open(QIODevice::WriteOnly) && file.write(text) == text.size())
+			statusBar()->showMessage("Wrote transform to " + path, 5000);
+		else
+			statusBar()->showMessage("Could not write " + path, 5000);
+	}
+
+	// Load an exported transform onto the selected overlay (replaying an alignment).
+	void load_alignment() {
+
+		dataset_layer* layer = selected_overlay();
+		if (layer == NULL || layer->state != LOAD_READY)
+			return;
+
+		QString path = QFileDialog::getOpenFileName(this, tr("Load Transform"),
+			QDir::currentPath(), tr("JSON (*.json)"));
+		if (path.isEmpty())
+			return;
+
+		QFile file(path);
+		if (!file.open(QIODevice::ReadOnly)) {
+			statusBar()->showMessage("Could not read " + path, 5000);
+			return;
+		}
+		QJsonDocument json = QJsonDocument::fromJson(file.readAll());
+
+		rigid_transform transform;
+		std::string error;
+		if (!json.isObject() || !transform.from_json(json.object(), error)) {
+			statusBar()->showMessage("Not a transform: " + path + (error.empty() ? QString() : " (" + QString::fromStdString(error) + ")"), 5000);
+			return;
+		}
+		set_transform(layer, transform);
+		statusBar()->showMessage("Dataset " + QString::number(layer->dset_num) + " moved by " + path, 5000);
+	}
+
+	/*
+	Difference view mode or range changed. Switching it on starts the range at half of dataset 1's
+	window; every slice view is computed again at its next render.
+	*/
+	void difference_changed(int) {
+
+		difference_mode mode = (difference_mode)difference_combobox->currentIndex();
+		if (sender() == difference_combobox && difference == DIFFERENCE_OFF && mode != DIFFERENCE_OFF &&
+			layers[0]->state == LOAD_READY) {
+			difference_range_spinbox->blockSignals(true);
+			difference_range_spinbox->setValue(std::max(1, (int)round(layers[0]->window / 2)));
+			difference_range_spinbox->blockSignals(false);
+		}
+		difference = mode;
+		difference_range_spinbox->setEnabled(mode != DIFFERENCE_OFF);
+		refresh_difference();
+	}
+
+	void combobox_changed(int new_index) {
+
+		QObject* caller = sender(); // determine dset1/overlay colormap combobox
+		dataset_layer* layer = caller == color_combobox0 ? layers[0] : selected_overlay();
+		if (layer == NULL)
+			return;
 
-		volume_property_arr[idx]->SetColor(map[new_index]);
+		layer->volume_colormap = new_index;
+		layer->volume_property->SetColor(volume_ctf(new_index));
 
-		window_arr[0]->Render();
+		scheduler->request(VOLUME);
 	}
 
 
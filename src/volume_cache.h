@@ -0,0 +1,405 @@
+/*
+This header contains volume_cache, a persistent on-disk cache of decoded volumes. Reopening
+a series that was loaded before maps the cached volume straight into memory instead of
+parsing and decoding the DICOM files again.
+
+Each entry is one flat file named after the cache key:
+
+	[cache_file_header][histogram counts][padding up to data_offset][voxels, x fastest, native byte order]
+
+The key is a hash of the directory path, the name/size/mtime of every file, and the
+SeriesInstanceUID, so changing any file of the series produces a miss. The cache is kept
+under max_bytes by deleting the least recently used entries. Entries are written to a .part
+file first; one that is not renamed into place within STALE_PART_SECONDS (the process was
+killed while storing) is deleted by the next eviction.
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkCallbackCommand.h>
+#include <vtkCommand.h>
+#include <vtkDataArray.h>
+#include <vtkImageData.h>
+#include <vtkPointData.h>
+#include <vtkSmartPointer.h>
+
+// Qt header files
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QString>
+#include <QTemporaryFile>
+
+// Our header files
+#include "intensity_histogram.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+
+// Fixed-size header at the start of every cache file.
+struct cache_file_header {
+	char magic[8];            // "DCMVOL1\0"
+	uint32_t version;
+	uint32_t data_offset;     // voxels start here (page aligned, so they can be mapped in place)
+	int32_t dims[3];
+	int32_t scalar_type;      // VTK scalar type
+	double spacing[3];
+	double origin[3];
+	double scalar_range[2];
+	uint64_t voxel_bytes;
+	char patient_name[256];
+	char series_uid[128];
+	uint32_t histogram_bins;  // intensity histogram (the counts follow the header; 0 = none)
+	double histogram_bin_width;
+	double histogram_mean;
+	uint64_t histogram_total;
+};
+
+// What a cache hit gives back.
+struct cached_volume {
+	vtkSmartPointer<vtkImageData> image;
+	double scalar_range[2];
+	std::string patient_name;
+	std::string series_uid;
+	std::shared_ptr<const intensity_histogram> histogram; // NULL if the entry has none
+};
+
+// Size and location of the cache (shown in the File menu).
+struct cache_stats {
+	int entries = 0;
+	int partial_entries = 0; // .part files (stores running, or cut off and not deleted yet)
+	qint64 bytes = 0;        // (includes the .part files)
+	qint64 max_bytes = 0;
+	QString directory;
+};
+
+
+class volume_cache {
+
+public:
+	// bump when the file layout changes (older entries then simply miss)
+	static const uint32_t VERSION = 2;
+
+	// upper bound for the total size of all entries
+	qint64 max_bytes = 8LL * 1024 * 1024 * 1024;
+
+	// a .part file not written to for this long belongs to a store that was cut off
+	static const int STALE_PART_SECONDS = 10 * 60;
+
+	// where the entries live
+	QString directory;
+
+	volume_cache() {
+		directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/volumes";
+	}
+
+	// The process-wide cache.
+	static volume_cache& shared() {
+		static volume_cache cache;
+		return cache;
+	}
+
+	/*
+	Build the cache key for a series.
+
+	Args:
+		dicom_dir: directory the series is read from
+		files: all files of the directory (absolute paths)
+		series_uid: SeriesInstanceUID of the series
+	*/
+	static std::string make_key(const QString& dicom_dir, const std::vector<std::string>& files, const std::string& series_uid) {
+
+		uint32_t version = VERSION;
+		uint64_t hash = 14695981039346656037ULL; // FNV-1a offset basis
+		hash = fnv1a(hash, &version, sizeof(version));
+		hash = fnv1a(hash, dicom_dir.toStdString());
+		hash = fnv1a(hash, series_uid);
+
+		for (size_t i = 0; i < files.size(); i++) {
+			QFileInfo info(QString::fromStdString(files[i]));
+			qint64 size = info.size();
+			qint64 mtime = info.lastModified().toMSecsSinceEpoch();
+
+			hash = fnv1a(hash, files[i]);
+			hash = fnv1a(hash, &size, sizeof(size));
+			hash = fnv1a(hash, &mtime, sizeof(mtime));
+		}
+
+		char text[17];
+		snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+		return text;
+	}
+
+	/*
+	Look up a volume. On a hit the voxels are memory mapped (not read) and the mapping
+	lives as long as the returned image's scalar array.
+	*/
+	bool lookup(const std::string& key, cached_volume& out) {
+
+		QString path = entry_path(key);
+		if (!QFile::exists(path))
+			return false;
+
+		// copy-on-write: VTK may treat the array as writable, but writes must never reach the file
+		mapped_file* mapping = new mapped_file();
+		if (!mapping->open(path.toStdString(), true) || mapping->size() < sizeof(cache_file_header)) {
+			delete mapping;
+			return false;
+		}
+
+		cache_file_header header;
+		memcpy(&header, mapping->data(), sizeof(header));
+
+		vtkSmartPointer<vtkDataArray> scalars;
+		if (is_valid(header, mapping->size()))
+			scalars.TakeReference(vtkDataArray::CreateDataArray(header.scalar_type));
+
+		if (scalars == NULL) {
+			delete mapping;
+			QFile::remove(path); // stale or corrupt entry
+			return false;
+		}
+
+		// point the array at the mapped voxels; save = 1 means VTK never frees them itself
+		vtkIdType count = (vtkIdType)header.dims[0] * header.dims[1] * header.dims[2];
+		scalars->SetNumberOfComponents(1);
+		scalars->SetVoidArray(mapping->data() + header.data_offset, count, 1);
+
+		// unmap when the array goes away
+		vtkSmartPointer<vtkCallbackCommand> unmap = vtkSmartPointer<vtkCallbackCommand>::New();
+		unmap->SetCallback(delete_mapping);
+		unmap->SetClientData(mapping);
+		scalars->AddObserver(vtkCommand::DeleteEvent, unmap);
+
+		out.image = vtkSmartPointer<vtkImageData>::New();
+		out.image->SetDimensions(header.dims);
+		out.image->SetSpacing(header.spacing);
+		out.image->SetOrigin(header.origin);
+		out.image->GetPointData()->SetScalars(scalars);
+
+		out.scalar_range[0] = header.scalar_range[0];
+		out.scalar_range[1] = header.scalar_range[1];
+		out.patient_name = std::string(header.patient_name, strnlen(header.patient_name, sizeof(header.patient_name)));
+		out.series_uid = std::string(header.series_uid, strnlen(header.series_uid, sizeof(header.series_uid)));
+
+		out.histogram = NULL;
+		if (header.histogram_bins > 0) {
+			std::shared_ptr<intensity_histogram> histogram = std::make_shared<intensity_histogram>();
+			histogram->min_value = header.scalar_range[0];
+			histogram->max_value = header.scalar_range[1];
+			histogram->bin_width = header.histogram_bin_width;
+			histogram->mean = header.histogram_mean;
+			histogram->total = header.histogram_total;
+			histogram->counts.resize(header.histogram_bins);
+			memcpy(histogram->counts.data(), mapping->data() + sizeof(header), header.histogram_bins * sizeof(uint64_t));
+			out.histogram = histogram;
+		}
+
+		touch(path);
+		return true;
+	}
+
+	/*
+	Write a volume to the cache (then evict old entries if the cache is over budget).
+	Safe to call from a worker thread; the image must not be modified meanwhile. The histogram
+	(optional) is stored with it, so a hit does not have to read every voxel to get it.
+	*/
+	bool store(const std::string& key, vtkImageData* image, const double scalar_range[2],
+		const std::string& patient_name, const std::string& series_uid,
+		std::shared_ptr<const intensity_histogram> histogram = NULL) {
+
+		if (!QDir().mkpath(directory))
+			return false;
+
+		// (the same series may be stored twice at once, e.g. loaded as two datasets)
+		QString path = entry_path(key);
+		if (has_valid_entry(path))
+			return true;
+
+		cache_file_header header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "DCMVOL1", 8);
+		header.version = VERSION;
+		if (histogram != NULL && !histogram->empty()) {
+			header.histogram_bins = (uint32_t)histogram->counts.size();
+			header.histogram_bin_width = histogram->bin_width;
+			header.histogram_mean = histogram->mean;
+			header.histogram_total = histogram->total;
+		}
+		size_t histogram_bytes = header.histogram_bins * sizeof(uint64_t);
+		header.data_offset = (uint32_t)((sizeof(header) + histogram_bytes + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT);
+		image->GetDimensions(header.dims);
+		header.scalar_type = image->GetScalarType();
+		image->GetSpacing(header.spacing);
+		image->GetOrigin(header.origin);
+		header.scalar_range[0] = scalar_range[0];
+		header.scalar_range[1] = scalar_range[1];
+		header.voxel_bytes = (uint64_t)image->GetPointData()->GetScalars()->GetDataSize() *
+			image->GetPointData()->GetScalars()->GetDataTypeSize();
+		strncpy(header.patient_name, patient_name.c_str(), sizeof(header.patient_name) - 1);
+		strncpy(header.series_uid, series_uid.c_str(), sizeof(header.series_uid) - 1);
+
+		// write under a temporary name of its own so a half-written entry is never picked up, and
+		// two stores of the same key never write the same file
+		QTemporaryFile file(path + ".XXXXXX.part");
+		file.setAutoRemove(false); // (removed below; it is renamed into place on success)
+		if (!file.open())
+			return false;
+		QString temp_path = file.fileName();
+
+		std::vector<char> padding(header.data_offset - sizeof(header) - histogram_bytes, 0);
+		bool ok = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header) &&
+			(histogram_bytes == 0 || file.write(reinterpret_cast<const char*>(histogram->counts.data()), histogram_bytes) == (qint64)histogram_bytes) &&
+			file.write(padding.data(), padding.size()) == (qint64)padding.size() &&
+			file.write(static_cast<const char*>(image->GetScalarPointer()), header.voxel_bytes) == (qint64)header.voxel_bytes;
+		file.close();
+
+		// a store that finished first wins; its entry may already be mapped by a lookup
+		if (!ok || !QFile::rename(temp_path, path)) {
+			QFile::remove(temp_path);
+			return ok && has_valid_entry(path);
+		}
+
+		evict(max_bytes);
+		return true;
+	}
+
+	/*
+	Delete least recently used entries until the cache holds at most the given number of bytes.
+	Stale .part files are deleted first; the ones still being written count towards the total.
+	*/
+	void evict(qint64 bytes_allowed) {
+
+		QDir dir(directory);
+		qint64 total = 0;
+
+		QDateTime stale = QDateTime::currentDateTime().addSecs(-STALE_PART_SECONDS);
+		QFileInfoList parts = dir.entryInfoList(QStringList() << "*.part", QDir::Files);
+		for (int i = 0; i < parts.size(); i++) {
+			if (parts[i].lastModified() < stale && QFile::remove(parts[i].absoluteFilePath()))
+				continue;
+			total += parts[i].size();
+		}
+
+		QFileInfoList entries = dir.entryInfoList(QStringList() << "*.vol", QDir::Files, QDir::Time | QDir::Reversed);
+		for (int i = 0; i < entries.size(); i++)
+			total += entries[i].size();
+
+		// oldest first
+		for (int i = 0; i < entries.size() && total > bytes_allowed; i++) {
+			if (QFile::remove(entries[i].absoluteFilePath()))
+				total -= entries[i].size();
+		}
+	}
+
+	// Delete every entry (and stale .part files; stores still running finish normally).
+	void clear() {
+		evict(0);
+	}
+
+	cache_stats stats() const {
+
+		cache_stats result;
+		result.max_bytes = max_bytes;
+		result.directory = directory;
+
+		QFileInfoList entries = QDir(directory).entryInfoList(QStringList() << "*.vol", QDir::Files);
+		for (int i = 0; i < entries.size(); i++) {
+			result.entries++;
+			result.bytes += entries[i].size();
+		}
+
+		QFileInfoList parts = QDir(directory).entryInfoList(QStringList() << "*.part", QDir::Files);
+		for (int i = 0; i < parts.size(); i++) {
+			result.partial_entries++;
+			result.bytes += parts[i].size();
+		}
+		return result;
+	}
+
+private:
+	// voxel data starts on a page boundary so it can be used in place from the mapping
+	static const uint32_t DATA_ALIGNMENT = 4096;
+
+	QString entry_path(const std::string& key) const {
+		return directory + "/" + QString::fromStdString(key) + ".vol";
+	}
+
+	bool is_valid(const cache_file_header& header, size_t file_size) const {
+
+		if (memcmp(header.magic, "DCMVOL1", 8) != 0 || header.version != VERSION ||
+			header.data_offset < sizeof(header) + (size_t)header.histogram_bins * sizeof(uint64_t))
+			return false;
+		if (header.dims[0] <= 0 || header.dims[1] <= 0 || header.dims[2] <= 0)
+			return false;
+
+		// only the scalar types the reader produces, and exactly dims voxels of that type
+		switch (header.scalar_type) {
+		case VTK_SIGNED_CHAR: case VTK_UNSIGNED_CHAR: case VTK_SHORT: case VTK_UNSIGNED_SHORT: case VTK_INT: case VTK_UNSIGNED_INT:
+			break;
+		default:
+			return false;
+		}
+		uint64_t voxels = (uint64_t)header.dims[0] * header.dims[1];
+		uint64_t type_size = (uint64_t)vtkDataArray::GetDataTypeSize(header.scalar_type);
+		if (voxels > UINT64_MAX / header.dims[2] / type_size ||
+			header.voxel_bytes != voxels * header.dims[2] * type_size)
+			return false;
+
+		return header.voxel_bytes <= file_size && header.data_offset <= file_size - header.voxel_bytes;
+	}
+
+	// Whether a complete entry is stored under this path.
+	bool has_valid_entry(const QString& path) const {
+
+		QFile file(path);
+		cache_file_header header;
+		if (!file.open(QIODevice::ReadOnly) || file.read(reinterpret_cast<char*>(&header), sizeof(header)) != sizeof(header))
+			return false;
+		return is_valid(header, (size_t)file.size());
+	}
+
+	// Mark an entry as recently used (eviction goes by modification time).
+	static void touch(const QString& path) {
+#ifdef _WIN32
+		_wutime(path.toStdWString().c_str(), NULL);
+#else
+		utime(QFile::encodeName(path).constData(), NULL);
+#endif
+	}
+
+	// vtkCommand::DeleteEvent observer on a cached scalar array
+	static void delete_mapping(vtkObject*, unsigned long, void* client_data, void*) {
+		delete static_cast<mapped_file*>(client_data);
+	}
+
+	static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ULL; // FNV prime
+		}
+		return hash;
+	}
+
+	static uint64_t fnv1a(uint64_t hash, const std::string& text) {
+		return fnv1a(hash, text.data(), text.size() + 1); // include the terminator as a separator
+	}
+};
@@ -0,0 +1,212 @@
+/*
+This header contains volume_pyramid, downsampled copies of a dataset's volume for the volume
+viewport: level 1 has half the resolution along each axis (1/8 of the voxels), level 2 a
+quarter (1/64). Level 0 is the volume itself. While the camera is being rotated or zoomed the
+viewport renders a coarse level, and goes back to level 0 once the interaction has stopped.
+
+The levels are built on the thread pool right after a load (each voxel of a level is the mean
+of a 2x2x2 block of the level below). ready() is emitted when they are done; it arrives on the
+thread the pyramid lives on (the GUI thread).
+
+	volume_pyramid* pyramid = new volume_pyramid(1, this);
+	connect(pyramid, SIGNAL(ready(int)), this, SLOT(pyramid_ready(int)));
+	pyramid->build(dset.image);
+	...
+	mapper->SetInputData(pyramid->level(2));
+*/
+
+// Prevent this header file from being included multiple times
+#pragma once
+
+// VTK header files
+#include <vtkImageData.h>
+#include <vtkSmartPointer.h>
+
+// Qt header files
+#include <QObject>
+
+// Our header files
+#include "thread_pool.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+
+
+class volume_pyramid : public QObject {
+
+	Q_OBJECT
+public:
+	// full resolution, 1/2, 1/4
+	static const int NUM_LEVELS = 3;
+
+	volume_pyramid(int dset_num, QObject* parent = NULL) : QObject(parent), dset_num(dset_num), generation(0) {}
+
+	// Stop a build that is still running and wait for it; the task holds a pointer to this object.
+	~volume_pyramid() {
+		generation++;
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this]() { return !building; });
+	}
+
+	/*
+	Drop the current levels and build new ones for a volume on the thread pool. A build that is
+	still running for a previous volume is abandoned.
+	*/
+	void build(vtkImageData* volume) {
+
+		int my_generation = ++generation;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			idle.wait(lock, [this]() { return !building; }); // the previous build stops at its next slice
+			for (int i = 0; i < NUM_LEVELS; i++)
+				levels[i] = NULL;
+			levels[0] = volume;
+			building = true;
+		}
+
+		vtkSmartPointer<vtkImageData> source = volume;
+		thread_pool::shared().submit([this, source, my_generation]() {
+			TRACE_SCOPE("build_pyramid", dset_num);
+
+			vtkSmartPointer<vtkImageData> built[NUM_LEVELS];
+			built[0] = source;
+			bool complete = true;
+			for (int i = 1; i < NUM_LEVELS && complete; i++) {
+				built[i] = vtkSmartPointer<vtkImageData>::New();
+				complete = shrink(built[i - 1], built[i], my_generation);
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			if (complete && generation == my_generation) {
+				for (int i = 1; i < NUM_LEVELS; i++)
+					levels[i] = built[i];
+				emit ready(dset_num); // queued to the GUI thread, so it may arrive after another build() call
+			}
+			building = false;
+			idle.notify_all();
+		});
+	}
+
+	// Forget the volume (e.g. before its dataset is reloaded).
+	void clear() {
+
+		generation++;
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [this]() { return !building; });
+		for (int i = 0; i < NUM_LEVELS; i++)
+			levels[i] = NULL;
+	}
+
+	// A level (0 = the volume itself). NULL until the pyramid has been built.
+	vtkImageData* level(int i) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return levels[i];
+	}
+
+	// Whether every level is available.
+	bool is_ready() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return levels[NUM_LEVELS - 1] != NULL;
+	}
+
+	// Memory held by the downsampled levels (level 0 belongs to the dataset).
+	size_t bytes() {
+
+		std::lock_guard<std::mutex> lock(mutex);
+		size_t total = 0;
+		for (int i = 1; i < NUM_LEVELS; i++) {
+			if (levels[i] != NULL)
+				total += (size_t)levels[i]->GetNumberOfPoints() * levels[i]->GetScalarSize() * levels[i]->GetNumberOfScalarComponents();
+		}
+		return total;
+	}
+
+signals:
+	// Every level of the pyramid has been built.
+	void ready(int dset_num);
+
+private:
+	int dset_num;
+
+	std::mutex mutex;
+	std::condition_variable idle;
+	bool building = false;
+	std::atomic<int> generation; // bumped to abandon a running build
+	vtkSmartPointer<vtkImageData> levels[NUM_LEVELS];
+
+	/*
+	Halve the resolution of a volume: every output voxel is the mean of a 2x2x2 block (smaller at
+	odd edges), and sits at the centre of its block. Output slices are spread over the thread
+	pool. Returns false if the build was abandoned meanwhile.
+	*/
+	bool shrink(vtkImageData* in, vtkImageData* out, int my_generation) {
+
+		// from the extent: GetDimensions() writes to the image, which the GUI thread may be reading
+		int* extent = in->GetExtent();
+		int in_dims[3], out_dims[3];
+		double origin[3], spacing[3];
+		for (int i = 0; i < 3; i++) {
+			in_dims[i] = extent[2 * i + 1] - extent[2 * i] + 1;
+			out_dims[i] = (in_dims[i] + 1) / 2;
+			spacing[i] = in->GetSpacing()[i] * (in_dims[i] > 1 ? 2 : 1);
+			origin[i] = in->GetOrigin()[i] + (extent[2 * i] + (in_dims[i] > 1 ? 0.5 : 0.0)) * in->GetSpacing()[i];
+		}
+
+		out->SetDimensions(out_dims);
+		out->SetOrigin(origin);
+		out->SetSpacing(spacing);
+		out->AllocateScalars(in->GetScalarType(), in->GetNumberOfScalarComponents());
+
+		int scalar_type = in->GetScalarType();
+		int components = in->GetNumberOfScalarComponents();
+		const void* in_voxels = in->GetScalarPointer();
+		void* out_voxels = out->GetScalarPointer();
+
+		std::atomic<bool> abandoned(false);
+		thread_pool::shared().parallel_for(out_dims[2], [&](int k) {
+			if (generation != my_generation) {
+				abandoned = true;
+				return;
+			}
+			switch (scalar_type) {
+				vtkTemplateMacro(shrink_slice(static_cast<const VTK_TT*>(in_voxels), in_dims, components,
+					static_cast<VTK_TT*>(out_voxels), out_dims, k));
+			}
+		});
+		return !abandoned;
+	}
+
+	// One output slice k of shrink().
+	template <class T>
+	static void shrink_slice(const T* in, const int in_dims[3], int components, T* out, const int out_dims[3], int k) {
+
+		size_t in_row = (size_t)in_dims[0] * components;
+		size_t in_slice = in_row * in_dims[1];
+		int z_count = std::min(2, in_dims[2] - 2 * k);
+
+		T* out_voxel = out + (size_t)k * out_dims[0] * out_dims[1] * components;
+		for (int j = 0; j < out_dims[1]; j++) {
+			int y_count = std::min(2, in_dims[1] - 2 * j);
+
+			for (int i = 0; i < out_dims[0]; i++) {
+				int x_count = std::min(2, in_dims[0] - 2 * i);
+				const T* block = in + 2 * k * in_slice + 2 * j * in_row + (size_t)2 * i * components;
+
+				for (int c = 0; c < components; c++) {
+					double sum = 0.0;
+					for (int z = 0; z < z_count; z++)
+						for (int y = 0; y < y_count; y++)
+							for (int x = 0; x < x_count; x++)
+								sum += block[z * in_slice + y * in_row + x * components + c];
+					double mean = sum / (x_count * y_count * z_count);
+					*out_voxel++ = std::numeric_limits<T>::is_integer ? (T)std::floor(mean + 0.5) : (T)mean;
+				}
+			}
+		}
+	}
+};